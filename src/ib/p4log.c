@@ -0,0 +1,380 @@
+/**
+ * @file p4log.c
+ *
+ * Decoder for the binary log files written by the library when
+ * PTL_LOG_BINARY is set (see ptl_log.c for the file layout). The
+ * messages of all the threads, and of all the files given, are merged
+ * in time order and printed the way they would have been on stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ptl_log.h"
+
+#define LOG_MAGIC	"P4LOG001"
+
+/* a record with the file and thread it came from */
+struct rec {
+    struct log_rec rec;
+    uint16_t file;
+    uint16_t tid;
+};
+
+struct site {
+    int level;
+    int line;
+    char *tag;
+    char *format;
+    char *func;
+    char *file;
+};
+
+/* the call sites and time base of each file */
+struct file {
+    struct site *sites;
+    uint32_t num_sites;
+    double tick_ns;
+    uint64_t tsc0;
+    uint64_t realtime0;
+};
+
+static struct file *files;
+static struct rec *recs;
+static size_t num_recs;
+static size_t size_recs;
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (!p) {
+        fprintf(stderr, "p4log: out of memory\n");
+        exit(1);
+    }
+
+    return p;
+}
+
+static void xread(void *p, size_t size, FILE *f, const char *path)
+{
+    if (size && fread(p, size, 1, f) != 1) {
+        fprintf(stderr, "p4log: %s: truncated log file\n", path);
+        exit(1);
+    }
+}
+
+static char *read_string(FILE *f, const char *path)
+{
+    uint32_t len;
+    char *s;
+
+    xread(&len, sizeof(len), f, path);
+    s = xmalloc(len + 1);
+    xread(s, len, f, path);
+    s[len] = 0;
+
+    return s;
+}
+
+/* load one log file and append its records */
+static void load(const char *path, int file)
+{
+    struct file *fl = &files[file];
+    char magic[8];
+    uint64_t stamps[5];
+    uint32_t num_rings;
+    FILE *f;
+    int i;
+
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+
+    xread(magic, sizeof(magic), f, path);
+    if (memcmp(magic, LOG_MAGIC, sizeof(magic))) {
+        fprintf(stderr, "p4log: %s: not a log file\n", path);
+        exit(1);
+    }
+
+    xread(stamps, sizeof(stamps), f, path);
+    fl->tsc0 = stamps[0];
+    fl->realtime0 = stamps[4];
+    fl->tick_ns = 1;
+    if (stamps[3] > stamps[1] && stamps[2] > stamps[0])
+        fl->tick_ns = (double)(stamps[2] - stamps[0]) /
+            (double)(stamps[3] - stamps[1]);
+
+    xread(&fl->num_sites, sizeof(fl->num_sites), f, path);
+    fl->sites = xmalloc(fl->num_sites * sizeof(struct site));
+    for (i = 0; i < fl->num_sites; i++) {
+        struct site *s = &fl->sites[i];
+        int32_t nums[2];
+
+        xread(nums, sizeof(nums), f, path);
+        s->level = nums[0];
+        s->line = nums[1];
+        s->tag = read_string(f, path);
+        s->format = read_string(f, path);
+        s->func = read_string(f, path);
+        s->file = read_string(f, path);
+    }
+
+    xread(&num_rings, sizeof(num_rings), f, path);
+    for (i = 0; i < num_rings; i++) {
+        uint32_t hdr[2];
+        uint64_t count, k;
+
+        xread(hdr, sizeof(hdr), f, path);
+        xread(&count, sizeof(count), f, path);
+
+        if (num_recs + count > size_recs) {
+            size_recs = 2 * (num_recs + count);
+            recs = realloc(recs, size_recs * sizeof(*recs));
+            if (!recs) {
+                fprintf(stderr, "p4log: out of memory\n");
+                exit(1);
+            }
+        }
+
+        for (k = 0; k < count; k++) {
+            struct rec *r = &recs[num_recs++];
+
+            xread(&r->rec, sizeof(r->rec), f, path);
+            r->file = file;
+            r->tid = hdr[0];
+        }
+    }
+
+    fclose(f);
+}
+
+/* time of a record in ns since the start of its process */
+static double rec_ns(const struct rec *r)
+{
+    const struct file *fl = &files[r->file];
+
+    return (r->rec.tsc - fl->tsc0) / fl->tick_ns;
+}
+
+static int cmp_rec(const void *a, const void *b)
+{
+    const struct rec *r1 = a;
+    const struct rec *r2 = b;
+    double t1 = files[r1->file].realtime0 + rec_ns(r1);
+    double t2 = files[r2->file].realtime0 + rec_ns(r2);
+
+    return (t1 > t2) - (t1 < t2);
+}
+
+/* fetch the next 8 bytes argument, return 0 if there are no more */
+static int next_val(const struct log_rec *rec, int *pos, uint64_t *val)
+{
+    if (*pos + sizeof(*val) > rec->len)
+        return 0;
+
+    memcpy(val, &rec->data[*pos], sizeof(*val));
+    *pos += sizeof(*val);
+
+    return 1;
+}
+
+/* print a message, reformatting each conversion with its argument */
+static void print_message(const char *format, const struct log_rec *rec)
+{
+    const char *p = format;
+    const char *start;
+    enum log_arg kind;
+    int pos = 0;
+    int stars;
+
+    for (;;) {
+        const char *prev = p;
+        int star[2] = { 0, 0 };
+        char spec[64];
+        uint64_t val = 0;
+        int i, ok = 1;
+
+        kind = log_next_arg(&p, &start, &stars);
+        if (kind == LOG_ARG_END) {
+            fputs(prev, stdout);
+            break;
+        }
+
+        fwrite(prev, 1, start - prev, stdout);
+
+        if (p - start >= sizeof(spec)) {
+            fwrite(start, 1, p - start, stdout);
+            continue;
+        }
+        memcpy(spec, start, p - start);
+        spec[p - start] = 0;
+
+        for (i = 0; i < stars && i < 2; i++) {
+            ok = ok && next_val(rec, &pos, &val);
+            star[i] = (int)val;
+        }
+
+        switch (kind) {
+            case LOG_ARG_NONE:
+                fputs(spec[1] == '%' ? "%" : spec, stdout);
+                continue;
+
+            case LOG_ARG_STR:{
+                char s[256];
+                int n;
+
+                if (!ok || pos >= rec->len) {
+                    ok = 0;
+                    break;
+                }
+                n = rec->data[pos++];
+                if (pos + n > rec->len)
+                    n = rec->len - pos;
+                memcpy(s, &rec->data[pos], n);
+                s[n] = 0;
+                pos += n;
+
+                if (stars == 2)
+                    printf(spec, star[0], star[1], s);
+                else if (stars == 1)
+                    printf(spec, star[0], s);
+                else
+                    printf(spec, s);
+                continue;
+            }
+
+            default:
+                ok = ok && next_val(rec, &pos, &val);
+                break;
+        }
+
+        if (!ok) {
+            fputs("<?>", stdout);
+            continue;
+        }
+
+#define PRINT_ARG(arg)							\
+        do {								\
+            if (stars == 2)						\
+                printf(spec, star[0], star[1], arg);			\
+            else if (stars == 1)					\
+                printf(spec, star[0], arg);				\
+            else							\
+                printf(spec, arg);					\
+        } while (0)
+
+        switch (kind) {
+            case LOG_ARG_INT:
+                PRINT_ARG((int)val);
+                break;
+            case LOG_ARG_LONG:
+                PRINT_ARG((long long)val);
+                break;
+            case LOG_ARG_PTR:
+                PRINT_ARG((void *)(uintptr_t)val);
+                break;
+            case LOG_ARG_DOUBLE:{
+                double d;
+
+                memcpy(&d, &val, sizeof(d));
+                PRINT_ARG(d);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    if (rec->truncated)
+        fputs(" <truncated>\n", stdout);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: p4log [OPTION]... FILE...\n\n");
+    fprintf(stderr, "  -h           Display this help message and exit\n");
+    fprintf(stderr, "  -l <level>   Only show messages up to level (1 errors, 2 warnings, 3 info)\n");
+    fprintf(stderr, "  -a           Show the wall clock time instead of the time since start\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int max_level = 4;
+    int wall = 0;
+    int num_files;
+    size_t i;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "hl:a")) != -1) {
+        switch (ch) {
+            case 'l':
+                max_level = strtol(optarg, NULL, 0);
+                break;
+            case 'a':
+                wall = 1;
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    num_files = argc - optind;
+    if (num_files <= 0) {
+        usage();
+        return 1;
+    }
+
+    files = xmalloc(num_files * sizeof(*files));
+    for (i = 0; i < num_files; i++)
+        load(argv[optind + i], i);
+
+    qsort(recs, num_recs, sizeof(*recs), cmp_rec);
+
+    for (i = 0; i < num_recs; i++) {
+        const struct rec *r = &recs[i];
+        const struct file *fl = &files[r->file];
+        const struct site *s;
+        double ns = rec_ns(r);
+
+        if (r->rec.site >= fl->num_sites) {
+            printf("bad record (site %u)\n", r->rec.site);
+            continue;
+        }
+
+        s = &fl->sites[r->rec.site];
+        if (s->level > max_level)
+            continue;
+
+        if (wall) {
+            uint64_t t = fl->realtime0 + (uint64_t)ns;
+            time_t sec = t / 1000000000;
+            struct tm tm;
+            char buf[32];
+
+            localtime_r(&sec, &tm);
+            strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+            printf("[%s.%06llu] ", buf,
+                   (unsigned long long)(t % 1000000000) / 1000);
+        } else {
+            printf("[%12.6f] ", ns * 1e-9);
+        }
+
+        if (num_files > 1)
+            printf("%d:", r->file);
+        printf("%u %s%s(%s:%d): ", r->tid, s->tag, s->func, s->file, s->line);
+        print_message(s->format, &r->rec);
+    }
+
+    return 0;
+}
@@ -143,10 +143,77 @@ static struct client *find_client(pid_t pid)
     return res;
 }
 
+/* Current time in ms. */
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* Give a shard to a progress thread. It will start serving it on its
+ * next loop. The shard is counted in the load of the thread now, so
+ * that clients connecting in a burst are spread over the threads. */
+static void give_shard(struct prog_thread *pt, struct shard *shard)
+{
+    pthread_mutex_lock(&pt->incoming_lock);
+    list_add_tail(&shard->list, &pt->incoming);
+    pt->num_incoming++;
+    pt->load_shards++;
+    pthread_mutex_unlock(&pt->incoming_lock);
+}
+
+/* Pick a free shard for a new client and give it to the least loaded
+ * progress thread. Called by the event loop thread. */
+static struct shard *assign_shard(void)
+{
+    struct prog_thread *best = NULL;
+    struct shard *shard = NULL;
+    int i;
+
+    for (i = 0; i < MAX_PPE_CLIENTS; i++) {
+        if (!ppe.shard[i].in_use) {
+            shard = &ppe.shard[i];
+            break;
+        }
+    }
+
+    if (!shard)
+        return NULL;
+
+    for (i = 0; i < ppe.num_prog_threads; i++) {
+        struct prog_thread *pt = &ppe.prog_thread[i];
+
+        if (!best || pt->load < best->load ||
+            (pt->load == best->load && pt->load_shards < best->load_shards))
+            best = pt;
+    }
+
+    shard->in_use = 1;
+    shard->closing = 0;
+    shard->busy = 0;
+    shard->moved = now_ms();
+    queue_init(shard->queue);
+    INIT_LIST_HEAD(&shard->ni_list);
+
+    give_shard(best, shard);
+
+    return shard;
+}
+
 static void destroy_client(struct client *client)
 {
     RB_REMOVE(clients_root, &ppe.clients_tree, client);
 
+    /* The progress thread serving the client will release the
+     * shard. */
+    if (client->shard) {
+        client->shard->closing = 1;
+        client->shard = NULL;
+    }
+
 #ifndef HAVE_KITTEN
     ev_io_stop(evl.loop, &client->watcher);
 
@@ -187,19 +254,22 @@ static int process_client_msg(struct client *client,
         msg->rep.ret = PTL_FAIL;
         return -1;
     } else {
-        /* Designate a progress thread for this client. They are alloted
-         * on a round-robin fashion. */
-        client->gbl.prog_thread = ppe.current_prog_thread;
-        ppe.current_prog_thread++;
-        if (ppe.current_prog_thread >= ppe.num_prog_threads)
-            ppe.current_prog_thread = 0;
+        /* Give the client its own shard, served by the least loaded
+         * progress thread. */
+        client->shard = assign_shard();
+        if (!client->shard) {
+            ptl_warn("too many clients\n");
+            msg->rep.ret = PTL_NO_SPACE;
+            return -1;
+        }
+        client->gbl.shard = client->shard->index;
 
         RB_INSERT(clients_root, &ppe.clients_tree, client);
 
         msg->rep.cookie = client;
         msg->rep.ppebufs_mapping = ppe.comm_pad_mapping;
         msg->rep.ppebufs_ppeaddr = ppe.comm_pad->ppebuf_slab;
-        msg->rep.queue_index = client->gbl.prog_thread;
+        msg->rep.queue_index = client->gbl.shard;
         msg->rep.ret = PTL_OK;
     }
 
@@ -369,14 +439,21 @@ static int init_ppe(void)
         goto exit_fail;
     }
 
+    for (i = 0; i < MAX_PPE_CLIENTS; i++) {
+        struct shard *shard = &ppe.shard[i];
+
+        shard->index = i;
+        shard->queue = &ppe.comm_pad->q[i].queue;
+        queue_init(shard->queue);
+        queue_init(&shard->internal_queue);
+        INIT_LIST_HEAD(&shard->ni_list);
+    }
+
     for (i = 0; i < ppe.num_prog_threads; i++) {
         struct prog_thread *pt = &ppe.prog_thread[i];
 
-        /* Initialize both thread queues. */
-        pt->queue = &ppe.comm_pad->q[i].queue;
-        queue_init(pt->queue);
-        queue_init(&pt->internal_queue);
-        INIT_LIST_HEAD(&pt->ni_list);
+        pthread_mutex_init(&pt->incoming_lock, NULL);
+        INIT_LIST_HEAD(&pt->incoming);
     }
 
     return PTL_OK;
@@ -521,8 +598,8 @@ static int ppe_init_prepare_transfer(md_t *md, data_dir_t dir,
         mr_t *mr;
         if (md->num_iov) {
             err =
-                append_immediate_data(md->start, md->mr_list, md->num_iov,
-                                      dir, offset, length, buf);
+                append_immediate_data(md->start, md->iov_offsets, md->mr_list,
+                                      md->num_iov, dir, offset, length, buf);
         } else {
             err =
                 mr_lookup_app(obj_to_ni(md), md->start + offset, length, &mr);
@@ -532,7 +609,7 @@ static int ppe_init_prepare_transfer(md_t *md, data_dir_t dir,
             }
 
             err =
-                append_immediate_data(md->start, &mr, md->num_iov, dir,
+                append_immediate_data(md->start, NULL, &mr, md->num_iov, dir,
                                       offset, length, buf);
 
             mr_put(mr);
@@ -543,8 +620,8 @@ static int ppe_init_prepare_transfer(md_t *md, data_dir_t dir,
         /* Find the index and offset of the first IOV as well as the
          * total number of IOVs to transfer. */
         num_sge =
-            iov_count_elem(iovecs, md->num_iov, offset, length, &iov_start,
-                           &iov_offset);
+            iov_count_elem(iovecs, md->iov_offsets, md->num_iov, offset,
+                           length, &iov_start, &iov_offset);
         if (num_sge < 0) {
             WARN();
             return PTL_FAIL;
@@ -1440,89 +1517,436 @@ static struct {
 #endif
 ADD_OP(PtlStartBundle), ADD_OP(PtlEndBundle),};
 
-/* Progress thread for the PPE. */
-static void *ppe_progress(void *arg)
+/* An operation submitted asynchronously failed. The client is not
+ * waiting for msg.ret, so report a failed event on the MD of the
+ * operation, or a failure on the CT of a triggered CT operation. */
+static void async_error(ppebuf_t *buf)
 {
-    struct prog_thread *pt = arg;
+    struct client *client = buf->cookie;
+    ptl_event_kind_t type = PTL_EVENT_SEND;
+    ptl_handle_md_t md_handle;
+    ptl_handle_ct_t ct_handle;
+    void *user_ptr;
+    md_t *md;
+    ct_t *ct;
 
-    while (!pt->stop) {
-        ppebuf_t *ppebuf;
-        buf_t *mem_buf;
+    switch (buf->op) {
+        case OP_PtlPut:
+            md_handle = buf->msg.PtlPut.md_handle;
+            user_ptr = buf->msg.PtlPut.user_ptr;
+            break;
+        case OP_PtlAtomic:
+            md_handle = buf->msg.PtlAtomic.md_handle;
+            user_ptr = buf->msg.PtlAtomic.user_ptr;
+            break;
+        case OP_PtlTriggeredPut:
+            md_handle = buf->msg.PtlTriggeredPut.md_handle;
+            user_ptr = buf->msg.PtlTriggeredPut.user_ptr;
+            break;
+        case OP_PtlTriggeredAtomic:
+            md_handle = buf->msg.PtlTriggeredAtomic.md_handle;
+            user_ptr = buf->msg.PtlTriggeredAtomic.user_ptr;
+            break;
+        case OP_PtlGet:
+            type = PTL_EVENT_REPLY;
+            md_handle = buf->msg.PtlGet.md_handle;
+            user_ptr = buf->msg.PtlGet.user_ptr;
+            break;
+        case OP_PtlFetchAtomic:
+            type = PTL_EVENT_REPLY;
+            md_handle = buf->msg.PtlFetchAtomic.get_md_handle;
+            user_ptr = buf->msg.PtlFetchAtomic.user_ptr;
+            break;
+        case OP_PtlTriggeredGet:
+            type = PTL_EVENT_REPLY;
+            md_handle = buf->msg.PtlTriggeredGet.md_handle;
+            user_ptr = buf->msg.PtlTriggeredGet.user_ptr;
+            break;
+        case OP_PtlTriggeredFetchAtomic:
+            type = PTL_EVENT_REPLY;
+            md_handle = buf->msg.PtlTriggeredFetchAtomic.get_md_handle;
+            user_ptr = buf->msg.PtlTriggeredFetchAtomic.user_ptr;
+            break;
+        case OP_PtlTriggeredCTInc:
+        case OP_PtlTriggeredCTSet:
+            ct_handle = (buf->op == OP_PtlTriggeredCTInc) ?
+                buf->msg.PtlTriggeredCTInc.ct_handle :
+                buf->msg.PtlTriggeredCTSet.ct_handle;
+            if (to_ct(&client->gbl, ct_handle, &ct) == PTL_OK && ct) {
+                make_ct_failure(ct);
+                ct_put(ct);
+            } else {
+                ptl_warn("asynchronous %s failed (%d), no CT to report to\n",
+                         ppe_ops[buf->op].name, buf->msg.ret);
+            }
+            return;
+        default:
+            return;
+    }
 
-#if WITH_TRANSPORT_IB
-        /* Infiniband. Walking the list of active NIs to find work. */
+    md = to_md(&client->gbl, md_handle);
+    if (!md) {
+        ptl_warn("asynchronous %s failed (%d), no MD to report to\n",
+                 ppe_ops[buf->op].name, buf->msg.ret);
+        return;
+    }
+
+    if (md->eq)
+        make_error_event(md->eq, type, user_ptr, PTL_NI_UNDELIVERABLE);
+
+    if (md->ct && (md->options & (type == PTL_EVENT_SEND ?
+                                  PTL_MD_EVENT_CT_SEND :
+                                  PTL_MD_EVENT_CT_REPLY)))
+        make_ct_failure(md->ct);
+
+    md_put(md);
+}
+
+/* Idle back-off of the progress threads. A thread spins while it had
+ * work recently, then pauses longer and longer between polls, and
+ * finally yields the CPU between polls. It never sleeps, so a new
+ * message is seen at most one yield later. */
+#define IDLE_SPIN_LOOPS		(1024)
+#define IDLE_YIELD_LOOPS	(16384)
+#define IDLE_MAX_PAUSES		(64)
+
+/* Balancing. A thread busier than BALANCE_MIN_LOAD, and busier than
+ * the least loaded thread by at least BALANCE_MIN_GAP (both in per
+ * mille), gives it one of its shards. A migrated shard stays where it
+ * is for BALANCE_HOLD periods. */
+#define BALANCE_MIN_LOAD	(500)
+#define BALANCE_MIN_GAP		(200)
+#define BALANCE_HOLD		(10)
+
+/* Maximum number of ppebufs processed for a shard on each loop, so
+ * that a busy client cannot starve the others. */
+#define SHARD_BATCH		(8)
+
+static void idle_backoff(struct prog_thread *pt, unsigned int idle)
+{
+    unsigned int pauses;
+
+    if (idle < IDLE_SPIN_LOOPS) {
+        SPINLOCK_BODY();
+    } else if (idle < IDLE_YIELD_LOOPS) {
+        pauses = (idle - IDLE_SPIN_LOOPS) / 256 + 2;
+        if (pauses > IDLE_MAX_PAUSES)
+            pauses = IDLE_MAX_PAUSES;
+        while (pauses--)
+            SPINLOCK_BODY();
+    } else {
+        sched_yield();
+        pt->stats.yields++;
+    }
+}
+
+/* Start serving the shards given to this thread. */
+static void take_incoming(struct prog_thread *pt)
+{
+    struct list_head *l, *t;
+
+    pthread_mutex_lock(&pt->incoming_lock);
+
+    list_for_each_safe(l, t, &pt->incoming) {
+        struct shard *shard = list_entry(l, struct shard, list);
+
+        list_del(l);
+        pt->shard[pt->num_shards++] = shard;
+        pt->stats.migrated_in++;
+    }
+
+    pt->num_incoming = 0;
+
+    pthread_mutex_unlock(&pt->incoming_lock);
+}
+
+/* Stop serving the shard at index i of this thread. */
+static struct shard *remove_shard(struct prog_thread *pt, int i)
+{
+    struct shard *shard = pt->shard[i];
+
+    pt->num_shards--;
+    pt->shard[i] = pt->shard[pt->num_shards];
+
+    return shard;
+}
+
+/* Give a shard to the least loaded thread if this one is much busier. */
+static void balance(struct prog_thread *pt, uint64_t ticks, uint64_t now)
+{
+    struct prog_thread *low = NULL;
+    struct shard *shard;
+    uint64_t excess;
+    int best = -1;
+    int i;
+
+    for (i = 0; i < ppe.num_prog_threads; i++) {
+        struct prog_thread *other = &ppe.prog_thread[i];
+
+        if (other != pt && (!low || other->load < low->load))
+            low = other;
+    }
+
+    /* Moving the only shard of a thread would not help. */
+    if (!low || pt->num_shards < 2 || pt->load < BALANCE_MIN_LOAD ||
+        pt->load < low->load + BALANCE_MIN_GAP)
+        return;
+
+    /* Move the busiest shard worth at most half the difference, so
+     * that the two threads get closer without swapping roles. */
+    excess = ticks * (pt->load - low->load) / 2000;
+
+    for (i = 0; i < pt->num_shards; i++) {
+        shard = pt->shard[i];
+
+        if (shard->busy == 0 || shard->busy > excess ||
+            now - shard->moved < BALANCE_HOLD * ppe.balance_interval)
+            continue;
+
+        if (best == -1 || shard->busy > pt->shard[best]->busy)
+            best = i;
+    }
+
+    if (best == -1)
+        return;
+
+    shard = remove_shard(pt, best);
+    shard->moved = now;
+    pt->stats.migrated_out++;
+
+    ptl_info("moving shard %d from progress thread %d (%u/1000) to %d "
+             "(%u/1000)\n", shard->index, (int)(pt - ppe.prog_thread),
+             pt->load, (int)(low - ppe.prog_thread), low->load);
+
+    give_shard(low, shard);
+}
+
+/* End of a balancing period: publish the load of the thread, and
+ * rebalance. */
+static void end_period(struct prog_thread *pt, uint64_t now)
+{
+    uint64_t tsc = trace_tsc();
+    uint64_t ticks = tsc - pt->period_start_tsc;
+    int i;
+
+    pt->load = ticks ? pt->period_busy * 1000 / ticks : 0;
+
+    /* give_shard() counts the shards it hands over under the same
+     * lock. */
+    pthread_mutex_lock(&pt->incoming_lock);
+    pt->load_shards = pt->num_shards + pt->num_incoming;
+    pthread_mutex_unlock(&pt->incoming_lock);
+
+    pt->stats.busy += pt->period_busy;
+    pt->stats.total += ticks;
+
+    if (ppe.balance_interval && ppe.num_prog_threads > 1)
+        balance(pt, ticks, now);
+
+    for (i = 0; i < pt->num_shards; i++)
+        pt->shard[i]->busy = 0;
+
+    pt->period_busy = 0;
+    pt->period_start_tsc = tsc;
+    pt->period_start_ms = now;
+}
+
+/* Process a buffer sent by a client to another one. */
+static void process_mem_buf(buf_t *mem_buf)
+{
+    int err;
+
+    if (mem_buf->type == BUF_MEM_SEND) {
+        buf_t *buf;
         ni_t *ni;
-        list_for_each_entry(ni, &pt->ni_list, rdma.ppe_ni_list) {
-            progress_thread_rdma(ni);
+
+        /* Mark it for releasing. The target state machine might
+         * change its type back to BUF_MEM_SEND. */
+        mem_buf->type = BUF_MEM_RELEASE;
+
+        /* The destination NI has been computed by send_message_mem. */
+        ni = mem_buf->dest_ni;
+        err = buf_alloc(ni, &buf);
+        if (err) {
+            WARN();
+        } else {
+            buf->data = mem_buf->internal_data;
+            buf->length = mem_buf->length;
+            buf->mem_buf = mem_buf;
+            INIT_LIST_HEAD(&buf->list);
+            process_recv_mem(ni, buf);
+
+            if (mem_buf->type == BUF_MEM_SEND) {
+                err = mem_buf->conn->transport.send_message(mem_buf, 0);
+                if (err) {
+                    WARN();
+                }
+            }
         }
+    } else {
+        assert(mem_buf->type == BUF_MEM_RELEASE);
+    }
+
+    /* From send_message_mem(). */
+    buf_put(mem_buf);
+}
+
+/* Poll the NIs and queues of a shard once. Returns the amount of work
+ * done. */
+static int serve_shard(struct prog_thread *pt, struct shard *shard)
+{
+    ppebuf_t *ppebuf;
+    buf_t *mem_buf;
+    int work = 0;
+    int n;
+
+#if WITH_TRANSPORT_IB
+    /* Infiniband. Walking the list of active NIs to find work. */
+    ni_t *ni;
+    list_for_each_entry(ni, &shard->ni_list, rdma.ppe_ni_list) {
+        work += progress_thread_rdma(ni);
+    }
 #endif
 
 #if WITH_TRANSPORT_UDP
-        /* UDP. Walking the list of active NIs to find work. */
-        ni_t *ni;
-        list_for_each_entry(ni, &pt->ni_list, udp.ppe_ni_list) {
-            progress_thread_udp(ni);
-        }
+    /* UDP. Walking the list of active NIs to find work. */
+    ni_t *ni;
+    list_for_each_entry(ni, &shard->ni_list, udp.ppe_ni_list) {
+        work += progress_thread_udp(ni);
+    }
 #endif
 
-        /* Get message from the message queue. */
-        ppebuf = (ppebuf_t *)dequeue(NULL, pt->queue);
+    pt->stats.net += work;
 
-        if (ppebuf) {
-            ppe_ops[ppebuf->op].func(ppebuf);
+    /* Get messages from the client queue. */
+    for (n = 0; n < SHARD_BATCH; n++) {
+        ppebuf = (ppebuf_t *)dequeue(NULL, shard->queue);
+        if (!ppebuf)
+            break;
 
-            /* Return response to blocked client. */
-            buf_completed(ppebuf);
-        }
+        ppe_ops[ppebuf->op].func(ppebuf);
 
-        /* Get message from our own queue. */
-        mem_buf = (buf_t *)dequeue(NULL, &pt->internal_queue);
-        if (mem_buf) {
-            int err;
+        if (ppebuf->async && ppebuf->msg.ret != PTL_OK)
+            async_error(ppebuf);
 
-            if (mem_buf->type == BUF_MEM_SEND) {
-                buf_t *buf;
-                ni_t *ni;
+        /* Return response to blocked client, or the ring slot
+         * to an asynchronous one. */
+        buf_completed(ppebuf);
+    }
 
-                /* Mark it for releasing. The target state machine might
-                 * change its type back to BUF_MEM_SEND. */
-                mem_buf->type = BUF_MEM_RELEASE;
+    pt->stats.ops += n;
+    work += n;
 
-                /* The destination NI has been computed by send_message_mem. */
-                ni = mem_buf->dest_ni;
-                err = buf_alloc(ni, &buf);
-                if (err) {
-                    WARN();
-                } else {
-                    buf->data = mem_buf->internal_data;
-                    buf->length = mem_buf->length;
-                    buf->mem_buf = mem_buf;
-                    INIT_LIST_HEAD(&buf->list);
-                    process_recv_mem(ni, buf);
-
-                    if (mem_buf->type == BUF_MEM_SEND) {
-                        err =
-                            mem_buf->conn->transport.send_message(mem_buf, 0);
-                        if (err) {
-                            WARN();
-                        }
-                    }
-                }
-            } else {
-                assert(mem_buf->type == BUF_MEM_RELEASE);
+    /* Get message from the internal queue. */
+    mem_buf = (buf_t *)dequeue(NULL, &shard->internal_queue);
+    if (mem_buf) {
+        process_mem_buf(mem_buf);
+        pt->stats.mem_bufs++;
+        work++;
+    }
+
+    return work;
+}
+
+/* Progress thread for the PPE. */
+static void *ppe_progress(void *arg)
+{
+    struct prog_thread *pt = arg;
+    unsigned int idle = 0;
+    unsigned int loops = 0;
+
+    pt->period_start_tsc = trace_tsc();
+    pt->period_start_ms = now_ms();
+
+    while (!pt->stop) {
+        uint64_t start = trace_tsc();
+        uint64_t last = start;
+        int work = 0;
+        int i;
+
+        if (pt->num_incoming)
+            take_incoming(pt);
+
+        for (i = 0; i < pt->num_shards; i++) {
+            struct shard *shard = pt->shard[i];
+            int w;
+
+            if (unlikely(shard->closing)) {
+                buf_t *mem_buf;
+
+                /* The client is gone. Its NIs are not polled
+                 * anymore and the shard can be reused. The bufs
+                 * still on its internal queue are processed first;
+                 * the queue is kept as is for the next client, as
+                 * other clients may be enqueuing on it. */
+                while ((mem_buf =
+                        (buf_t *)dequeue(NULL, &shard->internal_queue)))
+                    process_mem_buf(mem_buf);
+
+                remove_shard(pt, i);
+                i--;
+                INIT_LIST_HEAD(&shard->ni_list);
+                __sync_synchronize();
+                shard->in_use = 0;
+                continue;
             }
 
-            /* From send_message_mem(). */
-            buf_put(mem_buf);
+            w = serve_shard(pt, shard);
+            if (w) {
+                /* Only read the clock when there was work. The time
+                 * spent polling idle shards is charged to the next
+                 * busy one, which is close enough. */
+                uint64_t now = trace_tsc();
+
+                shard->busy += now - last;
+                last = now;
+                work += w;
+            }
         }
 
-        /* TODO: don't spin if we got messages. */
-        SPINLOCK_BODY();
+        if (work) {
+            pt->period_busy += last - start;
+            idle = 0;
+        } else {
+            idle_backoff(pt, ++idle);
+        }
+
+        /* Don't look at the clock on every pass. */
+        if ((++loops & 255) == 0) {
+            uint64_t now = now_ms();
+
+            if (now - pt->period_start_ms >= ppe.period)
+                end_period(pt, now);
+        }
     }
 
+    pt->stats.busy += pt->period_busy;
+    pt->stats.total += trace_tsc() - pt->period_start_tsc;
+
     return NULL;
 }
 
+/* Print the utilization counters of the progress threads. */
+static void print_prog_thread_stats(void)
+{
+    int i;
+
+    for (i = 0; i < ppe.num_prog_threads; i++) {
+        struct prog_thread *pt = &ppe.prog_thread[i];
+        struct prog_thread_stats *st = &pt->stats;
+
+        printf("progress thread %d: %.1f%% busy, %d shards, %llu ops, "
+               "%llu mem bufs, %llu net, %llu yields, %llu shards in, "
+               "%llu out\n", i,
+               st->total ? 100.0 * st->busy / st->total : 0.0,
+               pt->num_shards, (unsigned long long)st->ops,
+               (unsigned long long)st->mem_bufs,
+               (unsigned long long)st->net, (unsigned long long)st->yields,
+               (unsigned long long)st->migrated_in,
+               (unsigned long long)st->migrated_out);
+    }
+}
+
 void gbl_release(ref_t *ref)
 {
     gbl_t *gbl = container_of(ref, gbl_t, ref);
@@ -1576,7 +2000,7 @@ static unsigned int fakepid(void)
  */
 static int NIInit_ppe(gbl_t *gbl, ni_t *ni)
 {
-    struct prog_thread *pt = &ppe.prog_thread[gbl->prog_thread];
+    struct shard *shard = &ppe.shard[gbl->shard];
 
     /* Only if IB hasn't setup the NID first. */
     if (ni->iface->id.phys.nid == PTL_NID_ANY) {
@@ -1591,15 +2015,15 @@ static int NIInit_ppe(gbl_t *gbl, ni_t *ni)
     if (ni->id.phys.pid == PTL_PID_ANY)
         ni->id.phys.pid = ni->iface->id.phys.pid;
 
-    ni->mem.internal_queue = &pt->internal_queue;
+    ni->mem.internal_queue = &shard->internal_queue;
     ni->mem.apid = gbl->apid;
 
 #if WITH_TRANSPORT_IB
-    list_add_tail(&ni->rdma.ppe_ni_list, &pt->ni_list);
+    list_add_tail(&ni->rdma.ppe_ni_list, &shard->ni_list);
 #endif
 
 #if WITH_TRANSPORT_UDP
-    list_add_tail(&ni->udp.ppe_ni_list, &pt->ni_list);
+    list_add_tail(&ni->udp.ppe_ni_list, &shard->ni_list);
 #endif
 
     if (ni->options & PTL_NI_PHYSICAL) {
@@ -1661,6 +2085,9 @@ int ppe_run(int num_bufs, int num_threads, size_t stack_size)
     if (err)
         return 1;
 
+    ppe.balance_interval = get_param(PTL_PPE_BALANCE_INTERVAL);
+    ppe.period = ppe.balance_interval ? ppe.balance_interval : 100;
+
     /* Init the index service */
     err = index_init(&ppe.gbl);
     if (err)
@@ -1699,10 +2126,19 @@ int ppe_run(int num_bufs, int num_threads, size_t stack_size)
 #ifndef HAVE_KITTEN
     signal(SIGTERM, sig_terminate);
 
-    /* Start the event loop. Does not exit. */
+    /* Start the event loop. Returns on SIGTERM. */
     evl_run(&evl);
 #endif
 
+    for (i = 0; i < ppe.num_prog_threads; i++) {
+        struct prog_thread *pt = &ppe.prog_thread[i];
+
+        pt->stop = 1;
+        pthread_join(pt->thread, NULL);
+    }
+
+    print_prog_thread_stats();
+
     //todo: on shutdown, we might want to cleanup
 
     return 0;
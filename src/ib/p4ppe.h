@@ -7,6 +7,8 @@
 
 #if IS_PPE
 
+struct shard;
+
 /* Represents a client connected to the PPE. */
 struct client {
     RB_ENTRY(client) entry;
@@ -27,6 +29,9 @@ struct client {
     uid_t uid;
 #endif
 
+    /* Shard of the client, NULL once it is gone. */
+    struct shard *shard;
+
     gbl_t gbl;
 };
 
@@ -42,21 +47,81 @@ struct logical_ni_set {
     int members;                /* number of rank in the set */
 };
 
-struct prog_thread {
-    pthread_t thread;
+/* A shard is the unit of work of the progress threads: the queue of
+ * one client, its internal queue and its NIs. A shard is served by one
+ * progress thread at a time, and can be migrated to another one to
+ * balance the load. */
+struct shard {
+    /* Index of the shard, and of its queue in the comm pad. */
+    int index;
 
-    /* When to stop the progress thread. */
-    int stop;
+    /* Set by the event loop thread when a client is assigned to the
+     * shard. Cleared by the progress thread once the client is gone. */
+    volatile int in_use;
 
-    /* Linked list of active NIs. */
-    struct list_head ni_list;
+    /* Set by the event loop thread when the client is gone. */
+    volatile int closing;
 
-    /* Points to own queue in comm pad. */
+    /* Points to the client queue in the comm pad. */
     queue_t *queue;
 
     /* Internal queue. Used for communication regarding transfer
      * between clients. */
     queue_t internal_queue;
+
+    /* Linked list of active NIs of the client. */
+    struct list_head ni_list;
+
+    /* Chaining in the incoming list of a progress thread. */
+    struct list_head list;
+
+    /* Time spent working on the shard during the current balancing
+     * period, in timestamp counter ticks. */
+    uint64_t busy;
+
+    /* When the shard was last migrated, in ms. */
+    uint64_t moved;
+};
+
+/* Utilization counters of a progress thread. */
+struct prog_thread_stats {
+    uint64_t ops;               /* ppebufs processed */
+    uint64_t mem_bufs;          /* internal buffers processed */
+    uint64_t net;               /* network completions processed */
+    uint64_t busy;              /* ticks spent working */
+    uint64_t total;             /* ticks elapsed */
+    uint64_t yields;            /* times the thread yielded while idle */
+    uint64_t migrated_in;
+    uint64_t migrated_out;
+};
+
+struct prog_thread {
+    pthread_t thread;
+
+    /* When to stop the progress thread. */
+    int stop;
+
+    /* Shards served by this thread. Only accessed by the thread. */
+    struct shard *shard[MAX_PPE_CLIENTS];
+    int num_shards;
+
+    /* Shards given to this thread by the event loop or by another
+     * progress thread. */
+    pthread_mutex_t incoming_lock;
+    struct list_head incoming;
+    volatile int num_incoming;
+
+    /* Fraction of the last balancing period spent working, in per
+     * mille, and number of shards. Read by the other threads. */
+    volatile unsigned int load;
+    volatile int load_shards;
+
+    /* Current balancing period. */
+    uint64_t period_start_tsc;
+    uint64_t period_start_ms;
+    uint64_t period_busy;
+
+    struct prog_thread_stats stats;
 };
 
 struct ppe {
@@ -66,9 +131,18 @@ struct ppe {
 
     /* The progress threads. */
     int num_prog_threads;       /* in prog_thread[] */
-    int current_prog_thread;
     struct prog_thread prog_thread[MAX_PROGRESS_THREADS];
 
+    /* The shards, one per client. */
+    struct shard shard[MAX_PPE_CLIENTS];
+
+    /* Balancing period in ms, 0 to disable migrations. */
+    unsigned int balance_interval;
+
+    /* Period at which the progress threads update their load, in
+     * ms. The balancing period, or 100ms if disabled. */
+    unsigned int period;
+
     /* The event loop thread. */
     pthread_t event_thread;
     int event_thread_run;
@@ -0,0 +1,373 @@
+/**
+ * @file p4stat.c
+ *
+ * Monitor for the statistics pages published by the library when
+ * PTL_STATS is set (see ptl_stats.h for the page layout).
+ *
+ * Without arguments every page found on the node is printed once.
+ * Pids restrict the output to those processes, and -i prints a new
+ * sample every interval with the counter rates since the previous one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ptl_stats.h"
+
+#define SHM_DIR		"/dev/shm"
+#define MAX_PAGES	(256)
+
+/* the previous sample of a page, to compute rates */
+struct sample {
+    char name[NAME_MAX + 1];            /* as a dirent name */
+    struct ptl_stats *copy;
+    int seen;
+};
+
+static struct sample samples[MAX_PAGES];
+static int num_samples;
+
+static const char *ni_type_name[4] = {
+    "no matching physical",
+    "no matching logical",
+    "matching physical",
+    "matching logical",
+};
+
+static const char *transport_name[STATS_TRANSPORT_LAST] = {
+    [STATS_RDMA] = "rdma",
+    [STATS_SHMEM] = "shmem",
+    [STATS_UDP] = "udp",
+    [STATS_LOOP] = "loop",
+};
+
+static const char *fail_name[STATS_NUM_FAIL] = {
+    "ok", "undeliverable", "dropped", "pt_disabled",
+    "perm_violation", "op_violation", "no_match", "segv",
+};
+
+/*
+ * Copy a page, retrying while its snapshot is being written.
+ *
+ * @return the copy or NULL if the page is not ready or busy.
+ */
+static struct ptl_stats *read_page(const struct ptl_stats *stats, size_t size)
+{
+    struct ptl_stats *copy;
+    uint32_t seq;
+    int try;
+
+    if (memcmp(stats->magic, STATS_MAGIC, sizeof(stats->magic)) ||
+        stats->size > size)
+        return NULL;
+
+    copy = malloc(stats->size);
+    if (!copy)
+        return NULL;
+
+    for (try = 0; try < 1000; try++) {
+        seq = stats->seq;
+        __sync_synchronize();
+        memcpy(copy, stats, stats->size);
+        __sync_synchronize();
+        if (!(seq & 1) && seq == stats->seq)
+            return copy;
+        usleep(100);
+    }
+
+    free(copy);
+    return NULL;
+}
+
+static double rate(uint64_t cur, uint64_t prev, double dt)
+{
+    return dt > 0 ? (cur - prev) / dt : 0;
+}
+
+static void print_page(const char *name, const struct ptl_stats *s,
+                       const struct ptl_stats *prev, int all_pt)
+{
+    double dt = 0;
+    time_t now = time(NULL);
+    int i;
+
+    if (prev && s->time_ns > prev->time_ns)
+        dt = (s->time_ns - prev->time_ns) * 1e-9;
+
+    printf("%s: pid %d, %s NI, nid %u pid %u", name, s->os_pid,
+           ni_type_name[s->ni_type & 3], s->nid, s->pid);
+    if (s->rank != (uint32_t)-1)
+        printf(" rank %u", s->rank);
+    if (kill(s->os_pid, 0) && errno == ESRCH)
+        printf(" (dead)");
+    else if (s->time_ns)
+        printf(" (updated %lds ago)", (long)(now - s->time_ns / 1000000000));
+    printf("\n");
+
+    printf("  %-8s %12s %12s %14s %14s", "", "send pkts", "recv pkts",
+           "send bytes", "recv bytes");
+    if (dt)
+        printf(" %12s %12s", "send/s", "recv/s");
+    printf("\n");
+    for (i = 0; i < STATS_TRANSPORT_LAST; i++) {
+        const struct stats_transport_count *t = &s->transport[i];
+
+        if (!t->send_pkts && !t->recv_pkts)
+            continue;
+
+        printf("  %-8s %12llu %12llu %14llu %14llu", transport_name[i],
+               (unsigned long long)t->send_pkts,
+               (unsigned long long)t->recv_pkts,
+               (unsigned long long)t->send_bytes,
+               (unsigned long long)t->recv_bytes);
+        if (dt)
+            printf(" %12.0f %12.0f",
+                   rate(t->send_pkts, prev->transport[i].send_pkts, dt),
+                   rate(t->recv_pkts, prev->transport[i].recv_pkts, dt));
+        printf("\n");
+    }
+
+    if (s->udp_packed_dgrams || s->udp_unpacked_dgrams) {
+        printf("  udp packing: sent %llu msgs in %llu datagrams",
+               (unsigned long long)s->udp_packed_msgs,
+               (unsigned long long)s->udp_packed_dgrams);
+        if (s->udp_packed_dgrams)
+            printf(" (%.1f per datagram)",
+                   (double)s->udp_packed_msgs / s->udp_packed_dgrams);
+        printf(", received %llu msgs in %llu datagrams",
+               (unsigned long long)s->udp_unpacked_msgs,
+               (unsigned long long)s->udp_unpacked_dgrams);
+        if (s->udp_unpacked_dgrams)
+            printf(" (%.1f per datagram)",
+                   (double)s->udp_unpacked_msgs / s->udp_unpacked_dgrams);
+        printf("\n");
+    }
+
+    printf("  drops:");
+    for (i = 1; i < STATS_NUM_FAIL; i++)
+        if (s->drops[i])
+            printf(" %s=%llu", fail_name[i],
+                   (unsigned long long)s->drops[i]);
+    printf(" recv_errs=%llu recv_drops=%llu sr_drop_count=%llu\n",
+           (unsigned long long)s->recv_errs,
+           (unsigned long long)s->recv_drops,
+           (unsigned long long)s->status[0]);
+
+    printf("  mr cache: %llu hits, %llu misses",
+           (unsigned long long)s->mr_hits,
+           (unsigned long long)s->mr_misses);
+    if (s->mr_hits + s->mr_misses)
+        printf(" (%.1f%% hits)",
+               100.0 * s->mr_hits / (s->mr_hits + s->mr_misses));
+    printf("\n");
+
+    printf("  eqs: %u, %llu/%llu events, fullest at %.1f%%\n", s->num_eqs,
+           (unsigned long long)s->eq_used, (unsigned long long)s->eq_size,
+           s->eq_max_fill / 10.0);
+    printf("  cts: %u, %llu triggered ops pending, longest list %llu\n",
+           s->num_cts, (unsigned long long)s->ct_trig,
+           (unsigned long long)s->ct_trig_max);
+
+    printf("  pools:");
+    for (i = 0; i < s->num_pools && i < STATS_MAX_POOLS; i++)
+        printf(" %.*s=%llu/%llu", STATS_NAME_LEN, s->pool[i].name,
+               (unsigned long long)s->pool[i].in_use,
+               (unsigned long long)s->pool[i].total);
+    printf("\n");
+
+    printf("  %-6s %-8s %10s %10s %10s %8s\n", "pt", "state", "priority",
+           "overflow", "unexpected", "active");
+    for (i = 0; i < s->num_pt; i++) {
+        const struct stats_pt *pt = &s->pt[i];
+
+        if (!pt->in_use)
+            continue;
+        if (!all_pt && !pt->priority && !pt->overflow && !pt->unexpected &&
+            !pt->active && !pt->state)
+            continue;
+
+        printf("  %-6d %-8s %10u %10u %10u %8u\n", i,
+               pt->state ? "disabled" : "enabled", pt->priority,
+               pt->overflow, pt->unexpected, pt->active);
+    }
+}
+
+/* find the previous sample of a page */
+static struct sample *get_sample(const char *name)
+{
+    int i;
+
+    for (i = 0; i < num_samples; i++)
+        if (!strcmp(samples[i].name, name))
+            return &samples[i];
+
+    if (num_samples == MAX_PAGES)
+        return NULL;
+
+    snprintf(samples[num_samples].name, sizeof(samples[0].name), "%s", name);
+    return &samples[num_samples++];
+}
+
+static int wanted(int pid, int num_pids, char **pids)
+{
+    int i;
+
+    if (!num_pids)
+        return 1;
+
+    for (i = 0; i < num_pids; i++)
+        if (atoi(pids[i]) == pid)
+            return 1;
+
+    return 0;
+}
+
+/* sample every page found once, return the number of pages */
+static int sample_all(int num_pids, char **pids, int all_pt, int clean)
+{
+    const char *prefix = STATS_SHM_PREFIX + 1;
+    struct dirent *de;
+    DIR *dir;
+    int found = 0;
+
+    dir = opendir(SHM_DIR);
+    if (!dir) {
+        perror(SHM_DIR);
+        exit(1);
+    }
+
+    while ((de = readdir(dir))) {
+        char shm_name[300];
+        struct ptl_stats *stats, *copy;
+        struct sample *sample;
+        struct stat st;
+        int fd;
+
+        if (strncmp(de->d_name, prefix, strlen(prefix)))
+            continue;
+
+        if (!wanted(atoi(de->d_name + strlen(prefix)), num_pids, pids))
+            continue;
+
+        snprintf(shm_name, sizeof(shm_name), "/%s", de->d_name);
+        fd = shm_open(shm_name, O_RDONLY, 0);
+        if (fd < 0)
+            continue;
+
+        if (fstat(fd, &st) || st.st_size < sizeof(*stats)) {
+            close(fd);
+            continue;
+        }
+
+        stats = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (stats == MAP_FAILED)
+            continue;
+
+        copy = read_page(stats, st.st_size);
+        munmap(stats, st.st_size);
+        if (!copy)
+            continue;
+
+        if (clean) {
+            if (kill(copy->os_pid, 0) && errno == ESRCH) {
+                printf("removing %s\n", shm_name);
+                shm_unlink(shm_name);
+            }
+            free(copy);
+            continue;
+        }
+
+        sample = get_sample(de->d_name);
+        print_page(de->d_name, copy, sample ? sample->copy : NULL, all_pt);
+        printf("\n");
+
+        if (sample) {
+            free(sample->copy);
+            sample->copy = copy;
+        } else {
+            free(copy);
+        }
+
+        found++;
+    }
+
+    closedir(dir);
+
+    return found;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: p4stat [OPTION]... [PID]...\n\n");
+    fprintf(stderr, "  -h           Display this help message and exit\n");
+    fprintf(stderr, "  -i <secs>    Sample every secs seconds\n");
+    fprintf(stderr, "  -n <num>     Stop after num samples (with -i)\n");
+    fprintf(stderr, "  -a           Show all the portals table entries in use\n");
+    fprintf(stderr, "  -c           Remove the pages of dead processes\n");
+}
+
+int main(int argc, char *argv[])
+{
+    double interval = 0;
+    long count = -1;
+    int all_pt = 0;
+    int clean = 0;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "hi:n:ac")) != -1) {
+        switch (ch) {
+            case 'i':
+                interval = strtod(optarg, NULL);
+                break;
+            case 'n':
+                count = strtol(optarg, NULL, 0);
+                break;
+            case 'a':
+                all_pt = 1;
+                break;
+            case 'c':
+                clean = 1;
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (clean) {
+        sample_all(argc - optind, argv + optind, all_pt, 1);
+        return 0;
+    }
+
+    for (;;) {
+        if (!sample_all(argc - optind, argv + optind, all_pt, 0) &&
+            interval <= 0) {
+            fprintf(stderr, "p4stat: no statistics page found "
+                    "(is PTL_STATS=1 set?)\n");
+            return 1;
+        }
+
+        if (interval <= 0 || (count > 0 && --count == 0))
+            break;
+
+        fflush(stdout);
+        usleep(interval * 1e6);
+    }
+
+    return 0;
+}
@@ -0,0 +1,458 @@
+/**
+ * @file p4trace.c
+ *
+ * Analyzer for the state machine traces written by the library when
+ * PTL_STATE_TRACE is set (see ptl_trace.h for the file layout).
+ *
+ * The time spent in a state is the time from entering it to entering
+ * the next state of the same state machine for the same buf, so it
+ * includes the time the buf waited for an external event in that
+ * state. A run of a state machine ends when the buf enters one of
+ * the machine's start states again; the last state of a run has no
+ * duration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_MAGIC	"P4TRACE1"
+
+/* same layout as struct trace_rec in ptl_trace.h */
+struct trace_rec {
+    uint64_t tsc;
+    uint32_t buf;
+    uint8_t machine;
+    uint8_t state;
+    uint16_t pad;
+};
+
+/* a record with the file and thread it came from */
+struct rec {
+    uint64_t tsc;
+    uint32_t buf;
+    uint16_t file;
+    uint16_t tid;
+    uint8_t machine;
+    uint8_t state;
+};
+
+struct machine {
+    char *name;
+    uint32_t start_mask;
+    int num_states;
+    char **state_name;
+};
+
+/* durations of one state, in ticks */
+struct state_stat {
+    uint64_t *val;
+    size_t num;
+    size_t size;
+};
+
+static struct machine *machines;
+static int num_machines;
+
+/* ticks per nanosecond, from the first file */
+static double tick_ns;
+
+static struct rec *recs;
+static size_t num_recs;
+static size_t size_recs;
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (!p) {
+        fprintf(stderr, "p4trace: out of memory\n");
+        exit(1);
+    }
+
+    return p;
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+    p = realloc(p, size);
+    if (!p) {
+        fprintf(stderr, "p4trace: out of memory\n");
+        exit(1);
+    }
+
+    return p;
+}
+
+static void xread(void *p, size_t size, FILE *f, const char *path)
+{
+    if (size && fread(p, size, 1, f) != 1) {
+        fprintf(stderr, "p4trace: %s: truncated trace file\n", path);
+        exit(1);
+    }
+}
+
+static char *read_string(FILE *f, const char *path)
+{
+    uint32_t len;
+    char *s;
+
+    xread(&len, sizeof(len), f, path);
+    s = xmalloc(len + 1);
+    xread(s, len, f, path);
+    s[len] = 0;
+
+    return s;
+}
+
+/* load one trace file and append its records */
+static void load(const char *path, int file)
+{
+    char magic[8];
+    uint64_t stamps[4];
+    uint32_t n, num_rings;
+    FILE *f;
+    int i, j;
+
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+
+    xread(magic, sizeof(magic), f, path);
+    if (memcmp(magic, TRACE_MAGIC, sizeof(magic))) {
+        fprintf(stderr, "p4trace: %s: not a trace file\n", path);
+        exit(1);
+    }
+
+    xread(stamps, sizeof(stamps), f, path);
+    if (file == 0 && stamps[3] > stamps[1])
+        tick_ns = (double)(stamps[2] - stamps[0]) /
+            (double)(stamps[3] - stamps[1]);
+
+    xread(&n, sizeof(n), f, path);
+    if (file == 0) {
+        num_machines = n;
+        machines = xmalloc(n * sizeof(*machines));
+    }
+
+    for (i = 0; i < n; i++) {
+        struct machine m;
+
+        m.name = read_string(f, path);
+        xread(&m.start_mask, sizeof(uint32_t), f, path);
+        xread(&m.num_states, sizeof(uint32_t), f, path);
+        m.state_name = xmalloc(m.num_states * sizeof(char *));
+        for (j = 0; j < m.num_states; j++)
+            m.state_name[j] = read_string(f, path);
+
+        if (file == 0)
+            machines[i] = m;
+    }
+
+    xread(&num_rings, sizeof(num_rings), f, path);
+    for (i = 0; i < num_rings; i++) {
+        uint32_t hdr[2];
+        uint64_t count, k;
+
+        xread(hdr, sizeof(hdr), f, path);
+        xread(&count, sizeof(count), f, path);
+
+        if (num_recs + count > size_recs) {
+            size_recs = 2 * (num_recs + count);
+            recs = xrealloc(recs, size_recs * sizeof(*recs));
+        }
+
+        for (k = 0; k < count; k++) {
+            struct trace_rec tr;
+            struct rec *r = &recs[num_recs++];
+
+            xread(&tr, sizeof(tr), f, path);
+            r->tsc = tr.tsc;
+            r->buf = tr.buf;
+            r->file = file;
+            r->tid = hdr[0];
+            r->machine = tr.machine;
+            r->state = tr.state;
+        }
+    }
+
+    fclose(f);
+}
+
+static int cmp_rec(const void *a, const void *b)
+{
+    const struct rec *r1 = a;
+    const struct rec *r2 = b;
+
+    return (r1->tsc > r2->tsc) - (r1->tsc < r2->tsc);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const uint64_t *v1 = a;
+    const uint64_t *v2 = b;
+
+    return (*v1 > *v2) - (*v1 < *v2);
+}
+
+static const char *state_name(int machine, int state)
+{
+    if (machine >= num_machines)
+        return "?";
+    if (state >= machines[machine].num_states)
+        return "?";
+
+    return machines[machine].state_name[state];
+}
+
+static double to_ns(uint64_t ticks)
+{
+    return tick_ns ? ticks / tick_ns : ticks;
+}
+
+/* key of the message a record belongs to */
+static inline uint64_t rec_key(const struct rec *r)
+{
+    return ((uint64_t)r->file << 40) | ((uint64_t)r->machine << 32) |
+        r->buf;
+}
+
+/* whether r starts a new run of its state machine */
+static int is_start(const struct rec *r)
+{
+    return r->machine < num_machines && r->state < 32 &&
+        (machines[r->machine].start_mask & (1U << r->state));
+}
+
+/*
+ * Link each record to the next record of the same message. Uses an
+ * open addressing table holding the last record seen per message.
+ */
+static void link_recs(size_t *next)
+{
+    size_t size = 16;
+    size_t *last;
+    size_t i;
+
+    while (size < 2 * num_recs)
+        size <<= 1;
+
+    last = xmalloc(size * sizeof(*last));
+    for (i = 0; i < size; i++)
+        last[i] = SIZE_MAX;
+
+    for (i = 0; i < num_recs; i++) {
+        uint64_t key = rec_key(&recs[i]);
+        size_t h = (key * 0x9e3779b97f4a7c15ULL) >> 20;
+
+        next[i] = SIZE_MAX;
+
+        for (h &= size - 1;; h = (h + 1) & (size - 1)) {
+            if (last[h] == SIZE_MAX)
+                break;
+            if (rec_key(&recs[last[h]]) == key) {
+                if (!is_start(&recs[i]))
+                    next[last[h]] = i;
+                break;
+            }
+        }
+
+        last[h] = i;
+    }
+
+    free(last);
+}
+
+static void print_histogram(const struct state_stat *st)
+{
+    size_t bins[64] = { 0 };
+    size_t i, max = 0;
+    int b, lo = 63, hi = 0;
+
+    for (i = 0; i < st->num; i++) {
+        uint64_t ns = to_ns(st->val[i]);
+
+        for (b = 0; ns > 1; b++)
+            ns >>= 1;
+        bins[b]++;
+        if (b < lo)
+            lo = b;
+        if (b > hi)
+            hi = b;
+    }
+
+    for (b = lo; b <= hi; b++)
+        if (bins[b] > max)
+            max = bins[b];
+
+    for (b = lo; b <= hi; b++) {
+        int bar = max ? (int)(bins[b] * 50 / max) : 0;
+
+        printf("      < %10llu ns %10zu ", 2ULL << b, bins[b]);
+        while (bar--)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+static void summary(const size_t *next, int histogram)
+{
+    struct state_stat *stats;
+    int m, s;
+    size_t i;
+
+    /* indexed by machine and state */
+    stats = calloc(num_machines * 256, sizeof(*stats));
+
+    for (i = 0; i < num_recs; i++) {
+        struct state_stat *st;
+
+        if (next[i] == SIZE_MAX || recs[i].machine >= num_machines)
+            continue;
+
+        st = &stats[recs[i].machine * 256 + recs[i].state];
+        if (st->num == st->size) {
+            st->size = st->size ? 2 * st->size : 64;
+            st->val = xrealloc(st->val, st->size * sizeof(uint64_t));
+        }
+        st->val[st->num++] = recs[next[i]].tsc - recs[i].tsc;
+    }
+
+    printf("%-6s %-22s %10s %10s %10s %10s %10s %12s\n", "sm", "state",
+           "count", "mean(ns)", "p50(ns)", "p99(ns)", "max(ns)",
+           "total(us)");
+
+    for (m = 0; m < num_machines; m++) {
+        for (s = 0; s < 256; s++) {
+            struct state_stat *st = &stats[m * 256 + s];
+            uint64_t total = 0;
+
+            if (!st->num)
+                continue;
+
+            qsort(st->val, st->num, sizeof(uint64_t), cmp_u64);
+            for (i = 0; i < st->num; i++)
+                total += st->val[i];
+
+            printf("%-6s %-22s %10zu %10.0f %10.0f %10.0f %10.0f %12.1f\n",
+                   machines[m].name, state_name(m, s), st->num,
+                   to_ns(total) / st->num, to_ns(st->val[st->num / 2]),
+                   to_ns(st->val[st->num * 99 / 100]),
+                   to_ns(st->val[st->num - 1]), to_ns(total) / 1000);
+
+            if (histogram)
+                print_histogram(st);
+
+            free(st->val);
+        }
+    }
+
+    free(stats);
+}
+
+/* print the timeline of the message starting at record i */
+static void timeline(const size_t *next, size_t i)
+{
+    uint64_t start = recs[i].tsc;
+
+    printf("file %d %s buf %08x (tid %d)\n", recs[i].file,
+           recs[i].machine < num_machines ?
+           machines[recs[i].machine].name : "?", recs[i].buf,
+           recs[i].tid);
+
+    for (; i != SIZE_MAX; i = next[i]) {
+        printf("  %+12.0f ns  %-22s", to_ns(recs[i].tsc - start),
+               state_name(recs[i].machine, recs[i].state));
+        if (next[i] != SIZE_MAX)
+            printf(" %10.0f ns", to_ns(recs[next[i]].tsc - recs[i].tsc));
+        printf("\n");
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: p4trace [OPTION]... FILE...\n\n");
+    fprintf(stderr, "  -h           Display this help message and exit\n");
+    fprintf(stderr, "  -H           Add a latency histogram per state\n");
+    fprintf(stderr, "  -t <num>     Print the timelines of the first num messages\n");
+    fprintf(stderr, "  -b <handle>  Print the timelines of the buf with that handle\n");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t *next;
+    size_t *prev_count;
+    size_t i;
+    int histogram = 0;
+    long num_timelines = 0;
+    long buf = -1;
+    int ch;
+    int file;
+
+    while ((ch = getopt(argc, argv, "hHt:b:")) != -1) {
+        switch (ch) {
+            case 'H':
+                histogram = 1;
+                break;
+            case 't':
+                num_timelines = strtol(optarg, NULL, 0);
+                break;
+            case 'b':
+                buf = strtol(optarg, NULL, 16);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (optind == argc) {
+        usage();
+        return 1;
+    }
+
+    for (file = 0; optind < argc; optind++, file++)
+        load(argv[optind], file);
+
+    qsort(recs, num_recs, sizeof(*recs), cmp_rec);
+
+    next = xmalloc((num_recs + 1) * sizeof(*next));
+    link_recs(next);
+
+    printf("%zu records, %.3f ticks/ns\n\n", num_recs, tick_ns);
+
+    if (num_timelines == 0 && buf == -1) {
+        summary(next, histogram);
+        return 0;
+    }
+
+    /* a record is the start of a message if no record points to it */
+    prev_count = calloc(num_recs + 1, sizeof(*prev_count));
+    for (i = 0; i < num_recs; i++)
+        if (next[i] != SIZE_MAX)
+            prev_count[next[i]]++;
+
+    for (i = 0; i < num_recs; i++) {
+        if (prev_count[i])
+            continue;
+
+        if (buf != -1) {
+            if (recs[i].buf == buf)
+                timeline(next, i);
+        } else if (num_timelines-- > 0) {
+            timeline(next, i);
+        }
+    }
+
+    free(prev_count);
+    free(next);
+
+    return 0;
+}
@@ -98,6 +98,12 @@ int buf_init(void *arg, void *parm)
 
     buf->length = 0;
     buf->type = BUF_FREE;
+#if WITH_TRANSPORT_UDP
+    buf->udp_self = 0;
+#endif
+
+    /* The MR slots follow the data area. */
+    buf->mr_list = (mr_t **)(buf->internal_data + BUF_DATA_SIZE);
 
     pthread_mutex_init(&buf->mutex, NULL);
     pthread_cond_init(&buf->cond, NULL);
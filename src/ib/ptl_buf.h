@@ -104,6 +104,11 @@ struct xremote {
 
 #define BUF_DATA_SIZE 1024
 
+/* Number of MR slots of a buf when the IB transport, which can hold
+ * one MR per SGE, is not built in. One per data direction, and one
+ * for an indirect iovec list. */
+#define BUF_MIN_MR_SLOTS 4
+
 /**
  * A buf struct holds information about a common
  * buffer object that is used for sending and receiving
@@ -112,12 +117,17 @@ struct xremote {
  *
  * A buf struct includes room to hold either an OFA
  * verbs send or recv work request or info if it is
- * a shared memory message. It also includes a data buffer that
- * can hold a short message. Additionally there
- * is an array to hold a list of pointers to any memory
+ * a shared memory message. It is followed in its pool object by a
+ * data area (internal_data) that can hold a short message, and by
+ * an array to hold a list of pointers to any memory
  * regions used by the message so that they can be freed after
  * the operation is completed.
  *
+ * The fields used by every message come first, so that processing
+ * a small put or an ack only touches the first few cache lines of
+ * the buf and of its data area. The transport and transfer state,
+ * which only some messages need, is kept after them.
+ *
  * Bufs used by OFA verbs are allocated in a slab that has been
  * registered.
  */
@@ -125,25 +135,53 @@ struct buf {
         /** base object */
     obj_t obj;
 
-    pthread_mutex_t mutex;
-
-        /** enables holding buf on lists */
-    struct list_head list;
+        /** type of buf */
+    buf_type_t type;
 
     unsigned int event_mask;
 
-    ptl_size_t rlength;
-    ptl_size_t roffset;
-    ptl_size_t mlength;
-    ptl_size_t moffset;
+        /** message length */
+    unsigned int length;
+
+        /** recv state */
+    int recv_state;
+
+        /** number of mr's used in message */
+    int num_mr;
+
+#if WITH_TRANSPORT_UDP
+        /** set while processed as a message to self, see
+         * udp_progress_rxq */
+    int udp_self;
+#endif
+
     ptl_ni_fail_t ni_fail;      /* todo: may remove */
     ptl_list_t matching_list;   /* for ptl_list event field */
 
+        /** message (usually internal_data) */
+    void *data;
+
     conn_t *conn;
 
     struct data *data_in;
     struct data *data_out;
 
+        /** mr's used in message, after the data area */
+    mr_t **mr_list;
+
+    ptl_size_t rlength;
+    ptl_size_t roffset;
+    ptl_size_t mlength;
+    ptl_size_t moffset;
+
+        /** enables holding buf on lists */
+    struct list_head list;
+
+    pthread_mutex_t mutex;
+
+        /** remote destination for message */
+    struct xremote dest;
+
     /* Fields only valid during the lifetime of a buffer. */
     union {
         /* Initiator side only. */
@@ -221,24 +259,6 @@ struct buf {
         };
     };
 
-        /** recv state */
-    int recv_state;
-
-        /** remote destination for message */
-    struct xremote dest;
-
-        /** message length */
-    unsigned int length;
-
-        /** message (usually internal_data) */
-    void *data;
-
-        /** data to hold message */
-    uint8_t internal_data[BUF_DATA_SIZE];
-
-        /** type of buf */
-    buf_type_t type;
-
     /* Target only. Must survive through buffer reuse. */
     struct list_head unexpected_list;
     int unexpected_busy;
@@ -332,6 +352,7 @@ struct buf {
 
             /* Local MD/ME/LE */
             ptl_iovec_t *iovecs;
+            const ptl_size_t *iov_offsets;  /* offset index, or NULL */
             ptl_size_t num_iovecs;
             ptl_size_t length_left;
             ptl_size_t offset;
@@ -364,6 +385,8 @@ struct buf {
 
             /* Local MD/ME/LE */
             ptl_iovec_t *iovecs;
+            const ptl_size_t *iov_offsets;  /* or NULL */
+            mr_t **mr_list;     /* NULL if iovecs is already translated */
             ptl_size_t num_iovecs;
             ptl_size_t length_left;
             ptl_size_t offset;
@@ -430,11 +453,8 @@ struct buf {
     ni_t *dest_ni;
 #endif
 
-        /** number of mr's used in message */
-    int num_mr;
-
-        /** mr's used in message */
-    mr_t *mr_list[0];
+        /** data to hold message, BUF_DATA_SIZE bytes */
+    uint8_t internal_data[] __attribute__ ((aligned(64)));
 };
 
 typedef struct buf buf_t;
@@ -451,20 +471,39 @@ int ptl_post_recv(ni_t *ni, int count);
 
 void buf_dump(buf_t *buf);
 
+/**
+ * Compute the number of MR slots of a buf.
+ *
+ * @return number of MRs a buf can hold
+ */
+static inline int buf_mr_slots(void)
+{
+#if WITH_TRANSPORT_IB
+    return get_param(PTL_MAX_QP_SEND_SGE);
+#else
+    return BUF_MIN_MR_SLOTS;
+#endif
+}
+
 /**
  * Compute the actual buf size.
  *
- * Account for room needed to hold MR addresses in the buf_t struct.
+ * Account for the data area and the room needed to hold MR addresses
+ * after the buf_t struct.
  *
  * @return size of buf
  */
 static inline size_t real_buf_t_size(void)
 {
-    int max_sge = get_param(PTL_MAX_QP_SEND_SGE);
-
-    return sizeof(buf_t) + max_sge * sizeof(mr_t *);
+    return sizeof(buf_t) + BUF_DATA_SIZE + buf_mr_slots() * sizeof(mr_t *);
 }
 
+#if WITH_TRANSPORT_UDP
+/* A buf with its data area, which the UDP transport puts on the
+ * wire. */
+#define UDP_BUF_SIZE (sizeof(buf_t) + BUF_DATA_SIZE)
+#endif
+
 /**
  * Allocate a buf from the normal buf pool.
  *
@@ -586,6 +625,13 @@ static inline void set_buf_dest(buf_t *buf, conn_t *connect)
             //buf->dest.udp.dest_addr = &connect->sin;
             break;
 #endif
+
+#if WITH_TRANSPORT_LOOP
+        case CONN_TYPE_LOOP:
+            /* Nothing to set: the destination NI is kept in the
+             * connection (conn->loop.dest_ni). */
+            break;
+#endif
     }
 }
 
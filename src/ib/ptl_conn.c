@@ -48,8 +48,8 @@ int conn_init(void *arg, void *parm)
 #endif
 
 #if WITH_TRANSPORT_UDP
-    /* Set udp as the transport. */
-    conn->transport = transport_udp;
+    /* Set udp as the transport, over TCP streams with PTL_TCP. */
+    conn->transport = get_param(PTL_TCP) ? transport_tcp : transport_udp;
 
 #if WITH_RUDP
     atomic_set(&conn->udp.send_seq_num, 1);
@@ -62,6 +62,12 @@ int conn_init(void *arg, void *parm)
 
 #endif
 
+#if WITH_TRANSPORT_SHMEM && !WITH_TRANSPORT_IB && !WITH_TRANSPORT_UDP
+    /* No network transport. */
+    conn->transport = transport_shmem;
+    conn->shmem.local_rank = -1;
+#endif
+
 #if WITH_TRANSPORT_IB || WITH_TRANSPORT_UDP
     pthread_cond_init(&conn->move_wait, NULL);
 #endif
@@ -102,24 +108,285 @@ void conn_fini(void *arg)
 #endif
 }
 
-static int compare_conn_id(const void *a, const void *b)
+/*
+ * Connections of a physical NI are kept in an open addressing hash
+ * table keyed by nid/pid. Lookups don't take any lock. Inserts are
+ * serialized by ni->physical.lock and publish the new conn with a
+ * single pointer store. When the table gets half full it is replaced
+ * by a table twice as large; the old one may still be walked by a
+ * reader so it is only freed with the NI.
+ */
+struct conn_hash {
+    unsigned int mask;          /* number of slots - 1 */
+    unsigned int num_conns;
+    struct conn_hash *old;      /* previous (smaller) table */
+    conn_t *volatile slot[];
+};
+
+/* initial number of slots of a physical NI hash table */
+#define CONN_HASH_MIN_SIZE	(64)
+
+static inline unsigned int conn_hash_id(ptl_process_t id)
+{
+    uint64_t key = ((uint64_t)id.phys.nid << 32) | id.phys.pid;
+
+    return (key * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+/**
+ * Find the connection to a process on a physical NI.
+ *
+ * @param[in] ni the physical NI
+ * @param[in] id the process ID to lookup
+ *
+ * @return the conn_t or NULL, without taking a reference
+ */
+static conn_t *lookup_phys_conn(ni_t *ni, ptl_process_t id)
+{
+    const struct conn_hash *hash = ni->physical.conn_hash;
+    unsigned int i;
+
+    if (!hash)
+        return NULL;
+
+    for (i = conn_hash_id(id) & hash->mask;; i = (i + 1) & hash->mask) {
+        conn_t *conn = hash->slot[i];
+
+        if (!conn)
+            return NULL;
+
+        if (conn->id.phys.nid == id.phys.nid &&
+            conn->id.phys.pid == id.phys.pid)
+            return conn;
+    }
+}
+
+/* insert conn in a table that has a free slot. */
+static void conn_hash_insert(struct conn_hash *hash, conn_t *conn)
+{
+    unsigned int i = conn_hash_id(conn->id) & hash->mask;
+
+    while (hash->slot[i])
+        i = (i + 1) & hash->mask;
+
+    /* conn must be complete before readers can see it */
+    __sync_synchronize();
+    hash->slot[i] = conn;
+    hash->num_conns++;
+}
+
+/**
+ * Make room for one more connection in the hash table of a physical
+ * NI.
+ *
+ * @pre caller holds ni->physical.lock
+ *
+ * @param[in] ni the physical NI
+ *
+ * @return status
+ */
+static int conn_hash_reserve(ni_t *ni)
+{
+    struct conn_hash *old = ni->physical.conn_hash;
+    struct conn_hash *hash;
+    unsigned int size;
+    unsigned int i;
+
+    if (old && 2 * (old->num_conns + 1) <= old->mask + 1)
+        return PTL_OK;
+
+    size = old ? 2 * (old->mask + 1) : CONN_HASH_MIN_SIZE;
+
+    hash = calloc(1, sizeof(*hash) + size * sizeof(conn_t *));
+    if (!hash)
+        return PTL_NO_SPACE;
+
+    hash->mask = size - 1;
+    hash->old = old;
+
+    if (old) {
+        for (i = 0; i <= old->mask; i++) {
+            if (old->slot[i])
+                conn_hash_insert(hash, old->slot[i]);
+        }
+    }
+
+    __sync_synchronize();
+    ni->physical.conn_hash = hash;
+
+    return PTL_OK;
+}
+
+/**
+ * Prebuild the request header of a new connection.
+ *
+ * The move APIs start each request from it, and only set what
+ * depends on the call.
+ *
+ * @param[in] ni the NI that owns the connection
+ * @param[in] conn the new connection
+ */
+static void init_req_tmpl(ni_t *ni, conn_t *conn)
 {
-    const conn_t *c1 = a;
-    const conn_t *c2 = b;
+    req_hdr_t *hdr = &conn->req_tmpl;
+
+    memset(hdr, 0, sizeof(*hdr));
 
-    return compare_id(&c1->id, &c2->id);
+    hdr->h1.version = PTL_HDR_VER_2;
+    hdr->h1.ni_type = ni->ni_type;
+    hdr->h1.pkt_fmt = PKT_FMT_REQ;
+    hdr->h1.physical = !!(ni->options & PTL_NI_PHYSICAL);
+    hdr->h1.src_nid = cpu_to_le32(ni->id.phys.nid);
+    hdr->h1.src_pid = cpu_to_le32(ni->id.phys.pid);
+    hdr->uid = cpu_to_le32(ni->uid);
+}
+
+/**
+ * Allocate the connection to a process of a physical NI and insert
+ * it in the hash table.
+ *
+ * @param[in] ni the physical NI
+ * @param[in] id the remote process
+ *
+ * @return the conn_t in the table, without taking a reference
+ */
+static conn_t *new_phys_conn(ni_t *ni, ptl_process_t id)
+{
+    conn_t *conn;
+
+    PTL_FASTLOCK_LOCK(&ni->physical.lock);
+
+    /* Another thread may have inserted it while we waited. */
+    conn = lookup_phys_conn(ni, id);
+    if (conn)
+        goto done;
+
+    if (conn_hash_reserve(ni)) {
+        WARN();
+        goto done;
+    }
+
+    if (conn_alloc(ni, &conn)) {
+        WARN();
+        conn = NULL;
+        goto done;
+    }
+
+    conn->id = id;
+    init_req_tmpl(ni, conn);
+
+#if WITH_TRANSPORT_LOOP
+    /* A process in this one is reached through memory queues. */
+    if (loop_connect(ni, conn, id) == PTL_OK)
+        goto connected;
+#endif
+
+#if IS_PPE || WITH_TRANSPORT_SHMEM
+    //need to connect local processes over shared memory
+    if (id.phys.nid == ni->iface->id.phys.nid) {
+        if (get_param(PTL_ENABLE_MEM)) {
+#if IS_PPE
+            conn->transport = transport_mem;
+            conn->state = CONN_STATE_CONNECTED;
+#elif WITH_TRANSPORT_SHMEM
+            /* Only the processes registered in the node directory
+             * share our comm pad. The others are reached with the
+             * network transport. */
+            conn->shmem.local_rank =
+                shmem_phys_lookup(ni, id, &conn->shmem.gen);
+            if (conn->shmem.local_rank != -1) {
+                conn->transport = transport_shmem;
+                conn->state = CONN_STATE_CONNECTED;
+            }
+#endif
+        }
+    }
+#endif
+
+#if WITH_TRANSPORT_LOOP
+  connected:
+#endif
+    /* Get the IP address from the NID. */
+    conn->sin.sin_family = AF_INET;
+    conn->sin.sin_addr.s_addr = nid_to_addr(id.phys.nid);
+    conn->sin.sin_port = pid_to_port(id.phys.pid);
+
+    conn_hash_insert(ni->physical.conn_hash, conn);
+
+  done:
+    PTL_FASTLOCK_UNLOCK(&ni->physical.lock);
+
+    return conn;
+}
+
+/* Last peer looked up on a physical NI by this thread, for
+ * ping-pong style traffic. The NI handle is checked along with its
+ * address since it changes when the ni_t is recycled. */
+static __thread struct {
+    const ni_t *ni;
+    ptl_handle_ni_t ni_handle;
+    ptl_process_t id;
+    conn_t *conn;
+} last_peer;
+
+/**
+ * Allocate the connection to a rank of a logical NI and publish it
+ * in the rank table.
+ *
+ * @param[in] ni the logical NI
+ * @param[in] rank the remote rank
+ *
+ * @return the conn_t in the rank table, without taking a reference
+ */
+static conn_t *new_logical_conn(ni_t *ni, ptl_rank_t rank)
+{
+    conn_t *conn;
+    conn_t *cur;
+    ptl_process_t id;
+
+    if (conn_alloc(ni, &conn)) {
+        WARN();
+        return NULL;
+    }
+
+    init_req_tmpl(ni, conn);
+
+    /* convert nid/pid to ipv4 address */
+    rank_to_phys(ni, rank, &id);
+    conn->sin.sin_family = AF_INET;
+    conn->sin.sin_addr.s_addr = nid_to_addr(id.phys.nid);
+    conn->sin.sin_port = pid_to_port(id.phys.pid);
+
+#if WITH_TRANSPORT_LOOP
+    loop_connect(ni, conn, id);
+#endif
+
+#if WITH_TRANSPORT_UDP
+    if (conn->transport.type == CONN_TYPE_UDP)
+        conn->udp.dest_addr = conn->sin;
+#endif
+
+    cur = __sync_val_compare_and_swap(&ni->logical.conn_table[rank],
+                                      NULL, conn);
+    if (cur) {
+        /* lost the race */
+        conn_put(conn);
+        conn = cur;
+    }
+
+    return conn;
 }
 
 /**
  * Get connection info for a given process id.
  *
  * For logical NIs the connection is contained in the rank table.
- * For physical NIs the connection is held in a binary tree using
- * the ID as a sorting value.
+ * For physical NIs the connection is held in a hash table using
+ * the ID as the key.
  *
- * For physical NIs if this is the first time we are sending a message
- * to this process create a new conn_t. For logical NIs the conn_t
- * structs are all allocated when the rank table is loaded.
+ * In both cases, if this is the first time we are talking to this
+ * process create a new conn_t. Looking up an existing connection
+ * doesn't take any lock.
  *
  * @param[in] ni the NI from which to get the connection
  * @param[in] id the process ID to lookup
@@ -129,7 +396,6 @@ static int compare_conn_id(const void *a, const void *b)
 conn_t *get_conn(ni_t *ni, ptl_process_t id)
 {
     conn_t *conn;
-    void **ret;
 
     if (ni->options & PTL_NI_LOGICAL) {
         if (unlikely(id.rank >= ni->logical.map_size)) {
@@ -138,61 +404,35 @@ conn_t *get_conn(ni_t *ni, ptl_process_t id)
             return NULL;
         }
 
-        conn = ni->logical.rank_table[id.rank].connect;
-        conn_get(conn);
+        conn = ni->logical.conn_table[id.rank];
+        if (unlikely(!conn)) {
+            conn = new_logical_conn(ni, id.rank);
+            if (!conn)
+                return NULL;
+        }
     } else {
-        conn_t conn_search;
-
-        PTL_FASTLOCK_LOCK(&ni->physical.lock);
-
-        /* lookup in binary tree */
-        conn_search.id = id;
-        ret = tfind(&conn_search, &ni->physical.tree, compare_conn_id);
-        if (ret) {
-            conn = *ret;
-            conn_get(conn);
+        if (last_peer.ni == ni &&
+            last_peer.ni_handle == ni_to_handle(ni) &&
+            last_peer.id.phys.nid == id.phys.nid &&
+            last_peer.id.phys.pid == id.phys.pid) {
+            conn = last_peer.conn;
         } else {
-            /* Not found. Allocate and insert. */
-            if (conn_alloc(ni, &conn)) {
-                PTL_FASTLOCK_UNLOCK(&ni->physical.lock);
-                WARN();
-                return NULL;
-            }
-#if IS_PPE || WITH_TRANSPORT_SHMEM
-            //need to connect local processes over shared memory
-            if (conn->id.phys.nid == ni->iface->id.phys.nid) {
-                if (get_param(PTL_ENABLE_MEM)) {
-#if IS_PPE
-                    conn->transport = transport_mem;
-#elif WITH_TRANSPORT_SHMEM
-                    conn->transport = transport_shmem;
-#endif
-                    conn->state = CONN_STATE_CONNECTED;
-                }
+            conn = lookup_phys_conn(ni, id);
+            if (unlikely(!conn)) {
+                conn = new_phys_conn(ni, id);
+                if (!conn)
+                    return NULL;
             }
-#endif
 
-            conn->id = id;
-
-            /* Get the IP address from the NID. */
-            conn->sin.sin_family = AF_INET;
-            conn->sin.sin_addr.s_addr = nid_to_addr(id.phys.nid);
-            conn->sin.sin_port = pid_to_port(id.phys.pid);
-
-            /* insert new conn into binary tree */
-            ret = tsearch(conn, &ni->physical.tree, compare_conn_id);
-            if (!ret) {
-                WARN();
-                conn_put(conn);
-                conn = NULL;
-            } else {
-                conn_get(conn);
-            }
+            last_peer.ni = ni;
+            last_peer.ni_handle = ni_to_handle(ni);
+            last_peer.id = id;
+            last_peer.conn = conn;
         }
-
-        PTL_FASTLOCK_UNLOCK(&ni->physical.lock);
     }
 
+    conn_get(conn);
+
     return conn;
 }
 
@@ -224,7 +464,7 @@ static int send_disconnect_msg(ni_t *ni, conn_t *conn)
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_RDMA_DISC;
-    hdr->h1.version = PTL_HDR_VER_1;
+    hdr->h1.version = PTL_HDR_VER_2;
     hdr->h1.ni_type = conn->obj.obj_ni->ni_type;
     hdr->h1.src_nid = cpu_to_le32(ni->id.phys.nid);
     hdr->h1.src_pid = cpu_to_le32(ni->id.phys.pid);
@@ -264,17 +504,6 @@ static void initiate_disconnect_one(conn_t *conn)
     pthread_mutex_unlock(&conn->mutex);
 }
 
-static void initiate_disconnect_one_twalk(const void *data, const VISIT which,
-                                          const int depth)
-{
-    conn_t *conn = *(conn_t **)data;
-
-    if (which != leaf && which != postorder)
-        return;
-
-    initiate_disconnect_one(conn);
-}
-
 /* When an application destroy an NI, it cannot just close its
  * connections because there might be some packets in flight. So it
  * just informs the remote sides that it is ready to shutdown. */
@@ -286,12 +515,19 @@ void initiate_disconnect_all(ni_t *ni)
 
         /* Send a disconnect message. */
         for (i = 0; i < map_size; i++) {
-            conn_t *conn = ni->logical.rank_table[i].connect;
+            conn_t *conn = ni->logical.conn_table[i];
 
-            initiate_disconnect_one(conn);
+            if (conn)
+                initiate_disconnect_one(conn);
+        }
+    } else if (ni->physical.conn_hash) {
+        struct conn_hash *hash = ni->physical.conn_hash;
+        unsigned int i;
+
+        for (i = 0; i <= hash->mask; i++) {
+            if (hash->slot[i])
+                initiate_disconnect_one(hash->slot[i]);
         }
-    } else {
-        twalk(ni->physical.tree, initiate_disconnect_one_twalk);
     }
 }
 
@@ -339,6 +575,14 @@ static void destroy_conn(void *data)
         }
     }
 #endif
+
+#if WITH_TRANSPORT_LOOP
+    if (conn->transport.type == CONN_TYPE_LOOP) {
+        ni_put(conn->loop.dest_ni);
+        conn->loop.dest_ni = NULL;
+    }
+#endif
+
     conn_put(conn);
 }
 
@@ -348,27 +592,37 @@ static void destroy_conn(void *data)
 void destroy_conns(ni_t *ni)
 {
     if (ni->options & PTL_NI_LOGICAL) {
-        if (ni->logical.mapping) {
+        if (ni->logical.conn_table) {
             int i;
             const int map_size = ni->logical.map_size;
 
             /* Destroy active connections. */
             for (i = 0; i < map_size; i++) {
-                entry_t *entry = &ni->logical.rank_table[i];
-                destroy_conn(entry->connect);
-                entry->connect = NULL;
+                conn_t *conn = ni->logical.conn_table[i];
+
+                if (conn) {
+                    destroy_conn(conn);
+                    ni->logical.conn_table[i] = NULL;
+                }
             }
         }
-    } else {
-#ifdef HAVE_TDESTROY
-        tdestroy(ni->physical.tree, destroy_conn);
-#else
-        while (ni->physical.tree != NULL) {
-            destroy_conn(*(void **)ni->physical.tree);
-            tdelete(*(void **)ni->physical.tree, &ni->physical.tree,
-                    compare_conn_id);
+    } else if (ni->physical.conn_hash) {
+        struct conn_hash *hash = ni->physical.conn_hash;
+        unsigned int i;
+
+        for (i = 0; i <= hash->mask; i++) {
+            if (hash->slot[i])
+                destroy_conn(hash->slot[i]);
         }
-#endif
+
+        /* free the current table and the ones it replaced */
+        while (hash) {
+            struct conn_hash *old = hash->old;
+
+            free(hash);
+            hash = old;
+        }
+        ni->physical.conn_hash = NULL;
     }
 }
 
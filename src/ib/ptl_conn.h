@@ -36,6 +36,9 @@ enum transport_type {
 #if WITH_TRANSPORT_UDP
     CONN_TYPE_UDP,
 #endif
+#if WITH_TRANSPORT_LOOP
+    CONN_TYPE_LOOP,
+#endif
 };
 
 struct md;
@@ -79,7 +82,9 @@ struct transport {
 
 extern struct transport transport_rdma;
 extern struct transport transport_udp;
+extern struct transport transport_tcp;
 extern struct transport transport_shmem;
+extern struct transport transport_loop;
 
 /**
  * Per connection information.
@@ -95,6 +100,10 @@ struct conn {
 
     struct transport transport;
 
+    /* Header of the requests to this peer, with the fields that are
+     * the same for all of them set. */
+    req_hdr_t req_tmpl;
+
     union {
 #if WITH_TRANSPORT_IB
         struct {
@@ -146,6 +155,7 @@ struct conn {
 #if WITH_TRANSPORT_SHMEM
         struct {
             ptl_rank_t local_rank;  /* local rank on that node. */
+            unsigned int gen;   /* of its directory slot, if physical */
         } shmem;
 #endif
 
@@ -162,6 +172,12 @@ struct conn {
 #endif
         } udp;
 #endif
+
+#if WITH_TRANSPORT_LOOP
+        struct {
+            struct ni *dest_ni; /* NI of this process, with a reference */
+        } loop;
+#endif
     };
 
 #if WITH_TRANSPORT_IB || WITH_TRANSPORT_UDP
@@ -269,6 +285,35 @@ struct udp_conn_msg {
         struct cm_priv_reject rej;
     };
 };
+
+/* Header of a message on the UDP wire. It is followed by a
+ * udp_conn_msg for a connection message, then by the message itself
+ * (the portals header and any inline data) and, for a large message,
+ * by a fragment of its data. Messages in a packed datagram each have
+ * their own header and are padded to 8 bytes. */
+struct udp_hdr {
+    uint8_t flags;
+#define UDP_HDR_PACKED  1       /* in a datagram packing several messages */
+#define UDP_HDR_CONN    2       /* followed by a udp_conn_msg */
+#define UDP_HDR_FRAG    4       /* the message is followed by data */
+#define UDP_HDR_HELLO   8       /* opens a TCP stream, see ptl_tcp.c */
+    uint8_t type;               /* buf type, for the RUDP acks */
+    __le16 frag_seq;            /* fragment number of a large message */
+    __le32 length;              /* of the message */
+    __le64 rlength;             /* of the data */
+    __le32 seq_num;             /* RUDP sequence number */
+    __le32 frag_offset;         /* of the fragment in the data */
+    uint8_t stripe;             /* picks the receive socket, see
+                                 * udp_stripe() and udp_socks_init() */
+    uint8_t pad[7];             /* no implicit padding on the wire */
+};
+
+/* The message in a wire image. */
+static inline void *udp_wire_msg(const struct udp_hdr *hdr)
+{
+    return (unsigned char *)(hdr + 1) +
+        ((hdr->flags & UDP_HDR_CONN) ? sizeof(struct udp_conn_msg) : 0);
+}
 #endif
 
 /**
@@ -1051,3 +1051,21 @@ void make_ct_event(ct_t *ct, buf_t *buf, enum ct_bytes bytes)
     if (atomic_read(&ct->list_size))
         ct_check(ct);
 }
+
+#if IS_PPE
+/**
+ * @brief Count a failure on a counting event.
+ *
+ * Used by the PPE for the operations a client submitted without
+ * waiting for their return code.
+ *
+ * @param[in] ct The counting event to update.
+ */
+void make_ct_failure(ct_t *ct)
+{
+    (void)__sync_add_and_fetch(&ct->info.event.failure, 1);
+
+    if (atomic_read(&ct->list_size))
+        ct_check(ct);
+}
+#endif
@@ -60,6 +60,10 @@ void post_ct_local(struct buf *buf, ct_t *ct);
 
 void make_ct_event(ct_t *ct, struct buf *buf, enum ct_bytes bytes);
 
+#if IS_PPE
+void make_ct_failure(ct_t *ct);
+#endif
+
 /**
  * Allocate a new ct object.
  *
@@ -70,6 +70,11 @@ int data_size(data_t *data)
             break;
 #endif
 
+#if WITH_TRANSPORT_LOOP
+        case DATA_FMT_LOOP:
+            break;
+#endif
+
         default:
             abort();
             break;
@@ -85,13 +90,15 @@ int data_size(data_t *data)
  * that can be sent as immediate inline data.
  *
  * @param[in] me the me or le that contains the data
+ * @param[in] iov_offsets the offset index of its iovecs, if any
  * @param[in] offset the offset into the me of the data
  * @param[in] length the length of the data
  * @param[in] buf the buf to add the data segment to
  *
  * @return status
  */
-int append_immediate_data(void *start, mr_t **mr_list, int num_iov,
+int append_immediate_data(void *start, const ptl_size_t *iov_offsets,
+                          mr_t **mr_list, int num_iov,
                           data_dir_t dir, ptl_size_t offset,
                           ptl_size_t length, buf_t *buf)
 {
@@ -108,8 +115,8 @@ int append_immediate_data(void *start, mr_t **mr_list, int num_iov,
 
         if (num_iov) {
             err =
-                iov_copy_out(data->immediate.data, start, mr_list, num_iov,
-                             offset, length);
+                iov_copy_out(data->immediate.data, start, iov_offsets,
+                             mr_list, num_iov, offset, length);
             if (err) {
                 WARN();
                 return err;
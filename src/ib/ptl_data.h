@@ -40,6 +40,10 @@ enum data_fmt {
     DATA_FMT_MEM_DMA,
     DATA_FMT_MEM_INDIRECT,
 #endif
+
+#if WITH_TRANSPORT_LOOP
+    DATA_FMT_LOOP,
+#endif
 };
 
 typedef enum data_fmt data_fmt_t;
@@ -132,6 +136,17 @@ struct data {
             int target_done;
         } udp;
 #endif
+
+#if WITH_TRANSPORT_LOOP
+        /* Initiator memory, accessed in place by the target since
+         * both are in the same process. */
+        struct {
+            void *start;        /* address, or ptl_iovec_t array */
+            const ptl_size_t *iov_offsets;
+            ptl_size_t num_iov; /* 0 if not an iovec */
+            ptl_size_t offset;
+        } loop;
+#endif
     };
 } __attribute__ ((__packed__));
 
@@ -141,7 +156,8 @@ struct mr;
 
 int data_size(data_t *data);
 
-int append_immediate_data(void *start, struct mr **mr_list, int num_iov,
+int append_immediate_data(void *start, const ptl_size_t *iov_offsets,
+                          struct mr **mr_list, int num_iov,
                           data_dir_t dir, ptl_size_t offset,
                           ptl_size_t length, struct buf *buf);
 
@@ -19,6 +19,7 @@ int eq_new(void *arg)
     eq_t *eq = arg;
 
     INIT_LIST_HEAD(&eq->flowctrl_list);
+    INIT_LIST_HEAD(&eq->list);
 
     return PTL_OK;
 }
@@ -33,6 +34,14 @@ int eq_new(void *arg)
 void eq_cleanup(void *arg)
 {
     eq_t *eq = arg;
+    ni_t *ni = obj_to_ni(eq);
+
+    /* remove ourselves from ni->eq_list */
+    if (!list_empty(&eq->list)) {
+        PTL_FASTLOCK_LOCK(&ni->eq_list_lock);
+        list_del_init(&eq->list);
+        PTL_FASTLOCK_UNLOCK(&ni->eq_list_lock);
+    }
 
     if (eq->eqe_list) {
         PTL_FASTLOCK_DESTROY(&eq->eqe_list->lock);
@@ -151,6 +160,10 @@ int _PtlEQAlloc(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t count,
 
 #endif
 
+    PTL_FASTLOCK_LOCK(&ni->eq_list_lock);
+    list_add(&eq->list, &ni->eq_list);
+    PTL_FASTLOCK_UNLOCK(&ni->eq_list_lock);
+
     *eq_handle_p = eq_to_handle(eq);
 
     err = PTL_OK;
@@ -641,3 +654,38 @@ void make_le_event(le_t *restrict le, eq_t *restrict eq,
 
     check_waiter(eq->eqe_list);
 }
+
+#if IS_PPE
+/**
+ * @brief Add a failed event to the event queue for an operation that
+ * never started.
+ *
+ * Used by the PPE for the operations a client submitted without
+ * waiting for their return code.
+ *
+ * @param[in] eq The event queue to add the event to.
+ * @param[in] type The event type.
+ * @param[in] user_ptr The user pointer of the operation.
+ * @param[in] fail_type The NI fail type.
+ */
+void make_error_event(eq_t *restrict eq, ptl_event_kind_t type,
+                      void *user_ptr, ptl_ni_fail_t fail_type)
+{
+    ptl_event_t *ev;
+
+    PTL_FASTLOCK_LOCK(&eq->eqe_list->lock);
+
+    ev = reserve_ev(eq);
+    ev->type = type;
+    ev->user_ptr = user_ptr;
+    ev->ni_fail_type = fail_type;
+    ev->mlength = 0;
+
+    if (eq->overflowing)
+        process_overflowing(eq);
+
+    PTL_FASTLOCK_UNLOCK(&eq->eqe_list->lock);
+
+    check_waiter(eq->eqe_list);
+}
+#endif
@@ -23,6 +23,9 @@ struct eq {
 
         /** to attach the PTs supporting flow control. **/
     struct list_head flowctrl_list;
+
+        /** list member of allocated event queues */
+    struct list_head list;
     int overflowing;            /* the queue is overflowing */
 
 #if IS_PPE
@@ -52,6 +55,11 @@ void make_target_event(buf_t *buf, eq_t *eq, ptl_event_kind_t type,
 void make_le_event(le_t *le, eq_t *eq, ptl_event_kind_t type,
                    ptl_ni_fail_t fail_type);
 
+#if IS_PPE
+void make_error_event(eq_t *eq, ptl_event_kind_t type, void *user_ptr,
+                      ptl_ni_fail_t fail_type);
+#endif
+
 /**
  * Allocate a new eq object.
  *
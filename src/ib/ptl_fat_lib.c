@@ -193,15 +193,17 @@ static void dump_everything(int unused)
             if (ni->options & PTL_NI_LOGICAL) {
                 printf("  Connections on logical NI:\n");
 
-                if (ni->logical.rank_table) {
+                if (ni->logical.conn_table) {
                     for (k = 0; k < ni->logical.map_size; k++) {
-                        struct rank_entry *entry = &ni->logical.rank_table[k];
-                        printf("    rank            = %d\n", entry->rank);
+                        conn_t *conn = ni->logical.conn_table[k];
+
+                        if (!conn)
+                            continue;
+                        printf("    rank            = %d\n", k);
                         printf("    max pending wr  = %d\n",
-                               entry->connect->rdma.max_req_avail);
+                               conn->rdma.max_req_avail);
                         printf("    pending send wr = %d\n",
-                               atomic_read(&entry->connect->
-                                           rdma.num_req_posted));
+                               atomic_read(&conn->rdma.num_req_posted));
                     }
                 }
             }
@@ -5,6 +5,8 @@
 #ifndef PTL_GBL_H
 #define PTL_GBL_H
 
+#include "ptl_locks.h"
+
 struct ni;
 struct iface;
 
@@ -32,14 +34,16 @@ typedef struct gbl {
 
     atomic_t next_index;
     void **index_map;
+    unsigned int index_free;    /* head of recycled index list */
+    PTL_FASTLOCK_TYPE index_lock;
 
     /* PPE specific. */
 
     /* Mapping of the whole process. */
     xpmem_apid_t apid;
 
-    /* Number of the progress thread assigned to this client. */
-    unsigned int prog_thread;
+    /* Number of the shard assigned to this client. */
+    unsigned int shard;
 } gbl_t;
 
 static inline int gbl_get(void)
@@ -51,6 +55,11 @@ static inline void gbl_put(void)
 {
 }
 
+static inline int gbl_borrow(void)
+{
+    return PTL_OK;
+}
+
 #define PPEGBL struct gbl *gbl,
 #define MYGBL gbl
 #define MYGBL_ gbl,
@@ -86,6 +95,8 @@ typedef struct gbl {
 
     atomic_t next_index;
     void **index_map;
+    unsigned int index_free;    /* head of recycled index list */
+    PTL_FASTLOCK_TYPE index_lock;
 } gbl_t;
 
 extern gbl_t per_proc_gbl;
@@ -135,6 +146,27 @@ static inline void gbl_put(void)
 #endif
 }
 
+/*
+ * gbl_borrow()
+ *	check that the per process global state is initialized, without
+ *	taking a reference. The data movement calls borrow the reference
+ *	held since PtlInit() instead of taking one of their own, since
+ *	PtlFini() must not run concurrently with them. There is no
+ *	matching gbl_put().
+ *
+ * Return Value
+ *	PTL_OK			success
+ *	PTL_NO_INIT		failure, per_proc_gbl is not in init state
+ */
+static inline int gbl_borrow(void)
+{
+#ifndef NO_ARG_VALIDATION
+    if (unlikely(per_proc_gbl.ref_cnt == 0))
+        return PTL_NO_INIT;
+#endif
+    return PTL_OK;
+}
+
 #endif
 
 struct ni *gbl_lookup_ni(gbl_t *gbl, ptl_interface_t iface, int ni_type);
@@ -14,7 +14,9 @@
  *	packed some unrelated info into the first word
  */
 
-#define PTL_HDR_VER_1		(1)
+/* Version 2 moved pt_index up in req_hdr for the compact header.
+ * Messages of another version are dropped. */
+#define PTL_HDR_VER_2		(2)
 
 /* note: please keep all init->target before all tgt->init */
 enum hdr_op {
@@ -89,19 +91,41 @@ typedef struct req_hdr {
     unsigned int ack_req:4;
     unsigned int atom_type:4;
     unsigned int atom_op:5;
-    unsigned int reserved_19:19;
+    unsigned int compact:1;     /* sent as a compact header */
+    unsigned int fields:9;      /* compact only, see below */
+    unsigned int reserved_23:9;
+    __le32 pt_index;
     __le64 rlength;
     __le64 roffset;
     __le64 match_bits;
     __le64 hdr_data;
-    __le32 pt_index;
     __le32 uid;
-#if WITH_TRANSPORT_UDP
-    unsigned int udp_is_large:1;
-    unsigned int fragment_seq:8;
-#endif
 } req_hdr_t;
 
+/*
+ * A request is sent with a compact header when that is shorter, as
+ * it is for most small messages. The compact header is req_hdr up to
+ * pt_index, followed by those of rlength, roffset, match_bits,
+ * hdr_data and uid which are not 0, in that order, on 4 bytes when
+ * they fit, as told by fields. It is padded to 8 bytes, and expanded
+ * back in place by the target.
+ */
+#define REQ_HDR_FIXED	(offsetof(struct req_hdr, pt_index) + sizeof(__le32))
+
+/* Width of a 64 bits field of a compact header. */
+enum hdr_field_width {
+    HDR_FIELD_NONE,             /* left out, 0 */
+    HDR_FIELD_32,
+    HDR_FIELD_64,
+};
+
+/* Position of the widths in req_hdr.fields. uid is present or not. */
+#define HDR_FIELD_RLENGTH	(0)
+#define HDR_FIELD_ROFFSET	(2)
+#define HDR_FIELD_MATCH_BITS	(4)
+#define HDR_FIELD_HDR_DATA	(6)
+#define HDR_FIELD_UID		(8)
+
 /* Header for an ack or a reply. */
 typedef struct ack_hdr {
     struct hdr_common h1;
@@ -160,6 +160,9 @@ int init_iface_table(gbl_t *gbl)
 
 
         gbl->iface[i].udp.connect_s = -1;
+        gbl->iface[i].udp.num_s = 0;
+        gbl->iface[i].udp.tcp_s = -1;
+        INIT_LIST_HEAD(&gbl->iface[i].udp.tcp_accepted);
 #endif
 
     }
@@ -13,6 +13,9 @@ struct gbl;
 /** @brief Size of ni table per iface */
 #define MAX_NI_TYPES		(4)
 
+/** @brief Most UDP sockets per iface, see PTL_UDP_SOCKETS */
+#define UDP_SOCKS_MAX		(16)
+
 /**
  * @brief Per network interface information.
  */
@@ -60,12 +63,44 @@ struct iface {
         /* Endpoint for connections handling. */
         int connect_s;
 
+                /** Receive sockets sharing the port of connect_s
+                 * through SO_REUSEPORT, s[0] being connect_s */
+        int s[UDP_SOCKS_MAX];
+
+                /** Number of receive sockets */
+        int num_s;
+
                 /** IPV4 address of this interface */
         struct sockaddr_in sin;
 
+                /** MTU of the network device, 0 if unknown */
+        int mtu;
+
+                /** Datagram size for UDP_SEGMENT, 0 if not used */
+        int gso_size;
+
+                /** Set if UDP_GRO is enabled on connect_s */
+        int gro;
+
+#if WITH_UDP_URING
+                /** io_uring driving each socket, NULL if not used;
+                 * sends go through uring[0] */
+        struct uring *uring[UDP_SOCKS_MAX];
+
+                /** Set to send large messages with SENDMSG_ZC */
+        int zc;
+#endif
+
+                /** Listening TCP socket on the port of connect_s,
+                 * -1 unless PTL_TCP is set */
+        int tcp_s;
+
                 /** Libev handler for incoming connections. */
         ev_io watcher;
 
+                /** Accepted TCP streams waiting for their hello */
+        struct list_head tcp_accepted;
+
         /* Reference counter for number of attached NIs */
         /* Used to determine when to close the shared */
         /* connection socket */
@@ -37,6 +37,105 @@ static in_addr_t get_ip_address(const char *ifname)
     return addr;
 }
 
+/**
+ * @brief Get the MTU of a network device.
+ *
+ * @param[in] ifname The network interface name to use
+ *
+ * @return the MTU, or 0 on error
+ */
+static int get_mtu(const char *ifname)
+{
+    int fd;
+    struct ifreq devinfo;
+    int mtu;
+
+    fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (fd < 0)
+        return 0;
+
+    strncpy(devinfo.ifr_name, ifname, IFNAMSIZ);
+
+    if (ioctl(fd, SIOCGIFMTU, &devinfo) == 0)
+        mtu = devinfo.ifr_mtu;
+    else
+        mtu = 0;
+
+    close(fd);
+
+    return mtu;
+}
+
+/**
+ * @brief Close the extra receive sockets of an interface.
+ *
+ * @param[in] iface the interface
+ */
+static void udp_socks_fini(iface_t *iface)
+{
+    while (iface->udp.num_s > 1)
+        close(iface->udp.s[--iface->udp.num_s]);
+}
+
+/**
+ * @brief Open the extra receive sockets of an interface.
+ *
+ * With PTL_UDP_SOCKETS > 1, more sockets join the port of connect_s
+ * through SO_REUSEPORT, and the kernel steers each datagram to one
+ * of them from the stripe of its udp_hdr. Each socket has its own
+ * receive queue in the NIs. On failure the interface keeps using
+ * connect_s alone.
+ *
+ * @param[in] iface the interface, once connect_s is bound
+ */
+static void udp_socks_init(iface_t *iface)
+{
+    int num_s = get_param(PTL_UDP_SOCKETS);
+    int on = 1;
+    int flags;
+    int s;
+
+    iface->udp.s[0] = iface->udp.connect_s;
+    iface->udp.num_s = 1;
+
+    if (num_s <= 1 || get_param(PTL_TCP))
+        return;
+
+    if (setsockopt(iface->udp.connect_s, SOL_SOCKET, SO_REUSEPORT, &on,
+                   sizeof(on)) == -1) {
+        ptl_warn("SO_REUSEPORT not supported: %s\n", strerror(errno));
+        return;
+    }
+
+    while (iface->udp.num_s < num_s) {
+        s = socket(AF_INET, SOCK_DGRAM, 0);
+        if (s == -1)
+            break;
+
+        flags = fcntl(s, F_GETFL);
+        if (fcntl(s, F_SETFL, flags | O_NONBLOCK) == -1 ||
+            setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1 ||
+            bind(s, (struct sockaddr *)&iface->udp.sin,
+                 sizeof(iface->udp.sin)) == -1) {
+            ptl_warn("cannot add receive socket: %s\n", strerror(errno));
+            close(s);
+            break;
+        }
+
+        iface->udp.s[iface->udp.num_s++] = s;
+    }
+
+    if (iface->udp.num_s == num_s &&
+        udp_steer_init(iface->udp.connect_s, num_s,
+                       offsetof(struct udp_hdr, stripe)) == 0) {
+        /* Start counting the datagrams steered wrong. */
+        __sync_bool_compare_and_swap(&udp_missteered, ULONG_MAX, 0);
+        return;
+    }
+
+    udp_socks_fini(iface);
+}
+
 /**
  * @brief Initialize interface.
  *
@@ -65,6 +164,7 @@ int init_iface_udp(iface_t *iface)
 
     iface->udp.sin.sin_family = AF_INET;
     iface->udp.sin.sin_addr.s_addr = addr;
+    iface->udp.mtu = get_mtu(iface->ifname);
 
     return PTL_OK;
 
@@ -83,6 +183,10 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
     int port;
     iface_t *iface = ni->iface;
 
+    err = tcp_ni_init(ni);
+    if (err)
+        return err;
+
     //if already initialized
     if (ni->id.phys.pid == (port_to_pid(ni->iface->udp.sin.sin_port))) {
         ptl_warn("attempting to re-initialize the interface \n");
@@ -93,7 +197,10 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
 #if !IS_PPE
         ni->umn_fd = -1;
 #endif
-        return PTL_OK;
+        err = udp_pack_init(ni);
+        if (err)
+            tcp_ni_fini(ni);
+        return err;
     }
 
     ni->udp.s = -1;
@@ -136,10 +243,26 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
 
     for (port = 49152; port <= 65535; port++) {
         addr.sin_port = htons(port);
+
+        /* With PTL_TCP, the port must be free for TCP too. */
+        if (get_param(PTL_TCP)) {
+            ret = tcp_listen(iface, &addr);
+            if (ret == -1) {
+                if (errno == EADDRINUSE)
+                    continue;
+
+                ptl_warn("unable to listen on port %d (errno=%d)\n", port,
+                         errno);
+                break;
+            }
+        }
+
         ret = bind(ni->udp.s, (struct sockaddr *)&addr, sizeof(addr));
         if (ret == -1) {
-            if (errno == EADDRINUSE)
+            if (errno == EADDRINUSE) {
+                tcp_iface_fini(iface);
                 continue;
+            }
 
             ptl_warn
                 ("unable to bind to local address:port %x:%d (errno=%d)\n",
@@ -161,6 +284,12 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
     ni->iface->udp.sin.sin_port = htons(port);
     ni->iface->udp.connect_s = ni->udp.s;
 
+    udp_socks_init(ni->iface);
+    if (iface->udp.tcp_s == -1) {
+        udp_offload_init(ni->iface);
+        udp_uring_init(ni->iface);
+    }
+
     //set NI pid and nid
     ni->id.phys.pid = port_to_pid(ni->iface->udp.sin.sin_port);
     ni->id.phys.nid = addr_to_nid((struct sockaddr_in *)&ni->iface->udp.sin);
@@ -202,11 +331,17 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
     //bounce_buf_offset = ni->udp.comm_pad_size;
     //ni->udp.comm_pad_size += ni->udp.udp_buf.buf_size * ni->udp.udp_buf.num_bufs;
 
+    err = udp_pack_init(ni);
+    if (err)
+        goto error;
+
     ni->iface->udp.ni_count++;
 
     return PTL_OK;
 
   error:
+    tcp_iface_fini(iface);
+    tcp_ni_fini(ni);
     if (ni->udp.s != -1) {
         close(ni->udp.s);
         ni->udp.s = -1;
@@ -216,11 +351,16 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
 
 void cleanup_udp(ni_t *ni)
 {
+    udp_pack_fini(ni);
+    tcp_ni_fini(ni);
 
     ni->iface->udp.ni_count--;
     if (ni->iface->udp.ni_count <= 0) {
         //remove address information
         ni->udp.dest_addr = NULL;
+        tcp_iface_fini(ni->iface);
+        udp_uring_fini(ni->iface);
+        udp_socks_fini(ni->iface);
         //close the socket
         close(ni->udp.s);
     }
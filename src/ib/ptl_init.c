@@ -5,7 +5,7 @@
  */
 #include "ptl_loc.h"
 
-static char *init_state_name[] = {
+char *init_state_name[] = {
     [STATE_INIT_START] = "start",
     [STATE_INIT_PREP_REQ] = "prepare_req",
     [STATE_INIT_WAIT_CONN] = "wait_conn",
@@ -205,6 +205,127 @@ static int start(buf_t *buf)
     return STATE_INIT_PREP_REQ;
 }
 
+/**
+ * @brief Append a field to a compact header.
+ *
+ * @param[in] p where to write the field
+ * @param[in] val the value of the field
+ * @param[in] pos the position of its width in req_hdr.fields
+ * @param[in,out] fields the widths so far
+ *
+ * @return the end of the field
+ */
+static unsigned char *hdr_put_field(unsigned char *p, uint64_t val, int pos,
+                                    unsigned int *fields)
+{
+    if (!val)
+        return p;
+
+    if (val <= UINT32_MAX) {
+        __le32 v32 = cpu_to_le32(val);
+
+        memcpy(p, &v32, sizeof(v32));
+        *fields |= HDR_FIELD_32 << pos;
+        return p + sizeof(v32);
+    } else {
+        __le64 v64 = cpu_to_le64(val);
+
+        memcpy(p, &v64, sizeof(v64));
+        *fields |= HDR_FIELD_64 << pos;
+        return p + sizeof(v64);
+    }
+}
+
+/**
+ * @brief Whether a request can be sent with a compact header.
+ *
+ * Only the transports that copy the message out gain anything, and
+ * the data descriptors move up behind the header, so none may be
+ * pointed to. Immediate data is never.
+ *
+ * @param[in] buf the request buf
+ *
+ * @return 1 if it can
+ */
+static int can_compact_hdr(buf_t *buf)
+{
+    if (!get_param(PTL_COMPACT_HDR))
+        return 0;
+
+    switch (buf->conn->transport.type) {
+#if WITH_TRANSPORT_IB
+        case CONN_TYPE_RDMA:
+#endif
+#if WITH_TRANSPORT_UDP
+        case CONN_TYPE_UDP:
+#endif
+            break;
+        default:
+            return 0;
+    }
+
+    if (buf->data_out && (void *)buf->data_out < buf->data + buf->length &&
+        buf->data_out->data_fmt != DATA_FMT_IMMEDIATE)
+        return 0;
+
+    if (buf->data_in && (void *)buf->data_in < buf->data + buf->length &&
+        buf->data_in->data_fmt != DATA_FMT_IMMEDIATE)
+        return 0;
+
+    return 1;
+}
+
+/**
+ * @brief Turn the header of a request into a compact one, if shorter.
+ *
+ * See ptl_hdr.h. The rest of the message moves up behind it.
+ *
+ * @param[in] buf the request buf
+ */
+static void compact_hdr(buf_t *buf)
+{
+    req_hdr_t *hdr = (req_hdr_t *) buf->data;
+    unsigned char var[sizeof(req_hdr_t) - REQ_HDR_FIXED];
+    unsigned char *p = var;
+    unsigned int fields = 0;
+    unsigned int len;
+    unsigned int shift;
+
+    p = hdr_put_field(p, le64_to_cpu(hdr->rlength), HDR_FIELD_RLENGTH,
+                      &fields);
+    p = hdr_put_field(p, le64_to_cpu(hdr->roffset), HDR_FIELD_ROFFSET,
+                      &fields);
+    p = hdr_put_field(p, le64_to_cpu(hdr->match_bits), HDR_FIELD_MATCH_BITS,
+                      &fields);
+    p = hdr_put_field(p, le64_to_cpu(hdr->hdr_data), HDR_FIELD_HDR_DATA,
+                      &fields);
+    if (hdr->uid) {
+        memcpy(p, &hdr->uid, sizeof(hdr->uid));
+        p += sizeof(hdr->uid);
+        fields |= 1 << HDR_FIELD_UID;
+    }
+
+    len = (REQ_HDR_FIXED + (p - var) + 7) & ~7;
+    if (len >= sizeof(*hdr))
+        return;
+
+    shift = sizeof(*hdr) - len;
+
+    hdr->compact = 1;
+    hdr->fields = fields;
+    memcpy(buf->data + REQ_HDR_FIXED, var, p - var);
+    memset(buf->data + REQ_HDR_FIXED + (p - var), 0,
+           len - REQ_HDR_FIXED - (p - var));
+    memmove(buf->data + len, buf->data + sizeof(*hdr),
+            buf->length - sizeof(*hdr));
+
+    buf->length -= shift;
+    if (buf->data_out)
+        buf->data_out = (data_t *)((unsigned char *)buf->data_out - shift);
+    if (buf->data_in)
+        buf->data_in = (data_t *)((unsigned char *)buf->data_in - shift);
+}
+
 /**
  * @brief initiator prepare request state.
  *
@@ -217,24 +338,14 @@ static int start(buf_t *buf)
 static int prepare_req(buf_t *buf)
 {
     int err;
-    ni_t *ni = obj_to_ni(buf);
     req_hdr_t *hdr = (req_hdr_t *) buf->data;
     ptl_size_t length = buf->rlength;
 
-    hdr->h1.version = PTL_HDR_VER_1;
-    hdr->h1.ni_type = ni->ni_type;
-    hdr->h1.pkt_fmt = PKT_FMT_REQ;
+    /* The rest of h1 comes from the template of the conn. */
     hdr->h1.handle = cpu_to_le32(buf_to_handle(buf));
-    hdr->h1.operand = 0;
-    hdr->h1.physical = !!(ni->options & PTL_NI_PHYSICAL);
-    ptl_info("request uses physical: %x or logical addressing: %x \n",
-             !!(ni->options & PTL_NI_PHYSICAL),
-             !!(ni->options & PTL_NI_LOGICAL));
-    hdr->h1.src_nid = cpu_to_le32(ni->id.phys.nid);
-    hdr->h1.src_pid = cpu_to_le32(ni->id.phys.pid);
 #if WITH_TRANSPORT_UDP
     ptl_info("initiator nid: %i pid: %i NI: %p\n", le32_to_cpu(hdr->h1.src_nid),
-             le32_to_cpu(hdr->h1.src_pid), ni);
+             le32_to_cpu(hdr->h1.src_pid), obj_to_ni(buf));
     ptl_info("buffer handle: %i %i buf:%p\n", hdr->h1.handle,
              le32_to_cpu(hdr->h1.handle), &buf);
 #endif
@@ -242,6 +353,8 @@ static int prepare_req(buf_t *buf)
     hdr->roffset = cpu_to_le64(buf->roffset);
 
 #if IS_PPE
+    ni_t *ni = obj_to_ni(buf);
+
     hdr->h1.physical = !!(ni->options & PTL_NI_PHYSICAL);
     if (ni->options & PTL_NI_PHYSICAL) {
         hdr->h1.src_nid = cpu_to_le32(ni->id.phys.nid);
@@ -352,6 +465,10 @@ static int prepare_req(buf_t *buf)
         (buf->data_out && buf->data_out->data_fmt == DATA_FMT_IMMEDIATE))
         buf->event_mask |= XI_EARLY_SEND;
 
+    /* The header is final. Shorten it before deciding to inline. */
+    if (can_compact_hdr(buf))
+        compact_hdr(buf);
+
     /* Inline the data if it fits. That may save waiting for a
      * completion. */
     buf->conn->transport.set_send_flags(buf, 0);
@@ -421,7 +538,7 @@ static int wait_conn(buf_t *buf)
             while (conn->state < CONN_STATE_CONNECTED)
                 progress_thread_udp(ni);
         }
-        else{
+        else if (conn->state < CONN_STATE_CONNECTED) {
 #endif
             pthread_cond_wait(&conn->move_wait, &conn->mutex);
 #if WITH_TRANSPORT_UDP
@@ -555,7 +672,8 @@ static int init_copy_in(buf_t *buf)
 
     ret =
         iov_copy_in(buf->transfer.noknem.data, buf->transfer.noknem.iovecs,
-                    NULL, buf->transfer.noknem.num_iovecs,
+                    buf->transfer.noknem.iov_offsets, NULL,
+                    buf->transfer.noknem.num_iovecs,
                     buf->transfer.noknem.offset, to_copy);
     if (ret == PTL_FAIL) {
         WARN();
@@ -593,7 +711,8 @@ static int init_copy_out(buf_t *buf)
 
     ret =
         iov_copy_out(buf->transfer.noknem.data, buf->transfer.noknem.iovecs,
-                     NULL, buf->transfer.noknem.num_iovecs,
+                     buf->transfer.noknem.iov_offsets, NULL,
+                     buf->transfer.noknem.num_iovecs,
                      buf->transfer.noknem.offset, to_copy);
     if (ret == PTL_FAIL) {
         WARN();
@@ -658,7 +777,7 @@ static int init_copy_in(buf_t *buf)
 	assert(to_copy <= buf->transfer.udp.length_left);
 
 	ret = iov_copy_in(buf->transfer.udp.data, buf->transfer.udp.iovecs,
-					  NULL,
+					  NULL, NULL,
 					  buf->transfer.udp.num_iovecs,
 					  buf->transfer.udp.offset,
 					  to_copy);
@@ -697,7 +816,7 @@ static int init_copy_out(buf_t *buf)
 		to_copy = buf->transfer.udp.length_left;
 
 	ret = iov_copy_out(buf->transfer.udp.data, buf->transfer.udp.iovecs,
-					   NULL,
+					   NULL, NULL,
 					   buf->transfer.udp.num_iovecs,
 					   buf->transfer.udp.offset,
 					   to_copy);
@@ -907,8 +1026,8 @@ static int data_in(buf_t *buf)
 
     if (md->num_iov) {
         err =
-            iov_copy_in(data, (ptl_iovec_t *)md->start, md->mr_list,
-                        md->num_iov, offset, length);
+            iov_copy_in(data, (ptl_iovec_t *)md->start, md->iov_offsets,
+                        md->mr_list, md->num_iov, offset, length);
         if (err)
             return STATE_INIT_ERROR;
     } else {
@@ -1064,7 +1183,8 @@ static int reply_event(buf_t *buf)
                 int err;
                 err =
                     iov_copy_in(buf->recv_buf->transfer.udp.my_iovec.iov_base,
-                                buf->get_md->start, buf->get_md->mr_list,
+                                buf->get_md->start, buf->get_md->iov_offsets,
+                                buf->get_md->mr_list,
                                 buf->get_md->num_iov, buf->get_offset,
                                 buf->mlength);
                 buf->recv_buf->transfer.udp.num_iovecs = buf->get_md->num_iov;
@@ -1162,6 +1282,65 @@ static void cleanup(buf_t *buf)
     conn_put(buf->conn);
 }
 
+/**
+ * @brief initiator fast path.
+ *
+ * Runs the states of the common flows, a small put, get or atomic
+ * sent to a connected peer, as straight-line calls rather than through
+ * the switch of process_init. The request goes start, prepare_req
+ * and send_req, and the response wait_recv, data_in, late_send_event
+ * and ack_event or reply_event. As soon as a state returns something
+ * else the general machine takes over from there. The states are
+ * still recorded for the state trace, but not logged.
+ *
+ * @param[in] buf the request buf.
+ * @param[in] state the state the buf is in.
+ * @return the state to continue from.
+ */
+static int init_fast_path(buf_t *buf, int state)
+{
+    if (state == STATE_INIT_START) {
+        TRACE_STATE(TRACE_INIT, buf, state);
+        state = start(buf);
+        if (state != STATE_INIT_PREP_REQ)
+            return state;
+
+        TRACE_STATE(TRACE_INIT, buf, state);
+        state = prepare_req(buf);
+        if (state != STATE_INIT_SEND_REQ)
+            return state;
+
+        TRACE_STATE(TRACE_INIT, buf, state);
+        return send_req(buf);
+    }
+
+    if (state != STATE_INIT_WAIT_RECV || !buf->recv_buf)
+        return state;
+
+    TRACE_STATE(TRACE_INIT, buf, state);
+    state = wait_recv(buf);
+
+    if (state == STATE_INIT_DATA_IN) {
+        TRACE_STATE(TRACE_INIT, buf, state);
+        state = data_in(buf);
+    }
+
+    if (state == STATE_INIT_LATE_SEND_EVENT) {
+        TRACE_STATE(TRACE_INIT, buf, state);
+        state = late_send_event(buf);
+    }
+
+    if (state == STATE_INIT_ACK_EVENT) {
+        TRACE_STATE(TRACE_INIT, buf, state);
+        state = ack_event(buf);
+    } else if (state == STATE_INIT_REPLY_EVENT) {
+        TRACE_STATE(TRACE_INIT, buf, state);
+        state = reply_event(buf);
+    }
+
+    return state;
+}
+
 /*
  * @brief initiator state machine.
  *
@@ -1191,11 +1370,20 @@ int process_init(buf_t *buf)
 
     pthread_mutex_lock(&buf->mutex);
 
-    state = buf->init_state;
+    state = init_fast_path(buf, buf->init_state);
+
+#if WITH_TRANSPORT_SHMEM && !USE_KNEM
+    /* The fast path ended in send_req, which left the copy to the
+     * progress thread. Leave as the loop does after send_req. */
+    if (buf->init_state == STATE_INIT_START &&
+        (state == STATE_INIT_COPY_IN || state == STATE_INIT_COPY_OUT))
+        goto exit;
+#endif
 
     while (1) {
         ptl_info("[%d]%p: init state = %s\n", getpid(), buf,
                  init_state_name[state]);
+        TRACE_STATE(TRACE_INIT, buf, state);
 
         switch (state) {
             case STATE_INIT_START:
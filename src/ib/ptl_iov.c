@@ -6,6 +6,97 @@
 
 #include "ptl_loc.h"
 
+/**
+ * Build the offset index of an iovec array.
+ *
+ * iov_offsets[i] is the offset of element i in the data segment, so
+ * that iov_seek() can binary search it.
+ *
+ * @param[in] iov address of iovec array
+ * @param[in] num_iov number of entries in iovec array
+ * @param[out] iov_offsets the index, num_iov entries
+ *
+ * @return the total length of the iovec array
+ */
+ptl_size_t iov_build_offsets(const ptl_iovec_t *iov, ptl_size_t num_iov,
+                             ptl_size_t *iov_offsets)
+{
+    ptl_size_t length = 0;
+    ptl_size_t i;
+
+    for (i = 0; i < num_iov; i++) {
+        iov_offsets[i] = length;
+        length += iov[i].iov_len;
+    }
+
+    return length;
+}
+
+/**
+ * Find the iovec element that contains an offset.
+ *
+ * Zero length elements are skipped. When iov_offsets is NULL, the
+ * array is walked from its first element.
+ *
+ * @param[in] iov address of iovec array
+ * @param[in] iov_offsets offset index from iov_build_offsets(), or NULL.
+ * iov and iov_offsets may point to the same element of a longer array.
+ * @param[in] num_iov number of entries in iovec array
+ * @param[in,out] offset offset into the iovec array, on return
+ * offset into the element, or past the end of the array
+ *
+ * @return the index of the element, num_iov if offset is past the end
+ */
+ptl_size_t iov_seek(const ptl_iovec_t *iov, const ptl_size_t *iov_offsets,
+                    ptl_size_t num_iov, ptl_size_t *offset)
+{
+    ptl_size_t lo;
+    ptl_size_t hi;
+    ptl_size_t target;
+    ptl_size_t end;
+
+    if (!iov_offsets) {
+        for (lo = 0; lo < num_iov; lo++) {
+            if (*offset < iov[lo].iov_len)
+                break;
+            *offset -= iov[lo].iov_len;
+        }
+
+        return lo;
+    }
+
+    if (num_iov == 0)
+        return 0;
+
+    /* The array may be the tail of a bigger one, so the offsets are
+     * relative to its first element. */
+    target = iov_offsets[0] + *offset;
+
+    end = iov_offsets[num_iov - 1] + iov[num_iov - 1].iov_len;
+    if (target >= end) {
+        *offset = target - end;
+        return num_iov;
+    }
+
+    /* Find the last element starting at or before offset. Zero
+     * length elements share their start with the next one, so it is
+     * never one of them. */
+    lo = 0;
+    hi = num_iov - 1;
+    while (lo < hi) {
+        ptl_size_t mid = lo + (hi - lo + 1) / 2;
+
+        if (iov_offsets[mid] <= target)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    *offset = target - iov_offsets[lo];
+
+    return lo;
+}
+
 /**
  * Copy data from an iovec to linear buffer.
  *
@@ -13,29 +104,27 @@
  *
  * @param[in] dst address of destination buffer
  * @param[in] iov address of iovec array
+ * @param[in] iov_offsets offset index of the iovec array, or NULL
  * @param[in] num_iov number of entries in iovec array
  * @param[in] offset offset into iovec
  * @param[in] length number of bytes to copy
  *
  * @return status
  */
-int iov_copy_out(void *dst, ptl_iovec_t *iov, mr_t **mr_list,
-                 ptl_size_t num_iov, ptl_size_t offset, ptl_size_t length)
+int iov_copy_out(void *dst, ptl_iovec_t *iov, const ptl_size_t *iov_offsets,
+                 mr_t **mr_list, ptl_size_t num_iov, ptl_size_t offset,
+                 ptl_size_t length)
 {
-    unsigned int i;
+    ptl_size_t i;
     ptl_size_t dst_offset = 0;
     ptl_size_t bytes;
 
     /* Find starting point in iovec from offset. i is the index of the first iovec. */
-    for (i = 0; i < num_iov; i++, iov++) {
-        if (offset > iov->iov_len)
-            offset -= iov->iov_len;
-        else
-            break;
-    }
+    i = iov_seek(iov, iov_offsets, num_iov, &offset);
+    iov += i;
 
     /* check if we ran off the end of the iovec before we started */
-    if (i >= num_iov) {
+    if (i >= num_iov && (offset || length)) {
         WARN();
         return PTL_FAIL;
     }
@@ -71,25 +160,23 @@ int iov_copy_out(void *dst, ptl_iovec_t *iov, mr_t **mr_list,
  *
  * @param[in] src address of source buffer
  * @param[in] iov address of iovec array
+ * @param[in] iov_offsets offset index of the iovec array, or NULL
  * @param[in] num_iov number of entries in iovec array
  * @param[in] offset offset into iovec
  * @param[in] length number of bytes to copy
  *
  * @return status
  */
-int iov_copy_in(void *src, ptl_iovec_t *iov, mr_t **mr_list,
-                ptl_size_t num_iov, ptl_size_t offset, ptl_size_t length)
+int iov_copy_in(void *src, ptl_iovec_t *iov, const ptl_size_t *iov_offsets,
+                mr_t **mr_list, ptl_size_t num_iov, ptl_size_t offset,
+                ptl_size_t length)
 {
-    unsigned int i;
+    ptl_size_t i;
     ptl_size_t src_offset = 0;
     ptl_size_t bytes;
 
-    for (i = 0; i < num_iov; i++, iov++) {
-        if (offset >= iov->iov_len)
-            offset -= iov->iov_len;
-        else
-            break;
-    }
+    i = iov_seek(iov, iov_offsets, num_iov, &offset);
+    iov += i;
 
     if (i >= num_iov) {
         WARN();
@@ -127,6 +214,7 @@ int iov_copy_in(void *src, ptl_iovec_t *iov, mr_t **mr_list,
  * @param[in] atom_size the size of each atomic operand
  * @param[in] src address of source buffer
  * @param[in] iov address of iovec array
+ * @param[in] iov_offsets offset index of the iovec array, or NULL
  * @param[in] num_iov number of entries in iovec array
  * @param[in] offset offset into iovec
  * @param[in] length number of bytes to copy
@@ -134,23 +222,18 @@ int iov_copy_in(void *src, ptl_iovec_t *iov, mr_t **mr_list,
  * @return status
  */
 int iov_atomic_in(atom_op_t op, int atom_size, void *src, ptl_iovec_t *iov,
-                  mr_t **mr_list, ptl_size_t num_iov, ptl_size_t offset,
-                  ptl_size_t length)
+                  const ptl_size_t *iov_offsets, mr_t **mr_list,
+                  ptl_size_t num_iov, ptl_size_t offset, ptl_size_t length)
 {
     ptl_size_t i;
-    ptl_size_t iov_offset = 0;
+    ptl_size_t iov_offset = offset;
     ptl_size_t src_offset = 0;
-    ptl_size_t dst_offset = 0;
     ptl_size_t bytes;
 
-    for (i = 0; i < num_iov && dst_offset < offset; i++, iov++) {
-        iov_offset = offset - dst_offset;
-        if (iov_offset > iov->iov_len)
-            iov_offset = iov->iov_len;
-        dst_offset += iov_offset;
-    }
+    i = iov_seek(iov, iov_offsets, num_iov, &iov_offset);
+    iov += i;
 
-    if (dst_offset < offset) {
+    if (i >= num_iov && (iov_offset || length)) {
         WARN();
         return PTL_FAIL;
     }
@@ -217,6 +300,7 @@ int iov_atomic_in(atom_op_t op, int atom_size, void *src, ptl_iovec_t *iov,
  * will not fit into the data segment.
  *
  * @param[in] iov the iovec list
+ * @param[in] iov_offsets offset index of the iovec list, or NULL
  * @param[in] num_iov the number of entries in the iovec list
  * @param[in] offset the offset of the data region into the data segment
  * @param[in] length the length of the data region
@@ -226,30 +310,17 @@ int iov_atomic_in(atom_op_t op, int atom_size, void *src, ptl_iovec_t *iov,
  * @return number of iovec elements on success
  * @return -1 on failure
  */
-int iov_count_elem(ptl_iovec_t *iov, ptl_size_t num_iov, ptl_size_t offset,
-                   ptl_size_t length, ptl_size_t *index_p, ptl_size_t *base_p)
+int iov_count_elem(ptl_iovec_t *iov, const ptl_size_t *iov_offsets,
+                   ptl_size_t num_iov, ptl_size_t offset, ptl_size_t length,
+                   ptl_size_t *index_p, ptl_size_t *base_p)
 {
     ptl_size_t index_start;
     ptl_size_t index_stop;
-    ptl_size_t iov_len;
+    ptl_size_t end;
 
     /* find the index of the iovec element and its starting
      * offset that contains the start of the data region */
-    for (index_start = 0; index_start < num_iov; index_start++) {
-        iov_len = iov->iov_len;
-
-        if (offset < iov_len) {
-            /* Adjust total length so we start at the beggining of
-             * that iovec buffer. */
-            length += offset;
-
-            *base_p = offset;
-            break;
-        }
-
-        offset -= iov_len;
-        iov++;
-    }
+    index_start = iov_seek(iov, iov_offsets, num_iov, &offset);
 
     /* Check out of range. */
     if (unlikely(index_start == num_iov)) {
@@ -257,16 +328,18 @@ int iov_count_elem(ptl_iovec_t *iov, ptl_size_t num_iov, ptl_size_t offset,
         return -1;
     }
 
-    /* find the index of the iovec element that contains the
-     * end of the data region */
-    for (index_stop = index_start; index_stop < num_iov; index_stop++) {
-        iov_len = iov->iov_len;
-
-        if (length <= iov_len)
-            break;
+    *base_p = offset;
 
-        length -= iov_len;
-        iov++;
+    /* find the index of the iovec element that contains the
+     * end of the data region, i.e. its last byte */
+    if (length <= iov[index_start].iov_len - offset) {
+        index_stop = index_start;
+    } else {
+        end = offset + length - 1 - iov[index_start].iov_len;
+        index_stop = index_start + 1 +
+            iov_seek(iov + index_start + 1,
+                     iov_offsets ? iov_offsets + index_start + 1 : NULL,
+                     num_iov - index_start - 1, &end);
     }
 
     /* Check out of range. */
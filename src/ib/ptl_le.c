@@ -59,6 +59,7 @@ void le_cleanup(void *arg)
 
         free(le->mr_list);
         le->mr_list = NULL;
+        le->iov_offsets = NULL;
     }
 
     (void)__sync_fetch_and_sub(&ni->current.max_entries, 1);
@@ -194,19 +195,23 @@ int le_get_mr(ni_t *restrict ni, const ptl_le_t *le_init, le_t *le)
         le->num_iov = le_init->length;
         le->length = 0;
 
-        le->mr_list = calloc(le->num_iov, sizeof(mr_t *));
+        /* The offset index lives in the same allocation. */
+        le->mr_list =
+            calloc(le->num_iov, sizeof(mr_t *) + sizeof(ptl_size_t));
         if (!le->mr_list)
             return PTL_NO_SPACE;
+        le->iov_offsets = (ptl_size_t *)(le->mr_list + le->num_iov);
 
         iov = (ptl_iovec_t *)addr_to_ppe(le_init->start, le->mr_start);
 
+        le->length = iov_build_offsets(iov, le->num_iov, le->iov_offsets);
+
         for (i = 0; i < le->num_iov; i++) {
             if (!mr_lookup_app
                 (ni, iov->iov_base, iov->iov_len, &le->mr_list[i]) == PTL_OK)
                 return PTL_ARG_INVALID;
             if (le->mr_list[i]->readonly)
                 return PTL_ARG_INVALID;
-            le->length += iov->iov_len;
             iov++;
         }
     } else {
@@ -50,6 +50,17 @@ static struct {
 
     /* XPMEM segid for that whole process. */
     xpmem_segid_t segid;
+
+    /* Command ring. The ppebufs used for the asynchronous operations
+     * are kept by the client instead of being allocated and released
+     * for every call. A slot is free once the PPE has completed
+     * it. */
+    struct {
+        ppebuf_t **buf;
+        unsigned int size;      /* power of 2 */
+        unsigned int next;
+        PTL_FASTLOCK_TYPE lock;
+    } ring;
 } ppe;
 
 /**
@@ -314,6 +325,7 @@ static void transfer_msg(ppebuf_t *buf)
      * parameter. */
     buf->obj.next = NULL;
     buf->completed = 0;
+    buf->async = 0;
     buf->cookie = ppe.cookie;
 
     enqueue((void *)(uintptr_t) ppe.ppebufs_offset, ppe.queue, (obj_t *)buf);
@@ -323,6 +335,158 @@ static void transfer_msg(ppebuf_t *buf)
         SPINLOCK_BODY();
 }
 
+/* Take the ppebufs of the command ring from the pool. Does nothing
+ * if asynchronous operations are disabled. */
+static int ring_init(void)
+{
+    unsigned int size = get_param(PTL_PPE_RING_SIZE);
+    unsigned int i;
+    int err;
+
+    if (!get_param(PTL_PPE_ASYNC))
+        return PTL_OK;
+
+    ppe.ring.size = 1;
+    while (ppe.ring.size < size)
+        ppe.ring.size <<= 1;
+
+    ppe.ring.buf = calloc(ppe.ring.size, sizeof(ppebuf_t *));
+    if (!ppe.ring.buf)
+        return PTL_NO_SPACE;
+
+    for (i = 0; i < ppe.ring.size; i++) {
+        if ((err = ppebuf_alloc(&ppe.ring.buf[i]))) {
+            WARN();
+            return err;
+        }
+        ppe.ring.buf[i]->completed = 1;
+    }
+
+    ppe.ring.next = 0;
+    PTL_FASTLOCK_INIT(&ppe.ring.lock);
+
+    return PTL_OK;
+}
+
+/* Wait for the PPE to complete the operations still in the command
+ * ring, and give its ppebufs back to the pool. */
+static void ring_fini(void)
+{
+    unsigned int i;
+
+    if (!ppe.ring.buf)
+        return;
+
+    for (i = 0; i < ppe.ring.size; i++) {
+        ppebuf_t *buf = ppe.ring.buf[i];
+
+        if (!buf)
+            continue;
+
+        while (buf->completed == 0)
+            SPINLOCK_BODY();
+
+        ppebuf_release(buf);
+    }
+
+    PTL_FASTLOCK_DESTROY(&ppe.ring.lock);
+    free(ppe.ring.buf);
+    ppe.ring.buf = NULL;
+}
+
+/**
+ * Get a ppebuf for a data movement or triggered operation.
+ *
+ * When asynchronous operations are enabled this is the next slot of
+ * the command ring, once the PPE is done with its previous
+ * operation. Otherwise it is allocated from the pool.
+ *
+ * @param buf_p pointer to return value
+ *
+ * @return status
+ */
+static inline int cmd_alloc(ppebuf_t **buf_p)
+{
+    ppebuf_t *buf;
+
+    if (!ppe.ring.buf)
+        return ppebuf_alloc(buf_p);
+
+    PTL_FASTLOCK_LOCK(&ppe.ring.lock);
+
+    buf = ppe.ring.buf[ppe.ring.next & (ppe.ring.size - 1)];
+    ppe.ring.next++;
+
+    /* The slot is reused in order, so this only waits when the
+     * client is ring size operations ahead of the PPE. */
+    while (buf->completed == 0)
+        SPINLOCK_BODY();
+    buf->completed = 0;
+
+    PTL_FASTLOCK_UNLOCK(&ppe.ring.lock);
+
+    *buf_p = buf;
+    return PTL_OK;
+}
+
+/**
+ * Submit an operation obtained from cmd_alloc().
+ *
+ * A ring slot is enqueued without waiting for the PPE, and a failure
+ * will be reported by the PPE through the EQ or CT of the operation.
+ * A ppebuf from the pool is transferred synchronously as usual.
+ *
+ * @param buf the operation
+ *
+ * @return status
+ */
+static inline int cmd_submit(ppebuf_t *buf)
+{
+    int err;
+
+    if (ppe.ring.buf) {
+        buf->obj.next = NULL;
+        buf->async = 1;
+        buf->cookie = ppe.cookie;
+
+        enqueue((void *)(uintptr_t) ppe.ppebufs_offset, ppe.queue,
+                (obj_t *)buf);
+
+        return PTL_OK;
+    }
+
+    transfer_msg(buf);
+
+    err = buf->msg.ret;
+
+    ppebuf_release(buf);
+
+    return err;
+}
+
+/* Local validation of the handles passed to an asynchronous
+ * operation, since the PPE will not be able to return an error for
+ * them. */
+static inline int check_handle(ptl_handle_any_t handle, enum obj_type type)
+{
+#ifndef NO_ARG_VALIDATION
+    if (handle == PTL_INVALID_HANDLE || (handle >> HANDLE_SHIFT) != type)
+        return PTL_ARG_INVALID;
+#endif
+
+    return PTL_OK;
+}
+
+static inline int check_atomic(ptl_op_t operation, ptl_datatype_t datatype)
+{
+#ifndef NO_ARG_VALIDATION
+    if (operation >= PTL_OP_LAST || datatype >= PTL_DATATYPE_LAST)
+        return PTL_ARG_INVALID;
+#endif
+
+    return PTL_OK;
+}
+
 int PtlInit(void)
 {
     int ret;
@@ -351,6 +515,13 @@ int PtlInit(void)
         if (ret != PTL_OK) {
             goto err1;
         }
+
+        ret = ring_init();
+        if (ret != PTL_OK) {
+            ring_fini();
+            release_ppe_resources();
+            goto err1;
+        }
     }
 
     /* Call PPE now. */
@@ -406,6 +577,8 @@ void PtlFini(void)
 
         ppe.finalized = 1;
 
+        ring_fini();
+
         /* Call PPE now. */
         if ((ret = ppebuf_alloc(&buf))) {
             WARN();
@@ -1266,7 +1439,10 @@ int PtlPut(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(md_handle, POOL_MD)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1284,13 +1460,7 @@ int PtlPut(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     buf->msg.PtlPut.user_ptr = user_ptr;
     buf->msg.PtlPut.hdr_data = hdr_data;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlGet(ptl_handle_md_t md_handle, ptl_size_t local_offset,
@@ -1301,7 +1471,10 @@ int PtlGet(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(md_handle, POOL_MD)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1317,13 +1490,7 @@ int PtlGet(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     buf->msg.PtlGet.remote_offset = remote_offset;
     buf->msg.PtlGet.user_ptr = user_ptr;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlAtomic(ptl_handle_md_t md_handle, ptl_size_t local_offset,
@@ -1336,7 +1503,11 @@ int PtlAtomic(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(md_handle, POOL_MD)) ||
+        (err = check_atomic(operation, datatype)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1356,13 +1527,7 @@ int PtlAtomic(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     buf->msg.PtlAtomic.operation = operation;
     buf->msg.PtlAtomic.datatype = datatype;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlFetchAtomic(ptl_handle_md_t get_md_handle, ptl_size_t local_get_offset,
@@ -1376,7 +1541,12 @@ int PtlFetchAtomic(ptl_handle_md_t get_md_handle, ptl_size_t local_get_offset,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(get_md_handle, POOL_MD)) ||
+        (err = check_handle(put_md_handle, POOL_MD)) ||
+        (err = check_atomic(operation, datatype)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1397,13 +1567,7 @@ int PtlFetchAtomic(ptl_handle_md_t get_md_handle, ptl_size_t local_get_offset,
     buf->msg.PtlFetchAtomic.operation = operation;
     buf->msg.PtlFetchAtomic.datatype = datatype;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlSwap(ptl_handle_md_t get_md_handle, ptl_size_t local_get_offset,
@@ -1672,7 +1836,11 @@ int PtlTriggeredPut(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(md_handle, POOL_MD)) ||
+        (err = check_handle(trig_ct_handle, POOL_CT)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1692,13 +1860,7 @@ int PtlTriggeredPut(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     buf->msg.PtlTriggeredPut.trig_ct_handle = trig_ct_handle;
     buf->msg.PtlTriggeredPut.threshold = threshold;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlTriggeredGet(ptl_handle_md_t md_handle, ptl_size_t local_offset,
@@ -1710,7 +1872,11 @@ int PtlTriggeredGet(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(md_handle, POOL_MD)) ||
+        (err = check_handle(trig_ct_handle, POOL_CT)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1728,13 +1894,7 @@ int PtlTriggeredGet(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     buf->msg.PtlTriggeredGet.trig_ct_handle = trig_ct_handle;
     buf->msg.PtlTriggeredGet.threshold = threshold;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlTriggeredAtomic(ptl_handle_md_t md_handle, ptl_size_t local_offset,
@@ -1748,7 +1908,12 @@ int PtlTriggeredAtomic(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(md_handle, POOL_MD)) ||
+        (err = check_atomic(operation, datatype)) ||
+        (err = check_handle(trig_ct_handle, POOL_CT)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1770,13 +1935,7 @@ int PtlTriggeredAtomic(ptl_handle_md_t md_handle, ptl_size_t local_offset,
     buf->msg.PtlTriggeredAtomic.trig_ct_handle = trig_ct_handle;
     buf->msg.PtlTriggeredAtomic.threshold = threshold;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlTriggeredFetchAtomic(ptl_handle_md_t get_md_handle,
@@ -1794,7 +1953,13 @@ int PtlTriggeredFetchAtomic(ptl_handle_md_t get_md_handle,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(get_md_handle, POOL_MD)) ||
+        (err = check_handle(put_md_handle, POOL_MD)) ||
+        (err = check_atomic(operation, datatype)) ||
+        (err = check_handle(trig_ct_handle, POOL_CT)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1817,13 +1982,7 @@ int PtlTriggeredFetchAtomic(ptl_handle_md_t get_md_handle,
     buf->msg.PtlTriggeredFetchAtomic.trig_ct_handle = trig_ct_handle;
     buf->msg.PtlTriggeredFetchAtomic.threshold = threshold;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlTriggeredSwap(ptl_handle_md_t get_md_handle,
@@ -1879,7 +2038,11 @@ int PtlTriggeredCTInc(ptl_handle_ct_t ct_handle, ptl_ct_event_t increment,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(ct_handle, POOL_CT)) ||
+        (err = check_handle(trig_ct_handle, POOL_CT)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1891,13 +2054,7 @@ int PtlTriggeredCTInc(ptl_handle_ct_t ct_handle, ptl_ct_event_t increment,
     buf->msg.PtlTriggeredCTInc.trig_ct_handle = trig_ct_handle;
     buf->msg.PtlTriggeredCTInc.threshold = threshold;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlTriggeredCTSet(ptl_handle_ct_t ct_handle, ptl_ct_event_t new_ct,
@@ -1906,7 +2063,11 @@ int PtlTriggeredCTSet(ptl_handle_ct_t ct_handle, ptl_ct_event_t new_ct,
     ppebuf_t *buf;
     int err;
 
-    if ((err = ppebuf_alloc(&buf))) {
+    if ((err = check_handle(ct_handle, POOL_CT)) ||
+        (err = check_handle(trig_ct_handle, POOL_CT)))
+        return err;
+
+    if ((err = cmd_alloc(&buf))) {
         WARN();
         return err;
     }
@@ -1918,13 +2079,7 @@ int PtlTriggeredCTSet(ptl_handle_ct_t ct_handle, ptl_ct_event_t new_ct,
     buf->msg.PtlTriggeredCTSet.trig_ct_handle = trig_ct_handle;
     buf->msg.PtlTriggeredCTSet.threshold = threshold;
 
-    transfer_msg(buf);
-
-    err = buf->msg.ret;
-
-    ppebuf_release(buf);
-
-    return err;
+    return cmd_submit(buf);
 }
 
 int PtlStartBundle(ptl_handle_ni_t ni_handle)
@@ -16,6 +16,7 @@
 #include <net/if.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stddef.h>
@@ -70,6 +71,7 @@
 #include "ptl_pt.h"
 #include "ptl_ni.h"
 #include "ptl_data.h"
+#include "ptl_hdr.h"
 #include "ptl_conn.h"
 #include "ptl_mr.h"
 #include "ptl_md.h"
@@ -78,9 +80,11 @@
 #include "ptl_ct.h"
 #include "ptl_buf.h"
 #include "ptl_eq.h"
-#include "ptl_hdr.h"
 #include "ptl_misc.h"
 #include "ptl_knem.h"
+#include "ptl_trace.h"
+#include "ptl_stats.h"
+#include "ptl_uring.h"
 
 enum recv_state {
     STATE_RECV_SEND_COMP,
@@ -210,19 +214,27 @@ struct transports {
 };
 extern struct transports transports;
 
-int iov_copy_out(void *dst, ptl_iovec_t *iov, mr_t **mr_list,
-                 ptl_size_t num_iov, ptl_size_t offset, ptl_size_t length);
+ptl_size_t iov_build_offsets(const ptl_iovec_t *iov, ptl_size_t num_iov,
+                             ptl_size_t *iov_offsets);
+
+ptl_size_t iov_seek(const ptl_iovec_t *iov, const ptl_size_t *iov_offsets,
+                    ptl_size_t num_iov, ptl_size_t *offset);
 
-int iov_copy_in(void *src, ptl_iovec_t *iov, mr_t **mr_list,
-                ptl_size_t num_iov, ptl_size_t offset, ptl_size_t length);
+int iov_copy_out(void *dst, ptl_iovec_t *iov, const ptl_size_t *iov_offsets,
+                 mr_t **mr_list, ptl_size_t num_iov, ptl_size_t offset,
+                 ptl_size_t length);
+
+int iov_copy_in(void *src, ptl_iovec_t *iov, const ptl_size_t *iov_offsets,
+                mr_t **mr_list, ptl_size_t num_iov, ptl_size_t offset,
+                ptl_size_t length);
 
 int iov_atomic_in(atom_op_t op, int atom_size, void *src, ptl_iovec_t *iov,
-                  mr_t **mr_list, ptl_size_t num_iov, ptl_size_t offset,
-                  ptl_size_t length);
+                  const ptl_size_t *iov_offsets, mr_t **mr_list,
+                  ptl_size_t num_iov, ptl_size_t offset, ptl_size_t length);
 
-int iov_count_elem(ptl_iovec_t *iov, ptl_size_t num_iov, ptl_size_t offset,
-                   ptl_size_t length, ptl_size_t *index_p,
-                   ptl_size_t *base_p);
+int iov_count_elem(ptl_iovec_t *iov, const ptl_size_t *iov_offsets,
+                   ptl_size_t num_iov, ptl_size_t offset, ptl_size_t length,
+                   ptl_size_t *index_p, ptl_size_t *base_p);
 
 int process_rdma_desc(buf_t *buf);
 
@@ -242,10 +254,11 @@ void initiate_disconnect_all(ni_t *ni);
 
 #if WITH_TRANSPORT_IB
 void disconnect_conn_locked(conn_t *conn);
-void progress_thread_rdma(ni_t *ni);
+int progress_thread_rdma(ni_t *ni);
 #else
-static inline void progress_thread_rdma(ni_t *ni)
+static inline int progress_thread_rdma(ni_t *ni)
 {
+    return 0;
 }
 #endif
 
@@ -254,6 +267,7 @@ int PtlSetMap_mem(ni_t *ni, ptl_size_t map_size,
                   const ptl_process_t *mapping);
 void shmem_enqueue(ni_t *ni, buf_t *buf, ptl_pid_t dest);
 buf_t *shmem_dequeue(ni_t *ni);
+int shmem_phys_lookup(ni_t *ni, ptl_process_t id, unsigned int *gen);
 void process_recv_mem(ni_t *ni, buf_t *buf);
 int mem_do_transfer(buf_t *buf);
 
@@ -269,16 +283,69 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni);
 void cleanup_udp(ni_t *ni);
 
 #if WITH_TRANSPORT_UDP
-void PtlSetMap_udp(ni_t *ni, ptl_size_t map_size,
-                   const ptl_process_t *mapping);
 void disconnect_conn_locked(conn_t *conn);
 void udp_send(ni_t *ni, buf_t *buf, struct sockaddr_in *dest);
-buf_t *udp_receive(ni_t *ni);
+buf_t *udp_receive(ni_t *ni, struct udp_rxq *rxq);
+int udp_wire_iov(buf_t *buf, struct udp_hdr *hdr, struct iovec *iov,
+                 int flags);
+unsigned int udp_wire_len(const struct udp_hdr *hdr);
+buf_t *udp_wire_to_buf(const unsigned char *wire, unsigned int len);
+buf_t *udp_frag_complete(buf_t *big_buf);
+buf_t *udp_received(ni_t *ni, buf_t *thebuf, const struct sockaddr_in *src);
+int udp_for_ni(ni_t *ni, const req_hdr_t *hdr);
+
+/* Cursor over the data of a large message, which is sent straight
+ * from the MD or ME, one fragment at a time. */
+struct udp_gather {
+    ptl_iovec_t *iov;
+    const ptl_size_t *iov_offsets;
+    mr_t **mr_list;             /* NULL if iov is already translated */
+    ptl_size_t num_iov;
+    ptl_size_t index;           /* current element */
+    ptl_size_t offset;          /* into the current element */
+};
+
+void udp_gather_init(buf_t *buf, struct udp_gather *g);
+int udp_gather_frag(struct udp_gather *g, struct iovec *iov,
+                    int max_iov, ptl_size_t *length);
+void udp_offload_init(iface_t *iface);
+int udp_steer_init(int s, int num_s, unsigned int stripe_offset);
+extern unsigned long udp_missteered;
+void udp_uring_init(iface_t *iface);
+void udp_uring_fini(iface_t *iface);
+int udp_pack_init(ni_t *ni);
+void udp_pack_fini(ni_t *ni);
+void udp_pack_progress(ni_t *ni, int idle);
 void process_recv_udp(ni_t *ni, buf_t *buf);
-void progress_thread_udp(ni_t *ni);
+int progress_thread_udp(ni_t *ni);
+
+/* TCP streams for the UDP transport, with PTL_TCP. */
+int tcp_listen(iface_t *iface, const struct sockaddr_in *addr);
+void tcp_iface_fini(iface_t *iface);
+int tcp_ni_init(ni_t *ni);
+void tcp_ni_fini(ni_t *ni);
+int init_connect_tcp(ni_t *ni, conn_t *conn);
+int send_message_tcp(buf_t *buf, int from_init);
+buf_t *tcp_receive(ni_t *ni);
+void tcp_cork_begin(ni_t *ni);
+void tcp_cork_end(ni_t *ni);
+#else
+static inline int progress_thread_udp(ni_t *ni)
+{
+    return 0;
+}
+#endif
+
+/* In-process loopback transport. */
+#if WITH_TRANSPORT_LOOP
+int loop_NIInit(ni_t *ni);
+void loop_NIFini(ni_t *ni);
+int loop_connect(ni_t *ni, conn_t *conn, ptl_process_t id);
+int progress_thread_loop(ni_t *ni);
 #else
-static inline void progress_thread_udp(ni_t *ni)
+static inline int progress_thread_loop(ni_t *ni)
 {
+    return 0;
 }
 #endif
 
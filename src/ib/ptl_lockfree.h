@@ -5,6 +5,8 @@
 #ifndef PTL_LOCKFREE_H
 #define PTL_LOCKFREE_H
 
+#include "ptl_sync.h"
+
 #if SANDIA_BUILTIN_CAS128 || HAVE_CMPXCHG16B
 /*
  * Lock free linked list. Enqueue/dequeue at the head (FIFO). Can be
@@ -44,6 +46,8 @@ PtlInternalAtomicCas128(ptlinternal_uint128_t *addr,
 
     assert(((uintptr_t) addr & 0xf) == 0);
 
+    ATOMIC_COUNT();
+
 #if defined SANDIA_BUILTIN_CAS128
     ret.c16 = __sync_val_compare_and_swap(addr, oldval.c16, newval.c16);
 
@@ -0,0 +1,333 @@
+/**
+ * @file ptl_log.c
+ *
+ * @brief Log message output, see ptl_log.h.
+ *
+ * Binary log file layout, in host byte order:
+ *	char magic[8] ("P4LOG001")
+ *	uint64_t tsc0, ns0, tsc1, ns1 (to convert ticks to time)
+ *	uint64_t realtime0 (CLOCK_REALTIME in ns at tsc0)
+ *	uint32_t number of call sites, then for each of them
+ *		int32_t level, int32_t line and the strings tag,
+ *		format, func and file
+ *	uint32_t number of rings, then for each of them
+ *		uint32_t tid, uint32_t unused, uint64_t count
+ *		and count struct log_rec, oldest first
+ * where a string is a uint32_t length followed by the characters.
+ */
+
+#include "ptl_loc.h"
+
+#include <stdarg.h>
+
+#define LOG_MAGIC	"P4LOG001"
+
+/* number of records per ring, 0 when printing to stderr */
+unsigned long ptl_log_binary;
+
+/* the call sites, gathered by the linker */
+extern const struct log_site __start_ptl_log_sites[] __attribute__ ((weak));
+extern const struct log_site __stop_ptl_log_sites[] __attribute__ ((weak));
+
+struct log_ring {
+    struct log_ring *next;
+    uint64_t head;
+    uint32_t tid;
+    struct log_rec rec[];
+};
+
+static __thread struct log_ring *log_ring;
+static struct log_ring *volatile log_rings;
+static atomic_t log_next_tid;
+
+static uint64_t log_tsc0;
+static uint64_t log_ns0;
+static uint64_t log_realtime0;
+
+static uint64_t log_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct log_ring *log_ring_alloc(void)
+{
+    struct log_ring *ring;
+    struct log_ring *head;
+
+    ring = calloc(1, sizeof(*ring) +
+                  ptl_log_binary * sizeof(struct log_rec));
+    if (!ring)
+        return NULL;
+
+    ring->tid = atomic_inc(&log_next_tid);
+
+    do {
+        head = log_rings;
+        ring->next = head;
+    } while (!__sync_bool_compare_and_swap(&log_rings, head, ring));
+
+    log_ring = ring;
+
+    return ring;
+}
+
+/* Store the arguments of a message in a record. */
+static void log_record(const struct log_site *site, const char *format,
+                       va_list ap)
+{
+    struct log_ring *ring = log_ring;
+    struct log_rec *rec;
+    const char *start;
+    enum log_arg kind;
+    int stars;
+    int len = 0;
+
+    if (unlikely(!ring)) {
+        ring = log_ring_alloc();
+        if (!ring)
+            return;
+    }
+
+    rec = &ring->rec[ring->head & (ptl_log_binary - 1)];
+    rec->tsc = trace_tsc();
+    rec->site = site - __start_ptl_log_sites;
+    rec->truncated = 0;
+
+    while ((kind = log_next_arg(&format, &start, &stars)) != LOG_ARG_END) {
+        uint64_t val;
+        const char *s;
+        size_t n;
+
+        /* '*' widths and precisions are recorded as integers */
+        for (; stars; stars--) {
+            val = va_arg(ap, int);
+            if (len + sizeof(val) <= sizeof(rec->data)) {
+                memcpy(&rec->data[len], &val, sizeof(val));
+                len += sizeof(val);
+            } else {
+                rec->truncated = 1;
+            }
+        }
+
+        switch (kind) {
+            case LOG_ARG_INT:
+                val = va_arg(ap, int);
+                break;
+            case LOG_ARG_LONG:
+                val = va_arg(ap, long long);
+                break;
+            case LOG_ARG_PTR:
+                val = (uintptr_t)va_arg(ap, void *);
+                break;
+            case LOG_ARG_DOUBLE:{
+                double d = va_arg(ap, double);
+
+                memcpy(&val, &d, sizeof(val));
+                break;
+            }
+            case LOG_ARG_STR:
+                s = va_arg(ap, const char *);
+                if (!s)
+                    s = "(null)";
+                if (len + 1 > sizeof(rec->data)) {
+                    rec->truncated = 1;
+                    continue;
+                }
+                n = strlen(s);
+                if (n > sizeof(rec->data) - len - 1) {
+                    n = sizeof(rec->data) - len - 1;
+                    rec->truncated = 1;
+                }
+                rec->data[len++] = n;
+                memcpy(&rec->data[len], s, n);
+                len += n;
+                continue;
+            default:
+                continue;
+        }
+
+        if (len + sizeof(val) <= sizeof(rec->data)) {
+            memcpy(&rec->data[len], &val, sizeof(val));
+            len += sizeof(val);
+        } else {
+            rec->truncated = 1;
+        }
+    }
+
+    rec->len = len;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Emit a log message.
+ *
+ * Called by the logging macros once the message is known to be
+ * enabled. Errors are always printed on stderr, even when the
+ * messages are recorded, and a fatal error writes the log file
+ * before the process aborts.
+ *
+ * @param[in] site the call site
+ * @param[in] format the message format, also in site
+ */
+void ptl_log_emit(const struct log_site *site, const char *format, ...)
+{
+    va_list ap;
+
+    if (ptl_log_binary && __start_ptl_log_sites) {
+        va_start(ap, format);
+        log_record(site, format, ap);
+        va_end(ap);
+
+        if (site->level > 1)
+            return;
+    }
+
+    flockfile(stderr);
+    fprintf(stderr, "%s%s(%s:%d): ", site->tag, site->func, site->file,
+            site->line);
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    funlockfile(stderr);
+
+    if (ptl_log_binary && site->level == 0)
+        ptl_log_dump();
+}
+
+static void write_string(FILE *f, const char *s)
+{
+    uint32_t len = s ? strlen(s) : 0;
+
+    fwrite(&len, sizeof(len), 1, f);
+    fwrite(s, 1, len, f);
+}
+
+/* Write the records of a ring, oldest first. The other threads keep
+ * logging, so the ring is copied out before it is written. */
+static void dump_ring(FILE *f, struct log_ring *ring, struct log_rec *copy)
+{
+    uint32_t hdr[2] = { ring->tid, 0 };
+    uint64_t head, first, count, i;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    memcpy(copy, ring->rec, ptl_log_binary * sizeof(struct log_rec));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    /* The record at the current head may be half written, and it
+     * replaces the one ptl_log_binary records before. */
+    first = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) + 1;
+    first = first > ptl_log_binary ? first - ptl_log_binary : 0;
+    count = head > first ? head - first : 0;
+
+    fwrite(hdr, sizeof(hdr), 1, f);
+    fwrite(&count, sizeof(count), 1, f);
+
+    for (i = head - count; i < head; i++)
+        fwrite(&copy[i & (ptl_log_binary - 1)], sizeof(struct log_rec), 1, f);
+}
+
+/**
+ * @brief Write all the rings to the log file.
+ *
+ * The threads still running may log meanwhile, see dump_ring(). The
+ * file is named by PTL_LOG_FILE, else p4log.<pid> in the current
+ * directory.
+ */
+void ptl_log_dump(void)
+{
+    const struct log_site *site;
+    struct log_ring *rings;
+    struct log_ring *ring;
+    struct log_rec *copy;
+    char name[64];
+    const char *path;
+    uint64_t stamps[5];
+    uint32_t n;
+    FILE *f;
+
+    if (!ptl_log_binary)
+        return;
+
+    path = getenv("PTL_LOG_FILE");
+    if (!path) {
+        snprintf(name, sizeof(name), "p4log.%d", getpid());
+        path = name;
+    }
+
+    copy = malloc(ptl_log_binary * sizeof(struct log_rec));
+    if (!copy) {
+        fprintf(stderr, "cannot allocate the log dump buffer\n");
+        return;
+    }
+
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "cannot open log file %s\n", path);
+        free(copy);
+        return;
+    }
+
+    stamps[0] = log_tsc0;
+    stamps[1] = log_ns0;
+    stamps[2] = trace_tsc();
+    stamps[3] = log_ns(CLOCK_MONOTONIC);
+    stamps[4] = log_realtime0;
+
+    fwrite(LOG_MAGIC, 1, 8, f);
+    fwrite(stamps, sizeof(stamps), 1, f);
+
+    n = __stop_ptl_log_sites - __start_ptl_log_sites;
+    fwrite(&n, sizeof(n), 1, f);
+    for (site = __start_ptl_log_sites; site < __stop_ptl_log_sites; site++) {
+        int32_t nums[2] = { site->level, site->line };
+
+        fwrite(nums, sizeof(nums), 1, f);
+        write_string(f, site->tag);
+        write_string(f, site->format);
+        write_string(f, site->func);
+        write_string(f, site->file);
+    }
+
+    /* rings added from now on are left out */
+    rings = log_rings;
+
+    n = 0;
+    for (ring = rings; ring; ring = ring->next)
+        n++;
+    fwrite(&n, sizeof(n), 1, f);
+
+    for (ring = rings; ring; ring = ring->next)
+        dump_ring(f, ring, copy);
+
+    fclose(f);
+    free(copy);
+}
+
+/**
+ * @brief Switch to binary logging if requested.
+ *
+ * Called once at library initialization, after the parameters have
+ * been read.
+ */
+void ptl_log_init(void)
+{
+    unsigned long size = get_param(PTL_LOG_BINARY);
+
+    if (!size || ptl_log_binary)
+        return;
+
+    log_tsc0 = trace_tsc();
+    log_ns0 = log_ns(CLOCK_MONOTONIC);
+    log_realtime0 = log_ns(CLOCK_REALTIME);
+
+    atexit(ptl_log_dump);
+
+    /* round up to a power of 2 */
+    ptl_log_binary = 1;
+    while (ptl_log_binary < size)
+        ptl_log_binary <<= 1;
+}
@@ -1,57 +1,173 @@
 /*
  * ptl_log.h - logging and trace macros
+ *
+ * Messages have a level: 1 for errors, 2 for warnings, 3 for info
+ * and 4 for function enter/exit. Messages above PTL_LOG_MAX_LEVEL
+ * (configure --with-log-level) are not compiled in at all. The others
+ * are emitted when PTL_LOG_LEVEL is at least their level; errors and
+ * fatal errors always are.
+ *
+ * By default an emitted message is printed on stderr. When
+ * PTL_LOG_BINARY is set to a number of records, messages are instead
+ * stored in binary form in a per-thread ring that is written to a file
+ * at exit, and decoded with p4log. Only the arguments are recorded:
+ * the format string, function, file and line of each call site are
+ * gathered at compile time in the ptl_log_sites section.
+ *
+ * This file does not depend on the rest of the library so that p4log
+ * can include it.
  */
 
 #ifndef PTL_LOG_H
 #define PTL_LOG_H
 
-#ifdef PTL_LOG_ENABLE
+#ifndef PTL_LOG_MAX_LEVEL
+#define PTL_LOG_MAX_LEVEL 4
+#endif
 
-#define ptl_enter(format, arg...)					\
-	do {								\
-		if (ptl_log_level > 3)					\
-		fprintf(stderr, "enter %s(%s:%d): " format,		\
-			__func__, __FILE__, __LINE__,  ## arg);		\
-	} while (0)
+/**
+ * @brief A logging call site, in the ptl_log_sites section.
+ */
+struct log_site {
+    const char *tag;
+    const char *format;
+    const char *func;
+    const char *file;
+    int line;
+    int level;
+};
+
+/**
+ * @brief One binary log record, also the on disk format.
+ *
+ * The data holds the arguments in the order of the format string:
+ * integers, pointers and doubles take 8 bytes, strings a length byte
+ * followed by their characters. Arguments that don't fit are dropped
+ * and truncated is set.
+ */
+struct log_rec {
+    uint64_t tsc;
+    uint32_t site;                      /**< index in ptl_log_sites */
+    uint16_t len;                       /**< bytes used in data */
+    uint8_t truncated;
+    uint8_t pad;
+    uint8_t data[48];
+};
+
+/**
+ * @brief Kinds of printf conversions.
+ */
+enum log_arg {
+    LOG_ARG_END,                        /* end of format */
+    LOG_ARG_INT,                        /* int or smaller */
+    LOG_ARG_LONG,                       /* 64 bits integer */
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STR,
+    LOG_ARG_PTR,
+    LOG_ARG_NONE,                       /* %% */
+};
+
+/**
+ * @brief Find the next conversion in a printf format.
+ *
+ * @param[in,out] fmt the format, on return points after the conversion
+ * @param[out] start the start of the conversion specification
+ * @param[out] stars number of '*' width/precision arguments it takes
+ *
+ * @return the kind of argument the conversion takes
+ */
+static inline enum log_arg log_next_arg(const char **fmt, const char **start,
+                                        int *stars)
+{
+    const char *p = *fmt;
+    int longs = 0;
+
+    while (*p && *p != '%')
+        p++;
+    if (!*p) {
+        *fmt = p;
+        return LOG_ARG_END;
+    }
+
+    *start = p++;
+    *stars = 0;
+
+    /* flags, width and precision */
+    while (*p && strchr("#0- +'.123456789*", *p)) {
+        if (*p == '*')
+            (*stars)++;
+        p++;
+    }
+
+    /* length modifiers */
+    while (*p && strchr("hlLqjzt", *p)) {
+        if (*p != 'h')
+            longs = 1;
+        p++;
+    }
+
+    *fmt = *p ? p + 1 : p;
 
-#define ptl_exit(format, arg...)					\
+    switch (*p) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+        case 'c':
+            return longs ? LOG_ARG_LONG : LOG_ARG_INT;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+        case 'a': case 'A':
+            return LOG_ARG_DOUBLE;
+        case 's':
+            return LOG_ARG_STR;
+        case 'p':
+            return LOG_ARG_PTR;
+        default:
+            return LOG_ARG_NONE;
+    }
+}
+
+extern int ptl_log_level;
+extern unsigned long ptl_log_binary;
+
+void ptl_log_emit(const struct log_site *site, const char *format, ...)
+__attribute__ ((cold, format(printf, 2, 3)));
+void ptl_log_init(void);
+void ptl_log_dump(void);
+
+/* Emit a message if level is compiled in and enabled. Errors
+ * always are. */
+#define ptl_log(level, tag, format, arg...)				\
 	do {								\
-		if (ptl_log_level > 3)					\
-		fprintf(stderr, "exit  %s(%s:%d): " format,		\
-			__func__, __FILE__, __LINE__,  ## arg);		\
+		if ((level) <= 1 ||					\
+		    (PTL_LOG_MAX_LEVEL >= (level) &&			\
+		     __builtin_expect(ptl_log_level >= (level), 0))) {	\
+			static const struct log_site __ptl_log_site	\
+			__attribute__ ((section("ptl_log_sites"),	\
+					aligned(8), used)) = {		\
+				tag, format, __func__, __FILE__,	\
+				__LINE__, level				\
+			};						\
+			ptl_log_emit(&__ptl_log_site, format, ## arg);	\
+		}							\
 	} while (0)
 
+#ifdef PTL_LOG_ENABLE
+
+#define ptl_enter(format, arg...)	ptl_log(4, "enter ", format, ## arg)
+#define ptl_exit(format, arg...)	ptl_log(4, "exit  ", format, ## arg)
+
 #else
 
 #define ptl_enter(format, arg...)
-#define ptl_enter(format, arg...)
+#define ptl_exit(format, arg...)
 
 #endif
 
-#define ptl_info(format, arg...)					\
-	do {								\
-		if (ptl_log_level > 2)					\
-		fprintf(stderr, "info  %s(%s:%d): " format,		\
-			__func__, __FILE__, __LINE__,  ## arg);		\
-	} while (0)
-
-#define ptl_warn(format, arg...)					\
-	do {								\
-		if (ptl_log_level > 1)					\
-		fprintf(stderr, "warn  %s(%s:%d): " format,		\
-			__func__, __FILE__, __LINE__,  ## arg);		\
-	} while (0)
-
-#define ptl_error(format, arg...)					\
-	do {								\
-		fprintf(stderr, "error %s(%s:%d): " format,		\
-			__func__, __FILE__, __LINE__,  ## arg);		\
-	} while (0)
+#define ptl_info(format, arg...)	ptl_log(3, "info  ", format, ## arg)
+#define ptl_warn(format, arg...)	ptl_log(2, "warn  ", format, ## arg)
+#define ptl_error(format, arg...)	ptl_log(1, "error ", format, ## arg)
 
 #define ptl_fatal(format, arg...)					\
 	do {								\
-		fprintf(stderr, "fatal %s(%s:%d): " format,		\
-			__func__, __FILE__, __LINE__,  ## arg);		\
+		ptl_log(0, "fatal ", format, ## arg);			\
 		abort();						\
 	} while (0)
 
@@ -0,0 +1,368 @@
+/**
+ * @file ptl_loop.c
+ *
+ * @brief In-process loopback transport.
+ *
+ * Connects the NIs of a process, including an NI talking to itself,
+ * through plain memory queues: no system call, no shared memory
+ * segment and no other process is involved. A message is enqueued
+ * on the destination NI, whose progress thread copies it into one of
+ * its own bufs, as a network would, and runs it through the receive
+ * state machine. Large data is copied in place by the target from or
+ * to the initiator's MD.
+ *
+ * This is meant to measure the software overhead of the library.
+ */
+
+#include "ptl_loc.h"
+
+/* Directory of the NIs of this process. */
+static struct {
+    pthread_mutex_t lock;
+    struct list_head nis;
+} loop_dir = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .nis = LIST_HEAD_INIT(loop_dir.nis),
+};
+
+/**
+ * @brief Send a message to an NI of this process.
+ *
+ * @param[in] buf
+ * @param[in] from_init
+ *
+ * @return status
+ */
+static int loop_send_message(buf_t *buf, int from_init)
+{
+    ni_t *dest = buf->conn->loop.dest_ni;
+
+    if (unlikely(dest->shutting_down))
+        return PTL_FAIL;
+
+    /* Keep a reference on the buffer until the destination has
+     * copied the message. Dropped by progress_thread_loop(). */
+    buf_get(buf);
+
+    buf->obj.next = NULL;
+
+    STATS_SEND(buf->obj.obj_ni, STATS_LOOP, buf->length);
+
+    enqueue(NULL, &dest->loop.queue, (obj_t *)buf);
+
+    return PTL_OK;
+}
+
+static void loop_set_send_flags(buf_t *buf, int can_signal)
+{
+    /* The message is copied by the destination. */
+    buf->event_mask |= XX_INLINE;
+}
+
+/**
+ * @param[in] ni
+ * @param[in] conn
+ *
+ * @return status
+ *
+ * conn must be locked
+ */
+static int loop_init_connect(ni_t *ni, conn_t *conn)
+{
+    /* Loop connections are connected when they are created. */
+    conn->state = CONN_STATE_CONNECTED;
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Build and append a data segment to a request message.
+ *
+ * Short data is carried in the message. Otherwise the target is told
+ * where the data is in the MD.
+ *
+ * @param[in] md the md that contains the data
+ * @param[in] dir the data direction, in or out
+ * @param[in] offset the offset into the md
+ * @param[in] length the length of the data
+ * @param[in] buf the buf the add the data segment to
+ *
+ * @return status
+ */
+static int loop_init_prepare_transfer(md_t *md, data_dir_t dir,
+                                      ptl_size_t offset, ptl_size_t length,
+                                      buf_t *buf)
+{
+    data_t *data = (data_t *)(buf->data + buf->length);
+    ni_t *ni = obj_to_ni(md);
+    void *addr;
+    ptl_size_t len;
+    mr_t *mr;
+    int err;
+
+    if (length <= get_param(PTL_MAX_INLINE_DATA))
+        return append_immediate_data(md->start, md->iov_offsets, NULL,
+                                     md->num_iov, dir, offset, length, buf);
+
+    data->data_fmt = DATA_FMT_LOOP;
+    data->loop.start = md->start;
+    data->loop.iov_offsets = md->iov_offsets;
+    data->loop.num_iov = md->num_iov;
+    data->loop.offset = offset;
+
+    /* Hold the memory the target will access, either the data or the
+     * iovec array. That also makes the initiator wait for the target
+     * to be done with it. */
+    if (md->num_iov) {
+        addr = md->start;
+        len = md->num_iov * sizeof(ptl_iovec_t);
+    } else {
+        addr = md->start + offset;
+        len = length;
+    }
+
+    err = mr_lookup_app(ni, addr, len, &mr);
+    if (err)
+        return err;
+
+    buf->mr_list[buf->num_mr++] = mr;
+
+    buf->length += sizeof(*data);
+
+    assert(buf->length <= BUF_DATA_SIZE);
+
+    return PTL_OK;
+}
+
+static int loop_tgt_data_out(buf_t *buf, data_t *data)
+{
+    if (data->data_fmt != DATA_FMT_LOOP) {
+        assert(0);
+        WARN();
+        return STATE_TGT_ERROR;
+    }
+
+    return STATE_TGT_RDMA;
+}
+
+/* Copy length bytes between addr and the ME/LE of buf, at offset. */
+static int loop_copy_me(me_t *me, data_dir_t dir, void *addr,
+                        ptl_size_t offset, ptl_size_t length)
+{
+    if (me->num_iov) {
+        if (dir == DATA_DIR_IN)
+            return iov_copy_in(addr, me->start, me->iov_offsets, NULL,
+                               me->num_iov, offset, length);
+        else
+            return iov_copy_out(addr, me->start, me->iov_offsets, NULL,
+                                me->num_iov, offset, length);
+    }
+
+    if (dir == DATA_DIR_IN)
+        memcpy(me->start + offset, addr, length);
+    else
+        memcpy(addr, me->start + offset, length);
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Copy the data between the initiator's MD and the target's
+ * ME/LE.
+ *
+ * Everything is copied at once.
+ *
+ * @param[in] buf the target buf
+ *
+ * @return status
+ */
+static int loop_do_transfer(buf_t *buf)
+{
+    data_dir_t dir = buf->rdma_dir;
+    data_t *data = (dir == DATA_DIR_IN) ? buf->data_in : buf->data_out;
+    ptl_size_t *resid =
+        (dir == DATA_DIR_IN) ? &buf->put_resid : &buf->get_resid;
+    ptl_size_t moffset = buf->moffset;
+    ptl_size_t roffset = data->loop.offset;
+    ptl_size_t length = *resid;
+    int err;
+
+    if (!data->loop.num_iov) {
+        err = loop_copy_me(buf->me, dir, data->loop.start + roffset, moffset,
+                           length);
+    } else {
+        ptl_iovec_t *iov = data->loop.start;
+        ptl_size_t num_iov = data->loop.num_iov;
+        ptl_size_t i;
+
+        i = iov_seek(iov, data->loop.iov_offsets, num_iov, &roffset);
+
+        err = PTL_OK;
+        while (length) {
+            ptl_size_t len;
+
+            if (i >= num_iov) {
+                WARN();
+                return PTL_FAIL;
+            }
+
+            len = iov[i].iov_len - roffset;
+            if (len > length)
+                len = length;
+
+            err = loop_copy_me(buf->me, dir, iov[i].iov_base + roffset,
+                               moffset, len);
+            if (err)
+                break;
+
+            moffset += len;
+            length -= len;
+            roffset = 0;
+            i++;
+        }
+    }
+
+    if (err)
+        return err;
+
+    *resid = 0;
+
+    return PTL_OK;
+}
+
+struct transport transport_loop = {
+    .type = CONN_TYPE_LOOP,
+    .buf_alloc = buf_alloc,
+    .init_connect = loop_init_connect,
+    .send_message = loop_send_message,
+    .set_send_flags = loop_set_send_flags,
+    .init_prepare_transfer = loop_init_prepare_transfer,
+    .post_tgt_dma = loop_do_transfer,
+    .tgt_data_out = loop_tgt_data_out,
+};
+
+/**
+ * @brief Make a new connection use the loop transport if the process
+ * is in this one.
+ *
+ * @param[in] ni the NI owning the connection
+ * @param[in] conn the new connection
+ * @param[in] id physical ID of the remote process
+ *
+ * @return PTL_OK if the connection uses the loop transport, PTL_FAIL
+ * otherwise
+ */
+int loop_connect(ni_t *ni, conn_t *conn, ptl_process_t id)
+{
+    struct list_head *l;
+    ni_t *dest = NULL;
+
+    pthread_mutex_lock(&loop_dir.lock);
+
+    list_for_each(l, &loop_dir.nis) {
+        ni_t *n = list_entry(l, ni_t, loop.list);
+
+        if (n->ni_type == ni->ni_type &&
+            n->iface->id.phys.nid == id.phys.nid &&
+            n->iface->id.phys.pid == id.phys.pid) {
+            /* Dropped with the connection. */
+            ni_get(n);
+            dest = n;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&loop_dir.lock);
+
+    if (!dest)
+        return PTL_FAIL;
+
+    conn->transport = transport_loop;
+    conn->loop.dest_ni = dest;
+    conn->state = CONN_STATE_CONNECTED;
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Register an NI so that the other NIs of the process can
+ * reach it.
+ *
+ * @param[in] ni
+ *
+ * @return status
+ */
+int loop_NIInit(ni_t *ni)
+{
+    queue_init(&ni->loop.queue);
+    INIT_LIST_HEAD(&ni->loop.list);
+
+    if (!get_param(PTL_ENABLE_LOOP))
+        return PTL_OK;
+
+    pthread_mutex_lock(&loop_dir.lock);
+    list_add_tail(&ni->loop.list, &loop_dir.nis);
+    pthread_mutex_unlock(&loop_dir.lock);
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Unregister an NI and drop the messages still queued on it.
+ *
+ * Called once the progress thread is stopped.
+ *
+ * @param[in] ni
+ */
+void loop_NIFini(ni_t *ni)
+{
+    buf_t *buf;
+
+    pthread_mutex_lock(&loop_dir.lock);
+    list_del_init(&ni->loop.list);
+    pthread_mutex_unlock(&loop_dir.lock);
+
+    while ((buf = (buf_t *)dequeue(NULL, &ni->loop.queue)))
+        buf_put(buf);              /* from loop_send_message() */
+}
+
+/**
+ * @brief Receive one message from the NIs of this process.
+ *
+ * @param[in] ni the ni to poll.
+ *
+ * @return 1 if a message was processed, 0 otherwise.
+ */
+int progress_thread_loop(ni_t *ni)
+{
+    buf_t *loop_buf;
+    buf_t *buf;
+    int err;
+
+    loop_buf = (buf_t *)dequeue(NULL, &ni->loop.queue);
+    if (!loop_buf)
+        return 0;
+
+    STATS_RECV(ni, STATS_LOOP, loop_buf->length);
+
+    err = buf_alloc(ni, &buf);
+    if (err) {
+        WARN();
+        buf_put(loop_buf);
+        return 1;
+    }
+
+    /* Take a copy so the sender gets its buffer back now. */
+    memcpy(buf->internal_data, loop_buf->data, loop_buf->length);
+    buf->length = loop_buf->length;
+#if WITH_TRANSPORT_SHMEM
+    buf->mem_buf = NULL;
+#endif
+    INIT_LIST_HEAD(&buf->list);
+
+    buf_put(loop_buf);             /* from loop_send_message() */
+
+    process_recv_mem(ni, buf);
+
+    return 1;
+}
@@ -81,7 +81,7 @@ static int init_iovec(md_t *md, const ptl_iovec_t *iov_list, int num_iov)
 
     md->num_iov = num_iov;
 
-    md->internal_data = calloc(num_iov, sizeof(mr_t)
+    md->internal_data = calloc(num_iov, sizeof(mr_t) + sizeof(ptl_size_t)
 #if WITH_TRANSPORT_IB
                                + sizeof(struct ibv_sge)
 #endif
@@ -99,6 +99,9 @@ static int init_iovec(md_t *md, const ptl_iovec_t *iov_list, int num_iov)
     md->mr_list = p;
     p += num_iov * sizeof(mr_t);
 
+    md->iov_offsets = p;
+    p += num_iov * sizeof(ptl_size_t);
+
 #if WITH_TRANSPORT_IB
     sge = md->sge_list = p;
     p += num_iov * sizeof(struct ibv_sge);
@@ -121,7 +124,7 @@ static int init_iovec(md_t *md, const ptl_iovec_t *iov_list, int num_iov)
         md->sge_list_mr = NULL;
     }
 
-    md->length = 0;
+    md->length = iov_build_offsets(iov_list, num_iov, md->iov_offsets);
 
     iov = iov_list;
 
@@ -134,8 +137,6 @@ static int init_iovec(md_t *md, const ptl_iovec_t *iov_list, int num_iov)
         void *iov_addr;
         mr_t *mr;
 
-        md->length += iov->iov_len;
-
         err = mr_lookup_app(ni, iov->iov_base, iov->iov_len, &md->mr_list[i]);
         if (err)
             goto err3;
@@ -51,6 +51,9 @@ struct md {
 	 * can hold one mr per iovec contained in internal_data	 */
     mr_t **mr_list;
 
+        /** offset of each iovec in the md, to seek with iov_seek() */
+    ptl_size_t *iov_offsets;
+
 #if WITH_TRANSPORT_SHMEM || IS_PPE
         /** list of info for each iovec for use in long
 	 * messages sent through shared memory */
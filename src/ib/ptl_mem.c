@@ -193,17 +193,31 @@ int mem_do_transfer(buf_t *buf)
 }
 #endif
 
-/* Computes a hash (crc32 based), to identify which group this NI belong to. */
+/* Computes a hash (crc32 based), to identify which group this NI
+ * belong to. Table driven since it runs over the whole map. */
 static uint32_t crc32(const unsigned char *p, uint32_t crc, int size)
 {
-    while (size--) {
-        int n;
+    static uint32_t table[256];
+    static int table_done;
 
-        crc ^= *p++;
-        for (n = 0; n < 8; n++)
-            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+    if (!table_done) {
+        uint32_t i;
+
+        for (i = 0; i < 256; i++) {
+            uint32_t c = i;
+            int n;
+
+            for (n = 0; n < 8; n++)
+                c = (c >> 1) ^ ((c & 1) ? 0xedb88320 : 0);
+            table[i] = c;
+        }
+        __sync_synchronize();
+        table_done = 1;
     }
 
+    while (size--)
+        crc = (crc >> 8) ^ table[(crc ^ *p++) & 0xff];
+
     return crc;
 }
 
@@ -239,6 +253,11 @@ int PtlSetMap_mem(ni_t *ni, ptl_size_t map_size, const ptl_process_t *mapping)
                     WARN();
                     return PTL_ARG_INVALID;
                 }
+#if WITH_TRANSPORT_LOOP
+                /* Keep the ranks of this process on the loop
+                 * transport. */
+                if (conn->transport.type != CONN_TYPE_LOOP) {
+#endif
 #if IS_PPE
                 conn->transport = transport_mem;
 #elif WITH_TRANSPORT_SHMEM
@@ -249,6 +268,9 @@ int PtlSetMap_mem(ni_t *ni, ptl_size_t map_size, const ptl_process_t *mapping)
 #error
 #endif
                 conn->state = CONN_STATE_CONNECTED;
+#if WITH_TRANSPORT_LOOP
+                }
+#endif
 
                 conn_put(conn);        /* from get_conn */
             }
@@ -13,12 +13,79 @@ char *ptl_iface_name;
 int ptl_disable_ummu;
 
 unsigned long pagesize;
+unsigned long hugepagesize;
 unsigned int linesize;
 
 #if !IS_LIGHT_LIB
 struct transports transports;
 #endif
 
+#if WITH_TRANSPORT_UDP && !IS_LIGHT_LIB
+/* Datagrams received through another socket than the one their
+ * stripe picks, ULONG_MAX until an interface steers them. */
+unsigned long udp_missteered = ULONG_MAX;
+#endif
+
+#if PTL_ATOMIC_COUNT
+__thread unsigned long ptl_atomic_count;
+#endif
+
+/* Number of atomic read-modify-writes done so far by the calling
+ * thread, or ULONG_MAX when they are not counted. Not part of the
+ * API; used by the tests. Always defined, since portals4.map exports
+ * it. */
+unsigned long PtlInternalAtomicCount(void)
+{
+#if PTL_ATOMIC_COUNT
+    return ptl_atomic_count;
+#else
+    return ULONG_MAX;
+#endif
+}
+
+/* Number of UDP datagrams received through another socket than the
+ * one their stripe picks, or ULONG_MAX when no interface steers them
+ * over several sockets. Not part of the API; used by the tests. */
+unsigned long PtlInternalUDPMissteered(void)
+{
+#if WITH_TRANSPORT_UDP && !IS_LIGHT_LIB
+    return udp_missteered;
+#else
+    return ULONG_MAX;
+#endif
+}
+
+/* Default huge page size, used when /proc/meminfo doesn't tell. */
+#define DEFAULT_HUGEPAGESIZE (2*1024*1024)
+
+/**
+ * Find the size of the default huge pages.
+ *
+ * @return the huge page size in bytes
+ */
+static unsigned long get_hugepagesize(void)
+{
+    FILE *f;
+    char line[128];
+    unsigned long size = 0;
+
+    f = fopen("/proc/meminfo", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "Hugepagesize: %lu kB", &size) == 1) {
+                size *= 1024;
+                break;
+            }
+        }
+        fclose(f);
+    }
+
+    if (size == 0 || (size & (size - 1)))
+        size = DEFAULT_HUGEPAGESIZE;
+
+    return size;
+}
+
 #ifdef IS_PPE
 
 /* Various initalizations that must be done once. */
@@ -27,9 +94,14 @@ int ppe_misc_init_once(void)
     init_param();
     debug = get_param(PTL_DEBUG);
     ptl_log_level = get_param(PTL_LOG_LEVEL);
+    ptl_log_init();
     ptl_iface_name = getenv("PTL_IFACE_NAME");
     ptl_disable_ummu = get_param(PTL_DISABLE_MEM_REG_CACHE);
     pagesize = sysconf(_SC_PAGESIZE);
+    hugepagesize = get_hugepagesize();
+#if !IS_LIGHT_LIB
+    trace_init();
+#endif
 #ifdef _SC_LEVEL1_DCACHE_LINESIZE
     linesize = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
     if (0 == linesize)
@@ -67,9 +139,14 @@ int misc_init_once(void)
     init_param();
     debug = get_param(PTL_DEBUG);
     ptl_log_level = get_param(PTL_LOG_LEVEL);
+    ptl_log_init();
     ptl_iface_name = getenv("PTL_IFACE_NAME");
     ptl_disable_ummu = get_param(PTL_DISABLE_MEM_REG_CACHE);
     pagesize = sysconf(_SC_PAGESIZE);
+    hugepagesize = get_hugepagesize();
+#if !IS_LIGHT_LIB
+    trace_init();
+#endif
 #ifdef _SC_LEVEL1_DCACHE_LINESIZE
     linesize = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
     if (0 == linesize)
@@ -1,8 +1,11 @@
 int gbl_init(gbl_t *gbl);
 extern int ptl_log_level;
 extern unsigned long pagesize;
+extern unsigned long hugepagesize;
 extern unsigned int linesize;
 
+unsigned long PtlInternalUDPMissteered(void);
+
 #ifdef IS_PPE
 int ppe_misc_init_once(void);
 #else
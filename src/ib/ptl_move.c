@@ -37,6 +37,9 @@ static int get_transport_buf(ni_t *ni, ptl_process_t target_id,
 
     buf->conn = conn;
 
+    /* Start from the header prebuilt for this peer. */
+    *(req_hdr_t *)buf->data = conn->req_tmpl;
+
     *retbuf = buf;
 
     return PTL_OK;
@@ -92,14 +95,14 @@ int _PtlPut(PPEGBL ptl_handle_md_t md_handle, ptl_size_t local_offset,
     buf_t *buf;
     req_hdr_t *hdr;
 
-    err = gbl_get();
+    err = gbl_borrow();
     if (unlikely(err))
         goto err0;
 
     md = to_md(MYGBL_ md_handle);
     if (unlikely(!md)) {
         err = PTL_ARG_INVALID;
-        goto err1;
+        goto err0;
     }
 
     ni = obj_to_ni(md);
@@ -116,12 +119,7 @@ int _PtlPut(PPEGBL ptl_handle_md_t md_handle, ptl_size_t local_offset,
 
     hdr = (req_hdr_t *) buf->data;
 
-#if WITH_TRANSPORT_UDP
-    hdr->h1.version = PTL_HDR_VER_1;
-#endif
-
     hdr->h1.operation = OP_PUT;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     hdr->ack_req = ack_req;
@@ -139,15 +137,12 @@ int _PtlPut(PPEGBL ptl_handle_md_t md_handle, ptl_size_t local_offset,
 
     err = process_init(buf);; 
     if (unlikely(err))
-        goto err1;
+        goto err0;
 
-    gbl_put();
     return PTL_OK;
 
   err2:
     md_put(md);
-  err1:
-    gbl_put();
   err0:
     return err;
 }
@@ -206,7 +201,6 @@ int _PtlTriggeredPut(PPEGBL ptl_handle_md_t md_handle,
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_PUT;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     hdr->ack_req = ack_req;
@@ -274,14 +268,14 @@ int _PtlGet(PPEGBL ptl_handle_md_t md_handle, ptl_size_t local_offset,
     buf_t *buf;
     req_hdr_t *hdr;
 
-    err = gbl_get();
+    err = gbl_borrow();
     if (unlikely(err))
         goto err0;
 
     md = to_md(MYGBL_ md_handle);
     if (unlikely(!md)) {
         err = PTL_ARG_INVALID;
-        goto err1;
+        goto err0;
     }
 
     ni = obj_to_ni(md);
@@ -299,7 +293,6 @@ int _PtlGet(PPEGBL ptl_handle_md_t md_handle, ptl_size_t local_offset,
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_GET;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     buf->rlength = length;
@@ -315,15 +308,12 @@ int _PtlGet(PPEGBL ptl_handle_md_t md_handle, ptl_size_t local_offset,
 
     err = process_init(buf); 
     if (unlikely(err)) 
-        goto err1;
+        goto err0;
 
-    gbl_put();
     return PTL_OK;
 
   err2:
     md_put(md);
-  err1:
-    gbl_put();
   err0:
     return err;
 }
@@ -381,7 +371,6 @@ int _PtlTriggeredGet(PPEGBL ptl_handle_md_t md_handle,
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_GET;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     buf->rlength = length;
@@ -506,14 +495,14 @@ int _PtlAtomic(PPEGBL ptl_handle_md_t md_handle, ptl_size_t local_offset,
     buf_t *buf;
     req_hdr_t *hdr;
 
-    err = gbl_get();
+    err = gbl_borrow();
     if (unlikely(err))
         goto err0;
 
     md = to_md(MYGBL_ md_handle);
     if (unlikely(!md)) {
         err = PTL_ARG_INVALID;
-        goto err1;
+        goto err0;
     }
 
     ni = obj_to_ni(md);
@@ -533,7 +522,6 @@ int _PtlAtomic(PPEGBL ptl_handle_md_t md_handle, ptl_size_t local_offset,
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_ATOMIC;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     hdr->ack_req = ack_req;
@@ -553,15 +541,12 @@ int _PtlAtomic(PPEGBL ptl_handle_md_t md_handle, ptl_size_t local_offset,
 
     err = process_init(buf); 
     if (unlikely(err)) 
-        goto err1;
+        goto err0;
 
-    gbl_put();
     return PTL_OK;
 
   err2:
     md_put(md);
-  err1:
-    gbl_put();
   err0:
     return err;
 }
@@ -623,7 +608,6 @@ int _PtlTriggeredAtomic(PPEGBL ptl_handle_md_t md_handle,
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_ATOMIC;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     hdr->ack_req = ack_req;
@@ -679,14 +663,14 @@ int _PtlFetchAtomic(PPEGBL ptl_handle_md_t get_md_handle,
     buf_t *buf;
     req_hdr_t *hdr;
 
-    err = gbl_get();
+    err = gbl_borrow();
     if (unlikely(err))
         goto err0;
 
     get_md = to_md(MYGBL_ get_md_handle);
     if (unlikely(!get_md)) {
         err = PTL_ARG_INVALID;
-        goto err1;
+        goto err0;
     }
 
     put_md = to_md(MYGBL_ put_md_handle);
@@ -727,7 +711,6 @@ int _PtlFetchAtomic(PPEGBL ptl_handle_md_t get_md_handle,
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_FETCH;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     hdr->hdr_data = cpu_to_le64(hdr_data);
@@ -750,17 +733,14 @@ int _PtlFetchAtomic(PPEGBL ptl_handle_md_t get_md_handle,
 
     err = process_init(buf); 
     if (unlikely(err)) 
-        goto err1;
+        goto err0;
 
-    gbl_put();
     return PTL_OK;
 
   err3:
     md_put(put_md);
   err2:
     md_put(get_md);
-  err1:
-    gbl_put();
   err0:
     return err;
 }
@@ -847,7 +827,6 @@ int _PtlTriggeredFetchAtomic(PPEGBL ptl_handle_md_t get_md_handle,
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_FETCH;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     hdr->hdr_data = cpu_to_le64(hdr_data);
@@ -974,14 +953,14 @@ int _PtlSwap(PPEGBL ptl_handle_md_t get_md_handle,
     buf_t *buf;
     req_hdr_t *hdr;
 
-    err = gbl_get();
+    err = gbl_borrow();
     if (unlikely(err))
         goto err0;
 
     get_md = to_md(MYGBL_ get_md_handle);
     if (unlikely(!get_md)) {
         err = PTL_ARG_INVALID;
-        goto err1;
+        goto err0;
     }
 
     put_md = to_md(MYGBL_ put_md_handle);
@@ -1022,7 +1001,6 @@ int _PtlSwap(PPEGBL ptl_handle_md_t get_md_handle,
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_SWAP;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     hdr->hdr_data = cpu_to_le64(hdr_data);
@@ -1052,17 +1030,14 @@ int _PtlSwap(PPEGBL ptl_handle_md_t get_md_handle,
 
     err = process_init(buf); 
     if (unlikely(err)) 
-        goto err1;
+        goto err0;
 
-    gbl_put();
     return PTL_OK;
 
   err3:
     md_put(put_md);
   err2:
     md_put(get_md);
-  err1:
-    gbl_put();
   err0:
     return err;
 }
@@ -1148,7 +1123,6 @@ int _PtlTriggeredSwap(PPEGBL ptl_handle_md_t get_md_handle,
     hdr = (req_hdr_t *) buf->data;
 
     hdr->h1.operation = OP_SWAP;
-    hdr->uid = cpu_to_le32(ni->uid);
     hdr->pt_index = cpu_to_le32(pt_index);
     hdr->match_bits = cpu_to_le64(match_bits);
     hdr->hdr_data = cpu_to_le64(hdr_data);
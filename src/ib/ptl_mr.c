@@ -342,6 +342,7 @@ int mr_lookup(ni_t *ni, struct ni_mr_tree *tree, void *start,
                     /* Requested mr fits in an existing region. */
                     mr_get(mr);
                     if (atomic_read(&mr->obj.obj_ref.ref_cnt) >= 1){
+                        STATS_INC(ni, mr_hits);
                         ret = 0;
                         *mr_p = mr;
                         goto done;
@@ -402,10 +403,14 @@ int mr_lookup(ni_t *ni, struct ni_mr_tree *tree, void *start,
             mr = NULL;
         }
     }
-    /* No memory registration cache enabled */
+    /* No memory registration cache enabled. The new MR belongs to the
+     * caller only and is not inserted in the tree, since the same
+     * range can be registered again before it is released. */
     else {
         INIT_LIST_HEAD(&mr_list);
     }
+    STATS_INC(ni, mr_misses);
+
     /* Insert the new node */
     ret = mr_create(ni, start, length, mr_p);
     if (ret) {
@@ -433,7 +438,7 @@ int mr_lookup(ni_t *ni, struct ni_mr_tree *tree, void *start,
 
         *mr_p = NULL;
         ret = PTL_FAIL;
-    } else {
+    } else if (global_umn_init == 1) {
         void *res;
 
         /* Remove all the MRs that are included in the new MR. We must
@@ -146,7 +146,12 @@ static int init_pools(ni_t *ni)
     ni->buf_pool.init = buf_init;
     ni->buf_pool.fini = buf_fini;
     ni->buf_pool.cleanup = buf_cleanup;
-    ni->buf_pool.slab_size = 128 * 1024;
+    /* With huge pages, make a slab span a whole huge page so the
+     * bufs share as few TLB entries as possible. */
+    if (get_param(PTL_HUGEPAGES))
+        ni->buf_pool.slab_size = hugepagesize;
+    else
+        ni->buf_pool.slab_size = 128 * 1024;
 
     err =
         pool_init(gbl, &ni->buf_pool, "buf", real_buf_t_size(), POOL_BUF,
@@ -170,51 +175,154 @@ static int init_pools(ni_t *ni)
     return PTL_OK;
 }
 
+/* true if rank i continues run */
+static inline int rank_in_run(const rank_run_t *run, ptl_rank_t i,
+                              const ptl_process_t *mapping)
+{
+    const uint32_t k = i - run->first;
+
+    return mapping[i].phys.nid == run->nid + k * run->nid_stride &&
+        mapping[i].phys.pid == run->pid + k * run->pid_stride;
+}
+
+/*
+ * split the mapping into runs of ranks with a constant nid and pid
+ * stride. Only counts the runs if runs is NULL.
+ */
+static int build_runs(const ptl_process_t *mapping, ptl_size_t map_size,
+                      rank_run_t *runs)
+{
+    rank_run_t run;
+    int num_runs = 0;
+    ptl_rank_t i;
+
+    for (i = 0; i < map_size; i++) {
+        if (num_runs) {
+            if (run.count == 1) {
+                /* second rank sets the stride */
+                run.nid_stride = mapping[i].phys.nid - run.nid;
+                run.pid_stride = mapping[i].phys.pid - run.pid;
+                run.count++;
+                continue;
+            }
+
+            if (rank_in_run(&run, i, mapping)) {
+                run.count++;
+                continue;
+            }
+
+            if (runs)
+                runs[num_runs - 1] = run;
+        }
+
+        run.first = i;
+        run.count = 1;
+        run.nid = mapping[i].phys.nid;
+        run.pid = mapping[i].phys.pid;
+        run.nid_stride = 0;
+        run.pid_stride = 0;
+        num_runs++;
+    }
+
+    if (runs && num_runs)
+        runs[num_runs - 1] = run;
+
+    return num_runs;
+}
+
+/**
+ * @brief Convert a rank to its nid/pid for a logical NI.
+ *
+ * @param[in] ni the NI
+ * @param[in] rank the rank, must be less than the map size
+ * @param[out] id the physical id of the rank
+ */
+void rank_to_phys(const ni_t *ni, ptl_rank_t rank, ptl_process_t *id)
+{
+    const rank_run_t *run;
+    int lo, hi;
+    uint32_t k;
+
+    if (ni->logical.mapping) {
+        *id = ni->logical.mapping[rank];
+        return;
+    }
+
+    /* binary search the run containing rank */
+    lo = 0;
+    hi = ni->logical.num_runs - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (ni->logical.runs[mid].first <= rank)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    run = &ni->logical.runs[lo];
+    k = rank - run->first;
+    id->phys.nid = run->nid + k * run->nid_stride;
+    id->phys.pid = run->pid + k * run->pid_stride;
+}
+
 /*
  * create_tables
  *	initialize private rank table in NI
- *	we are not yet connected to remote QPs
+ *	connections are only allocated when a rank is first used,
+ *	and the mapping is kept as runs when that is smaller
  */
-static int create_tables(ni_t *ni)
+static int create_tables(ni_t *ni, const ptl_process_t *mapping)
 {
-    int i;
-    conn_t *conn;
     const ptl_size_t map_size = ni->logical.map_size;
-    ptl_process_t *mapping = ni->logical.mapping;
+    int num_runs;
 
-    ni->logical.rank_table = calloc(map_size, sizeof(entry_t));
-    if (!ni->logical.rank_table) {
+    /* calloc'ed so pages of the table are only backed once
+     * connections to their ranks are made */
+    ni->logical.conn_table = calloc(map_size, sizeof(conn_t *));
+    if (!ni->logical.conn_table) {
         WARN();
         return PTL_NO_SPACE;
     }
 
-    ptl_info("mapping table: \n");
+    num_runs = build_runs(mapping, map_size, NULL);
 
-    for (i = 0; i < map_size; i++) {
-        entry_t *entry = &ni->logical.rank_table[i];
-
-        entry->rank = i;
-        entry->nid = mapping[i].phys.nid;
-        entry->pid = mapping[i].phys.pid;
-
-        if (conn_alloc(ni, &entry->connect))
-            return PTL_FAIL;
-
-        /* convert nid/pid to ipv4 address */
-        conn = entry->connect;
-        conn->sin.sin_family = AF_INET;
-        conn->sin.sin_addr.s_addr = nid_to_addr(entry->nid);
-        conn->sin.sin_port = pid_to_port(entry->pid);
-#if WITH_TRANSPORT_UDP
-//              conn->sin.sin_port = entry->pid;
-        ptl_info("entry: %i, ADDR: %s PID: %i \n", i,
-                 inet_ntoa(conn->sin.sin_addr), (entry->pid));
-#endif
+    if (num_runs * sizeof(rank_run_t) < map_size * sizeof(ptl_process_t)) {
+        ni->logical.runs = malloc(num_runs * sizeof(rank_run_t));
+        if (!ni->logical.runs) {
+            WARN();
+            return PTL_NO_SPACE;
+        }
+        ni->logical.num_runs = build_runs(mapping, map_size,
+                                          ni->logical.runs);
+    } else {
+        ni->logical.mapping = malloc(map_size * sizeof(ptl_process_t));
+        if (!ni->logical.mapping) {
+            WARN();
+            return PTL_NO_SPACE;
+        }
+        memcpy(ni->logical.mapping, mapping,
+               map_size * sizeof(ptl_process_t));
     }
 
+    ptl_info("mapping table: %d ranks in %d runs\n", (int)map_size,
+             num_runs);
+
     return PTL_OK;
 }
 
+/* release the tables built by create_tables */
+static void destroy_tables(ni_t *ni)
+{
+    free(ni->logical.mapping);
+    ni->logical.mapping = NULL;
+    free(ni->logical.runs);
+    ni->logical.runs = NULL;
+    ni->logical.num_runs = 0;
+    free(ni->logical.conn_table);
+    ni->logical.conn_table = NULL;
+}
+
 enum {
     NI_INIT_CLEANUP,
     NI_WAIT_DISCONNECT_ALL,
@@ -317,6 +425,7 @@ int _PtlNIInit(gbl_t *gbl, ptl_interface_t iface_id, unsigned int options,
     ni->cleanup_state = NI_INIT_CLEANUP;
     INIT_LIST_HEAD(&ni->md_list);
     INIT_LIST_HEAD(&ni->ct_list);
+    INIT_LIST_HEAD(&ni->eq_list);
 #if WITH_TRANSPORT_UDP
     PTL_FASTLOCK_INIT(&ni->udp_lock);
     INIT_LIST_HEAD(&ni->udp_list);
@@ -330,6 +439,7 @@ int _PtlNIInit(gbl_t *gbl, ptl_interface_t iface_id, unsigned int options,
 #endif
     PTL_FASTLOCK_INIT(&ni->md_list_lock);
     PTL_FASTLOCK_INIT(&ni->ct_list_lock);
+    PTL_FASTLOCK_INIT(&ni->eq_list_lock);
     pthread_mutex_init(&ni->atomic_mutex, NULL);
     pthread_mutex_init(&ni->pt_mutex, NULL);
 
@@ -350,6 +460,16 @@ int _PtlNIInit(gbl_t *gbl, ptl_interface_t iface_id, unsigned int options,
     if (unlikely(err))
         goto err3;
 
+#if WITH_TRANSPORT_LOOP
+    /* Before the other transports, which may connect the NI to
+     * itself. */
+    err = loop_NIInit(ni);
+    if (unlikely(err)) {
+        WARN();
+        goto err3;
+    }
+#endif
+
     /* Initialize the remote transport first, because the local
      * transport might depend on it. */
     if (transports.remote.NIInit) {
@@ -384,6 +504,11 @@ int _PtlNIInit(gbl_t *gbl, ptl_interface_t iface_id, unsigned int options,
         goto err3;
     }
 
+#if !IS_PPE
+    err = stats_init(ni);
+    if (err)
+        goto err3;
+#endif
 
     /* Add a progress thread. */
     err = start_progress_thread(ni);
@@ -422,7 +547,6 @@ int _PtlSetMap(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t map_size,
     int err;
     ni_t *ni;
     iface_t *iface;
-    int length;
     int i;
 
     err = gbl_get();
@@ -434,7 +558,7 @@ int _PtlSetMap(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t map_size,
     if (unlikely(err))
         goto err1;
 
-    if (ni->logical.mapping) {
+    if (ni_has_map(ni)) {
         ni_put(ni);
         gbl_put();
 
@@ -455,18 +579,6 @@ int _PtlSetMap(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t map_size,
         goto err2;
     }
 
-    /* Allocate new mapping and fill-up now. */
-    length = map_size * sizeof(ptl_process_t);
-
-    ni->logical.mapping = malloc(length);
-    if (!ni->logical.mapping) {
-        WARN();
-        goto err2;
-    }
-    ni->logical.map_size = map_size;
-
-    memcpy(ni->logical.mapping, mapping, length);
-
     /* lookup our nid/pid to determine rank */
     ni->id.rank = PTL_RANK_ANY;
 
@@ -486,19 +598,19 @@ int _PtlSetMap(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t map_size,
 
     if (ni->id.rank == PTL_RANK_ANY) {
         WARN();
-        free(ni->logical.mapping);
-        ni->logical.map_size = 0;
         goto err2;
     }
 
-    err = create_tables(ni);
+    ni->logical.map_size = map_size;
+
+    err = create_tables(ni, mapping);
     if (err) {
         WARN();
+        destroy_tables(ni);
+        ni->logical.map_size = 0;
         goto err2;
     }
 
-
-
     if (transports.local.SetMap) {
         err = transports.local.SetMap(ni, map_size, mapping);
         if (err) {
@@ -507,7 +619,6 @@ int _PtlSetMap(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t map_size,
         }
     }
 #if WITH_TRANSPORT_UDP
-    PtlSetMap_udp(ni, map_size, mapping);
     ni->udp.map_done = 1;
     ptl_info("done setting maps. my rank is: %i port: %i\n", ni->id.rank,
              iface->id.phys.pid);
@@ -548,7 +659,7 @@ int _PtlGetMap(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t map_size,
         goto err2;
     }
 
-    if (!ni->logical.mapping) {
+    if (!ni_has_map(ni)) {
         err = PTL_NO_SPACE;
         goto err2;
     }
@@ -556,9 +667,16 @@ int _PtlGetMap(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t map_size,
     if (map_size > ni->logical.map_size)
         map_size = ni->logical.map_size;
 
-    if (map_size)
-        memcpy(mapping, ni->logical.mapping,
-               map_size * sizeof(ptl_process_t));
+    if (ni->logical.mapping) {
+        if (map_size)
+            memcpy(mapping, ni->logical.mapping,
+                   map_size * sizeof(ptl_process_t));
+    } else {
+        ptl_rank_t i;
+
+        for (i = 0; i < map_size; i++)
+            rank_to_phys(ni, i, &mapping[i]);
+    }
 
     if (actual_map_size)
         *actual_map_size = ni->logical.map_size;
@@ -594,7 +712,7 @@ static void ni_cleanup(ni_t *ni)
      * set the value of map size to 0 (otherwise
      * it is undefined) */
     if (ni->options & PTL_NI_LOGICAL) {
-        if (!ni->logical.mapping)
+        if (!ni_has_map(ni))
             ni->logical.map_size = 0;
     }
 
@@ -619,6 +737,10 @@ static void ni_cleanup(ni_t *ni)
 
     stop_progress_thread(ni);
 
+#if WITH_TRANSPORT_LOOP
+    loop_NIFini(ni);
+#endif
+
     destroy_conns(ni);
 
     interrupt_cts(ni);
@@ -630,19 +752,16 @@ static void ni_cleanup(ni_t *ni)
     if (transports.remote.NIFini)
         transports.remote.NIFini(ni);
 
+#if !IS_PPE
+    /* Nothing else runs for the NI anymore. */
+    stats_fini(ni);
+#endif
+
     ni->iface->ni[ni->ni_type] = NULL;
     ni->iface = NULL;
 
-    if (ni->options & PTL_NI_LOGICAL) {
-        if (ni->logical.mapping) {
-            free(ni->logical.mapping);
-            ni->logical.mapping = NULL;
-        }
-        if (ni->logical.rank_table) {
-            free(ni->logical.rank_table);
-            ni->logical.rank_table = NULL;
-        }
-    }
+    if (ni->options & PTL_NI_LOGICAL)
+        destroy_tables(ni);
 
     pool_fini(&ni->conn_pool);
     pool_fini(&ni->buf_pool);
@@ -663,6 +782,7 @@ static void ni_cleanup(ni_t *ni)
     pthread_mutex_destroy(&ni->pt_mutex);
     PTL_FASTLOCK_DESTROY(&ni->md_list_lock);
     PTL_FASTLOCK_DESTROY(&ni->ct_list_lock);
+    PTL_FASTLOCK_DESTROY(&ni->eq_list_lock);
     PTL_FASTLOCK_DESTROY(&ni->mr_self.tree_lock);
     PTL_FASTLOCK_DESTROY(&ni->mr_app.tree_lock);
 #if WITH_TRANSPORT_UDP
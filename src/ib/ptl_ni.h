@@ -9,27 +9,52 @@
 
 struct queue;
 struct conn;
+struct conn_hash;
+struct ptl_stats;
+struct tcp_peer;
 
 /*
- * rank_entry_t
- *	per private rank table entry info
- *	only used for logical NIs
+ * rank_run_t
+ *	a run of consecutive ranks whose nid and pid both advance
+ *	by a constant stride, only used for logical NIs
  */
-typedef struct rank_entry {
-    ptl_rank_t rank;            /* world rank */
-    ptl_rank_t main_rank;       /* main rank on NID */
-    ptl_nid_t nid;
-    ptl_pid_t pid;
-    struct conn *connect;
-} entry_t;
+typedef struct rank_run {
+    ptl_rank_t first;           /* first rank in the run */
+    ptl_rank_t count;           /* number of ranks in the run */
+    ptl_nid_t nid;              /* nid of the first rank */
+    ptl_pid_t pid;              /* pid of the first rank */
+    uint32_t nid_stride;
+    uint32_t pid_stride;
+} rank_run_t;
 
 /* Used by SHMEM to communicate the PIDs between the local ranks for a
- * physical NI. */
+ * logical NI, and as the directory of the physical NIs of a node. */
 struct shmem_pid_table {
     ptl_process_t id;
 
-    /* Set to 1 when id is valid. */
+    /* Set to 1 when id is valid. A physical NI sets it to 2 while it
+     * owns the slot but is not ready to receive yet. */
     int valid;
+
+    /* Process owning a directory slot, to reclaim it if it dies. */
+    pid_t os_pid;
+
+    /* Bumped each time a directory slot is claimed, so that a
+     * connection can tell its peer left. */
+    unsigned int gen;
+};
+
+/* Head of the comm pad shared by all the physical NIs of a node with
+ * the same options. Each NI takes a slot, which gives its queue and
+ * buffers, and publishes its id in it so that local peers can find
+ * it when they connect. */
+struct shmem_phys_dir {
+    size_t comm_pad_size;       /* to check all agree on the layout */
+    int num_slots;
+    int ready;                  /* set once the creator initialized it */
+    int dead;                   /* set by the last user before unlinking */
+    pid_t lock;                 /* process holding the lock, or 0 */
+    struct shmem_pid_table slot[];
 };
 
 struct shmem_bounce_head {
@@ -44,6 +69,63 @@ struct udp_bounce_head {
                                  * 0. Invariant. */
 };
 
+#if WITH_TRANSPORT_UDP
+/* What an NI receives through one of the sockets of its interface. */
+struct udp_rxq {
+    struct ni *ni;
+    int index;                  /* of the socket in iface->udp.s */
+
+    /* The last packed datagram received, until all its messages
+     * are processed. */
+    struct {
+        unsigned char *data;
+        unsigned int length;
+        unsigned int offset;
+        struct sockaddr_in src;
+    } unpack;
+
+    /* The last train of datagrams coalesced by UDP_GRO, until all
+     * of them are processed. */
+    struct {
+        unsigned char *data;
+        unsigned int size;      /* of data */
+        const unsigned char *train; /* data, or an io_uring buffer */
+#if WITH_UDP_URING
+        int bid;                /* that buffer, or -1 */
+#endif
+        unsigned int length;
+        unsigned int offset;
+        unsigned int seg;       /* datagram size, but the last */
+        struct sockaddr_in src;
+    } gro;
+
+    /* A large message whose last fragment came through this queue,
+     * waiting for fragments striped to the other queues. Nothing
+     * else is received meanwhile, to keep the messages of a
+     * sender to a portal table in order. */
+    struct buf *wait;
+
+    /* Receive thread of the queue, see PTL_UDP_RECV_THREADS. */
+    pthread_t thread;
+    int has_thread;
+};
+#endif
+
+/* Most target workers of an NI. */
+#define TGT_WORKERS_MAX		(16)
+
+/* A thread processing the requests received by an NI for some of
+ * its portal tables, with PTL_TGT_WORKERS. See ptl_recv.c. */
+struct tgt_worker {
+    queue_t queue;              /* of the requests, first */
+    struct ni *ni;
+    pthread_t thread;
+    volatile int stop;
+    volatile int sleeping;      /* waiting on cond for a request */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} __attribute__ ((aligned(CACHELINE_WIDTH)));
+
 /* Memory regions tree attached to an NI. The PPE must have 2, the
  * other transports need one. */
 struct ni_mr_tree {
@@ -90,6 +172,12 @@ typedef struct ni {
     struct list_head ct_list;
     PTL_FASTLOCK_TYPE ct_list_lock;
 
+    struct list_head eq_list;
+    PTL_FASTLOCK_TYPE eq_list_lock;
+
+    /* Statistics page, NULL unless PTL_STATS is set. */
+    struct ptl_stats *stats;
+
     /* The PPE must have a tree indexed on the application addresses,
      * and one tree for its own addresses. The other implementations
      * don't need that distinction. */
@@ -114,6 +202,10 @@ typedef struct ni {
     int catcher_nosleep;
 #endif
 
+    /* Target workers, with PTL_TGT_WORKERS, or none. */
+    struct tgt_worker *tgt_workers;
+    int num_tgt_workers;
+
     int cleanup_state;
 
 #if WITH_TRANSPORT_IB
@@ -154,6 +246,7 @@ typedef struct ni {
         struct queue *queue;    /* own queue, in the comm pad */
         void *first_queue;      /* addr of rank 0 queue, in the comm pad */
         char *comm_pad_shm_name;
+        struct shmem_phys_dir *dir; /* physical NIs only, or NULL */
 
 #if !USE_KNEM
         /* Bounce buffers used when KNEM is not available. They are
@@ -189,6 +282,14 @@ typedef struct ni {
     } mem;
 #endif
 
+#if WITH_TRANSPORT_LOOP
+    /* In-process loopback transport specific */
+    struct {
+        queue_t queue;          /* messages from the NIs of this process */
+        struct list_head list;  /* entry in the directory of NIs */
+    } loop;
+#endif
+
 #if WITH_TRANSPORT_UDP
     /* UDP transport specific */
     struct {
@@ -219,6 +320,33 @@ typedef struct ni {
             size_t buf_size;
             unsigned int num_bufs;
         } udp_buf;
+
+        /* Small messages waiting to be sent packed in one datagram,
+         * one pack per destination. See udp_pack_add(). */
+        struct {
+            PTL_FASTLOCK_TYPE lock;
+            struct list_head busy;  /* packs holding messages */
+            struct list_head free;
+            unsigned int max;       /* largest datagram */
+            uint64_t delay;         /* in ns, 0 when disabled */
+        } pack;
+
+        /* One receive queue per socket of the interface. */
+        struct udp_rxq *rxq;
+        int num_rxq;
+
+        /* TCP streams to and from the peers, with PTL_TCP. Only
+         * the progress thread reads them. See ptl_tcp.c. */
+        struct {
+            PTL_FASTLOCK_TYPE lock;     /* protects incoming and peers */
+            struct list_head incoming;  /* handed over by the evl thread */
+            struct list_head streams;
+            struct list_head ready;     /* bufs read while sending */
+            struct tcp_peer **peers;    /* hashed by address */
+            struct list_head corked;    /* peers corked by the progress
+                                         * thread */
+            int epfd;
+        } tcp;
 #if IS_PPE
         /* Link the active NIs together so that the PPE can poll them. */
         struct list_head ppe_ni_list;
@@ -254,20 +382,36 @@ typedef struct ni {
              * XI/XT will not be queued on the non-main ranks, but on
              * the main rank. */
 
-            /* Rank table. This is used to connection TO remote ranks */
+            /* Connections TO remote ranks, indexed by rank. A slot
+             * stays NULL until the rank is first talked to. */
             int map_size;
-            struct rank_entry *rank_table;
+            struct conn **conn_table;
+
+            /* Rank to nid/pid mapping. Regular layouts are stored
+             * as runs, else a plain copy of the mapping is kept. One
+             * of the two is set once PtlSetMap has been called. */
+            int num_runs;
+            rank_run_t *runs;
             ptl_process_t *mapping;
         } logical;
 
         struct {
-            /* Physical NI. */
-            void *tree;
+            /* Physical NI. Connections hashed by nid/pid, the
+             * lock serializes inserts. */
+            struct conn_hash *volatile conn_hash;
             PTL_FASTLOCK_TYPE lock;
         } physical;
     };
 } ni_t;
 
+/* whether PtlSetMap has been called on a logical NI */
+static inline int ni_has_map(const ni_t *ni)
+{
+    return ni->logical.runs || ni->logical.mapping;
+}
+
+void rank_to_phys(const ni_t *ni, ptl_rank_t rank, ptl_process_t *id);
+
 static inline int ni_alloc(pool_t *pool, ni_t **ni_p)
 {
     int err;
@@ -4,12 +4,32 @@
 
 #include "ptl_loc.h"
 
-/* Maximum number of stored objects ever. */
-#define MAX_INDEX	(256*1024)
+/* Maximum number of objects alive at any time. Indexes are recycled
+ * when their slab is released, so this is not a lifetime limit. The
+ * all ones index is left out so that PTL_XX_NONE never validates. */
+#define MAX_INDEX	(HANDLE_INDEX_MASK)
+
+/* End of the recycled index list. */
+#define INDEX_NONE	MAX_INDEX
+
+/*
+ * A recycled slot of the index map doesn't point to an object but
+ * holds the next recycled index and the generation for the next
+ * object stored in that slot. The low bit is set so that it can't be
+ * mistaken for an (aligned) object pointer.
+ */
+#define FREE_SLOT(next, gen)	((void *)(uintptr_t)(((gen) << 22) | \
+					((next) << 1) | 1))
+#define FREE_SLOT_NEXT(slot)	(((uintptr_t)(slot) >> 1) & 0x1fffff)
+#define FREE_SLOT_GEN(slot)	(((uintptr_t)(slot) >> 22) & HANDLE_GEN_MASK)
+#define IS_FREE_SLOT(slot)	((uintptr_t)(slot) & 1)
 
 /**
  * initialize indexing service
  *
+ * The map is only touched as indexes are handed out, so the pages
+ * backing the unused part of it are never faulted in.
+ *
  * @return status
  */
 int index_init(gbl_t *gbl)
@@ -19,6 +39,8 @@ int index_init(gbl_t *gbl)
         return PTL_NO_SPACE;
 
     atomic_set(&gbl->next_index, 0);
+    gbl->index_free = INDEX_NONE;
+    PTL_FASTLOCK_INIT(&gbl->index_lock);
 
     return PTL_OK;
 }
@@ -28,35 +50,81 @@ int index_init(gbl_t *gbl)
  */
 void index_fini(gbl_t *gbl)
 {
+    PTL_FASTLOCK_DESTROY(&gbl->index_lock);
     free(gbl->index_map);
 }
 
 /**
  * Get index for object and save address.
  *
+ * Recycled indexes are reused first, else a new one is taken from
+ * the never used part of the map.
+ *
  * @param obj
  * @param index_p
+ * @param gen_p returns the generation to use for the object's handle
  *
  * @output status
  */
-static inline int index_get(gbl_t *gbl, obj_t *obj, unsigned int *index_p)
+static inline int index_get(gbl_t *gbl, obj_t *obj, unsigned int *index_p,
+                            unsigned int *gen_p)
 {
     unsigned int index;
+    unsigned int gen;
 
-    index = atomic_inc(&gbl->next_index);
+    PTL_FASTLOCK_LOCK(&gbl->index_lock);
 
-    if (index >= MAX_INDEX) {
-        ptl_warn("Index > MAX Index, index was: %i \n", index);
-        return PTL_FAIL;
+    if (gbl->index_free != INDEX_NONE) {
+        void *slot;
+
+        index = gbl->index_free;
+        slot = gbl->index_map[index];
+        gbl->index_free = FREE_SLOT_NEXT(slot);
+        gen = FREE_SLOT_GEN(slot);
+    } else {
+        index = atomic_read(&gbl->next_index);
+        if (index >= MAX_INDEX) {
+            PTL_FASTLOCK_UNLOCK(&gbl->index_lock);
+            ptl_warn("Index > MAX Index, index was: %i \n", index);
+            return PTL_FAIL;
+        }
+        atomic_inc(&gbl->next_index);
+        gen = 0;
     }
 
     gbl->index_map[index] = obj;
 
+    PTL_FASTLOCK_UNLOCK(&gbl->index_lock);
+
     *index_p = index;
+    *gen_p = gen;
 
     return PTL_OK;
 }
 
+/**
+ * Recycle the index of an object that is being destroyed.
+ *
+ * The slot keeps the object's generation, which obj_release has
+ * already moved past any handle given out for it, so that stale
+ * handles don't validate against the next object stored there.
+ *
+ * @param obj the object
+ */
+static inline void index_put(gbl_t *gbl, obj_t *obj)
+{
+    unsigned int index = obj_handle_to_index(obj->obj_handle);
+    unsigned int gen = obj_handle_to_gen(obj->obj_handle);
+
+    PTL_FASTLOCK_LOCK(&gbl->index_lock);
+
+    assert(gbl->index_map[index] == obj);
+    gbl->index_map[index] = FREE_SLOT(gbl->index_free, gen);
+    gbl->index_free = index;
+
+    PTL_FASTLOCK_UNLOCK(&gbl->index_lock);
+}
+
 /**
  * Convert index to object.
  *
@@ -66,20 +134,71 @@ static inline int index_get(gbl_t *gbl, obj_t *obj, unsigned int *index_p)
  */
 static inline int index_lookup(gbl_t *gbl, unsigned int index, obj_t **obj_p)
 {
+    void *slot;
+
     if (index >= MAX_INDEX) {
         WARN();
         return PTL_FAIL;
     }
 
-    if (gbl->index_map[index]) {
-        *obj_p = gbl->index_map[index];
+    slot = gbl->index_map[index];
+
+    if (slot && !IS_FREE_SLOT(slot)) {
+        *obj_p = slot;
         return PTL_OK;
     } else {
         return PTL_FAIL;
     }
 }
 
-#define HANDLE_SHIFT ((sizeof(ptl_handle_any_t)*8)-8)
+/**
+ * Allocate a private slab backed by huge pages.
+ *
+ * Depending on PTL_HUGEPAGES, try an explicit MAP_HUGETLB mapping
+ * first (2), then fall back to huge page aligned memory with a
+ * transparent huge page hint (1). Either step may fail silently if
+ * the system has no huge pages available, in which case the caller
+ * gets regular pages.
+ *
+ * @param pool the pool for which slab is created.
+ * @param map_len_p returns the mapping length if the slab was mmapped
+ *
+ * @return address of slab or null if unable to allocate memory
+ */
+static void *pool_get_huge_slab(pool_t *pool, size_t *map_len_p)
+{
+    int err;
+    void *slab;
+
+#ifdef MAP_HUGETLB
+    if (get_param(PTL_HUGEPAGES) >= 2) {
+        size_t len = ROUND_UP(pool->slab_size, hugepagesize);
+
+        slab = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (slab != MAP_FAILED) {
+            *map_len_p = len;
+            return slab;
+        }
+
+        ptl_info("MAP_HUGETLB failed for %s slab (errno=%d), "
+                 "falling back to transparent huge pages\n", pool->name,
+                 errno);
+    }
+#endif
+
+    err = posix_memalign(&slab, hugepagesize, pool->slab_size);
+    if (unlikely(err))
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(slab, pool->slab_size, MADV_HUGEPAGE))
+        ptl_info("madvise(MADV_HUGEPAGE) failed for %s slab (errno=%d)\n",
+                 pool->name, errno);
+#endif
+
+    return slab;
+}
 
 /**
  * Return a new zero filled slab.
@@ -89,20 +208,28 @@ static inline int index_lookup(gbl_t *gbl, unsigned int index, obj_t **obj_p)
  * page aligned memory. In the special case that
  * we are creating objects in shared memory the pool
  * has a pre allocated chunk of shared memory that is
- * used instead.
+ * used instead. If huge pages are enabled and the slab is
+ * at least one huge page long, it is backed by huge pages.
  *
  * @param pool the pool for which slab is created.
+ * @param map_len_p returns the mapping length if the slab was mmapped,
+ * 0 otherwise
  *
  * @return address of slab or null if unable to allocate memory
  */
-static void *pool_get_slab(pool_t *pool)
+static void *pool_get_slab(pool_t *pool, size_t *map_len_p)
 {
     int err;
     void *slab;
 
+    *map_len_p = 0;
+
     if (pool->use_pre_alloc_buffer) {
         slab = pool->pre_alloc_buffer;
         pool->pre_alloc_buffer = NULL;
+    } else if (get_param(PTL_HUGEPAGES) &&
+               pool->slab_size >= hugepagesize) {
+        slab = pool_get_huge_slab(pool, map_len_p);
     } else {
         err = posix_memalign(&slab, pagesize, pool->slab_size);
         if (unlikely(err))
@@ -115,6 +242,23 @@ static void *pool_get_slab(pool_t *pool)
     return slab;
 }
 
+/**
+ * Release a slab obtained from pool_get_slab.
+ *
+ * @param pool the pool that owns the slab
+ * @param slab the slab descriptor
+ */
+static void pool_put_slab(pool_t *pool, slab_info_t *slab)
+{
+    if (pool->use_pre_alloc_buffer)
+        return;
+
+    if (slab->map_len)
+        munmap(slab->addr, slab->map_len);
+    else
+        free(slab->addr);
+}
+
 /**
  * get chunk hold new slab.
  * note that we currently never free objects so there are
@@ -180,11 +324,12 @@ static int pool_alloc_slab(pool_t *pool)
     if (unlikely(err))
         return err;
 
-    p = pool_get_slab(pool);
+    slab = &chunk->slab_list[chunk->num_slabs];
+
+    p = pool_get_slab(pool, &slab->map_len);
     if (unlikely(!p))
         return PTL_NO_SPACE;
 
-    slab = &chunk->slab_list[chunk->num_slabs];
     slab->addr = p;
 
 #if WITH_TRANSPORT_IB
@@ -197,7 +342,7 @@ static int pool_alloc_slab(pool_t *pool)
                         IBV_ACCESS_LOCAL_WRITE);
         if (!mr) {
             WARN();
-            free(p);
+            pool_put_slab(pool, slab);
             return PTL_FAIL;
         }
         slab->mr = mr;
@@ -208,6 +353,7 @@ static int pool_alloc_slab(pool_t *pool)
 
     for (i = 0; i < pool->obj_per_slab; i++) {
         unsigned int index;
+        unsigned int gen;
 
         obj = (obj_t *)p;
         obj->obj_free = 1;
@@ -216,13 +362,13 @@ static int pool_alloc_slab(pool_t *pool)
         obj->obj_parent = pool->parent;
         obj->obj_ni = (pool->parent) ? pool->parent->obj_ni : (ni_t *)obj;
 
-        err = index_get(pool->gbl, obj, &index);
+        err = index_get(pool->gbl, obj, &index, &gen);
         if (err) {
             WARN();
             //todo: leak
             return err;
         }
-        obj->obj_handle = ((uint64_t) (pool->type) << HANDLE_SHIFT) | index;
+        obj->obj_handle = obj_make_handle(pool->type, gen, index);
 
         if (pool->init) {
             err = pool->init(obj, mr);
@@ -288,14 +434,21 @@ int pool_fini(pool_t *pool)
         chunk = list_entry(l, chunk_t, list);
 
         for (i = 0; i < chunk->num_slabs; i++) {
+            uint8_t *p = chunk->slab_list[i].addr;
+            int j;
 #if WITH_TRANSPORT_IB
             struct ibv_mr *mr = chunk->slab_list[i].mr;
             if (mr)
                 ibv_dereg_mr(mr);
 #endif
 
-            if (!pool->use_pre_alloc_buffer)
-                free(chunk->slab_list[i].addr);
+            /* give the indexes back for the next pool */
+            for (j = 0; j < pool->obj_per_slab; j++) {
+                index_put(pool->gbl, (obj_t *)p);
+                p += pool->round_size;
+            }
+
+            pool_put_slab(pool, &chunk->slab_list[i]);
         }
 
         free(chunk);
@@ -379,10 +532,17 @@ void obj_release(ref_t *ref)
     assert(obj->obj_free == 0);
     obj->obj_free = 1;
 
-    __sync_synchronize();
+    /* invalidate the handles given out for this incarnation */
+    obj->obj_handle = obj_make_handle(pool->type,
+                                      obj_handle_to_gen(obj->obj_handle) + 1,
+                                      obj_handle_to_index(obj->obj_handle));
+
+    /* The free list CAS is a full barrier where it is lock free, but
+     * not necessarily with the spinlock fallback. */
+    atomic_thread_fence(memory_order_release);
 
     ll_enqueue_obj(&pool->free_list, obj);
-    atomic_dec(&pool->count);
+    atomic_dec_relaxed(&pool->count);
 }
 
 /**
@@ -402,7 +562,7 @@ int obj_alloc(pool_t *pool, obj_t **obj_p)
     obj_t *obj;
 
     /* reserve an object */
-    atomic_inc(&pool->count);
+    atomic_inc_relaxed(&pool->count);
 
     obj = ll_dequeue_obj(&pool->free_list);
     if (unlikely(!obj)) {
@@ -420,7 +580,7 @@ int obj_alloc(pool_t *pool, obj_t **obj_p)
                 pthread_mutex_unlock(&pool->mutex);
 
                 if (unlikely(err)) {
-                    atomic_dec(&pool->count);
+                    atomic_dec_relaxed(&pool->count);
                     WARN();
                     return err;
                 }
@@ -493,7 +653,9 @@ void *to_obj(PPEGBL enum obj_type type, ptl_handle_any_t handle)
         goto err1;
     }
 
-    if (obj_handle_to_index(obj->obj_handle) != index) {
+    /* catches stale handles to a recycled object */
+    if ((obj->obj_handle ^ handle) &
+        ((HANDLE_GEN_MASK << HANDLE_GEN_SHIFT) | HANDLE_INDEX_MASK)) {
         WARN();
         goto err1;
     }
@@ -109,7 +109,34 @@ static inline int obj_put(obj_t *obj)
     return ref_put(&obj->obj_ref, obj_release);
 }
 
-#define HANDLE_INDEX_MASK	(0x00ffffff)
+/*
+ * A handle is made of the object type in the top 4 bits, a generation
+ * number in the next 8 bits and an index into the gbl index map in
+ * the low 20 bits. The generation is bumped every time the object is
+ * freed, so a stale handle no longer validates once its object has
+ * been recycled.
+ */
+#define HANDLE_SHIFT		(28)
+#define HANDLE_GEN_SHIFT	(20)
+#define HANDLE_GEN_MASK		(0xff)
+#define HANDLE_INDEX_MASK	(0x000fffff)
+
+/**
+ * Build a handle from its components.
+ *
+ * @param type the object type
+ * @param gen the generation number
+ * @param index the object index
+ *
+ * @return the handle
+ */
+static inline ptl_handle_any_t obj_make_handle(enum obj_type type,
+                                               unsigned int gen,
+                                               unsigned int index)
+{
+    return ((ptl_handle_any_t) type << HANDLE_SHIFT) |
+        ((gen & HANDLE_GEN_MASK) << HANDLE_GEN_SHIFT) | index;
+}
 
 /**
  * Convert a handle to an object index.
@@ -123,6 +150,18 @@ static inline unsigned int obj_handle_to_index(ptl_handle_any_t handle)
     return handle & HANDLE_INDEX_MASK;
 }
 
+/**
+ * Extract the generation number from a handle.
+ *
+ * @param handle the handle
+ *
+ * @return the generation
+ */
+static inline unsigned int obj_handle_to_gen(ptl_handle_any_t handle)
+{
+    return (handle >> HANDLE_GEN_SHIFT) & HANDLE_GEN_MASK;
+}
+
 #ifdef NO_ARG_VALIDATION
 /**
  * Faster version of to_obj without checking.
@@ -137,7 +176,7 @@ static inline unsigned int obj_handle_to_index(ptl_handle_any_t handle)
 static inline void *to_obj(PPEGBL enum obj_type type, ptl_handle_any_t handle)
 {
     obj_t *obj = (obj_t *)MYGBL->index_map[handle & HANDLE_INDEX_MASK];
-    atomic_inc(&obj->obj_ref.ref_cnt);
+    obj_get(obj);
     return obj;
 }
 #else
@@ -246,7 +246,7 @@ param_t param[] = {
     [PTL_LOG_LEVEL] = {
                        .name = "PTL_LOG_LEVEL",
                        .min = 0,
-                       .max = 3,
+                       .max = 4,
                        .val = 0,
                        },
     [PTL_DEBUG] = {
@@ -279,6 +279,126 @@ param_t param[] = {
                                    .max = 1,
                                    .val = 0,
                                   },
+    [PTL_HUGEPAGES] = {
+                       .name = "PTL_HUGEPAGES",
+                       .min = 0,
+                       .max = 2,
+                       .val = 0,
+                       },
+    [PTL_STATE_TRACE] = {
+                         .name = "PTL_STATE_TRACE",
+                         .min = 0,
+                         .max = 64 * MiB,
+                         .val = 0,
+                         },
+    [PTL_STATS] = {
+                   .name = "PTL_STATS",
+                   .min = 0,
+                   .max = 1,
+                   .val = 0,
+                   },
+    [PTL_STATS_INTERVAL] = {
+                            .name = "PTL_STATS_INTERVAL",
+                            .min = 1,
+                            .max = 60000,
+                            .val = 100,
+                            },
+    [PTL_LOG_BINARY] = {
+                        .name = "PTL_LOG_BINARY",
+                        .min = 0,
+                        .max = 64 * MiB,
+                        .val = 0,
+                        },
+    [PTL_PPE_ASYNC] = {
+                       .name = "PTL_PPE_ASYNC",
+                       .min = 0,
+                       .max = 1,
+                       .val = 0,
+                       },
+    [PTL_PPE_RING_SIZE] = {
+                           .name = "PTL_PPE_RING_SIZE",
+                           .min = 1,
+                           .max = 1024,
+                           .val = 32,
+                           },
+    [PTL_PPE_BALANCE_INTERVAL] = {
+                                  .name = "PTL_PPE_BALANCE_INTERVAL",
+                                  .min = 0,
+                                  .max = 10000,
+                                  .val = 10,
+                                  },
+    [PTL_SHMEM_PHYS_SLOTS] = {
+                              .name = "PTL_SHMEM_PHYS_SLOTS",
+                              .min = 1,
+                              .max = 1024,
+                              .val = 16,
+                              },
+    [PTL_ENABLE_LOOP] = {
+                         .name = "PTL_ENABLE_LOOP",
+                         .min = 0,
+                         .max = 1,
+                         .val = 1,
+                         },
+    [PTL_UDP_COALESCE_DELAY] = {
+                                .name = "PTL_UDP_COALESCE_DELAY",
+                                .min = 0,
+                                .max = 1000000,
+                                .val = 20,
+                                },
+    [PTL_UDP_OFFLOAD] = {
+                         .name = "PTL_UDP_OFFLOAD",
+                         .min = 0,
+                         .max = 1,
+                         .val = 1,
+                         },
+    [PTL_UDP_URING] = {
+                       .name = "PTL_UDP_URING",
+                       .min = 0,
+                       .max = 1,
+                       .val = 1,
+                       },
+    [PTL_UDP_URING_SQPOLL] = {
+                              .name = "PTL_UDP_URING_SQPOLL",
+                              .min = 0,
+                              .max = 1,
+                              .val = 0,
+                              },
+    [PTL_UDP_URING_ZC] = {
+                          .name = "PTL_UDP_URING_ZC",
+                          .min = 0,
+                          .max = 1,
+                          .val = 0,
+                          },
+    [PTL_UDP_SOCKETS] = {
+                         .name = "PTL_UDP_SOCKETS",
+                         .min = 1,
+                         .max = UDP_SOCKS_MAX,
+                         .val = 1,
+                         },
+    [PTL_UDP_RECV_THREADS] = {
+                              .name = "PTL_UDP_RECV_THREADS",
+                              .min = 0,
+                              .max = 1,
+                              .val = 0,
+                              },
+    [PTL_TCP] = {
+                 .name = "PTL_TCP",
+                 .min = 0,
+                 .max = 1,
+                 .val = 0,
+                 },
+    [PTL_COMPACT_HDR] = {
+                         .name = "PTL_COMPACT_HDR",
+                         .min = 0,
+                         .max = 1,
+                         .val = 1,
+                         },
+    [PTL_TGT_WORKERS] = {
+                         .name = "PTL_TGT_WORKERS",
+                         .min = 0,
+                         .max = TGT_WORKERS_MAX,
+                         .val = 0,
+                         },
 };
 
 /**
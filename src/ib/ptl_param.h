@@ -54,6 +54,26 @@ enum {
     PTL_BOUNCE_NUM_BUFS,
     PTL_BOUNCE_BUF_SIZE,
     PTL_DISABLE_MEM_REG_CACHE,
+    PTL_HUGEPAGES,
+    PTL_STATE_TRACE,
+    PTL_STATS,
+    PTL_STATS_INTERVAL,
+    PTL_LOG_BINARY,
+    PTL_PPE_ASYNC,
+    PTL_PPE_RING_SIZE,
+    PTL_PPE_BALANCE_INTERVAL,
+    PTL_SHMEM_PHYS_SLOTS,
+    PTL_ENABLE_LOOP,
+    PTL_UDP_COALESCE_DELAY,
+    PTL_UDP_OFFLOAD,
+    PTL_UDP_URING,
+    PTL_UDP_URING_SQPOLL,
+    PTL_UDP_URING_ZC,
+    PTL_UDP_SOCKETS,
+    PTL_UDP_RECV_THREADS,
+    PTL_TCP,
+    PTL_COMPACT_HDR,
+    PTL_TGT_WORKERS,
     PTL_PARAM_LAST,             /* keep me last */
 };
 
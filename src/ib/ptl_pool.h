@@ -57,6 +57,10 @@ struct slab_info {
         /** address of slab */
     void *addr;
 
+        /** length of the mapping if the slab was mmapped with huge
+         * pages, or 0 if it came from posix_memalign */
+    size_t map_len;
+
         /** slab private data */
 #if WITH_TRANSPORT_IB
     struct ibv_mr *mr;
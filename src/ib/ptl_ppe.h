@@ -423,19 +423,29 @@ typedef struct ppebuf {
 	 * buffer. */
     unsigned int completed;
 
+        /** Set by the client when it does not wait for the reply. A
+	 * failure is then reported through the EQ or CT of the
+	 * operation instead of msg.ret. */
+    unsigned int async;
+
         /** Message from client to PPE, with response from PPE. */
     struct ppe_msg msg;
 } ppebuf_t;
 
 /* Maximum number of progress threads on the PPE. */
-#define MAX_PROGRESS_THREADS 10
+#define MAX_PROGRESS_THREADS 32
+
+/* Maximum number of clients connected to the PPE. */
+#define MAX_PPE_CLIENTS 256
 
 /* Communication PAD. Created by the PPE and shared with the clients. */
 struct ppe_comm_pad {
-    /* Clients enqueue ppebufs here, and PPE consummes. */
+    /* Clients enqueue ppebufs here, and PPE consummes. There is one
+     * queue per client, so that a client can be moved to another
+     * progress thread. */
     struct {
         queue_t queue __attribute__ ((aligned(64)));
-    } q[MAX_PROGRESS_THREADS];
+    } q[MAX_PPE_CLIENTS];
 
     /* Pool of ppebufs, for clients to use. The slab itself has been
      * mapped through XPMEM by the PPE. */
@@ -119,6 +119,8 @@ static int rdma_send_message(buf_t *buf, int from_init)
 
     buf->type = BUF_SEND;
 
+    STATS_SEND(buf->obj.obj_ni, STATS_RDMA, buf->length);
+
     /* Rate limit the initiator. If the IB/RDMA send queue gets full, there
      * wouldn't be any space left to send the ACKs/replies, and we
      * would get a deadlock. */
@@ -301,8 +303,8 @@ static int rdma_init_prepare_transfer(md_t *md, data_dir_t dir,
         mr_t *mr;
         if (md->num_iov) {
             err =
-                append_immediate_data(md->start, md->mr_list, md->num_iov,
-                                      dir, offset, length, buf);
+                append_immediate_data(md->start, md->iov_offsets, md->mr_list,
+                                      md->num_iov, dir, offset, length, buf);
         } else {
             err =
                 mr_lookup_app(obj_to_ni(md), md->start + offset, length, &mr);
@@ -312,7 +314,7 @@ static int rdma_init_prepare_transfer(md_t *md, data_dir_t dir,
             }
 
             err =
-                append_immediate_data(md->start, &mr, md->num_iov, dir,
+                append_immediate_data(md->start, NULL, &mr, md->num_iov, dir,
                                       offset, length, buf);
 
             mr_put(mr);
@@ -323,8 +325,8 @@ static int rdma_init_prepare_transfer(md_t *md, data_dir_t dir,
         /* Find the index and offset of the first IOV as well as the
          * total number of IOVs to transfer. */
         num_sge =
-            iov_count_elem(iovecs, md->num_iov, offset, length, &iov_start,
-                           &iov_offset);
+            iov_count_elem(iovecs, md->iov_offsets, md->num_iov, offset,
+                           length, &iov_start, &iov_offset);
         if (num_sge < 0) {
             WARN();
             return PTL_FAIL;
@@ -10,7 +10,7 @@
 /**
  * Receive state name for debug output.
  */
-static char *recv_state_name[] = {
+char *recv_state_name[] = {
     [STATE_RECV_SEND_COMP] = "send_comp",
     [STATE_RECV_RDMA_COMP] = "rdma_comp",
     [STATE_RECV_PACKET_RDMA] = "recv_packet_rdma",
@@ -116,8 +116,10 @@ static int comp_poll(ni_t *ni, int num_wc, struct ibv_wc wc_list[],
                 buf->recv_state = STATE_RECV_SEND_COMP;
             else if (buf->type == BUF_RDMA)
                 buf->recv_state = STATE_RECV_RDMA_COMP;
-            else if (buf->type == BUF_RECV)
+            else if (buf->type == BUF_RECV) {
+                STATS_RECV(ni, STATS_RDMA, wc->byte_len);
                 buf->recv_state = STATE_RECV_PACKET_RDMA;
+            }
             else
                 buf->recv_state = STATE_RECV_ERROR;
         }
@@ -251,6 +253,73 @@ static int recv_packet_rdma(buf_t *buf)
 }
 #endif /* WITH_TRANSPORT_IB */
 
+/**
+ * Expand a compact request header in place. See ptl_hdr.h.
+ *
+ * @param buf the received buffer.
+ *
+ * @return 0, or 1 if the header is malformed.
+ */
+static int expand_hdr(buf_t *buf)
+{
+    req_hdr_t *hdr = (req_hdr_t *) buf->data;
+    const unsigned char *p = buf->data + REQ_HDR_FIXED;
+    uint64_t val[4];
+    __le32 uid = 0;
+    unsigned int len = REQ_HDR_FIXED;
+    int width;
+    int i;
+
+    /* rlength, roffset, match_bits and hdr_data, in that order. */
+    for (i = 0; i < 4; i++) {
+        width = (hdr->fields >> (2 * i)) & 3;
+        if (width > HDR_FIELD_64)
+            return 1;
+        len += width == HDR_FIELD_32 ? 4 : width == HDR_FIELD_64 ? 8 : 0;
+    }
+    if (hdr->fields & (1 << HDR_FIELD_UID))
+        len += sizeof(uid);
+    len = (len + 7) & ~7;
+
+    if (len > buf->length ||
+        buf->length - len + sizeof(*hdr) > BUF_DATA_SIZE)
+        return 1;
+
+    for (i = 0; i < 4; i++) {
+        width = (hdr->fields >> (2 * i)) & 3;
+        if (width == HDR_FIELD_32) {
+            __le32 v32;
+
+            memcpy(&v32, p, sizeof(v32));
+            val[i] = le32_to_cpu(v32);
+            p += sizeof(v32);
+        } else if (width == HDR_FIELD_64) {
+            __le64 v64;
+
+            memcpy(&v64, p, sizeof(v64));
+            val[i] = le64_to_cpu(v64);
+            p += sizeof(v64);
+        } else {
+            val[i] = 0;
+        }
+    }
+    if (hdr->fields & (1 << HDR_FIELD_UID))
+        memcpy(&uid, p, sizeof(uid));
+
+    memmove(buf->data + sizeof(*hdr), buf->data + len, buf->length - len);
+    buf->length += sizeof(*hdr) - len;
+
+    hdr->rlength = cpu_to_le64(val[0]);
+    hdr->roffset = cpu_to_le64(val[1]);
+    hdr->match_bits = cpu_to_le64(val[2]);
+    hdr->hdr_data = cpu_to_le64(val[3]);
+    hdr->uid = uid;
+    hdr->compact = 0;
+    hdr->fields = 0;
+
+    return 0;
+}
+
 /**
  * Process a received buffer. Common for RDMA and SHMEM.
  *
@@ -268,13 +337,19 @@ static int recv_packet(buf_t *buf)
     struct hdr_common *hdr = (struct hdr_common *)buf->data;
 
     /* sanity check received buffer */
-    if (hdr->version != PTL_HDR_VER_1) {
+    if (hdr->version != PTL_HDR_VER_2) {
         WARN();
         return STATE_RECV_DROP_BUF;
     }
 
     /* compute next state */
     if (hdr->operation <= OP_SWAP) {
+        if (buf->length >= REQ_HDR_FIXED &&
+            ((req_hdr_t *) hdr)->compact && expand_hdr(buf)) {
+            WARN();
+            return STATE_RECV_DROP_BUF;
+        }
+
         if (buf->length < sizeof(req_hdr_t))
             return STATE_RECV_DROP_BUF;
         else
@@ -374,6 +449,52 @@ static int recv_req(buf_t *buf)
     return STATE_RECV_REPOST;
 }
 
+#if WITH_TRANSPORT_IB || WITH_TRANSPORT_UDP
+/**
+ * Hand a received request over to the target worker of its portal
+ * table, with PTL_TGT_WORKERS. All the requests to a portal table go
+ * to the same worker, which processes them in the order they were
+ * handed over.
+ *
+ * @param ni the ni.
+ * @param buf the received buffer. It belongs to the worker once
+ * handed over.
+ * @param data the message, which may not be at buf->data yet.
+ *
+ * @return 1 if handed over, 0 if the caller must process it.
+ */
+static int tgt_work_queue(ni_t *ni, buf_t *buf, const void *data)
+{
+    const req_hdr_t *hdr = data;
+    struct tgt_worker *worker;
+
+    if (!ni->num_tgt_workers)
+        return 0;
+
+    /* Leave anything else than a well formed request to the caller. */
+    if (buf->length < REQ_HDR_FIXED || hdr->h1.version != PTL_HDR_VER_2 ||
+        hdr->h1.operation > OP_SWAP)
+        return 0;
+
+    worker = &ni->tgt_workers[le32_to_cpu(hdr->pt_index) %
+                              ni->num_tgt_workers];
+
+    buf->obj.next = NULL;
+    enqueue(NULL, &worker->queue, &buf->obj);
+
+    /* Wake up the worker if it went to sleep. Pairs with the barrier
+     * in tgt_worker_thread. */
+    __sync_synchronize();
+    if (unlikely(worker->sleeping)) {
+        pthread_mutex_lock(&worker->mutex);
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+
+    return 1;
+}
+#endif
+
 /**
  * Process a response message to initiator.
  *
@@ -504,10 +625,13 @@ static int recv_drop_buf(buf_t *buf)
 static void process_recv_rdma(ni_t *ni, buf_t *buf)
 {
     enum recv_state state = buf->recv_state;
+    ptl_handle_any_t handle = buf->obj.obj_handle;
 
     while (1) {
         ptl_info("tid:%lx buf:%p: state = %s\n", pthread_self(), buf,
                  recv_state_name[state]);
+        /* the buf may be gone by the final state */
+        TRACE_HANDLE(TRACE_RECV, handle, state);
 
         switch (state) {
             case STATE_RECV_SEND_COMP:
@@ -523,7 +647,10 @@ static void process_recv_rdma(ni_t *ni, buf_t *buf)
                 state = recv_packet(buf);
                 break;
             case STATE_RECV_REQ:
-                state = recv_req(buf);
+                if (tgt_work_queue(ni, buf, buf->data))
+                    state = STATE_RECV_REPOST;
+                else
+                    state = recv_req(buf);
                 break;
             case STATE_RECV_INIT:
                 state = recv_init(MYNIGBL_ buf);
@@ -552,7 +679,14 @@ static void process_recv_rdma(ni_t *ni, buf_t *buf)
     return;
 }
 
-void progress_thread_rdma(ni_t *ni)
+/**
+ * Poll the completion queue of an NI once.
+ *
+ * @param ni the ni to poll.
+ *
+ * @return the number of completions processed.
+ */
+int progress_thread_rdma(ni_t *ni)
 {
     const int num_wc = get_param(PTL_WC_COUNT);
     buf_t *buf_list[num_wc];
@@ -566,169 +700,218 @@ void progress_thread_rdma(ni_t *ni)
         if (buf_list[i])
             process_recv_rdma(ni, buf_list[i]);
     }
+
+    return num_buf;
 }
 #endif
 
 #if WITH_TRANSPORT_UDP
-void progress_thread_udp(ni_t *ni)
+/**
+ * Process a message received by the UDP transport.
+ *
+ * @param ni the ni.
+ * @param udp_buf the received buffer.
+ */
+static void udp_process_buf(ni_t *ni, buf_t *udp_buf)
 {
-    /* Socket connection. */
+    int err;
 
-    if (ni->udp.dest_addr && ni->udp.map_done != 0) {
+    ptl_info("UDP progress thread, received data: %p type:%i\n",
+             udp_buf, udp_buf->type);
+
+    ptl_info
+        ("received UDP buf type: %i, SEND=%i RETURN=%i RECV=%i CONN_REQ=%i CONN_REP=%i\n",
+         udp_buf->type, BUF_UDP_SEND, BUF_UDP_RETURN, BUF_UDP_RECEIVE,
+         BUF_UDP_CONN_REQ, BUF_UDP_CONN_REP);
+    ptl_info("start, self recv = %i \n",
+             atomic_read(&ni->udp.self_recv));
+    switch (udp_buf->type) {
+        case BUF_UDP_SEND:{
+            buf_t *buf;
+
+            STATS_RECV(ni, STATS_UDP, udp_buf->length);
+
+            /* Mark it for return now. The target state machine might
+             * change its type to BUF_SHMEM_SEND. */
+            udp_buf->type = BUF_UDP_RETURN;
+
+            err = buf_alloc(ni, &buf);
+            if (err) {
+                WARN();
+            } else {
+                buf->data = udp_buf->internal_data;
+                buf->length = udp_buf->length;
+                buf->udp_buf = udp_buf;
+                INIT_LIST_HEAD(&buf->list);
+                process_recv_udp(ni, buf);
+            }
 
-        int err;
-        buf_t *udp_buf;
+            /* Don't send back if it's on the noknem list. */
+            if (!list_empty(&buf->list))
+                break;
 
-        udp_buf = udp_receive(ni);
+            if (udp_buf->type == BUF_UDP_SEND ||
+                udp_buf->udp.dest_addr != ni->udp.dest_addr) {
+                /* Requested to send the buffer back, or not the
+                 * owner. Send the buffer back in both cases. */
+                //shmem_enqueue(ni, udp_buf, udp_buf->udp.index_owner);
+                //udp_send(ni, udp_buf, udp_buf->udp.index_owner);
+                udp_send(ni, udp_buf, &udp_buf->dest.udp.dest_addr);
+            } else {
+                /* It was returned to us with a message from a remote
+                 * rank. From send_message_udp(). */
+                buf_put(udp_buf);
+            }
 
-        if (udp_buf != NULL) {
-            ptl_info("UDP progress thread, received data: %p type:%i\n",
-                     udp_buf, udp_buf->type);
+            break;
         }
 
+        case BUF_UDP_RECEIVE:{
+            ptl_info("processing received data message\n");
+            STATS_RECV(ni, STATS_UDP, udp_buf->length);
+            if (udp_buf->put_ct != NULL) {
+                ptl_info("putct is : %p \n", udp_buf->put_ct);
+            }
+            pthread_mutex_init(&udp_buf->mutex, NULL);
+            udp_buf->obj.obj_ni = ni;
+            udp_buf->conn = get_conn(ni, ni->id);
+            udp_buf->conn->state = CONN_STATE_CONNECTED;
+            process_recv_udp(ni, udp_buf);
+            break;
+        }
 
-        if (udp_buf != NULL) {
-            ptl_info
-                ("received UDP buf type: %i, SEND=%i RETURN=%i RECV=%i CONN_REQ=%i CONN_REP=%i\n",
-                 udp_buf->type, BUF_UDP_SEND, BUF_UDP_RETURN, BUF_UDP_RECEIVE,
-                 BUF_UDP_CONN_REQ, BUF_UDP_CONN_REP);
-            ptl_info("start, self recv = %i \n",
-                     atomic_read(&ni->udp.self_recv));
-            switch (udp_buf->type) {
-                case BUF_UDP_SEND:{
-                    buf_t *buf;
+        case BUF_UDP_RETURN:{
+            /* Buffer returned to us by remote node. */
+            assert(udp_buf->udp.dest_addr == ni->udp.dest_addr);
+            /* From send_message_udp(). */
+            break;
+        }
 
-                    /* Mark it for return now. The target state machine might
-                     * change its type to BUF_SHMEM_SEND. */
-                    udp_buf->type = BUF_UDP_RETURN;
+        case BUF_UDP_CONN_REQ:{
 
-                    err = buf_alloc(ni, &buf);
-                    if (err) {
-                        WARN();
-                    } else {
-                        buf->data = udp_buf->internal_data;
-                        buf->length = udp_buf->length;
-                        buf->udp_buf = udp_buf;
-                        INIT_LIST_HEAD(&buf->list);
-                        process_recv_udp(ni, buf);
-                    }
+            ptl_info
+                ("UDP connection request received, handling now.... \n");
 
-                    /* Don't send back if it's on the noknem list. */
-                    if (!list_empty(&buf->list))
-                        break;
+            udp_buf->type = BUF_UDP_CONN_REP;
+            udp_buf->rlength = 0;
 
-                    if (udp_buf->type == BUF_UDP_SEND ||
-                        udp_buf->udp.dest_addr != ni->udp.dest_addr) {
-                        /* Requested to send the buffer back, or not the
-                         * owner. Send the buffer back in both cases. */
-                        //shmem_enqueue(ni, udp_buf, udp_buf->udp.index_owner);
-                        //udp_send(ni, udp_buf, udp_buf->udp.index_owner);
-                        udp_send(ni, udp_buf, &udp_buf->dest.udp.dest_addr);
-                    } else {
-                        /* It was returned to us with a message from a remote
-                         * rank. From send_message_udp(). */
-                        buf_put(udp_buf);
-                    }
+            struct udp_conn_msg msg;
+            msg.msg_type = cpu_to_le16(UDP_CONN_MSG_REP);
+            msg.port = ntohs(ni->udp.src_port);
+            msg.req.options = ni->options;
+            msg.req.src_id = ni->id;
+            msg.req_cookie =
+                udp_buf->transfer.udp.conn_msg.req_cookie;
 
-                    break;
-                }
+            udp_buf->transfer.udp.conn_msg = msg;
+            udp_buf->length = sizeof(struct req_hdr);
 
-                case BUF_UDP_RECEIVE:{
-                    ptl_info("processing received data message\n");
-                    if (udp_buf->put_ct != NULL) {
-                        ptl_info("putct is : %p \n", udp_buf->put_ct);
-                    }
-                    pthread_mutex_init(&udp_buf->mutex, NULL);
-                    udp_buf->obj.obj_ni = ni;
-                    udp_buf->conn = get_conn(ni, ni->id);
-                    udp_buf->conn->state = CONN_STATE_CONNECTED;
-                    process_recv_udp(ni, udp_buf);
-                    break;
-                }
+            //send back to the requesting address
+            udp_buf->udp.dest_addr = &udp_buf->udp.src_addr;
+            udp_buf->dest.udp.dest_addr = udp_buf->udp.src_addr;
 
-                case BUF_UDP_RETURN:{
-                    /* Buffer returned to us by remote node. */
-                    assert(udp_buf->udp.dest_addr == ni->udp.dest_addr);
-                    /* From send_message_udp(). */
-                    break;
-                }
+            udp_send(ni, udp_buf, udp_buf->udp.dest_addr);
+            //REG: Note: this assumes that we have a reliable transport, otherwise things can go wrong here
+            ptl_info
+                ("Connection request reply sent, connection valid. \n");
+            break;
 
-                case BUF_UDP_CONN_REQ:{
+        }
 
-                    ptl_info
-                        ("UDP connection request received, handling now.... \n");
+        case BUF_UDP_CONN_REP:{
+            ptl_info
+                ("UDP connection reply received, validating connection \n");
+            udp_buf->conn->state = CONN_STATE_CONNECTED;
 
-                    udp_buf->type = BUF_UDP_CONN_REP;
-                    udp_buf->rlength = 0;
+            udp_buf->conn->udp.dest_addr = udp_buf->udp.src_addr;
 
-                    struct udp_conn_msg msg;
-                    msg.msg_type = cpu_to_le16(UDP_CONN_MSG_REP);
-                    msg.port = ntohs(ni->udp.src_port);
-                    msg.req.options = ni->options;
-                    msg.req.src_id = ni->id;
+            int result;
 
-                    udp_buf->transfer.udp.conn_msg = msg;
-                    udp_buf->length = (sizeof(buf_t));
+            //release the thread waiting on the establishment of a connection
+            while (1) {
+                result = atomic_read(&udp_buf->conn->udp.is_waiting);
+                if (result > 0) {
+                    ptl_info("release wait on %p \n",
+                             &udp_buf->conn->move_wait);
+                    pthread_cond_broadcast(&udp_buf->conn->move_wait);
+                    atomic_set(&udp_buf->conn->udp.is_waiting, 0);
+                    break;
+                }
+            }
+            ptl_info("connection valid for reply\n");
+            break;
+        }
 
-                    //send back to the requesting address
-                    udp_buf->udp.dest_addr = &udp_buf->udp.src_addr;
-                    udp_buf->dest.udp.dest_addr = udp_buf->udp.src_addr;
+        default:
+            /* Should not happen. */
+            abort();
+    }
+}
 
-                    udp_send(ni, udp_buf, udp_buf->udp.dest_addr);
-                    //REG: Note: this assumes that we have a reliable transport, otherwise things can go wrong here
-                    ptl_info
-                        ("Connection request reply sent, connection valid. \n");
-                    break;
+/**
+ * Free a received buffer, once processed, unless it is still in use.
+ *
+ * @param udp_buf the received buffer.
+ */
+static void udp_release_buf(buf_t *udp_buf)
+{
+    if (udp_buf->completed) {
+        ptl_info("free recv buf %p\n", &udp_buf);
+        if (udp_buf->recv_buf)
+            buf_put(udp_buf->recv_buf);
+        if (udp_buf->conn)
+            conn_put(udp_buf->conn);
+        free(udp_buf);
+    }
+}
 
-                }
+/**
+ * Poll one receive queue of an NI once.
+ *
+ * @param ni the ni to poll.
+ * @param rxq the receive queue.
+ *
+ * @return 1 if a message was processed, 0 otherwise.
+ */
+static int udp_progress_rxq(ni_t *ni, struct udp_rxq *rxq)
+{
+    int got;
+    int self;
+    buf_t *udp_buf;
 
-                case BUF_UDP_CONN_REP:{
-                    ptl_info
-                        ("UDP connection reply received, validating connection \n");
-                    udp_buf->conn->state = CONN_STATE_CONNECTED;
+    udp_buf = udp_receive(ni, rxq);
+    got = (udp_buf != NULL);
 
-                    udp_buf->conn->udp.dest_addr = udp_buf->udp.src_addr;
+    /* udp_receive() hands out the buf of a message to self as is, and
+     * it is processed here, whatever else is counted in self_recv. */
+    self = udp_buf != NULL && rxq->index == 0 &&
+        atomic_read(&ni->udp.self_recv) > 0 &&
+        udp_buf == ni->udp.self_recv_addr;
 
-                    int result;
+    if (udp_buf != NULL && !self && udp_buf->type == BUF_UDP_RECEIVE &&
+        tgt_work_queue(ni, udp_buf, udp_buf->internal_data))
+        return got;
 
-                    //release the thread waiting on the establishment of a connection
-                    while (1) {
-                        result = atomic_read(&udp_buf->conn->udp.is_waiting);
-                        if (result > 0) {
-                            ptl_info("release wait on %p \n",
-                                     &udp_buf->conn->move_wait);
-                            pthread_cond_broadcast(&udp_buf->conn->move_wait);
-                            atomic_set(&udp_buf->conn->udp.is_waiting, 0);
-                            break;
-                        }
-                    }
-                    ptl_info("connection valid for reply\n");
-                    break;
-                }
+    if (udp_buf != NULL) {
+        /* Tells the target state machine the buf is not its own. */
+        if (self && udp_buf->type == BUF_UDP_RECEIVE)
+            udp_buf->udp_self = 1;
 
-                default:
-                    /* Should not happen. */
-                    abort();
-            }
-            //if a buffer was allocated for the recv, free it
-            if (atomic_read(&ni->udp.self_recv) == 0) {
-                if (udp_buf->completed) {
-                    ptl_info("free recv buf %p\n", &udp_buf);
-                    if (udp_buf->recv_buf)
-                        buf_put(udp_buf->recv_buf);
-                    if (udp_buf->conn)
-                        conn_put(udp_buf->conn);
-                    free(udp_buf);
-                }
-            }
-            //if we sent something to ourselves, flag it as processed
-            else if ((int)atomic_read(&ni->udp.self_recv) > 0) {
-                atomic_dec(&ni->udp.self_recv);
-                ptl_info(" self recv: %i \n",
-                         atomic_read(&ni->udp.self_recv));
-            }
+        udp_process_buf(ni, udp_buf);
 
+        //if a buffer was allocated for the recv, free it
+        if (!self) {
+            udp_release_buf(udp_buf);
+        }
+        //if we sent something to ourselves, flag it as processed
+        else {
+            if (udp_buf->type == BUF_UDP_RECEIVE)
+                udp_buf->udp_self = 0;
+            atomic_dec(&ni->udp.self_recv);
+            ptl_info(" self recv: %i \n",
+                     atomic_read(&ni->udp.self_recv));
         }
+
     }
 //TODO: do we need this for UDP?
 //#if WITH_TRANSPORT_SHMEM && !USE_KNEM
@@ -779,10 +962,169 @@ void progress_thread_udp(ni_t *ni)
 
 	PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
 //#endif*/
+
+    return got;
+}
+
+/* Most messages taken from the TCP streams per progress iteration. */
+#define TCP_PROGRESS_BATCH 16
+
+/**
+ * Process the messages received on the TCP streams of an NI, with
+ * PTL_TCP. What is sent meanwhile stays corked until the end.
+ *
+ * @param ni the ni to poll.
+ *
+ * @return 1 if a message was processed, 0 otherwise.
+ */
+static int tcp_progress(ni_t *ni)
+{
+    buf_t *udp_buf;
+    int i;
+
+    tcp_cork_begin(ni);
+
+    for (i = 0; i < TCP_PROGRESS_BATCH; i++) {
+        udp_buf = tcp_receive(ni);
+        if (!udp_buf)
+            break;
+
+        if (udp_buf->type == BUF_UDP_RECEIVE &&
+            tgt_work_queue(ni, udp_buf, udp_buf->internal_data))
+            continue;
+
+        udp_process_buf(ni, udp_buf);
+        udp_release_buf(udp_buf);
+    }
+
+    tcp_cork_end(ni);
+
+    return i > 0;
+}
+
+/**
+ * Poll the sockets of an NI once, but those with their own
+ * receive thread.
+ *
+ * @param ni the ni to poll.
+ *
+ * @return 1 if a message was processed, 0 otherwise.
+ */
+int progress_thread_udp(ni_t *ni)
+{
+    int got = 0;
+    int i;
+
+    /* Socket connection. */
+
+    if (ni->udp.dest_addr && ni->udp.map_done != 0) {
+        /* With PTL_TCP, nothing comes through the UDP sockets. */
+        if (ni->udp.tcp.epfd != -1)
+            return tcp_progress(ni);
+
+        for (i = 0; i < ni->udp.num_rxq; i++) {
+            if (!ni->udp.rxq[i].has_thread)
+                got |= udp_progress_rxq(ni, &ni->udp.rxq[i]);
+        }
+
+        udp_pack_progress(ni, !got);
+    }
+
+    return got;
+}
+
+#if !IS_PPE
+/* An idle receive thread spins for UDP_RXQ_SPIN_LOOPS empty polls,
+ * then yields the CPU until UDP_RXQ_YIELD_LOOPS, and then waits in
+ * poll() for its socket, UDP_RXQ_SLEEP_MS at most at a time. */
+#define UDP_RXQ_SPIN_LOOPS	(1024)
+#define UDP_RXQ_YIELD_LOOPS	(16384)
+#define UDP_RXQ_SLEEP_MS	(1)
+
+/**
+ * Receive thread of a socket, with PTL_UDP_RECV_THREADS.
+ *
+ * @param arg opaque pointer to the receive queue.
+ */
+static void *udp_rxq_thread(void *arg)
+{
+    struct udp_rxq *rxq = arg;
+    ni_t *ni = rxq->ni;
+    unsigned int idle = 0;
+    struct pollfd pfd;
+
+    pfd.fd = ni->iface->udp.s[rxq->index];
+    pfd.events = POLLIN;
+
+    while (!ni->catcher_stop) {
+        if (ni->udp.dest_addr && ni->udp.map_done != 0 &&
+            udp_progress_rxq(ni, rxq)) {
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < UDP_RXQ_SPIN_LOOPS) {
+            SPINLOCK_BODY();
+        } else if (idle < UDP_RXQ_YIELD_LOOPS || rxq->wait) {
+            /* A large message waits for fragments coming through
+             * the other sockets, which poll() wouldn't see. */
+            sched_yield();
+        } else {
+            /* With io_uring the datagrams go to the ring instead, so
+             * the timeout bounds the wait. */
+            poll(&pfd, 1, UDP_RXQ_SLEEP_MS);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Give each socket of an NI but the first its own receive thread.
+ * The progress thread keeps the first one.
+ *
+ * @param ni the ni.
+ */
+static void udp_start_rxq_threads(ni_t *ni)
+{
+    int i;
+
+    if (!get_param(PTL_UDP_RECV_THREADS))
+        return;
+
+    for (i = 1; i < ni->udp.num_rxq; i++) {
+        struct udp_rxq *rxq = &ni->udp.rxq[i];
+
+        rxq->has_thread = 1;
+        if (pthread_create(&rxq->thread, NULL, udp_rxq_thread, rxq)) {
+            WARN();
+            rxq->has_thread = 0;
+        }
+    }
+}
+
+/**
+ * Stop the receive threads of an NI. ni->catcher_stop is set.
+ *
+ * @param ni the ni.
+ */
+static void udp_stop_rxq_threads(ni_t *ni)
+{
+    int i;
+
+    for (i = 1; i < ni->udp.num_rxq; i++) {
+        struct udp_rxq *rxq = &ni->udp.rxq[i];
+
+        if (rxq->has_thread) {
+            pthread_join(rxq->thread, NULL);
+            rxq->has_thread = 0;
+        }
+    }
 }
 #endif
+#endif
 
-#if WITH_TRANSPORT_SHMEM || IS_PPE || WITH_TRANSPORT_UDP
+#if WITH_TRANSPORT_SHMEM || IS_PPE || WITH_TRANSPORT_UDP || WITH_TRANSPORT_LOOP
 /**
  * Process a received message in shared memory.
  *
@@ -792,11 +1134,14 @@ void progress_thread_udp(ni_t *ni)
 void process_recv_mem(ni_t *ni, buf_t *buf)
 {
     enum recv_state state = STATE_RECV_PACKET;
+    ptl_handle_any_t handle = buf->obj.obj_handle;
 
     while (1) {
         ptl_info("tid:%lx buf:%p: recv state local = %s\n",
                  (long unsigned int)pthread_self(), buf,
                  recv_state_name[state]);
+        /* the buf may be gone by the final state */
+        TRACE_HANDLE(TRACE_RECV, handle, state);
 
         switch (state) {
             case STATE_RECV_PACKET:
@@ -843,12 +1188,15 @@ void process_recv_mem(ni_t *ni, buf_t *buf)
 void process_recv_udp(ni_t *ni, buf_t *buf)
 {
     enum recv_state state = STATE_RECV_PACKET;
+    ptl_handle_any_t handle = buf->obj.obj_handle;
 
 //REG: TODO: process receive packets to deliver data.
     while (1) {
         ptl_info("tid:%lx buf:%p: recv state local = %s\n",
                  (long unsigned int)pthread_self(), buf,
                  recv_state_name[state]);
+        /* the buf may be gone by the final state */
+        TRACE_HANDLE(TRACE_RECV, handle, state);
         switch (state) {
             case STATE_RECV_PACKET:
                 state = recv_packet(buf);
@@ -889,6 +1237,164 @@ void process_recv_udp(ni_t *ni, buf_t *buf)
 #endif
 
 #if !IS_PPE
+/* An idle target worker spins for TGT_WORKER_SPIN_LOOPS empty polls,
+ * then yields the CPU until TGT_WORKER_YIELD_LOOPS, and then sleeps
+ * until a request comes. */
+#define TGT_WORKER_SPIN_LOOPS	(1024)
+#define TGT_WORKER_YIELD_LOOPS	(16384)
+
+/**
+ * Process a request handed over to a target worker.
+ *
+ * @param ni the ni.
+ * @param buf the received buffer.
+ */
+static void tgt_worker_process(ni_t *ni, buf_t *buf)
+{
+#if WITH_TRANSPORT_UDP
+    if (buf->type == BUF_UDP_RECEIVE) {
+        udp_process_buf(ni, buf);
+        udp_release_buf(buf);
+        return;
+    }
+#endif
+
+    recv_req(buf);
+}
+
+/**
+ * Target worker, with PTL_TGT_WORKERS.
+ *
+ * @param arg opaque pointer to the worker.
+ */
+static void *tgt_worker_thread(void *arg)
+{
+    struct tgt_worker *worker = arg;
+    ni_t *ni = worker->ni;
+    unsigned int idle = 0;
+    buf_t *buf;
+
+    while (!worker->stop) {
+        buf = (buf_t *)dequeue(NULL, &worker->queue);
+        if (buf) {
+            tgt_worker_process(ni, buf);
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < TGT_WORKER_SPIN_LOOPS) {
+            SPINLOCK_BODY();
+            continue;
+        } else if (idle < TGT_WORKER_YIELD_LOOPS) {
+            sched_yield();
+            continue;
+        }
+
+        /* Idle for a while. Sleep until tgt_work_queue() hands over
+         * a request. The queue is checked again once sleeping is
+         * visible, so that no request is missed. */
+        pthread_mutex_lock(&worker->mutex);
+        worker->sleeping = 1;
+        __sync_synchronize();
+        while (!(buf = (buf_t *)dequeue(NULL, &worker->queue)) &&
+               !worker->stop)
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        worker->sleeping = 0;
+        pthread_mutex_unlock(&worker->mutex);
+
+        if (buf)
+            tgt_worker_process(ni, buf);
+        idle = 0;
+    }
+
+    /* Whatever was handed over before the stop. */
+    while ((buf = (buf_t *)dequeue(NULL, &worker->queue)))
+        tgt_worker_process(ni, buf);
+
+    return NULL;
+}
+
+/**
+ * Start the target workers of an NI, with PTL_TGT_WORKERS. Worker i
+ * gets the requests to the portal tables whose index is i modulo the
+ * number of workers.
+ *
+ * @param ni the ni.
+ */
+static void tgt_start_workers(ni_t *ni)
+{
+    int num = get_param(PTL_TGT_WORKERS);
+    int i;
+
+    if (!num)
+        return;
+
+    if (posix_memalign((void **)&ni->tgt_workers, CACHELINE_WIDTH,
+                       num * sizeof(struct tgt_worker))) {
+        WARN();
+        ni->tgt_workers = NULL;
+        return;
+    }
+
+    for (i = 0; i < num; i++) {
+        struct tgt_worker *worker = &ni->tgt_workers[i];
+
+        queue_init(&worker->queue);
+        worker->ni = ni;
+        worker->stop = 0;
+        worker->sleeping = 0;
+        pthread_mutex_init(&worker->mutex, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+
+        if (pthread_create(&worker->thread, NULL, tgt_worker_thread,
+                           worker)) {
+            WARN();
+            pthread_cond_destroy(&worker->cond);
+            pthread_mutex_destroy(&worker->mutex);
+            break;
+        }
+    }
+
+    /* Only the workers that started get requests. */
+    ni->num_tgt_workers = i;
+    if (!i) {
+        free(ni->tgt_workers);
+        ni->tgt_workers = NULL;
+    }
+}
+
+/**
+ * Stop the target workers of an NI, once nothing hands them
+ * requests anymore.
+ *
+ * @param ni the ni.
+ */
+static void tgt_stop_workers(ni_t *ni)
+{
+    int i;
+
+    for (i = 0; i < ni->num_tgt_workers; i++) {
+        struct tgt_worker *worker = &ni->tgt_workers[i];
+
+        pthread_mutex_lock(&worker->mutex);
+        worker->stop = 1;
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+
+    for (i = 0; i < ni->num_tgt_workers; i++) {
+        struct tgt_worker *worker = &ni->tgt_workers[i];
+
+        pthread_join(worker->thread, NULL);
+        pthread_cond_destroy(&worker->cond);
+        pthread_mutex_destroy(&worker->mutex);
+    }
+
+    ni->num_tgt_workers = 0;
+    free(ni->tgt_workers);
+    ni->tgt_workers = NULL;
+}
+
 /**
  * Progress thread. Waits for ib, udp, and/or shared memory messages.
  *
@@ -898,6 +1404,7 @@ void process_recv_udp(ni_t *ni, buf_t *buf)
 static void *progress_thread(void *arg)
 {
     ni_t *ni = arg;
+    unsigned int loops = 0;
 #if WITH_TRANSPORT_SHMEM
     int err = 0;
 #endif
@@ -908,10 +1415,16 @@ static void *progress_thread(void *arg)
 #endif
         ) {
 
+        /* Don't look at the clock on every pass. */
+        if (unlikely(ni->stats != NULL) && (++loops & 1023) == 0)
+            stats_update(ni);
+
         progress_thread_rdma(ni);
 
         progress_thread_udp(ni);
 
+        progress_thread_loop(ni);
+
 #if WITH_TRANSPORT_SHMEM
         /* Shared memory. Physical NIs don't have a receive queue. */
         if (ni->shmem.queue) {
@@ -925,6 +1438,8 @@ static void *progress_thread(void *arg)
                     case BUF_SHMEM_SEND:{
                         buf_t *buf;
 
+                        STATS_RECV(ni, STATS_SHMEM, shmem_buf->length);
+
                         /* Mark it for return now. The target state machine might
                          * change its type to BUF_SHMEM_SEND. */
                         shmem_buf->type = BUF_SHMEM_RETURN;
@@ -1055,6 +1570,7 @@ int start_progress_thread(ni_t *ni)
     /* Keep the communication thread active at the end to terminate it */
     ni->catcher_nosleep = 0;
     atomic_set(&keep_polling, 0);
+    tgt_start_workers(ni);
     ret = pthread_create(&ni->catcher, NULL, progress_thread, ni);
     if (ret) {
         WARN();
@@ -1064,6 +1580,9 @@ int start_progress_thread(ni_t *ni)
 
         ret = PTL_OK;
     }
+#if WITH_TRANSPORT_UDP
+    udp_start_rxq_threads(ni);
+#endif
     /* Give the priority to the communication thread */
     int which = PRIO_PROCESS;
     pid_t pid = getpid();
@@ -1083,6 +1602,11 @@ void stop_progress_thread(ni_t *ni)
         pthread_join(ni->catcher, (void **)&status);
         assert(status == 0 || status == PTHREAD_CANCELED);
     }
+#if WITH_TRANSPORT_UDP
+    ni->catcher_stop = 1;
+    udp_stop_rxq_threads(ni);
+#endif
+    tgt_stop_workers(ni);
 }
 
 #endif
@@ -47,16 +47,19 @@ static inline void ref_set(struct ref *ref, int num)
 /**
  * Get or take a new reference.
  *
- * Uses gcc built in atomic operations.
+ * The caller already holds a reference, so the increment needs no
+ * ordering.
  * When debugging causes an assert if the new reference count is less than one.
  *
  * @param ref the ref to get a reference to.
  */
 static inline void ref_get(struct ref *ref)
 {
-    int ref_cnt = ref_cnt;
+    int ref_cnt;
 
-    ref_cnt = atomic_inc(&ref->ref_cnt);
+    ATOMIC_COUNT();
+    ref_cnt = atomic_fetch_add_explicit(&ref->ref_cnt.val, 1,
+                                        memory_order_relaxed);
 
     assert(ref_cnt >= 1);
 }
@@ -64,7 +67,9 @@ static inline void ref_get(struct ref *ref)
 /**
  * Put or drop a reference.
  *
- * Uses gcc built in atomic operations.
+ * The decrement releases the accesses made through the reference.
+ * The thread dropping the last one synchronizes with all the others
+ * before calling release.
  * When debugging causes an assert if the new reference count is less than zero.
  *
  * @param ref the ref to get a reference to.
@@ -74,11 +79,14 @@ static inline int ref_put(struct ref *ref, void (*release) (ref_t *ref))
 {
     int ref_cnt;
 
-    ref_cnt = atomic_dec(&ref->ref_cnt);
+    ATOMIC_COUNT();
+    ref_cnt = atomic_fetch_sub_explicit(&ref->ref_cnt.val, 1,
+                                        memory_order_release) - 1;
 
     assert(ref_cnt >= 0);
 
     if (ref_cnt == 0) {
+        atomic_thread_fence(memory_order_acquire);
         release(ref);
         return 1;
     }
@@ -13,6 +13,21 @@
 #include "ptl_rudp.h"
 
 #if WITH_RUDP
+/* Send the wire image of a buf, outside of the sequence. */
+static ssize_t rudp_send_wire(ni_t *ni, buf_t *buf, struct sockaddr_in *dest)
+{
+    struct udp_hdr hdr;
+    struct iovec iov[3];
+    struct msghdr msg = {
+        .msg_name = dest,
+        .msg_namelen = sizeof(*dest),
+        .msg_iov = iov,
+        .msg_iovlen = udp_wire_iov(buf, &hdr, iov, 0),
+    };
+
+    return sendmsg(ni->iface->udp.connect_s, &msg, 0);
+}
+
 int process_rudp_send_hdr(buf_t *buf, int len, ni_t *ni)
 {
 
@@ -138,11 +153,7 @@ int process_rudp_recv_hdr(buf_t *buf, int len, ni_t *ni)
             if (found_one == 1) {
                 //only handles the non-large message case
                 ptl_info("@@@@ RUDP NACK sendto retransmission @@@@@\n");
-                ret =
-                    sendto(ni->iface->udp.connect_s, temp_buf,
-                           sizeof(*temp_buf), 0,
-                           (struct sockaddr *)temp_buf->udp.dest_addr,
-                           sizeof(*temp_buf->udp.dest_addr));
+                ret = rudp_send_wire(ni, temp_buf, temp_buf->udp.dest_addr);
                 if (ret == -1)
                     return ret;
                 //add the buffer back to the list
@@ -186,9 +197,7 @@ int process_rudp_recv_hdr(buf_t *buf, int len, ni_t *ni)
 
             //TODO: strip out the data so we have less network load
             //      on the ACK/NACK
-            sendto(ni->iface->udp.connect_s, buf, sizeof(*buf), 0,
-                   (struct sockaddr *)&temp_conn->sin,
-                   sizeof(*&temp_conn->sin));
+            rudp_send_wire(ni, buf, &temp_conn->sin);
             break;
         }
 
@@ -221,23 +230,27 @@ int process_rudp_recv_hdr(buf_t *buf, int len, ni_t *ni)
  * given destination.
  *
  * @param[in] sockfd The socket to use for the send
- * @param[in] msg    The message to be sent, in strcut msghdr form
+ * @param[in] msg    The message to be sent, in strcut msghdr form,
+ *                   starting with its struct udp_hdr
  * @param[in] flags  Appropriate flags to pass for the sendmsg operation
+ * @param[in] buf    The buf being sent
  * @param[in] ni     The portals network interface to use 
  *
  * @return size      Size of the message sent
  */
-ssize_t ptl_sendmsg(int sockfd, const struct msghdr *msg, int flags, ni_t *ni)
+ssize_t ptl_sendmsg(int sockfd, const struct msghdr *msg, int flags,
+                    buf_t *buf, ni_t *ni)
 {
     ssize_t ret;
 #if !WITH_RUDP
     ret = sendmsg(sockfd, msg, flags);
 #else
     //send this reliably
+    struct udp_hdr *hdr = msg->msg_iov[0].iov_base;
     int hdr_status;
     hdr_status =
-        process_rudp_send_hdr((void *)(msg->msg_iov[0].iov_base),
-                              (int)(msg->msg_iov[0].iov_len), ni);
+        process_rudp_send_hdr(buf, (int)(msg->msg_iov[0].iov_len), ni);
+    hdr->seq_num = cpu_to_le32(buf->transfer.udp.seq_num);
 
     //begin the send
     ptl_info("@@@@@@@@@ RUDP sendmsg @@@@@@@@@\n");
@@ -245,119 +258,3 @@ ssize_t ptl_sendmsg(int sockfd, const struct msghdr *msg, int flags, ni_t *ni)
 #endif
     return ret;
 }
-
-/**
- * @brief Intercept sendto calls for reliability header processing
- *
- * This allows the non-RUDP case to simply pass through to sendto
- * RUDP calls have a reliabilty header applied to it for the
- * given destination.
- *
- * @param[in] sockfd     The socket to use for the send
- * @param[in] buf        The buffer to be sent
- * @param[in] len        The length of the buffer
- * @param[in] flags      Appropriate flags to pass for the sendmsg operation
- * @param[in] dest_addr  The destination address (struct sockaddr)
- * @param[in] addrlen    The length of the dest_addr struct
- * @param[in] ni         The portals network interface to use  
- *
- * @return size          Size of the message sent
- *
- */
-ssize_t ptl_sendto(int sockfd, buf_t *buf, size_t len, int flags,
-                   struct sockaddr * dest_addr, socklen_t addrlen, ni_t *ni)
-{
-    ssize_t ret;
-#if !WITH_RUDP
-    ret = sendto(sockfd, buf, len, flags, dest_addr, addrlen);
-#else
-    //send this reliably
-    int hdr_status;
-    hdr_status = process_rudp_send_hdr(buf, len, ni);
-
-    //begin send
-    ptl_info("@@@@@@@@@ RUDP sendto @@@@@@@@@\n");
-    ret = sendto(sockfd, buf, len, flags, dest_addr, addrlen);
-    if (ret == -1)
-        return ret;
-
-
-#endif
-    return ret;
-}
-
-
-/**
- * @brief Intercept recvmsg calls for reliability header processing
- *
- * This allows the non-RUDP case to simply pass through to recvmsg
- * RUDP calls have a reliabilty header processed
- *
- * @param[in] sockfd The socket to use for the recv
- * @param[in] msg    The message to be recvd, in strcut msghdr form
- * @param[in] flags  Appropriate flags to pass for the recvmsg operation
- * @param[in] ni     The portals network interface to use 
- *
- * @return size      Size of the message received
- */
-
-ssize_t ptl_recvmsg(int sockfd, struct msghdr *msg, int flags, ni_t *ni)
-{
-    ssize_t ret;
-#if !WITH_RUDP
-    ret = recvmsg(sockfd, msg, flags);
-#else
-    //send this reliably
-    int hdr_status;
-    ptl_info("@@@@@@@@@ RUDP recvmsg @@@@@@@@@\n");
-    ret = recvmsg(sockfd, msg, flags);
-    if (ret == -1)
-        return ret;
-    if (flags == MSG_PEEK)
-        return ret;
-
-    hdr_status =
-        process_rudp_recv_hdr(msg->msg_iov[0].iov_base,
-                              msg->msg_iov[0].iov_len, ni);
-#endif
-    return ret;
-}
-
-/**
- * @brief Intercept recvfrom calls for reliability header processing
- *
- * This allows the non-RUDP case to simply pass through to recvfrom
- * RUDP calls have a reliabilty header processed
- *
- * @param[in] sockfd     The socket to use for the recv
- * @param[in] buf        A buffer to put the message in
- * @param[in] len        The length of the buffer
- * @param[in] flags      Flags to pass to the recvfrom operation
- * @param[in] src_addr   The source address (struct sockaddr)
- * @param[in] addrlen    The length of the src_addr struct
- * @param[in] ni         The portals network interface to use  
- *  
- * @return size          Size of the message received
- *
- */
-ssize_t ptl_recvfrom(int sockfd, buf_t *buf, size_t len, int flags,
-                     struct sockaddr * src_addr, socklen_t *addrlen, ni_t *ni)
-{
-    ssize_t ret;
-#if !WITH_RUDP
-    ret = recvfrom(sockfd, buf, len, flags, src_addr, addrlen);
-#else
-    //recv this reliably
-    int hdr_status;
-    ret = recvfrom(sockfd, buf, len, flags, src_addr, addrlen);
-    //error processing, just hand the error back to the caller
-    if (ret == -1 || ret == 0)
-        return ret;
-    if (flags == MSG_PEEK)
-        return ret;
-
-    hdr_status = process_rudp_recv_hdr(buf, len, ni);
-
-#endif
-    return ret;
-}
@@ -4,6 +4,46 @@
 
 #include "ptl_loc.h"
 
+#include <signal.h>
+
+/**
+ * @brief Check that the peer of a physical NI connection still owns
+ * the directory slot it was found in.
+ *
+ * A peer that leaves releases its slot, and another process may take
+ * it. The connection is then reset, so that the next operation looks
+ * the peer up again instead of sending to the new owner.
+ *
+ * @param[in] ni the NI
+ * @param[in] conn the connection
+ *
+ * @return PTL_OK, or PTL_FAIL if the peer left
+ */
+static int shmem_check_peer(ni_t *ni, conn_t *conn)
+{
+    const struct shmem_pid_table *slot;
+
+    if (!ni->shmem.dir || !conn || conn->transport.type != CONN_TYPE_SHMEM)
+        return PTL_OK;
+
+    slot = &ni->shmem.dir->slot[conn->shmem.local_rank];
+    if (likely(slot->valid == 1)) {
+        __sync_synchronize();
+        if (likely(slot->gen == conn->shmem.gen))
+            return PTL_OK;
+    }
+
+    ptl_warn("process %u:%u left the shared memory directory\n",
+             conn->id.phys.nid, conn->id.phys.pid);
+
+    pthread_mutex_lock(&conn->mutex);
+    if (conn->state == CONN_STATE_CONNECTED)
+        conn->state = CONN_STATE_DISCONNECTED;
+    pthread_mutex_unlock(&conn->mutex);
+
+    return PTL_FAIL;
+}
+
 /**
  * @brief Send a message using shared memory.
  *
@@ -14,6 +54,9 @@
  */
 static int shmem_send_message(buf_t *buf, int from_init)
 {
+    if (unlikely(shmem_check_peer(buf->obj.obj_ni, buf->conn)))
+        return PTL_FAIL;
+
     /* Keep a reference on the buffer so it doesn't get freed. will be
      * returned by the remote side with type=BUF_SHMEM_RETURN. */
     assert(buf->obj.obj_pool->type == POOL_SBUF);
@@ -27,6 +70,8 @@ static int shmem_send_message(buf_t *buf, int from_init)
 
     buf->shmem.index_owner = buf->obj.obj_ni->mem.index;
 
+    STATS_SEND(buf->obj.obj_ni, STATS_SHMEM, buf->length);
+
     shmem_enqueue(buf->obj.obj_ni, buf, buf->dest.shmem.local_rank);
 
     return PTL_OK;
@@ -52,9 +97,17 @@ static int shmem_init_connect(ni_t *ni, conn_t *conn)
      * automatically connected when other ranks are discovered. */
     assert(ni->options & PTL_NI_PHYSICAL);
 
-    //TODO: It would be helpful to actually do something here.      
     ptl_info("start SHMEM connect \n");
 
+    /* The peer must have registered in the node directory. */
+    conn->shmem.local_rank =
+        shmem_phys_lookup(ni, conn->id, &conn->shmem.gen);
+    if (conn->shmem.local_rank == -1) {
+        ptl_warn("process %u:%u is not in the shared memory directory\n",
+                 conn->id.phys.nid, conn->id.phys.pid);
+        return PTL_FAIL;
+    }
+
     conn->state = CONN_STATE_CONNECTED;
 
     return PTL_OK;
@@ -127,16 +180,16 @@ static int shmem_init_prepare_transfer(md_t *md, data_dir_t dir,
 
     if (length <= get_param(PTL_MAX_INLINE_DATA)) {
         err =
-            append_immediate_data(md->start, NULL, md->num_iov, dir, offset,
-                                  length, buf);
+            append_immediate_data(md->start, md->iov_offsets, NULL,
+                                  md->num_iov, dir, offset, length, buf);
     } else if (md->options & PTL_IOVEC) {
         ptl_iovec_t *iovecs = md->start;
 
         /* Find the index and offset of the first IOV as well as the
          * total number of IOVs to transfer. */
         num_sge =
-            iov_count_elem(iovecs, md->num_iov, offset, length, &iov_start,
-                           &iov_offset);
+            iov_count_elem(iovecs, md->iov_offsets, md->num_iov, offset,
+                           length, &iov_start, &iov_offset);
         if (num_sge < 0) {
             WARN();
             return PTL_FAIL;
@@ -236,6 +289,7 @@ static void append_init_data_noknem_iovec(data_t *data, md_t *md,
 
     buf->transfer.noknem.num_iovecs = num_iov;
     buf->transfer.noknem.iovecs = &((ptl_iovec_t *)md->start)[iov_start];
+    buf->transfer.noknem.iov_offsets = &md->iov_offsets[iov_start];
     buf->transfer.noknem.offset = 0;
 
     buf->transfer.noknem.length_left = length;
@@ -262,6 +316,7 @@ static void append_init_data_noknem_direct(data_t *data, mr_t *mr, void *addr,
 
     buf->transfer.noknem.num_iovecs = 1;
     buf->transfer.noknem.iovecs = &buf->transfer.noknem.my_iovec;
+    buf->transfer.noknem.iov_offsets = NULL;
     buf->transfer.noknem.offset = 0;
 
     buf->transfer.noknem.length_left = length;
@@ -294,8 +349,8 @@ static int noknem_init_prepare_transfer(md_t *md, data_dir_t dir,
 
     if (length <= get_param(PTL_MAX_INLINE_DATA)) {
         err =
-            append_immediate_data(md->start, NULL, md->num_iov, dir, offset,
-                                  length, buf);
+            append_immediate_data(md->start, md->iov_offsets, NULL,
+                                  md->num_iov, dir, offset, length, buf);
     } else {
         if (dir == DATA_DIR_IN)
             buf->data_in->noknem.state = 2;
@@ -308,8 +363,8 @@ static int noknem_init_prepare_transfer(md_t *md, data_dir_t dir,
             /* Find the index and offset of the first IOV as well as the
              * total number of IOVs to transfer. */
             num_sge =
-                iov_count_elem(iovecs, md->num_iov, offset, length,
-                               &iov_start, &iov_offset);
+                iov_count_elem(iovecs, md->iov_offsets, md->num_iov, offset,
+                               length, &iov_start, &iov_offset);
             if (num_sge < 0) {
                 WARN();
                 return PTL_FAIL;
@@ -369,7 +424,8 @@ static int noknem_do_transfer(buf_t *buf)
 
             err =
                 iov_copy_in(buf->transfer.noknem.data,
-                            buf->transfer.noknem.iovecs, NULL,
+                            buf->transfer.noknem.iovecs,
+                            buf->transfer.noknem.iov_offsets, NULL,
                             buf->transfer.noknem.num_iovecs,
                             buf->transfer.noknem.offset, to_copy);
         } else {
@@ -379,7 +435,8 @@ static int noknem_do_transfer(buf_t *buf)
 
             err =
                 iov_copy_out(buf->transfer.noknem.data,
-                             buf->transfer.noknem.iovecs, NULL,
+                             buf->transfer.noknem.iovecs,
+                             buf->transfer.noknem.iov_offsets, NULL,
                              buf->transfer.noknem.num_iovecs,
                              buf->transfer.noknem.offset, to_copy);
 
@@ -426,11 +483,13 @@ static int noknem_tgt_data_out(buf_t *buf, data_t *data)
     if ((buf->rdma_dir == DATA_DIR_IN && buf->put_resid) ||
         (buf->rdma_dir == DATA_DIR_OUT && buf->get_resid)) {
         if (buf->me->options & PTL_IOVEC) {
-            buf->transfer.noknem.num_iovecs = buf->me->length;
+            buf->transfer.noknem.num_iovecs = buf->me->num_iov;
             buf->transfer.noknem.iovecs = buf->me->start;
+            buf->transfer.noknem.iov_offsets = buf->me->iov_offsets;
         } else {
             buf->transfer.noknem.num_iovecs = 1;
             buf->transfer.noknem.iovecs = &buf->transfer.noknem.my_iovec;
+            buf->transfer.noknem.iov_offsets = NULL;
 
             buf->transfer.noknem.my_iovec.iov_base = buf->me->start;
             buf->transfer.noknem.my_iovec.iov_len = buf->me->length;
@@ -464,6 +523,153 @@ struct transport transport_shmem = {
 #endif
 };
 
+/**
+ * @brief Lock the directory of the physical NIs.
+ *
+ * The lock holds the pid of its owner so that it can be taken over
+ * if that process died while holding it.
+ *
+ * @param[in] dir the directory
+ */
+static void phys_dir_lock(struct shmem_phys_dir *dir)
+{
+    pid_t me = getpid();
+    pid_t owner;
+
+    while ((owner = __sync_val_compare_and_swap(&dir->lock, 0, me)) != 0) {
+        if (kill(owner, 0) == -1 && errno == ESRCH &&
+            __sync_bool_compare_and_swap(&dir->lock, owner, me))
+            break;
+
+        SPINLOCK_BODY();
+    }
+}
+
+static void phys_dir_unlock(struct shmem_phys_dir *dir)
+{
+    __sync_synchronize();
+    dir->lock = 0;
+}
+
+/* Whether the process owning a slot is gone without releasing it. */
+static int slot_is_stale(const struct shmem_pid_table *slot)
+{
+    return slot->valid && kill(slot->os_pid, 0) == -1 && errno == ESRCH;
+}
+
+/**
+ * @brief Take a free slot in the directory of the physical NIs.
+ *
+ * The slot is only reserved. It is published once the queue and the
+ * buffers behind it are ready.
+ *
+ * @param[in] ni the physical NI
+ * @param[in] dir the directory
+ *
+ * @return PTL_OK, PTL_NO_SPACE if all the slots are in use, or
+ * PTL_INTERRUPTED if the comm pad is being removed by its last user.
+ */
+static int phys_dir_claim(ni_t *ni, struct shmem_phys_dir *dir)
+{
+    int err = PTL_NO_SPACE;
+    int i;
+
+    phys_dir_lock(dir);
+
+    if (dir->dead) {
+        err = PTL_INTERRUPTED;
+    } else {
+        for (i = 0; i < dir->num_slots; i++) {
+            struct shmem_pid_table *slot = &dir->slot[i];
+
+            if (slot->valid == 0 || slot_is_stale(slot)) {
+                slot->valid = 2;
+                slot->os_pid = getpid();
+                slot->gen++;
+                ni->mem.index = i;
+                err = PTL_OK;
+                break;
+            }
+        }
+    }
+
+    phys_dir_unlock(dir);
+
+    return err;
+}
+
+/**
+ * @brief Release our slot in the directory of the physical NIs.
+ *
+ * The last user removes the comm pad.
+ *
+ * @param[in] ni the physical NI
+ */
+static void phys_dir_leave(ni_t *ni)
+{
+    struct shmem_phys_dir *dir = ni->shmem.dir;
+    int i;
+
+    phys_dir_lock(dir);
+
+    dir->slot[ni->mem.index].valid = 0;
+
+    for (i = 0; i < dir->num_slots; i++) {
+        if (dir->slot[i].valid && !slot_is_stale(&dir->slot[i]))
+            break;
+    }
+
+    if (i == dir->num_slots) {
+        /* Processes that opened it but haven't taken a slot yet will
+         * see it's dead and create a new one. */
+        dir->dead = 1;
+        shm_unlink(ni->shmem.comm_pad_shm_name);
+    }
+
+    phys_dir_unlock(dir);
+
+    ni->shmem.dir = NULL;
+    free(ni->shmem.comm_pad_shm_name);
+    ni->shmem.comm_pad_shm_name = NULL;
+}
+
+/**
+ * @brief Find the local rank of a process in the directory of the
+ * physical NIs.
+ *
+ * @param[in] ni the physical NI
+ * @param[in] id the process to look for
+ * @param[out] gen the generation of its slot, see shmem_check_peer()
+ *
+ * @return the index of its queue in the comm pad, or -1 if the
+ * process doesn't share it.
+ */
+int shmem_phys_lookup(ni_t *ni, ptl_process_t id, unsigned int *gen)
+{
+    struct shmem_phys_dir *dir = ni->shmem.dir;
+    int i;
+
+    *gen = 0;
+
+    if (!dir)
+        /* Private comm pad. */
+        return (id.phys.nid == ni->id.phys.nid &&
+                id.phys.pid == ni->id.phys.pid) ? 0 : -1;
+
+    for (i = 0; i < dir->num_slots; i++) {
+        const struct shmem_pid_table *slot = &dir->slot[i];
+
+        if (slot->valid == 1 && slot->id.phys.pid == id.phys.pid &&
+            slot->id.phys.nid == id.phys.nid) {
+            __sync_synchronize();
+            *gen = slot->gen;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 /**
  * @brief Cleanup shared memory resources.
  *
@@ -473,6 +679,9 @@ static void release_shmem_resources(ni_t *ni)
 {
     pool_fini(&ni->sbuf_pool);
 
+    if (ni->shmem.dir)
+        phys_dir_leave(ni);
+
     if (ni->shmem.comm_pad != MAP_FAILED) {
         munmap(ni->shmem.comm_pad, ni->shmem.comm_pad_size);
         ni->shmem.comm_pad = MAP_FAILED;
@@ -494,85 +703,255 @@ static void release_shmem_resources(ni_t *ni)
 #endif
 }
 
+/* Offsets of the parts of a comm pad. */
+struct commpad_layout {
+    size_t queues;              /* area of the local index 0 */
+#if !USE_KNEM
+    size_t bounce_head;
+    size_t bounce_bufs;
+#endif
+};
+
 /**
- * @brief Initialize shared memory resources.
+ * @brief Compute the size and layout of the comm pad.
  *
- * This function is called during NI creation if the NI is physical,
- * or after PtlSetMap if it is logical.
+ * @param[in] ni
+ * @param[in] table_size size of the table at the start of the comm pad
+ * @param[out] layout
+ */
+static void commpad_layout(ni_t *ni, size_t table_size,
+                           struct commpad_layout *layout)
+{
+    layout->queues = ROUND_UP(table_size, pagesize);
+
+    ni->shmem.comm_pad_size = layout->queues +
+        (ni->shmem.per_proc_comm_buf_size * ni->mem.node_size);
+
+#if !USE_KNEM
+    layout->bounce_head = ni->shmem.comm_pad_size;
+    ni->shmem.comm_pad_size +=
+        ROUND_UP(sizeof(struct shmem_bounce_head), pagesize);
+
+    ni->shmem.bounce_buf.buf_size = get_param(PTL_BOUNCE_BUF_SIZE);
+    ni->shmem.bounce_buf.num_bufs = get_param(PTL_BOUNCE_NUM_BUFS);
+
+    layout->bounce_bufs = ni->shmem.comm_pad_size;
+    ni->shmem.comm_pad_size +=
+        ni->shmem.bounce_buf.buf_size * ni->shmem.bounce_buf.num_bufs;
+#endif
+
+    /* With huge pages, round the comm pad to a whole number of huge
+     * pages so that it can be entirely backed by them. */
+    if (get_param(PTL_HUGEPAGES))
+        ni->shmem.comm_pad_size =
+            ROUND_UP(ni->shmem.comm_pad_size, hugepagesize);
+}
+
+/**
+ * @brief Set the pointers into a freshly mapped comm pad.
  *
  * @param[in] ni
+ * @param[in] layout
+ */
+static void commpad_attach(ni_t *ni, const struct commpad_layout *layout)
+{
+#ifdef MADV_HUGEPAGE
+    /* Ask for transparent huge pages on the shmem mapping. This only
+     * takes effect if the kernel's shmem_enabled policy allows it, so a
+     * failure is not fatal. */
+    if (get_param(PTL_HUGEPAGES) &&
+        madvise(ni->shmem.comm_pad, ni->shmem.comm_pad_size, MADV_HUGEPAGE))
+        ptl_info("madvise(MADV_HUGEPAGE) failed on comm pad (errno=%d)\n",
+                 errno);
+#endif
+
+    ni->shmem.first_queue = ni->shmem.comm_pad + layout->queues;
+
+#if !USE_KNEM
+    ni->shmem.bounce_buf.head = ni->shmem.comm_pad + layout->bounce_head;
+    ni->shmem.bounce_buf.bbs = ni->shmem.comm_pad + layout->bounce_bufs;
+#endif
+}
+
+#if !USE_KNEM
+/**
+ * @brief Link the bounce buffers together. Done by the creator of
+ * the comm pad.
  *
- * @return status
+ * @param[in] ni
  */
-static int setup_commpad(ni_t *ni)
+static void link_bounce_buffers(ni_t *ni)
 {
-    int shm_fd = -1;
-    char comm_pad_shm_name[200] = "";
-    int err;
     int i;
-    int pid_table_size;
 
-    /*
-     * Buffers in shared memory. The buffers will be allocated later,
-     * but not by the pool management. We compute the sizes now.
-     */
-    /* Allocate a pool of buffers in the mmapped region. */
-    ni->shmem.per_proc_comm_buf_numbers = get_param(PTL_NUM_SBUF);
+    ni->shmem.bounce_buf.head->head_index0 = ni->shmem.bounce_buf.head;
+    ll_init(&ni->shmem.bounce_buf.head->free_list);
 
-    ni->sbuf_pool.setup = buf_setup;
-    ni->sbuf_pool.init = buf_init;
-    ni->sbuf_pool.fini = buf_fini;
-    ni->sbuf_pool.cleanup = buf_cleanup;
-    ni->sbuf_pool.use_pre_alloc_buffer = 1;
-    ni->sbuf_pool.round_size = real_buf_t_size();
-    ni->sbuf_pool.slab_size =
-        ni->shmem.per_proc_comm_buf_numbers * ni->sbuf_pool.round_size;
+    for (i = 0; i < ni->shmem.bounce_buf.num_bufs; i++) {
+        void *bb = ni->shmem.bounce_buf.bbs + i * ni->shmem.bounce_buf.buf_size;
 
-    /* Open KNEM device */
-    if (knem_init(ni)) {
-        WARN();
-        goto exit_fail;
+        ll_enqueue_obj(&ni->shmem.bounce_buf.head->free_list, bb);
     }
+}
+#endif
 
-    if (ni->options & PTL_NI_PHYSICAL) {
-        /* Create a unique name for the shared memory file. */
-        snprintf(comm_pad_shm_name, sizeof(comm_pad_shm_name),
-                 "/portals4-shmem-pid%d", ni->id.phys.pid);
+/**
+ * @brief Map the comm pad shared by the physical NIs of the node and
+ * take a slot in it.
+ *
+ * The comm pad starts with a directory keyed by process id. The
+ * first process creates and initializes it, the last one to leave
+ * removes it. Peers are looked up in the directory when the
+ * connection to them is created, see shmem_phys_lookup().
+ *
+ * @param[in] ni the physical NI
+ *
+ * @return status
+ */
+static int map_phys_dir(ni_t *ni)
+{
+    char name[200];
+    struct commpad_layout layout;
+    struct shmem_phys_dir *dir;
+    struct stat st;
+    int created;
+    int shm_fd;
+    int try_count;
+    int err;
+
+    snprintf(name, sizeof(name), "/portals4-shmem-phys-%d-%d", getuid(),
+             ni->options);
+
+    ni->mem.node_size = get_param(PTL_SHMEM_PHYS_SLOTS);
+    commpad_layout(ni, sizeof(*dir) +
+                   ni->mem.node_size * sizeof(struct shmem_pid_table),
+                   &layout);
+
+  again:
+    created = 0;
+    shm_fd =
+        shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (shm_fd >= 0) {
+        created = 1;
+
+        if (ftruncate(shm_fd, ni->shmem.comm_pad_size) != 0) {
+            ptl_warn("share memory ftruncate failed\n");
+            close(shm_fd);
+            shm_unlink(name);
+            return PTL_FAIL;
+        }
+    } else if (errno == EEXIST) {
+        shm_fd = shm_open(name, O_RDWR, S_IRUSR | S_IWUSR);
+        if (shm_fd == -1) {
+            if (errno == ENOENT)
+                /* Just removed by its last user. */
+                goto again;
+
+            ptl_warn("Couldn't open the shared memory file %s\n", name);
+            return PTL_FAIL;
+        }
+
+        /* Wait for its creator to size it. */
+        for (try_count = 100; try_count; try_count--) {
+            if (fstat(shm_fd, &st) == -1) {
+                st.st_size = 0;
+                break;
+            }
+
+            if (st.st_size)
+                break;
+
+            usleep(100000);            /* 100ms */
+        }
+
+        if (st.st_size != ni->shmem.comm_pad_size) {
+            ptl_warn("Shared memory file %s has wrong size, check "
+                     "PTL_NUM_SBUF and PTL_SHMEM_PHYS_SLOTS\n", name);
+            close(shm_fd);
+            return PTL_FAIL;
+        }
     } else {
-        /* Create a unique name for the shared memory file. Use the hash
-         * created from the mapping. */
-        snprintf(comm_pad_shm_name, sizeof(comm_pad_shm_name),
-                 "/portals4-shmem-%x-%d", ni->mem.hash, ni->options);
+        ptl_warn("shm_open of %s failed (errno=%d)\n", name, errno);
+        return PTL_FAIL;
     }
-    ni->shmem.comm_pad_shm_name = strdup(comm_pad_shm_name);
 
-    /* Allocate a pool of buffers in the mmapped region. */
-    ni->shmem.per_proc_comm_buf_size =
-        sizeof(queue_t) + ni->sbuf_pool.slab_size;
+    ni->shmem.comm_pad =
+        (uint8_t *) mmap(NULL, ni->shmem.comm_pad_size,
+                         PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
 
-    pid_table_size = ni->mem.node_size * sizeof(struct shmem_pid_table);
-    pid_table_size = ROUND_UP(pid_table_size, pagesize);
+    if (ni->shmem.comm_pad == MAP_FAILED) {
+        ptl_warn("mmap failed (%d)\n", errno);
+        if (created)
+            shm_unlink(name);
+        return PTL_FAIL;
+    }
 
-    ni->shmem.comm_pad_size = pid_table_size;
+    commpad_attach(ni, &layout);
 
-    ni->shmem.comm_pad_size +=
-        (ni->shmem.per_proc_comm_buf_size * ni->mem.node_size);
+    dir = ni->shmem.comm_pad;
 
+    if (created) {
+        dir->comm_pad_size = ni->shmem.comm_pad_size;
+        dir->num_slots = ni->mem.node_size;
 #if !USE_KNEM
-    off_t bounce_buf_offset;
-    off_t bounce_head_offset;
+        link_bounce_buffers(ni);
+#endif
+        __sync_synchronize();
+        dir->ready = 1;
+    } else {
+        /* Wait for its creator to initialize it. */
+        for (try_count = 100; !dir->ready && try_count; try_count--)
+            usleep(100000);            /* 100ms */
 
-    bounce_head_offset = ni->shmem.comm_pad_size;
-    ni->shmem.comm_pad_size +=
-        ROUND_UP(sizeof(struct shmem_bounce_head), pagesize);
+        if (!dir->ready || dir->num_slots != ni->mem.node_size ||
+            dir->comm_pad_size != ni->shmem.comm_pad_size) {
+            ptl_warn("Shared memory file %s is not usable\n", name);
+            goto fail;
+        }
+    }
 
-    ni->shmem.bounce_buf.buf_size = get_param(PTL_BOUNCE_BUF_SIZE);
-    ni->shmem.bounce_buf.num_bufs = get_param(PTL_BOUNCE_NUM_BUFS);
+    err = phys_dir_claim(ni, dir);
+    if (err == PTL_INTERRUPTED) {
+        munmap(ni->shmem.comm_pad, ni->shmem.comm_pad_size);
+        ni->shmem.comm_pad = MAP_FAILED;
+        goto again;
+    } else if (err) {
+        ptl_warn("All %d slots of %s are in use, raise "
+                 "PTL_SHMEM_PHYS_SLOTS\n", dir->num_slots, name);
+        goto fail;
+    }
 
-    bounce_buf_offset = ni->shmem.comm_pad_size;
-    ni->shmem.comm_pad_size +=
-        ni->shmem.bounce_buf.buf_size * ni->shmem.bounce_buf.num_bufs;
-#endif
+    ni->shmem.dir = dir;
+    ni->shmem.comm_pad_shm_name = strdup(name);
+
+    return PTL_OK;
+
+  fail:
+    munmap(ni->shmem.comm_pad, ni->shmem.comm_pad_size);
+    ni->shmem.comm_pad = MAP_FAILED;
+
+    return PTL_FAIL;
+}
+
+/**
+ * @brief Create or open the comm pad of the local ranks of a logical
+ * NI, or the private one of a physical NI. Local index 0 creates it.
+ *
+ * @param[in] ni
+ * @param[in] comm_pad_shm_name name of the shared memory file
+ *
+ * @return status
+ */
+static int map_commpad(ni_t *ni, const char *comm_pad_shm_name)
+{
+    struct commpad_layout layout;
+    int shm_fd = -1;
+
+    ni->shmem.comm_pad_shm_name = strdup(comm_pad_shm_name);
+
+    commpad_layout(ni, ni->mem.node_size * sizeof(struct shmem_pid_table),
+                   &layout);
 
     /* Open the communication pad. Let rank 0 create the shared memory. */
     assert(ni->shmem.comm_pad == MAP_FAILED);
@@ -644,7 +1023,6 @@ static int setup_commpad(ni_t *ni)
         }
     }
 
-    /* Fill our portion of the comm pad. */
     ni->shmem.comm_pad =
         (uint8_t *) mmap(NULL, ni->shmem.comm_pad_size,
                          PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
@@ -656,10 +1034,93 @@ static int setup_commpad(ni_t *ni)
 
     /* The share memory is mmaped, so we can close the file. */
     close(shm_fd);
-    shm_fd = -1;
+
+    commpad_attach(ni, &layout);
+
+#if !USE_KNEM
+    /* Let index 0 link the bounce buffers together. */
+    if (ni->mem.index == 0)
+        link_bounce_buffers(ni);
+#endif
+
+    return PTL_OK;
+
+  exit_fail:
+    if (shm_fd != -1)
+        close(shm_fd);
+
+    return PTL_FAIL;
+}
+
+/**
+ * @brief Initialize shared memory resources.
+ *
+ * This function is called during NI creation if the NI is physical,
+ * or after PtlSetMap if it is logical.
+ *
+ * @param[in] ni
+ *
+ * @return status
+ */
+static int setup_commpad(ni_t *ni)
+{
+    char comm_pad_shm_name[200] = "";
+    int err;
+    int i;
+
+    /*
+     * Buffers in shared memory. The buffers will be allocated later,
+     * but not by the pool management. We compute the sizes now.
+     */
+    /* Allocate a pool of buffers in the mmapped region. */
+    ni->shmem.per_proc_comm_buf_numbers = get_param(PTL_NUM_SBUF);
+
+    ni->sbuf_pool.setup = buf_setup;
+    ni->sbuf_pool.init = buf_init;
+    ni->sbuf_pool.fini = buf_fini;
+    ni->sbuf_pool.cleanup = buf_cleanup;
+    ni->sbuf_pool.use_pre_alloc_buffer = 1;
+    ni->sbuf_pool.round_size = real_buf_t_size();
+    ni->sbuf_pool.slab_size =
+        ni->shmem.per_proc_comm_buf_numbers * ni->sbuf_pool.round_size;
+
+    /* Open KNEM device */
+    if (knem_init(ni)) {
+        WARN();
+        goto exit_fail;
+    }
+
+    /* Allocate a pool of buffers in the mmapped region. */
+    ni->shmem.per_proc_comm_buf_size =
+        sizeof(queue_t) + ni->sbuf_pool.slab_size;
+
+    if (ni->options & PTL_NI_PHYSICAL) {
+        /* Share a comm pad with the other physical NIs of the node
+         * if possible. Otherwise only talk to ourselves. */
+        err = map_phys_dir(ni);
+        if (err) {
+            ptl_info("using a private comm pad\n");
+
+            ni->mem.index = 0;
+            ni->mem.node_size = 1;
+
+            /* Create a unique name for the shared memory file. */
+            snprintf(comm_pad_shm_name, sizeof(comm_pad_shm_name),
+                     "/portals4-shmem-pid%d", ni->id.phys.pid);
+            err = map_commpad(ni, comm_pad_shm_name);
+        }
+    } else {
+        /* Create a unique name for the shared memory file. Use the hash
+         * created from the mapping. */
+        snprintf(comm_pad_shm_name, sizeof(comm_pad_shm_name),
+                 "/portals4-shmem-%x-%d", ni->mem.hash, ni->options);
+        err = map_commpad(ni, comm_pad_shm_name);
+    }
+
+    if (err)
+        goto exit_fail;
 
     /* Now we can create the buffer pool */
-    ni->shmem.first_queue = ni->shmem.comm_pad + pid_table_size;
     ni->shmem.queue =
         (queue_t *)(ni->shmem.first_queue +
                     (ni->shmem.per_proc_comm_buf_size * ni->mem.index));
@@ -675,26 +1136,15 @@ static int setup_commpad(ni_t *ni)
         WARN();
         goto exit_fail;
     }
-#if !USE_KNEM
-    /* Initialize the bounce buffers and let index 0 link them
-     * together. */
-    ni->shmem.bounce_buf.head = ni->shmem.comm_pad + bounce_head_offset;
-    ni->shmem.bounce_buf.bbs = ni->shmem.comm_pad + bounce_buf_offset;
-
-    if (ni->mem.index == 0) {
-        ni->shmem.bounce_buf.head->head_index0 = ni->shmem.bounce_buf.head;
-        ll_init(&ni->shmem.bounce_buf.head->free_list);
 
-        for (i = 0; i < ni->shmem.bounce_buf.num_bufs; i++) {
-            void *bb =
-                ni->shmem.bounce_buf.bbs + i * ni->shmem.bounce_buf.buf_size;
+    if (ni->shmem.dir) {
+        /* Our queue is ready. Peers can now find us. */
+        struct shmem_pid_table *slot = &ni->shmem.dir->slot[ni->mem.index];
 
-            ll_enqueue_obj(&ni->shmem.bounce_buf.head->free_list, bb);
-        }
-    }
-#endif
-
-    if (ni->options & PTL_NI_LOGICAL) {
+        slot->id = ni->id;
+        __sync_synchronize();
+        slot->valid = 1;
+    } else if (ni->options & PTL_NI_LOGICAL) {
         /* Can now announce my presence. */
 
         /* The PID table is a the beginning of the comm pad. */
@@ -722,9 +1172,6 @@ static int setup_commpad(ni_t *ni)
     return PTL_OK;
 
   exit_fail:
-    if (shm_fd != -1)
-        close(shm_fd);
-
     release_shmem_resources(ni);
 
     return PTL_FAIL;
@@ -769,6 +1216,7 @@ static int PtlNIInit_shmem(gbl_t *gbl, ni_t *ni)
 {
     ni->shmem.knem_fd = -1;
     ni->shmem.comm_pad = MAP_FAILED;
+    ni->shmem.dir = NULL;
 
     /* Only if IB hasn't setup the NID first. */
     if (ni->iface->id.phys.nid == PTL_NID_ANY) {
@@ -789,17 +1237,15 @@ static int PtlNIInit_shmem(gbl_t *gbl, ni_t *ni)
         int err;
         conn_t *conn;
 
-        /* Used later to setup the buffers. */
-        ni->mem.index = 0;
-        ni->mem.node_size = 1;
-
         err = setup_commpad(ni);
         if (unlikely(err)) {
             WARN();
             return err;
         }
 
-        /* Physical interface. We are connected to ourselves. */
+        /* Physical interface. We are connected to ourselves, and
+         * get_conn() connects to the other local processes through
+         * the directory. */
         conn = get_conn(ni, ni->id);
         if (!conn) {
             /* It's hard to recover from here. */
@@ -807,10 +1253,17 @@ static int PtlNIInit_shmem(gbl_t *gbl, ni_t *ni)
             return PTL_ARG_INVALID;
         }
 
+#if WITH_TRANSPORT_LOOP
+        /* Unless we talk to ourselves through the loop transport. */
+        if (conn->transport.type != CONN_TYPE_LOOP) {
+#endif
         conn->transport = transport_shmem;
 
         //for physical addressing we need to make a connection
         shmem_init_connect(ni, conn);
+#if WITH_TRANSPORT_LOOP
+        }
+#endif
 
         conn_put(conn);                /* from get_conn */
     }
@@ -0,0 +1,245 @@
+/**
+ * @file ptl_stats.c
+ *
+ * @brief Per NI statistics page, see ptl_stats.h.
+ */
+
+#include "ptl_loc.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+static void stats_shm_name(ni_t *ni, char *name, size_t len)
+{
+    snprintf(name, len, STATS_SHM_PREFIX "%d.%u", getpid(), ni->ni_type);
+}
+
+/**
+ * @brief Create the statistics page of an NI if requested.
+ *
+ * Failing to create the page is not fatal, the NI just has no
+ * statistics.
+ *
+ * @param[in] ni the NI
+ *
+ * @return status
+ */
+int stats_init(ni_t *ni)
+{
+    char name[64];
+    struct ptl_stats *stats;
+    size_t size;
+    int fd;
+
+    if (!get_param(PTL_STATS))
+        return PTL_OK;
+
+    size = sizeof(*stats) +
+        (ni->limits.max_pt_index + 1) * sizeof(struct stats_pt);
+    size = ROUND_UP(size, pagesize);
+
+    stats_shm_name(ni, name, sizeof(name));
+
+    /* left behind by a dead process that had our pid */
+    shm_unlink(name);
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        ptl_warn("shm_open of %s failed (errno=%d)\n", name, errno);
+        return PTL_OK;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        ptl_warn("ftruncate of %s failed (errno=%d)\n", name, errno);
+        goto err;
+    }
+
+    stats = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (stats == MAP_FAILED) {
+        ptl_warn("mmap of %s failed (errno=%d)\n", name, errno);
+        goto err;
+    }
+
+    close(fd);
+
+    stats->size = size;
+    stats->os_pid = getpid();
+    stats->ni_type = ni->ni_type;
+    stats->num_pt = ni->limits.max_pt_index + 1;
+
+    /* the magic goes last, a reader ignores the page until then */
+    __sync_synchronize();
+    memcpy(stats->magic, STATS_MAGIC, sizeof(stats->magic));
+
+    ni->stats = stats;
+
+    return PTL_OK;
+
+  err:
+    close(fd);
+    shm_unlink(name);
+    return PTL_OK;
+}
+
+/**
+ * @brief Remove the statistics page of an NI.
+ *
+ * The threads of the NI must be stopped. STATS_ADD only reads
+ * ni->stats once, but a thread past that read would still write to
+ * the page.
+ *
+ * @param[in] ni the NI
+ */
+void stats_fini(ni_t *ni)
+{
+    char name[64];
+    struct ptl_stats *stats = ni->stats;
+
+    if (!stats)
+        return;
+
+    ni->stats = NULL;
+    __sync_synchronize();
+
+    stats_shm_name(ni, name, sizeof(name));
+    shm_unlink(name);
+
+    munmap(stats, stats->size);
+}
+
+static void update_pool(struct ptl_stats *stats, pool_t *pool)
+{
+    struct stats_pool *sp;
+    struct list_head *l;
+    uint64_t total = 0;
+
+    /* some pools are only set up for some NI types */
+    if (!pool->name || stats->num_pools == STATS_MAX_POOLS)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    list_for_each(l, &pool->chunk_list) {
+        chunk_t *chunk = list_entry(l, chunk_t, list);
+
+        total += chunk->num_slabs;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    sp = &stats->pool[stats->num_pools++];
+    strncpy(sp->name, pool->name, STATS_NAME_LEN - 1);
+    sp->type = pool->type;
+    sp->in_use = atomic_read(&pool->count);
+    sp->total = total * pool->obj_per_slab;
+}
+
+static void update_eqs(ni_t *ni, struct ptl_stats *stats)
+{
+    struct list_head *l;
+
+    stats->num_eqs = 0;
+    stats->eq_used = 0;
+    stats->eq_size = 0;
+    stats->eq_max_fill = 0;
+
+    PTL_FASTLOCK_LOCK(&ni->eq_list_lock);
+    list_for_each(l, &ni->eq_list) {
+        eq_t *eq = list_entry(l, eq_t, list);
+        struct eqe_list *eqe_list = eq->eqe_list;
+        unsigned int fill;
+
+        stats->num_eqs++;
+        stats->eq_used += eqe_list->used;
+        stats->eq_size += eqe_list->count;
+
+        fill = (uint64_t)eqe_list->used * 1000 / eqe_list->count;
+        if (fill > stats->eq_max_fill)
+            stats->eq_max_fill = fill;
+    }
+    PTL_FASTLOCK_UNLOCK(&ni->eq_list_lock);
+}
+
+static void update_cts(ni_t *ni, struct ptl_stats *stats)
+{
+    struct list_head *l;
+
+    stats->num_cts = 0;
+    stats->ct_trig = 0;
+    stats->ct_trig_max = 0;
+
+    PTL_FASTLOCK_LOCK(&ni->ct_list_lock);
+    list_for_each(l, &ni->ct_list) {
+        ct_t *ct = list_entry(l, ct_t, list);
+        unsigned int depth = atomic_read(&ct->list_size);
+
+        stats->num_cts++;
+        stats->ct_trig += depth;
+        if (depth > stats->ct_trig_max)
+            stats->ct_trig_max = depth;
+    }
+    PTL_FASTLOCK_UNLOCK(&ni->ct_list_lock);
+}
+
+/**
+ * @brief Refresh the snapshot part of the statistics page.
+ *
+ * Called often by the progress thread, only does the work once every
+ * PTL_STATS_INTERVAL milliseconds.
+ *
+ * @param[in] ni the NI
+ */
+void stats_update(ni_t *ni)
+{
+    struct ptl_stats *stats = ni->stats;
+    struct timespec ts;
+    uint64_t now;
+    int i;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if (now - stats->time_ns < get_param(PTL_STATS_INTERVAL) * 1000000ULL)
+        return;
+
+    stats->seq++;
+    __sync_synchronize();
+
+    stats->time_ns = now;
+    stats->nid = ni->id.phys.nid;
+    stats->pid = ni->id.phys.pid;
+    stats->rank = (ni->options & PTL_NI_LOGICAL) ? ni->id.rank :
+        PTL_RANK_ANY;
+
+    for (i = 0; i < PTL_SR_LAST; i++)
+        stats->status[i] = ni->status[i];
+    stats->recv_errs = ni->num_recv_errs;
+    stats->recv_drops = ni->num_recv_drops;
+
+    stats->num_pools = 0;
+    update_pool(stats, &ni->mr_pool);
+    update_pool(stats, &ni->md_pool);
+    update_pool(stats, &ni->me_pool);
+    update_pool(stats, &ni->le_pool);
+    update_pool(stats, &ni->eq_pool);
+    update_pool(stats, &ni->ct_pool);
+    update_pool(stats, &ni->xt_pool);
+    update_pool(stats, &ni->buf_pool);
+    update_pool(stats, &ni->sbuf_pool);
+    update_pool(stats, &ni->conn_pool);
+
+    update_eqs(ni, stats);
+    update_cts(ni, stats);
+
+    for (i = 0; i < stats->num_pt; i++) {
+        pt_t *pt = &ni->pt[i];
+        struct stats_pt *sp = &stats->pt[i];
+
+        sp->in_use = pt->in_use;
+        sp->state = pt->state;
+        sp->priority = pt->priority_size;
+        sp->overflow = pt->overflow_size;
+        sp->unexpected = atomic_read(&pt->unexpected_size);
+        sp->active = pt->num_tgt_active;
+    }
+
+    __sync_synchronize();
+    stats->seq++;
+}
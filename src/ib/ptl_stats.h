@@ -0,0 +1,147 @@
+/**
+ * @file ptl_stats.h
+ *
+ * @brief Per NI statistics page.
+ *
+ * When PTL_STATS is set, each NI publishes its statistics in a shared
+ * memory segment named STATS_SHM_PREFIX<pid>.<ni type> so that p4stat
+ * can sample a running process. The page is only ever written by the
+ * process that owns the NI and never locked:
+ *
+ * - the counters at the end of the page are updated in place, as the
+ *   events happen, with atomic adds;
+ *
+ * - the snapshot (list lengths, pool occupancy, EQ and CT levels) is
+ *   refreshed by the progress thread every PTL_STATS_INTERVAL
+ *   milliseconds. seq is odd while it is being written, so a reader
+ *   retries when seq is odd or has changed while it was reading.
+ *
+ * This file only depends on stdint.h so that p4stat can include it.
+ */
+#ifndef PTL_STATS_H
+#define PTL_STATS_H
+
+#define STATS_MAGIC		"P4STATS1"
+#define STATS_SHM_PREFIX	"/portals4-stats."
+#define STATS_NAME_LEN		(16)
+#define STATS_MAX_POOLS		(16)
+
+/* number of ptl_ni_fail_t values, PTL_NI_OK to PTL_NI_SEGV */
+#define STATS_NUM_FAIL		(8)
+
+/**
+ * @brief Transports with their own counters.
+ */
+enum stats_transport {
+    STATS_RDMA,
+    STATS_SHMEM,
+    STATS_UDP,
+    STATS_LOOP,
+    STATS_TRANSPORT_LAST,           /* keep me last */
+};
+
+/**
+ * @brief Occupancy of one object pool.
+ */
+struct stats_pool {
+    char name[STATS_NAME_LEN];
+    uint32_t type;                      /**< enum obj_type */
+    uint32_t pad;
+    uint64_t in_use;                    /**< objects allocated */
+    uint64_t total;                     /**< objects in the slabs */
+};
+
+/**
+ * @brief State of one portals table entry.
+ */
+struct stats_pt {
+    uint32_t in_use;
+    uint32_t state;                     /**< enum pt_state */
+    uint32_t priority;                  /**< priority list length */
+    uint32_t overflow;                  /**< overflow list length */
+    uint32_t unexpected;                /**< unexpected list length */
+    uint32_t active;                    /**< target operations in progress */
+};
+
+/**
+ * @brief Messages sent and received on one transport.
+ */
+struct stats_transport_count {
+    uint64_t send_pkts;
+    uint64_t send_bytes;
+    uint64_t recv_pkts;
+    uint64_t recv_bytes;
+};
+
+/**
+ * @brief The statistics page.
+ */
+struct ptl_stats {
+    char magic[8];
+    uint32_t size;                      /**< of the segment, in bytes */
+    int32_t os_pid;
+    uint32_t ni_type;
+    uint32_t num_pt;
+
+    /* snapshot */
+    volatile uint32_t seq;
+    uint32_t num_pools;
+    uint64_t time_ns;                   /**< CLOCK_REALTIME of the update */
+    uint32_t nid;
+    uint32_t pid;
+    uint32_t rank;
+    uint32_t num_eqs;
+    uint64_t eq_used;                   /**< events in all the EQs */
+    uint64_t eq_size;                   /**< capacity of all the EQs */
+    uint32_t eq_max_fill;               /**< fullest EQ, per thousand */
+    uint32_t num_cts;
+    uint64_t ct_trig;                   /**< pending triggered operations */
+    uint64_t ct_trig_max;               /**< longest trigger list */
+    uint64_t status[3];                 /**< PTL_SR_* registers */
+    uint64_t recv_errs;
+    uint64_t recv_drops;
+    struct stats_pool pool[STATS_MAX_POOLS];
+
+    /* counters */
+    uint64_t mr_hits;
+    uint64_t mr_misses;
+    uint64_t drops[STATS_NUM_FAIL];     /**< by ptl_ni_fail_t */
+    struct stats_transport_count transport[STATS_TRANSPORT_LAST];
+    uint64_t udp_packed_msgs;           /**< small UDP messages packed */
+    uint64_t udp_packed_dgrams;         /**< in that many datagrams */
+    uint64_t udp_unpacked_msgs;
+    uint64_t udp_unpacked_dgrams;
+
+    struct stats_pt pt[];
+};
+
+#define STATS_ADD(ni, field, n)						\
+	do {								\
+		struct ptl_stats *_stats = (ni)->stats;			\
+									\
+		if (unlikely(_stats != NULL))				\
+			(void)__sync_fetch_and_add(&_stats->field, n);	\
+	} while (0)
+
+#define STATS_INC(ni, field)	STATS_ADD(ni, field, 1)
+
+/* count a message sent or received on a transport */
+#define STATS_SEND(ni, t, len)						\
+	do {								\
+		STATS_INC(ni, transport[t].send_pkts);			\
+		STATS_ADD(ni, transport[t].send_bytes, len);		\
+	} while (0)
+
+#define STATS_RECV(ni, t, len)						\
+	do {								\
+		STATS_INC(ni, transport[t].recv_pkts);			\
+		STATS_ADD(ni, transport[t].recv_bytes, len);		\
+	} while (0)
+
+struct ni;
+
+int stats_init(struct ni *ni);
+void stats_fini(struct ni *ni);
+void stats_update(struct ni *ni);
+
+#endif /* PTL_STATS_H */
@@ -5,65 +5,96 @@
 #ifndef PTL_SYNC_H
 #define PTL_SYNC_H
 
+#include <stdatomic.h>
+
+/*
+ * When configured with --enable-atomic-count, every read-modify-write
+ * done through these helpers, ptl_ref.h and the lock-free lists is
+ * counted in a per thread counter. That lets a test check how many
+ * locked operations an API call costs.
+ */
+#if PTL_ATOMIC_COUNT
+extern __thread unsigned long ptl_atomic_count;
+#define ATOMIC_COUNT()	(ptl_atomic_count++)
+#else
+#define ATOMIC_COUNT()	do { } while (0)
+#endif
+
+unsigned long PtlInternalAtomicCount(void);
+
 typedef struct {
-    volatile int val __attribute__ ((aligned(8)));
+    _Atomic int val __attribute__ ((aligned(8)));
 } atomic_t;
 
+/*
+ * The read-modify-write operations are sequentially consistent, like
+ * the __sync builtins they replace. atomic_set() is a release store
+ * and atomic_read() an acquire load, which is enough for the flags
+ * passed between threads and processes, but does not order a set
+ * before a later read of another variable. Use the _relaxed versions
+ * for pure counters.
+ */
+
 static inline void atomic_set(atomic_t *var, int val)
 {
-    var->val = val;
+    atomic_store_explicit(&var->val, val, memory_order_release);
 }
 
 static inline int atomic_read(atomic_t *var)
 {
-    return var->val;
+    return atomic_load_explicit(&var->val, memory_order_acquire);
 }
 
 static inline int atomic_inc(atomic_t *var)
 {
-    return __sync_fetch_and_add(&var->val, 1);
+    ATOMIC_COUNT();
+    return atomic_fetch_add_explicit(&var->val, 1, memory_order_seq_cst);
 }
 
 static inline int atomic_add(atomic_t *var, int val)
 {
-    return __sync_fetch_and_add(&var->val, val);
+    ATOMIC_COUNT();
+    return atomic_fetch_add_explicit(&var->val, val, memory_order_seq_cst);
 }
 
 static inline int atomic_dec(atomic_t *var)
 {
-    return __sync_sub_and_fetch(&var->val, 1);
+    ATOMIC_COUNT();
+    return atomic_fetch_sub_explicit(&var->val, 1, memory_order_seq_cst) - 1;
 }
 
 static inline int atomic_sub(atomic_t *var, int val)
 {
-    return __sync_sub_and_fetch(&var->val, val);
+    ATOMIC_COUNT();
+    return atomic_fetch_sub_explicit(&var->val, val,
+                                     memory_order_seq_cst) - val;
 }
 
-static inline int atomic_swap(atomic_t *var, int newval)
+static inline int atomic_inc_relaxed(atomic_t *var)
 {
-    int oldval = var->val;
-    int tmp;
+    ATOMIC_COUNT();
+    return atomic_fetch_add_explicit(&var->val, 1, memory_order_relaxed);
+}
 
-    while ((tmp =
-            __sync_val_compare_and_swap(&var->val, oldval,
-                                        newval)) != oldval) {
-        oldval = tmp;
-    }
+static inline int atomic_dec_relaxed(atomic_t *var)
+{
+    ATOMIC_COUNT();
+    return atomic_fetch_sub_explicit(&var->val, 1, memory_order_relaxed) - 1;
+}
 
-    return oldval;
+static inline int atomic_swap(atomic_t *var, int newval)
+{
+    ATOMIC_COUNT();
+    return atomic_exchange_explicit(&var->val, newval, memory_order_seq_cst);
 }
 
+/* The pointers swapped live in structures shared with other processes
+ * and are not declared _Atomic. Use the builtin that <stdatomic.h>
+ * expands to. */
 static inline void *atomic_swap_ptr(void *volatile *addr, void *newval)
 {
-    void *oldval = *addr;
-    void *tmp;
-
-    while ((tmp =
-            __sync_val_compare_and_swap(addr, oldval, newval)) != oldval) {
-        oldval = tmp;
-    }
-
-    return oldval;
+    ATOMIC_COUNT();
+    return __atomic_exchange_n(addr, newval, __ATOMIC_SEQ_CST);
 }
 
 static inline void SPINLOCK_BODY(void)
@@ -0,0 +1,1045 @@
+/**
+ * @file ptl_tcp.c
+ *
+ * @brief TCP streams for the UDP transport.
+ *
+ * With PTL_TCP set, the UDP transport sends its messages over TCP
+ * instead of datagrams, and leaves the reliability to the kernel.
+ * The messages keep their wire image, the udp_hdr, an eventual
+ * udp_conn_msg and the message, but a large message is followed by
+ * all its data at once rather than fragmented.
+ *
+ * As the datagrams, messages go to the address in their buf, not
+ * to their conn, so an NI keeps one stream per peer address. It is
+ * opened to the listening socket the peer has on the port of its
+ * UDP socket, the first time it is used, and starts with a hello
+ * naming the port and the NI type of the sender. The listening
+ * socket is watched by the evl thread, which accepts the streams,
+ * reads their hello and hands them over to the NI they are for.
+ * Only the progress thread of that NI reads them afterward.
+ *
+ * Sends hold the lock of their peer and write the whole message,
+ * header and data, with one sendmsg() when they can. The progress
+ * thread must not block while its peers may be blocked sending to
+ * it, so it reads its streams meanwhile, into a queue of received
+ * messages. It also corks the streams it sends to until the end of
+ * its iteration, so that the acks and replies it sends to a peer
+ * leave together.
+ */
+
+#include "ptl_loc.h"
+
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+/* Receive buffer of a stream. Many small messages fit in it. */
+#define TCP_RX_SIZE (64 * 1024)
+
+/* Streams read at once by the progress thread. */
+#define TCP_EVENTS 16
+
+/* Pieces of data sent with the header of a large message, then at
+ * once. */
+#define TCP_IOV_MAX 64
+
+/* Buckets of the peers of an NI, a power of 2. */
+#define TCP_PEER_HASH 256
+
+/* The outgoing stream to a peer address. */
+struct tcp_peer {
+    struct tcp_peer *next;      /* in its bucket */
+    struct sockaddr_in addr;
+    int s;                      /* -1 until connected */
+    pthread_mutex_t lock;       /* serializes the senders */
+    int corked;                 /* on the corked list of the NI */
+    struct list_head cork_list;
+};
+
+/* An incoming stream. */
+struct tcp_stream {
+    struct list_head list;
+    ev_io watcher;              /* until its hello is read */
+    iface_t *iface;
+    int s;
+    struct sockaddr_in src;     /* UDP address of the sender */
+
+    unsigned char *rx;
+    unsigned int rx_len;        /* bytes in rx */
+    unsigned int rx_off;        /* bytes processed */
+
+    /* The large message whose data is being received. */
+    buf_t *big;
+    ptl_size_t big_len;
+};
+
+/* The NI whose progress thread runs on this thread, between
+ * tcp_cork_begin() and tcp_cork_end(). */
+static __thread ni_t *tcp_poller;
+
+static void tcp_drain(ni_t *ni);
+static int tcp_sendv(ni_t *ni, int s, struct iovec *iov, int n);
+
+/**
+ * @brief Create an incoming stream.
+ *
+ * @param[in] s the accepted socket
+ *
+ * @return the stream, or NULL on error
+ */
+static struct tcp_stream *tcp_stream_new(int s)
+{
+    struct tcp_stream *st;
+    int on = 1;
+    int flags;
+
+    flags = fcntl(s, F_GETFL);
+    if (fcntl(s, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1) {
+        ptl_warn("cannot setup TCP stream: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    st = calloc(1, sizeof(*st));
+    if (!st)
+        return NULL;
+
+    st->rx = malloc(TCP_RX_SIZE);
+    if (!st->rx) {
+        free(st);
+        return NULL;
+    }
+
+    st->s = s;
+
+    return st;
+}
+
+/* Close an incoming stream. */
+static void tcp_stream_free(struct tcp_stream *st)
+{
+    if (st->big) {
+        free(st->big->transfer.udp.data);
+        free(st->big);
+    }
+
+    close(st->s);
+    free(st->rx);
+    free(st);
+}
+
+/**
+ * @brief Read the hello of an accepted stream.
+ *
+ * Runs in the evl thread. Once the hello is in, the stream goes to
+ * the NI it names, with the bytes read after it.
+ */
+static void tcp_hello_cb(EV_P_ ev_io *w, int revents)
+{
+    struct tcp_stream *st = w->data;
+    iface_t *iface = st->iface;
+    const struct udp_hdr *whdr = (const struct udp_hdr *)st->rx;
+    const struct udp_conn_msg *msg;
+    const req_hdr_t *hdr;
+    socklen_t len = sizeof(st->src);
+    unsigned int wire_len;
+    ni_t *ni;
+    ssize_t n;
+
+    n = recv(st->s, st->rx + st->rx_len, TCP_RX_SIZE - st->rx_len, 0);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+
+    if (n <= 0)
+        goto drop;
+
+    st->rx_len += n;
+    if (st->rx_len < sizeof(*whdr))
+        return;
+
+    wire_len = udp_wire_len(whdr);
+    if (!(whdr->flags & UDP_HDR_HELLO) || !(whdr->flags & UDP_HDR_CONN) ||
+        le32_to_cpu(whdr->length) < sizeof(*hdr) || !wire_len) {
+        ptl_warn("dropping TCP stream without hello\n");
+        goto drop;
+    }
+
+    if (st->rx_len < wire_len)
+        return;
+
+    msg = (const struct udp_conn_msg *)(whdr + 1);
+    hdr = udp_wire_msg(whdr);
+
+    ni = (hdr->h1.ni_type < MAX_NI_TYPES) ? iface->ni[hdr->h1.ni_type] :
+        NULL;
+    if (!ni || ni->shutting_down || !udp_for_ni(ni, hdr)) {
+        ptl_warn("dropping TCP stream for a missing NI\n");
+        goto drop;
+    }
+
+    getpeername(st->s, (struct sockaddr *)&st->src, &len);
+    st->src.sin_port = htons(msg->port);
+    st->rx_off = wire_len;
+
+    ev_io_stop(EV_A_ w);
+    list_del(&st->list);
+
+    PTL_FASTLOCK_LOCK(&ni->udp.tcp.lock);
+    list_add_tail(&st->list, &ni->udp.tcp.incoming);
+    PTL_FASTLOCK_UNLOCK(&ni->udp.tcp.lock);
+
+    return;
+
+  drop:
+    ev_io_stop(EV_A_ w);
+    list_del(&st->list);
+    tcp_stream_free(st);
+}
+
+/**
+ * @brief Accept the streams coming to an interface.
+ *
+ * Runs in the evl thread.
+ */
+static void tcp_accept_cb(EV_P_ ev_io *w, int revents)
+{
+    iface_t *iface = w->data;
+    struct tcp_stream *st;
+    int s;
+
+    while ((s = accept(iface->udp.tcp_s, NULL, NULL)) != -1) {
+        st = tcp_stream_new(s);
+        if (!st) {
+            close(s);
+            continue;
+        }
+
+        st->iface = iface;
+        ev_io_init(&st->watcher, tcp_hello_cb, s, EV_READ);
+        st->watcher.data = st;
+        ev_io_start(EV_A_ &st->watcher);
+        list_add_tail(&st->list, &iface->udp.tcp_accepted);
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED &&
+        errno != EINTR)
+        ptl_warn("cannot accept TCP stream: %s\n", strerror(errno));
+}
+
+/**
+ * @brief Listen for TCP streams on an address.
+ *
+ * Called while PtlNIInit_UDP() looks for a free port, before the UDP
+ * socket is bound to it.
+ *
+ * @param[in] iface the interface
+ * @param[in] addr the address and port
+ *
+ * @return 0, or -1 with errno set
+ */
+int tcp_listen(iface_t *iface, const struct sockaddr_in *addr)
+{
+    int on = 1;
+    int flags;
+    int err;
+    int s;
+
+    s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == -1)
+        return -1;
+
+    flags = fcntl(s, F_GETFL);
+    if (fcntl(s, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+        bind(s, (struct sockaddr *)addr, sizeof(*addr)) == -1 ||
+        listen(s, SOMAXCONN) == -1) {
+        err = errno;
+        close(s);
+        errno = err;
+        return -1;
+    }
+
+    iface->udp.tcp_s = s;
+
+    ev_io_init(&iface->udp.watcher, tcp_accept_cb, s, EV_READ);
+    iface->udp.watcher.data = iface;
+    EVL_WATCH(ev_io_start(evl.loop, &iface->udp.watcher));
+
+    return 0;
+}
+
+/**
+ * @brief Stop listening for TCP streams.
+ *
+ * The streams not handed over to an NI yet are closed.
+ *
+ * @param[in] iface the interface
+ */
+void tcp_iface_fini(iface_t *iface)
+{
+    struct list_head *l, *t;
+
+    if (iface->udp.tcp_s == -1)
+        return;
+
+    pthread_mutex_lock(&evl.lock);
+
+    ev_io_stop(evl.loop, &iface->udp.watcher);
+
+    list_for_each_safe(l, t, &iface->udp.tcp_accepted) {
+        struct tcp_stream *st = list_entry(l, struct tcp_stream, list);
+
+        ev_io_stop(evl.loop, &st->watcher);
+        list_del(l);
+        tcp_stream_free(st);
+    }
+
+    ev_async_send(evl.loop, &evl.async_w);
+    pthread_mutex_unlock(&evl.lock);
+
+    close(iface->udp.tcp_s);
+    iface->udp.tcp_s = -1;
+}
+
+/**
+ * @brief Initialize the TCP state of an NI.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return status
+ */
+int tcp_ni_init(ni_t *ni)
+{
+    PTL_FASTLOCK_INIT(&ni->udp.tcp.lock);
+    INIT_LIST_HEAD(&ni->udp.tcp.incoming);
+    INIT_LIST_HEAD(&ni->udp.tcp.streams);
+    INIT_LIST_HEAD(&ni->udp.tcp.ready);
+    INIT_LIST_HEAD(&ni->udp.tcp.corked);
+    ni->udp.tcp.peers = NULL;
+    ni->udp.tcp.epfd = -1;
+
+    if (!get_param(PTL_TCP))
+        return PTL_OK;
+
+    ni->udp.tcp.peers = calloc(TCP_PEER_HASH, sizeof(*ni->udp.tcp.peers));
+    if (!ni->udp.tcp.peers) {
+        WARN();
+        return PTL_NO_SPACE;
+    }
+
+    ni->udp.tcp.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ni->udp.tcp.epfd == -1) {
+        WARN();
+        free(ni->udp.tcp.peers);
+        ni->udp.tcp.peers = NULL;
+        return PTL_FAIL;
+    }
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Close the streams of an NI.
+ *
+ * ni->shutting_down is set, so no more streams are handed over.
+ *
+ * @param[in] ni the network interface
+ */
+void tcp_ni_fini(ni_t *ni)
+{
+    struct list_head *l, *t;
+    struct tcp_peer *peer;
+    int i;
+
+    if (ni->udp.tcp.epfd == -1)
+        return;
+
+    for (i = 0; i < TCP_PEER_HASH; i++) {
+        while ((peer = ni->udp.tcp.peers[i])) {
+            ni->udp.tcp.peers[i] = peer->next;
+            if (peer->s != -1)
+                close(peer->s);
+            pthread_mutex_destroy(&peer->lock);
+            free(peer);
+        }
+    }
+
+    free(ni->udp.tcp.peers);
+    ni->udp.tcp.peers = NULL;
+
+    pthread_mutex_lock(&evl.lock);
+    list_splice_init(&ni->udp.tcp.incoming, &ni->udp.tcp.streams);
+    pthread_mutex_unlock(&evl.lock);
+
+    list_for_each_safe(l, t, &ni->udp.tcp.streams) {
+        list_del(l);
+        tcp_stream_free(list_entry(l, struct tcp_stream, list));
+    }
+
+    list_for_each_safe(l, t, &ni->udp.tcp.ready) {
+        buf_t *buf = list_entry(l, buf_t, list);
+
+        list_del(l);
+        if (buf->conn)
+            conn_put(buf->conn);
+        if (buf->transfer.udp.data != buf->internal_data)
+            free(buf->transfer.udp.data);
+        free(buf);
+    }
+
+    close(ni->udp.tcp.epfd);
+    ni->udp.tcp.epfd = -1;
+}
+
+/**
+ * @brief Find the peer of an address, or add it.
+ *
+ * @param[in] ni the network interface
+ * @param[in] addr the UDP address of the peer
+ *
+ * @return the peer, or NULL if out of memory
+ */
+static struct tcp_peer *tcp_peer_get(ni_t *ni, const struct sockaddr_in *addr)
+{
+    struct tcp_peer **bucket;
+    struct tcp_peer *peer;
+    uint32_t h;
+
+    h = (ntohl(addr->sin_addr.s_addr) * 31 + ntohs(addr->sin_port)) *
+        0x9e3779b1;
+    bucket = &ni->udp.tcp.peers[h >> 24 & (TCP_PEER_HASH - 1)];
+
+    PTL_FASTLOCK_LOCK(&ni->udp.tcp.lock);
+
+    for (peer = *bucket; peer; peer = peer->next) {
+        if (peer->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            peer->addr.sin_port == addr->sin_port)
+            break;
+    }
+
+    if (!peer) {
+        peer = calloc(1, sizeof(*peer));
+        if (peer) {
+            peer->addr = *addr;
+            peer->s = -1;
+            pthread_mutex_init(&peer->lock, NULL);
+            peer->next = *bucket;
+            *bucket = peer;
+        }
+    }
+
+    PTL_FASTLOCK_UNLOCK(&ni->udp.tcp.lock);
+
+    return peer;
+}
+
+/**
+ * @brief Wait until a stream can be written to.
+ *
+ * The progress thread keeps on receiving meanwhile, in case the peer
+ * waits for it, and only waits a little at a time.
+ *
+ * @param[in] ni the network interface
+ * @param[in] s the socket of the stream
+ *
+ * @return the events of the socket, 0 if none yet
+ */
+static int tcp_wait_out(ni_t *ni, int s)
+{
+    struct pollfd pfd;
+
+    pfd.fd = s;
+    pfd.events = POLLOUT;
+
+    if (tcp_poller == ni) {
+        tcp_drain(ni);
+        if (poll(&pfd, 1, 1) <= 0)
+            return 0;
+    } else if (poll(&pfd, 1, -1) <= 0) {
+        return 0;
+    }
+
+    return pfd.revents;
+}
+
+/**
+ * @brief Open the stream to a peer.
+ *
+ * peer->lock must be held. The connection completes without
+ * blocking, as the writes do, since the progress thread of the NI
+ * may be the one connecting.
+ *
+ * @param[in] ni the network interface
+ * @param[in] peer the peer
+ *
+ * @return status
+ */
+static int tcp_connect(ni_t *ni, struct tcp_peer *peer)
+{
+    struct udp_hdr whdr;
+    struct udp_conn_msg msg;
+    req_hdr_t hdr;
+    struct iovec iov[3];
+    socklen_t len;
+    int on = 1;
+    int flags;
+    int err;
+    int s;
+
+    s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == -1) {
+        WARN();
+        return PTL_FAIL;
+    }
+
+    flags = fcntl(s, F_GETFL);
+    if (fcntl(s, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1) {
+        ptl_warn("cannot setup TCP stream: %s\n", strerror(errno));
+        close(s);
+        return PTL_FAIL;
+    }
+
+    err = 0;
+    if (connect(s, (struct sockaddr *)&peer->addr,
+                sizeof(peer->addr)) == -1) {
+        err = errno;
+        if (err == EINPROGRESS) {
+            while (!tcp_wait_out(ni, s))
+                continue;
+
+            len = sizeof(err);
+            if (getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+                err = errno;
+        }
+    }
+
+    if (err) {
+        ptl_warn("cannot connect to %s:%d: %s\n",
+                 inet_ntoa(peer->addr.sin_addr), ntohs(peer->addr.sin_port),
+                 strerror(err));
+        close(s);
+        return PTL_FAIL;
+    }
+
+    /* The hello, much like a UDP connection request. */
+    memset(&whdr, 0, sizeof(whdr));
+    whdr.flags = UDP_HDR_HELLO | UDP_HDR_CONN;
+    whdr.type = BUF_UDP_CONN_REQ;
+    whdr.length = cpu_to_le32(sizeof(hdr));
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_type = cpu_to_le16(UDP_CONN_MSG_REQ);
+    msg.port = ntohs(ni->udp.src_port);
+    msg.req.options = ni->options;
+    msg.req.src_id = ni->id;
+
+    memset(&hdr, 0, sizeof(hdr));
+    ((struct hdr_common *)&hdr)->version = PTL_HDR_VER_2;
+    hdr.h1.src_nid = cpu_to_le32(ni->id.phys.nid);
+    hdr.h1.src_pid = cpu_to_le32(ni->id.phys.pid);
+    hdr.h1.physical = !!(ni->options & PTL_NI_PHYSICAL);
+    hdr.h1.ni_type = ni->ni_type;
+
+    iov[0].iov_base = &whdr;
+    iov[0].iov_len = sizeof(whdr);
+    iov[1].iov_base = &msg;
+    iov[1].iov_len = sizeof(msg);
+    iov[2].iov_base = &hdr;
+    iov[2].iov_len = sizeof(hdr);
+
+    if (tcp_sendv(ni, s, iov, 3)) {
+        ptl_warn("cannot setup TCP stream: %s\n", strerror(errno));
+        close(s);
+        return PTL_FAIL;
+    }
+
+    peer->s = s;
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Connect to a peer.
+ *
+ * The stream is opened right away, and the conn is connected once
+ * it is: there is no connection request to wait for.
+ *
+ * @param[in] ni the network interface
+ * @param[in] conn the conn, locked
+ *
+ * @return status
+ */
+int init_connect_tcp(ni_t *ni, conn_t *conn)
+{
+    struct tcp_peer *peer;
+    int err = PTL_OK;
+
+    /* Set by the connection reply with datagrams. */
+    conn->udp.dest_addr = conn->sin;
+
+    peer = tcp_peer_get(ni, &conn->udp.dest_addr);
+    if (!peer)
+        return PTL_NO_SPACE;
+
+    pthread_mutex_lock(&peer->lock);
+    if (peer->s == -1)
+        err = tcp_connect(ni, peer);
+    pthread_mutex_unlock(&peer->lock);
+
+    if (err)
+        return err;
+
+    conn->state = CONN_STATE_CONNECTED;
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Take the send lock of a peer.
+ *
+ * The progress thread reads its streams while it waits.
+ *
+ * @param[in] ni the network interface
+ * @param[in] peer the peer
+ */
+static void tcp_lock(ni_t *ni, struct tcp_peer *peer)
+{
+    if (tcp_poller != ni) {
+        pthread_mutex_lock(&peer->lock);
+        return;
+    }
+
+    while (pthread_mutex_trylock(&peer->lock))
+        tcp_drain(ni);
+}
+
+/**
+ * @brief Write some pieces to a stream.
+ *
+ * @param[in] ni the network interface
+ * @param[in] s the socket of the stream
+ * @param[in,out] iov the pieces, consumed
+ * @param[in] n the number of pieces
+ *
+ * @return 0, or -1 with errno set
+ */
+static int tcp_sendv(ni_t *ni, int s, struct iovec *iov, int n)
+{
+    struct msghdr msg;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+
+    while (msg.msg_iovlen) {
+        ret = sendmsg(s, &msg, MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+
+            /* The peer is slow. */
+            tcp_wait_out(ni, s);
+            continue;
+        }
+
+        while (msg.msg_iovlen && ret >= msg.msg_iov->iov_len) {
+            ret -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+
+        if (ret) {
+            msg.msg_iov->iov_base += ret;
+            msg.msg_iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Send a message on the stream to its destination.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf
+ * @param[in] dest the UDP address of the destination
+ *
+ * @return 0, or -1 with errno set
+ */
+static int tcp_send(ni_t *ni, buf_t *buf, const struct sockaddr_in *dest)
+{
+    int large = buf->rlength > UDP_BUF_SIZE;
+    struct iovec iov[3 + TCP_IOV_MAX];
+    struct tcp_peer *peer;
+    struct udp_hdr whdr;
+    struct udp_gather g;
+    ptl_size_t left;
+    ptl_size_t len;
+    int on = 1;
+    int err = 0;
+    int n;
+
+    peer = tcp_peer_get(ni, dest);
+    if (!peer) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    n = udp_wire_iov(buf, &whdr, iov, large ? UDP_HDR_FRAG : 0);
+
+    tcp_lock(ni, peer);
+
+    if (peer->s == -1 && tcp_connect(ni, peer)) {
+        pthread_mutex_unlock(&peer->lock);
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    if (tcp_poller == ni && !peer->corked) {
+        setsockopt(peer->s, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+        peer->corked = 1;
+        list_add_tail(&peer->cork_list, &ni->udp.tcp.corked);
+    }
+
+    if (!large) {
+        err = tcp_sendv(ni, peer->s, iov, n);
+    } else {
+        /* The headers go with the first pieces of data. */
+        udp_gather_init(buf, &g);
+
+        for (left = buf->rlength; left && !err; left -= len) {
+            len = left;
+            n += udp_gather_frag(&g, iov + n, TCP_IOV_MAX, &len);
+            if (!len) {
+                /* The data is shorter than announced. */
+                errno = EINVAL;
+                err = -1;
+                break;
+            }
+
+            err = tcp_sendv(ni, peer->s, iov, n);
+            n = 0;
+        }
+    }
+
+    if (err) {
+        /* The stream is out of sync. */
+        close(peer->s);
+        peer->s = -1;
+    }
+
+    pthread_mutex_unlock(&peer->lock);
+
+    return err;
+}
+
+/**
+ * @brief Send a message using TCP.
+ *
+ * @param[in] buf the buf
+ * @param[in] from_init unused
+ *
+ * @return status
+ */
+int send_message_tcp(buf_t *buf, int from_init)
+{
+    ni_t *ni = obj_to_ni(buf);
+    struct sockaddr_in *dest = &buf->dest.udp.dest_addr;
+    int err;
+
+    buf_get(buf);
+
+    /* The buffer type to be received at the other end. */
+    buf->type = BUF_UDP_RECEIVE;
+
+    STATS_SEND(ni, STATS_UDP, buf->length);
+
+    err = tcp_send(ni, buf, dest);
+    if (err) {
+        ptl_warn("error sending to %s:%d: %s\n", inet_ntoa(dest->sin_addr),
+                 ntohs(dest->sin_port), strerror(errno));
+    }
+
+    buf_put(buf);
+
+    return err ? PTL_FAIL : PTL_OK;
+}
+
+/**
+ * @brief Cork the streams the progress thread sends to.
+ *
+ * @param[in] ni the network interface
+ */
+void tcp_cork_begin(ni_t *ni)
+{
+    tcp_poller = ni;
+}
+
+/**
+ * @brief Flush the streams corked since tcp_cork_begin().
+ *
+ * @param[in] ni the network interface
+ */
+void tcp_cork_end(ni_t *ni)
+{
+    int off = 0;
+
+    while (!list_empty(&ni->udp.tcp.corked)) {
+        struct tcp_peer *peer = list_entry(ni->udp.tcp.corked.next,
+                                           struct tcp_peer, cork_list);
+
+        tcp_lock(ni, peer);
+        if (peer->s != -1)
+            setsockopt(peer->s, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+        peer->corked = 0;
+        pthread_mutex_unlock(&peer->lock);
+
+        list_del(&peer->cork_list);
+    }
+
+    tcp_poller = NULL;
+}
+
+/**
+ * @brief Get the next message buffered in a stream.
+ *
+ * @param[in] ni the network interface
+ * @param[in] st the stream
+ * @param[out] buf_p the message, once complete
+ *
+ * @return 1 with a message, 0 if more is to be read, -1 if the
+ * stream is broken
+ */
+static int tcp_stream_next(ni_t *ni, struct tcp_stream *st, buf_t **buf_p)
+{
+    const struct udp_hdr *whdr;
+    unsigned int avail = st->rx_len - st->rx_off;
+    unsigned int wire_len;
+    ptl_size_t copy;
+    buf_t *buf;
+
+    if (st->big) {
+        if (st->big_len < st->big->rlength)
+            return 0;
+
+        buf = st->big;
+        st->big = NULL;
+        goto complete;
+    }
+
+    if (avail < sizeof(*whdr))
+        return 0;
+
+    whdr = (const struct udp_hdr *)(st->rx + st->rx_off);
+    wire_len = udp_wire_len(whdr);
+    if (!wire_len) {
+        ptl_warn("malformed message on the TCP stream from %s:%d\n",
+                 inet_ntoa(st->src.sin_addr), ntohs(st->src.sin_port));
+        return -1;
+    }
+
+    if (avail < wire_len)
+        return 0;
+
+    buf = udp_wire_to_buf(st->rx + st->rx_off, wire_len);
+    if (!buf) {
+        WARN();
+        return -1;
+    }
+
+    st->rx_off += wire_len;
+
+    if (!(whdr->flags & UDP_HDR_FRAG)) {
+        *buf_p = udp_received(ni, buf, &st->src);
+        return 1;
+    }
+
+    /* A large message, followed by its data, which is allocated at
+     * once. Its length comes from the wire. */
+    if (buf->rlength > ni->limits.max_msg_size) {
+        ptl_warn("message of %lu bytes on the TCP stream from %s:%d\n",
+                 (unsigned long)buf->rlength, inet_ntoa(st->src.sin_addr),
+                 ntohs(st->src.sin_port));
+        free(buf);
+        return -1;
+    }
+
+    buf->transfer.udp.data = malloc(buf->rlength);
+    if (!buf->transfer.udp.data) {
+        WARN();
+        free(buf);
+        return -1;
+    }
+
+    copy = st->rx_len - st->rx_off;
+    if (copy > buf->rlength)
+        copy = buf->rlength;
+
+    memcpy(buf->transfer.udp.data, st->rx + st->rx_off, copy);
+    st->rx_off += copy;
+
+    if (copy < buf->rlength) {
+        st->big = buf;
+        st->big_len = copy;
+        return 0;
+    }
+
+  complete:
+    buf->transfer.udp.fragment_count = 1;
+    *buf_p = udp_received(ni, udp_frag_complete(buf), &st->src);
+
+    return 1;
+}
+
+/**
+ * @brief Read what a stream has, and queue its complete messages.
+ *
+ * @param[in] ni the network interface
+ * @param[in] st the stream
+ *
+ * @return 0, or -1 if the stream is closed or broken
+ */
+static int tcp_stream_read(ni_t *ni, struct tcp_stream *st)
+{
+    buf_t *buf;
+    ssize_t n;
+    int ret;
+
+    if (st->big) {
+        /* Straight into the message. */
+        n = recv(st->s, st->big->transfer.udp.data + st->big_len,
+                 st->big->rlength - st->big_len, 0);
+        if (n > 0)
+            st->big_len += n;
+    } else {
+        if (st->rx_off) {
+            st->rx_len -= st->rx_off;
+            memmove(st->rx, st->rx + st->rx_off, st->rx_len);
+            st->rx_off = 0;
+        }
+
+        n = recv(st->s, st->rx + st->rx_len, TCP_RX_SIZE - st->rx_len, 0);
+        if (n > 0)
+            st->rx_len += n;
+    }
+
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINTR))
+        return 0;
+
+    if (n <= 0)
+        return -1;
+
+    while ((ret = tcp_stream_next(ni, st, &buf)) == 1)
+        list_add_tail(&buf->list, &ni->udp.tcp.ready);
+
+    return ret;
+}
+
+/* Stop reading a stream. */
+static void tcp_stream_close(ni_t *ni, struct tcp_stream *st)
+{
+    epoll_ctl(ni->udp.tcp.epfd, EPOLL_CTL_DEL, st->s, NULL);
+    list_del(&st->list);
+    tcp_stream_free(st);
+}
+
+/**
+ * @brief Read the streams of an NI that have something.
+ *
+ * The messages are queued for tcp_receive().
+ *
+ * @param[in] ni the network interface
+ */
+static void tcp_drain(ni_t *ni)
+{
+    struct epoll_event ev[TCP_EVENTS];
+    int i, n;
+
+    n = epoll_wait(ni->udp.tcp.epfd, ev, TCP_EVENTS, 0);
+
+    for (i = 0; i < n; i++) {
+        struct tcp_stream *st = ev[i].data.ptr;
+
+        if (tcp_stream_read(ni, st))
+            tcp_stream_close(ni, st);
+    }
+}
+
+/**
+ * @brief Take the streams handed over by the evl thread.
+ *
+ * @param[in] ni the network interface
+ */
+static void tcp_take_incoming(ni_t *ni)
+{
+    struct list_head incoming;
+    struct list_head *l, *t;
+    struct epoll_event ev;
+    buf_t *buf;
+    int ret;
+
+    INIT_LIST_HEAD(&incoming);
+
+    PTL_FASTLOCK_LOCK(&ni->udp.tcp.lock);
+    list_splice_init(&ni->udp.tcp.incoming, &incoming);
+    PTL_FASTLOCK_UNLOCK(&ni->udp.tcp.lock);
+
+    list_for_each_safe(l, t, &incoming) {
+        struct tcp_stream *st = list_entry(l, struct tcp_stream, list);
+
+        list_del(l);
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = st;
+        if (epoll_ctl(ni->udp.tcp.epfd, EPOLL_CTL_ADD, st->s, &ev) == -1) {
+            WARN();
+            tcp_stream_free(st);
+            continue;
+        }
+
+        list_add_tail(&st->list, &ni->udp.tcp.streams);
+
+        /* The evl thread may have read past the hello. */
+        while ((ret = tcp_stream_next(ni, st, &buf)) == 1)
+            list_add_tail(&buf->list, &ni->udp.tcp.ready);
+
+        if (ret == -1)
+            tcp_stream_close(ni, st);
+    }
+}
+
+/**
+ * @brief Receive a message from the TCP streams of an NI.
+ *
+ * Called by the progress thread only.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return a buf, as udp_receive() returns, or NULL
+ */
+buf_t *tcp_receive(ni_t *ni)
+{
+    buf_t *buf;
+
+    if (list_empty(&ni->udp.tcp.ready)) {
+        if (!list_empty(&ni->udp.tcp.incoming))
+            tcp_take_incoming(ni);
+
+        tcp_drain(ni);
+
+        if (list_empty(&ni->udp.tcp.ready))
+            return NULL;
+    }
+
+    buf = list_entry(ni->udp.tcp.ready.next, buf_t, list);
+    list_del_init(&buf->list);
+
+    return buf;
+}
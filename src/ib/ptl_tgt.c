@@ -8,7 +8,7 @@
 /**
  * @brief Target state names for debugging output.
  */
-static char *tgt_state_name[] = {
+char *tgt_state_name[] = {
     [STATE_TGT_START] = "tgt_start",
     [STATE_TGT_DROP] = "tgt_drop",
     [STATE_TGT_GET_MATCH] = "tgt_get_match",
@@ -125,15 +125,15 @@ static int tgt_copy_in(buf_t *buf, me_t *me, void *data)
         }
 
         err =
-            iov_copy_in(data, addr_to_ppe(me->start, mr), me->mr_list,
-                        me->num_iov, offset, length);
+            iov_copy_in(data, addr_to_ppe(me->start, mr), me->iov_offsets,
+                        me->mr_list, me->num_iov, offset, length);
 
         if (!me->mr_start)
             mr_put(mr);
 #else
         err =
-            iov_copy_in(data, (ptl_iovec_t *)me->start, me->mr_list,
-                        me->num_iov, offset, length);
+            iov_copy_in(data, (ptl_iovec_t *)me->start, me->iov_offsets,
+                        me->mr_list, me->num_iov, offset, length);
 #endif
     } else {
         void *start = me->start + offset;
@@ -203,16 +203,16 @@ static int atomic_in(buf_t *buf, me_t *me, void *data)
 
         err =
             iov_atomic_in(op, atom_type_size[hdr->atom_type], data,
-                          addr_to_ppe(me->start, mr), me->mr_list,
-                          me->num_iov, offset, length);
+                          addr_to_ppe(me->start, mr), me->iov_offsets,
+                          me->mr_list, me->num_iov, offset, length);
 
         if (!me->mr_start)
             mr_put(mr);
 #else
         err =
             iov_atomic_in(op, atom_type_size[hdr->atom_type], data,
-                          (ptl_iovec_t *)me->start, me->mr_list, me->num_iov,
-                          offset, length);
+                          (ptl_iovec_t *)me->start, me->iov_offsets,
+                          me->mr_list, me->num_iov, offset, length);
 #endif
     } else {
         void *start = me->start + offset;
@@ -293,7 +293,7 @@ static int prepare_send_buf(buf_t *buf)
 
         ack_hdr->h1.data_in = 0;
         ack_hdr->h1.data_out = 0;
-        ack_hdr->h1.version = PTL_HDR_VER_1;
+        ack_hdr->h1.version = PTL_HDR_VER_2;
         ack_hdr->h1.handle = ((req_hdr_t *) buf->data)->h1.handle;
 #if WITH_TRANSPORT_UDP
         ptl_info(" preparing response for handle: %i \n", le32_to_cpu(ack_hdr->h1.handle));
@@ -335,30 +335,27 @@ static int init_local_offset(buf_t *buf)
     buf->cur_loc_iov_off = 0;
 
     if (me->num_iov) {
-        ptl_iovec_t *iov = (ptl_iovec_t *)me->start;
-        ptl_size_t i = 0;
-        ptl_size_t loc_offset = 0;
-        ptl_size_t iov_offset = 0;
-
-        for (i = 0; i < me->num_iov && loc_offset < buf->moffset; i++, iov++) {
-            iov_offset = buf->moffset - loc_offset;
-            if (iov_offset > iov->iov_len)
-                iov_offset = iov->iov_len;
-            loc_offset += iov_offset;
-        }
+#if IS_PPE
+        ptl_iovec_t *iov = me->mr_start->ppe_addr;
+#else
+        ptl_iovec_t *iov = me->start;
+#endif
+        ptl_size_t iov_offset = buf->moffset;
+        ptl_size_t i;
+
+        i = iov_seek(iov, me->iov_offsets, me->num_iov, &iov_offset);
+        if (i == me->num_iov) {
+            /* Only valid if nothing is left to transfer. */
+            if (iov_offset)
+                return PTL_FAIL;
 
-        if (loc_offset < buf->moffset)
-            return PTL_FAIL;
+            i = me->num_iov - 1;
+            iov_offset = iov[i].iov_len;
+        }
 
         buf->cur_loc_iov_index = i;
         buf->cur_loc_iov_off = iov_offset;
-#if IS_PPE
-        buf->start =
-            ((ptl_iovec_t *)(me->mr_start->ppe_addr))[i].iov_base +
-            iov_offset;
-#else
-        buf->start = iov->iov_base + iov_offset;
-#endif
+        buf->start = iov[i].iov_base + iov_offset;
     } else {
         buf->cur_loc_iov_off = buf->moffset;
         buf->start = me->start + buf->moffset;
@@ -441,7 +438,10 @@ static int tgt_start(buf_t *buf)
         buf->conn = get_conn(ni, initiator);
     }
     buf->conn->state = CONN_STATE_CONNECTED;
-    buf->conn->udp.dest_addr = buf->conn->sin;
+    /* conn->udp shares a union with the other transports; only touch
+     * it for UDP connections or a local shmem rank gets clobbered. */
+    if (buf->conn->transport.type == CONN_TYPE_UDP)
+        buf->conn->udp.dest_addr = buf->conn->sin;
 #endif
 #if !WITH_TRANSPORT_UDP
     buf->conn = get_conn(ni, initiator);
@@ -499,6 +499,8 @@ static int tgt_start(buf_t *buf)
  */
 static int request_drop(buf_t *buf)
 {
+    STATS_INC(obj_to_ni(buf), drops[buf->ni_fail]);
+
     if (buf->ni_fail != PTL_NI_OP_VIOLATION &&
         buf->ni_fail != PTL_NI_PERM_VIOLATION) {
         ni_t *ni = obj_to_ni(buf);
@@ -878,7 +880,7 @@ static int tgt_get_length(buf_t *buf)
     }
 #if WITH_TRANSPORT_UDP
     if (buf->conn->transport.type == CONN_TYPE_UDP) {
-        if (atomic_read((atomic_t *)&ni->udp.self_recv) <= 0) {
+        if (!buf->udp_self) {
 #endif
             /* initialize buf->cur_loc_iov_index/off and buf->start */
             err = init_local_offset(buf);
@@ -1065,7 +1067,8 @@ static int tgt_data_out(buf_t *buf)
             }
 
             err =
-                append_immediate_data(addr_to_ppe(me->start, mr), me->mr_list,
+                append_immediate_data(addr_to_ppe(me->start, mr),
+                                      me->iov_offsets, me->mr_list,
                                       me->num_iov, DATA_DIR_OUT, buf->moffset,
                                       buf->mlength, buf->send_buf);
 
@@ -1073,7 +1076,8 @@ static int tgt_data_out(buf_t *buf)
                 mr_put(mr);
 #else
             err =
-                append_immediate_data(me->start, me->mr_list, me->num_iov,
+                append_immediate_data(me->start, me->iov_offsets,
+                                      me->mr_list, me->num_iov,
                                       DATA_DIR_OUT, buf->moffset,
                                       buf->mlength, buf->send_buf);
 #endif
@@ -1094,7 +1098,7 @@ static int tgt_data_out(buf_t *buf)
             }
 
             err =
-                append_immediate_data(me->start, &mr, me->num_iov,
+                append_immediate_data(me->start, NULL, &mr, me->num_iov,
                                       DATA_DIR_OUT, buf->moffset,
                                       buf->mlength, buf->send_buf);
 
@@ -1102,7 +1106,7 @@ static int tgt_data_out(buf_t *buf)
                 mr_put(mr);
 #else
             err =
-                append_immediate_data(me->start, NULL, me->num_iov,
+                append_immediate_data(me->start, NULL, NULL, me->num_iov,
                                       DATA_DIR_OUT, buf->moffset,
                                       buf->mlength, buf->send_buf);
 #endif
@@ -1529,8 +1533,8 @@ static int tgt_swap_data_in(buf_t *buf)
 
     if (unlikely(me->num_iov)) {
         err =
-            iov_copy_out(copy, (ptl_iovec_t *)me->start, NULL, me->num_iov,
-                         buf->moffset, buf->mlength);
+            iov_copy_out(copy, (ptl_iovec_t *)me->start, me->iov_offsets,
+                         NULL, me->num_iov, buf->moffset, buf->mlength);
         if (err)
             return STATE_TGT_ERROR;
 
@@ -1750,7 +1754,7 @@ static int tgt_send_ack(buf_t *buf)
             case CONN_TYPE_UDP:
                 ack_buf->dest.udp.dest_addr = buf->udp.src_addr;
                 ack_buf->conn = buf->conn;
-                ack_buf->rlength = sizeof(buf_t);
+                ack_buf->rlength = UDP_BUF_SIZE;
                 ptl_info("buffer handle for initiator: %i \n",
                          le32_to_cpu(ack_hdr->h1.handle));
 
@@ -1762,6 +1766,17 @@ static int tgt_send_ack(buf_t *buf)
                 break;
 #endif
 
+#if WITH_TRANSPORT_LOOP
+            case CONN_TYPE_LOOP:
+                /* The received buffer is sent back. */
+                err = ack_buf->conn->transport.send_message(ack_buf, 0);
+                if (err) {
+                    WARN();
+                    return STATE_TGT_ERROR;
+                }
+                break;
+#endif
+
 #if WITH_TRANSPORT_IB
             case CONN_TYPE_RDMA:
                 /* That should not be possible. */
@@ -2042,6 +2057,78 @@ static int tgt_overflow_event(buf_t *buf)
     return STATE_TGT_CLEANUP_2;
 }
 
+/**
+ * @brief target fast path.
+ *
+ * Runs the states of the common flows, a small put, get or atomic
+ * from a connected peer with immediate data, as straight-line calls
+ * rather than through the switch of process_tgt: start, get_match,
+ * get_length, data, then data_out, data_in or atomic_data_in, then
+ * comm_event, send_ack or send_reply, and cleanup. As soon as a state
+ * returns something else the general machine takes over from there.
+ * The states are still recorded for the state trace, but not logged.
+ *
+ * @param[in] buf The message buf received by the target.
+ *
+ * @return The state to continue from.
+ */
+static int tgt_fast_path(buf_t *buf)
+{
+    int state = STATE_TGT_START;
+
+    TRACE_STATE(TRACE_TGT, buf, state);
+    state = tgt_start(buf);
+    if (state != STATE_TGT_GET_MATCH)
+        return state;
+
+    TRACE_STATE(TRACE_TGT, buf, state);
+    state = tgt_get_match(buf);
+    if (state != STATE_TGT_GET_LENGTH)
+        return state;
+
+    TRACE_STATE(TRACE_TGT, buf, state);
+    state = tgt_get_length(buf);
+    if (state != STATE_TGT_DATA)
+        return state;
+
+    TRACE_STATE(TRACE_TGT, buf, state);
+    state = tgt_data(buf);
+
+    if (state == STATE_TGT_DATA_OUT) {
+        TRACE_STATE(TRACE_TGT, buf, state);
+        state = tgt_data_out(buf);
+    }
+
+    if (state == STATE_TGT_DATA_IN) {
+        TRACE_STATE(TRACE_TGT, buf, state);
+        state = tgt_data_in(buf);
+    } else if (state == STATE_TGT_ATOMIC_DATA_IN) {
+        TRACE_STATE(TRACE_TGT, buf, state);
+        state = tgt_atomic_data_in(buf);
+    }
+
+    if (state != STATE_TGT_COMM_EVENT)
+        return state;
+
+    TRACE_STATE(TRACE_TGT, buf, state);
+    state = tgt_comm_event(buf);
+
+    if (state == STATE_TGT_SEND_ACK) {
+        TRACE_STATE(TRACE_TGT, buf, state);
+        state = tgt_send_ack(buf);
+    } else if (state == STATE_TGT_SEND_REPLY) {
+        TRACE_STATE(TRACE_TGT, buf, state);
+        state = tgt_send_reply(buf);
+    }
+
+    if (state == STATE_TGT_CLEANUP) {
+        TRACE_STATE(TRACE_TGT, buf, state);
+        state = tgt_cleanup(buf);
+    }
+
+    return state;
+}
+
 /**
  * @brief target state machine.
  *
@@ -2071,9 +2158,13 @@ int process_tgt(buf_t *buf)
 
     state = buf->tgt_state;
 
+    if (state == STATE_TGT_START)
+        state = tgt_fast_path(buf);
+
     while (1) {
         ptl_info("%p: tgt state = %s event mask: %i\n", buf,
                  tgt_state_name[state], buf->event_mask);
+        TRACE_STATE(TRACE_TGT, buf, state);
 
         switch (state) {
             case STATE_TGT_START:
@@ -2165,8 +2256,8 @@ int process_tgt(buf_t *buf)
                 buf->tgt_state = STATE_TGT_DONE;
                 pthread_mutex_unlock(&buf->mutex);
 #if WITH_TRANSPORT_UDP
-                ni_t *ni = obj_to_ni(buf);
-                if (atomic_read(&ni->udp.self_recv) == 0)
+                /* A message to self is the initiator's buf. */
+                if (!buf->udp_self)
 #endif
                     buf_put(buf);      /* match buf_alloc */
 
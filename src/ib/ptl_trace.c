@@ -0,0 +1,243 @@
+/**
+ * @file ptl_trace.c
+ *
+ * @brief State machine tracing.
+ *
+ * Trace file layout, in host byte order:
+ *	char magic[8] ("P4TRACE1")
+ *	uint64_t tsc0, ns0, tsc1, ns1 (to convert ticks to time)
+ *	uint32_t number of state machines, then for each of them
+ *		a string with its name, uint32_t mask of the states a
+ *		run of the machine starts with, uint32_t number of
+ *		states and a string for each state name
+ *	uint32_t number of rings, then for each of them
+ *		uint32_t tid, uint32_t unused, uint64_t count
+ *		and count struct trace_rec, oldest first
+ * where a string is a uint32_t length followed by the characters.
+ */
+
+#include "ptl_loc.h"
+
+#define TRACE_MAGIC	"P4TRACE1"
+
+int trace_enabled;
+__thread struct trace_ring *trace_ring;
+
+/* set when the ring of the thread could not be allocated */
+static __thread int trace_ring_failed;
+
+/* all the rings ever allocated */
+static struct trace_ring *volatile trace_rings;
+static atomic_t trace_next_tid;
+
+/* number of records per ring */
+static unsigned long trace_size;
+
+/* reference points to convert timestamps to nanoseconds */
+static uint64_t trace_tsc0;
+static uint64_t trace_ns0;
+
+extern char *init_state_name[];
+extern char *tgt_state_name[];
+extern char *recv_state_name[];
+
+/* bufs are not always released between two runs of a state machine,
+ * so the analyzer needs the start states to tell runs apart */
+static const struct {
+    const char *name;
+    char **state_name;
+    int num_states;
+    uint32_t start_mask;
+} trace_machines[TRACE_MACHINE_LAST] = {
+    [TRACE_INIT] = {"init", init_state_name, STATE_INIT_LAST,
+                    1 << STATE_INIT_START},
+    [TRACE_TGT] = {"tgt", tgt_state_name, STATE_TGT_DONE + 1,
+                   1 << STATE_TGT_START},
+    [TRACE_RECV] = {"recv", recv_state_name, STATE_RECV_DONE + 1,
+                    1 << STATE_RECV_SEND_COMP | 1 << STATE_RECV_RDMA_COMP |
+                    1 << STATE_RECV_PACKET_RDMA | 1 << STATE_RECV_PACKET},
+};
+
+static uint64_t trace_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Allocate the calling thread's ring.
+ *
+ * @return the ring or NULL if it could not be allocated
+ */
+struct trace_ring *trace_ring_alloc(void)
+{
+    struct trace_ring *ring;
+    struct trace_ring *head;
+
+    if (trace_ring_failed)
+        return NULL;
+
+    ring = calloc(1, sizeof(*ring) +
+                  trace_size * sizeof(struct trace_rec));
+    if (!ring) {
+        /* don't try again for this thread */
+        trace_ring_failed = 1;
+        WARN();
+        return NULL;
+    }
+
+    ring->mask = trace_size - 1;
+    ring->tid = atomic_inc(&trace_next_tid);
+
+    do {
+        head = trace_rings;
+        ring->next = head;
+    } while (!__sync_bool_compare_and_swap(&trace_rings, head, ring));
+
+    trace_ring = ring;
+
+    return ring;
+}
+
+static void write_string(FILE *f, const char *s)
+{
+    uint32_t len = s ? strlen(s) : 0;
+
+    fwrite(&len, sizeof(len), 1, f);
+    fwrite(s, 1, len, f);
+}
+
+/**
+ * @brief Write the records of a ring, oldest first.
+ *
+ * The owner thread may still be writing to the ring. The records are
+ * copied first, and those it overwrote meanwhile, or may have been
+ * overwriting, are left out.
+ *
+ * @param[in] f the trace file
+ * @param[in] ring the ring
+ * @param[in] copy room for trace_size records
+ */
+static void dump_ring(FILE *f, struct trace_ring *ring,
+                      struct trace_rec *copy)
+{
+    uint32_t hdr[2] = { ring->tid, 0 };
+    uint64_t head, first, count, i;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    memcpy(copy, ring->rec, trace_size * sizeof(struct trace_rec));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    /* The record at the current head may be half written, and it
+     * replaces the one trace_size records before. */
+    first = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) + 1;
+    first = first > trace_size ? first - trace_size : 0;
+    count = head > first ? head - first : 0;
+
+    fwrite(hdr, sizeof(hdr), 1, f);
+    fwrite(&count, sizeof(count), 1, f);
+
+    for (i = first; i < head; i++)
+        fwrite(&copy[i & ring->mask], sizeof(struct trace_rec), 1, f);
+}
+
+/**
+ * @brief Write all the rings to the trace file.
+ *
+ * Registered with atexit. Recording is turned off first, but the
+ * threads still running may complete a record, see dump_ring(). The
+ * file is named by PTL_STATE_TRACE_FILE, else p4trace.<pid> in the
+ * current directory.
+ */
+static void trace_dump(void)
+{
+    struct trace_ring *ring;
+    struct trace_rec *copy;
+    char name[64];
+    const char *path;
+    uint64_t stamps[4];
+    uint32_t n;
+    FILE *f;
+    int i, j;
+
+    trace_enabled = 0;
+    __sync_synchronize();
+
+    path = getenv("PTL_STATE_TRACE_FILE");
+    if (!path) {
+        snprintf(name, sizeof(name), "p4trace.%d", getpid());
+        path = name;
+    }
+
+    copy = malloc(trace_size * sizeof(struct trace_rec));
+    if (!copy) {
+        WARN();
+        return;
+    }
+
+    f = fopen(path, "w");
+    if (!f) {
+        ptl_warn("cannot open trace file %s\n", path);
+        free(copy);
+        return;
+    }
+
+    stamps[0] = trace_tsc0;
+    stamps[1] = trace_ns0;
+    stamps[2] = trace_tsc();
+    stamps[3] = trace_ns();
+
+    fwrite(TRACE_MAGIC, 1, 8, f);
+    fwrite(stamps, sizeof(stamps), 1, f);
+
+    n = TRACE_MACHINE_LAST;
+    fwrite(&n, sizeof(n), 1, f);
+    for (i = 0; i < TRACE_MACHINE_LAST; i++) {
+        write_string(f, trace_machines[i].name);
+        fwrite(&trace_machines[i].start_mask, sizeof(uint32_t), 1, f);
+        n = trace_machines[i].num_states;
+        fwrite(&n, sizeof(n), 1, f);
+        for (j = 0; j < trace_machines[i].num_states; j++)
+            write_string(f, trace_machines[i].state_name[j]);
+    }
+
+    n = 0;
+    for (ring = trace_rings; ring; ring = ring->next)
+        n++;
+    fwrite(&n, sizeof(n), 1, f);
+
+    for (ring = trace_rings; ring; ring = ring->next)
+        dump_ring(f, ring, copy);
+
+    fclose(f);
+    free(copy);
+}
+
+/**
+ * @brief Turn tracing on if requested.
+ *
+ * Called once at library initialization, after the parameters have
+ * been read.
+ */
+void trace_init(void)
+{
+    unsigned long size = get_param(PTL_STATE_TRACE);
+
+    if (!size || trace_enabled)
+        return;
+
+    /* round up to a power of 2 */
+    trace_size = 1;
+    while (trace_size < size)
+        trace_size <<= 1;
+
+    trace_tsc0 = trace_tsc();
+    trace_ns0 = trace_ns();
+
+    atexit(trace_dump);
+
+    trace_enabled = 1;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file ptl_trace.h
+ *
+ * @brief State machine tracing.
+ *
+ * When PTL_STATE_TRACE is set to a non zero number of entries, each
+ * state the initiator, target and receive state machines go through
+ * is recorded as (buf handle, state, timestamp) in a ring owned by
+ * the calling thread. The rings are written to a file at exit and
+ * can be analyzed with p4trace.
+ */
+#ifndef PTL_TRACE_H
+#define PTL_TRACE_H
+
+/**
+ * @brief State machines that can be traced.
+ */
+enum trace_machine {
+    TRACE_INIT,
+    TRACE_TGT,
+    TRACE_RECV,
+    TRACE_MACHINE_LAST,             /* keep me last */
+};
+
+/**
+ * @brief One trace record, also the on disk format.
+ */
+struct trace_rec {
+        /** timestamp counter when the state was entered */
+    uint64_t tsc;
+        /** handle of the buf going through the state machine */
+    uint32_t buf;
+        /** the state machine */
+    uint8_t machine;
+        /** the state */
+    uint8_t state;
+    uint16_t pad;
+};
+
+/**
+ * @brief Per thread ring of trace records.
+ *
+ * Only its owner thread writes to a ring, the oldest records are
+ * overwritten once the ring is full. head is only increased once a
+ * record is written.
+ */
+struct trace_ring {
+        /** next ring in the list of all rings */
+    struct trace_ring *next;
+        /** number of records ever written */
+    uint64_t head;
+        /** number of records in the ring - 1 */
+    uint64_t mask;
+        /** small number identifying the owner thread */
+    uint32_t tid;
+    struct trace_rec rec[];
+};
+
+extern int trace_enabled;
+extern __thread struct trace_ring *trace_ring;
+
+void trace_init(void);
+struct trace_ring *trace_ring_alloc(void);
+
+/**
+ * @brief Read the timestamp counter.
+ *
+ * @return the current time, in timestamp counter ticks
+ */
+static inline uint64_t trace_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc":"=a"(lo), "=d"(hi));
+
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Record a state in the calling thread's ring.
+ *
+ * @param[in] machine the state machine
+ * @param[in] handle the handle of the buf
+ * @param[in] state the state being entered
+ */
+static inline void trace_state(enum trace_machine machine, uint32_t handle,
+                               int state)
+{
+    struct trace_ring *ring = trace_ring;
+    struct trace_rec *rec;
+
+    if (unlikely(!ring)) {
+        ring = trace_ring_alloc();
+        if (!ring)
+            return;
+    }
+
+    rec = &ring->rec[ring->head & ring->mask];
+    rec->tsc = trace_tsc();
+    rec->buf = handle;
+    rec->machine = machine;
+    rec->state = state;
+
+    /* the record is complete for trace_dump */
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* costs a single predicted branch when tracing is off */
+#define TRACE_HANDLE(machine, handle, state)				\
+	do {								\
+		if (unlikely(trace_enabled))				\
+			trace_state(machine, handle, state);		\
+	} while (0)
+
+#define TRACE_STATE(machine, buf, state)				\
+	TRACE_HANDLE(machine, (buf) ? (buf)->obj.obj_handle : 0, state)
+
+#endif /* PTL_TRACE_H */
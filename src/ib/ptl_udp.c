@@ -26,6 +26,8 @@ static int send_message_udp(buf_t *buf, int from_init)
     // send-side of this connection
     //atomic_inc(&buf->conn->udp.send_seq);
 
+    STATS_SEND(buf->obj.obj_ni, STATS_UDP, buf->length);
+
 #if WITH_RUDP
     ptl_info("&&&&&&&&&& Reliable UDP send &&&&&&&&&\n");
 #endif
@@ -43,8 +45,8 @@ static void udp_set_send_flags(buf_t *buf, int can_signal)
     buf->event_mask |= XX_INLINE;
 }
 
-static void append_init_data_udp_iovec(data_t *data, md_t *md, int iov_start,
-                                       int num_iov, ptl_size_t length,
+static void append_init_data_udp_iovec(data_t *data, md_t *md,
+                                       ptl_size_t offset, ptl_size_t length,
                                        buf_t *buf)
 {
     data->data_fmt = DATA_FMT_UDP;
@@ -55,20 +57,13 @@ static void append_init_data_udp_iovec(data_t *data, md_t *md, int iov_start,
     buf->transfer.udp.transfer_state_expected = 0;  /* always the initiator here */
     buf->transfer.udp.udp = &data->udp;
 
-    buf->transfer.udp.num_iovecs = num_iov;
-    ptl_info("appending data for %i iovecs \n", num_iov);
-    int i;
-
-    buf->transfer.udp.iovecs = calloc(1, sizeof(ptl_iovec_t) * num_iov);
-
-    for (i = 0; i < num_iov; i++) {
-        buf->transfer.udp.iovecs[i].iov_base = md->udp_list[i].iov_base;
-        buf->transfer.udp.iovecs[i].iov_len = md->udp_list[i].iov_len;
-        //ptl_info("item is: %x length: %i \n",md->udp_list[i].iov_base,md->udp_list[i].iov_len);
-    }
-
-    buf->transfer.udp.my_iovec.iov_base = calloc(1, md->length);
-    buf->transfer.udp.offset = 0;
+    /* The data is gathered from the MD when sent. udp_list is
+     * already translated. */
+    buf->transfer.udp.iovecs = md->udp_list;
+    buf->transfer.udp.iov_offsets = md->iov_offsets;
+    buf->transfer.udp.mr_list = NULL;
+    buf->transfer.udp.num_iovecs = md->num_iov;
+    buf->transfer.udp.offset = offset;
 
     buf->transfer.udp.length_left = length;
 
@@ -93,10 +88,13 @@ static void append_init_data_udp_direct(data_t *data, mr_t *mr, void *addr,
 
     buf->transfer.udp.num_iovecs = 1;
     buf->transfer.udp.iovecs = &buf->transfer.udp.my_iovec;
+    buf->transfer.udp.iov_offsets = NULL;
+    buf->transfer.udp.mr_list = NULL;
     buf->transfer.udp.offset = 0;
 
     buf->transfer.udp.length_left = length;
 
+    buf->length += sizeof(*data);
 }
 
 /**
@@ -142,25 +140,24 @@ static int init_prepare_transfer_udp(md_t *md, data_dir_t dir,
 
         ptl_info("small transfer inlining data \n");
         if (append_immediate_data
-            (md->start, mr_list, md->num_iov, dir, offset, length, buf))
+            (md->start, md->iov_offsets, mr_list, md->num_iov, dir, offset,
+             length, buf))
             abort();
     } else {
         if (md->options & PTL_IOVEC) {
             ptl_warn("using native iovecs \n");
             ptl_iovec_t *iovecs = md->start;
 
-            // Find the index and offset of the first IOV as well as the
-            //  total number of IOVs to transfer. 
+            // Check that the data region is within the MD.
             num_sge =
-                iov_count_elem(iovecs, md->num_iov, offset, length,
-                               &iov_start, &iov_offset);
+                iov_count_elem(iovecs, md->iov_offsets, md->num_iov, offset,
+                               length, &iov_start, &iov_offset);
             if (num_sge < 0) {
                 WARN();
                 return PTL_FAIL;
             }
 
-            append_init_data_udp_iovec(data, md, iov_start, num_sge, length,
-                                       buf);
+            append_init_data_udp_iovec(data, md, offset, length, buf);
 
             hdr->roffset = 0;
 
@@ -230,7 +227,7 @@ static int do_udp_transfer(buf_t *buf)
                 (buf->me->mr_list) ? buf->me->mr_list : &buf->me->mr_start;
             err =
                 iov_copy_in(buf->transfer.udp.data, buf->transfer.udp.iovecs,
-                            mr_list, buf->transfer.udp.num_iovecs,
+                            NULL, mr_list, buf->transfer.udp.num_iovecs,
                             buf->transfer.udp.offset, to_copy);
         } else {
             //Get operation response
@@ -255,19 +252,15 @@ static int do_udp_transfer(buf_t *buf)
                                 buf->me->mr_start);
                 buf->send_buf->transfer.udp.data =
                     buf->transfer.udp.my_iovec.iov_base;
-            }
-
-            if (is_iovec == 1) {
-                mr_list =
+            } else {
+                //the reply is gathered from the ME iovecs when sent
+                buf->send_buf->transfer.udp.mr_list =
                     (buf->me->mr_list) ? buf->me->mr_list : &buf->
                     me->mr_start;
-                err =
-                    iov_copy_out(buf->send_buf->transfer.udp.
-                                 my_iovec.iov_base, buf->me->start, mr_list,
-                                 buf->me->num_iov, buf->transfer.udp.offset,
-                                 to_copy);
-                buf->send_buf->transfer.udp.num_iovecs = buf->me->num_iov;
+                buf->send_buf->transfer.udp.iov_offsets =
+                    buf->me->iov_offsets;
             }
+
             //We need to setup the reply buffer for this data
             buf->send_buf->rlength = to_copy;
             buf->send_buf->transfer.udp.udp->length = to_copy;
@@ -336,730 +329,1919 @@ static int udp_tgt_data_out(buf_t *buf, data_t *data)
     return STATE_TGT_UDP;
 }
 
+/* 65535 - 8 byte UDP header - 20 byte IP header */
+#define UDP_MAX_PAYLOAD 65507
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define UDP_OFFLOAD 1
+#else
+#define UDP_OFFLOAD 0
+#endif
+
+/* Most datagrams in one UDP_SEGMENT send, UDP_MAX_SEGMENTS in the
+ * kernel. */
+#define UDP_GSO_SEGS 64
+
+/* Largest wire image of a message, before its data. */
+#define UDP_HDR_MAX (sizeof(struct udp_hdr) + sizeof(struct udp_conn_msg) + \
+                     BUF_DATA_SIZE)
+
 /**
- * @brief send a buf to a pid using UDP socket.
+ * @brief Pick the receive socket of a message.
  *
- * @param[in] ni the network interface
- * @param[in] buf the buf
- * @param[in] dest the destination socket info
+ * With PTL_UDP_SOCKETS > 1, the receiver steers a datagram to one
+ * of its sockets from the stripe byte of its header, see
+ * udp_steer_init(). Requests are hashed by source and portal table,
+ * so that those which must stay ordered go through the same
+ * socket, and responses by source only.
+ *
+ * @param[in] buf the buf to send
+ *
+ * @return the stripe
  */
-void udp_send(ni_t *ni, buf_t *buf, struct sockaddr_in *dest)
+static uint8_t udp_stripe(const buf_t *buf)
 {
-    int err;
-
-    const struct sockaddr_in target = *dest;
+    const req_hdr_t *hdr = (const req_hdr_t *)buf->internal_data;
+    uint32_t h;
 
-    int MAX_UDP_MSG_SIZE = 1488;
-    uint32_t max_len_size;
-    max_len_size = sizeof(int);
-    getsockopt(ni->iface->udp.connect_s, SOL_SOCKET, SO_SNDBUF,
-               (int *)&MAX_UDP_MSG_SIZE, &max_len_size);
-    //65507 is the max IPv4 UDP message size (65536 - 8 byte UDP header - 20 byte IP header)
-    //Send buffers can sometimes exceed this size, so we need to cap the max packet size
-    if (MAX_UDP_MSG_SIZE > 65507)
-        MAX_UDP_MSG_SIZE = 65507;
+    if (buf->type == BUF_UDP_CONN_REQ || buf->type == BUF_UDP_CONN_REP ||
+        buf->length < sizeof(struct hdr_common))
+        return 0;
 
-    ptl_info("max udp message size is: %i \n", MAX_UDP_MSG_SIZE);
+    h = le32_to_cpu(hdr->h1.src_nid) * 31 + le32_to_cpu(hdr->h1.src_pid);
+    /* pt_index is where it is in a compact header too. */
+    if (hdr->h1.operation <= OP_SWAP && buf->length >= REQ_HDR_FIXED)
+        h = h * 31 + le32_to_cpu(hdr->pt_index);
 
-    //check for send to self, use local memory for transfer
-    if (((dest->sin_port == ni->id.phys.pid) &&
-         (dest->sin_addr.s_addr == nid_to_addr(ni->id.phys.nid)))) {
-        ptl_info("sending to self! \n");
-        if (buf->rlength <= sizeof(buf_t)) {
-            if (buf->transfer.udp.conn_msg.msg_type !=
-                le16_to_cpu(UDP_CONN_MSG_REP)) {
-                //the only multiple outstanding self sends that are valid are
-                //connection request replies and ACKS, otherwise, wait until the previous
-                //send has been received and processed
-                ack_hdr_t *hdr = (ack_hdr_t *) buf->data;
-                if (!
-                    (hdr->h1.operation == OP_ACK ||
-                     hdr->h1.operation == OP_CT_ACK ||
-                     hdr->h1.operation == OP_OC_ACK)) {
-                    while (atomic_read(&ni->udp.self_recv) > 0) {
-                        ptl_info("queuing for self send \n");
-                        sleep(1);
-                    }
-                }
-            }
-            buf->udp.src_addr = *dest;
-            ni->udp.self_recv_addr = buf;
-            ni->udp.self_recv_len = sizeof(buf_t);
-            ptl_info("self ref addr is: %p \n", ni->udp.self_recv_addr);
-            atomic_inc(&ni->udp.self_recv);
-            return;
-        } else {
-            ptl_warn("large message self sends not yet supported \n");
-            abort();
-        }
+    return (h * 0x9e3779b1) >> 24;
+}
 
+/**
+ * @brief Describe the wire image of a message.
+ *
+ * Only the message itself is sent, not the buf holding it.
+ *
+ * @param[in] buf the buf to send
+ * @param[out] hdr the UDP header to fill
+ * @param[out] iov at least 3 entries describing the image
+ * @param[in] flags UDP_HDR_* flags to set
+ *
+ * @return the number of iovec entries used
+ */
+int udp_wire_iov(buf_t *buf, struct udp_hdr *hdr, struct iovec *iov,
+                 int flags)
+{
+    int n = 0;
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->flags = flags;
+    hdr->type = buf->type;
+    hdr->length = cpu_to_le32(buf->length);
+    hdr->rlength = cpu_to_le64(buf->rlength);
+    hdr->seq_num = cpu_to_le32(buf->transfer.udp.seq_num);
+    hdr->stripe = udp_stripe(buf);
+
+    iov[n].iov_base = hdr;
+    iov[n++].iov_len = sizeof(*hdr);
+
+    if (buf->type == BUF_UDP_CONN_REQ || buf->type == BUF_UDP_CONN_REP) {
+        hdr->flags |= UDP_HDR_CONN;
+        iov[n].iov_base = &buf->transfer.udp.conn_msg;
+        iov[n++].iov_len = sizeof(buf->transfer.udp.conn_msg);
     }
 
-    struct md *send_md = NULL;
+    iov[n].iov_base = buf->internal_data;
+    iov[n++].iov_len = buf->length;
 
-    if ((buf->put_md != NULL) || buf->get_md != NULL) {
-        if (buf->put_md != NULL) {
-            if (buf->put_md->options) {
-                if (!!(buf->put_md->options & PTL_IOVEC)) {
-                    ptl_warn("IO vec put transfer %i \n", (int)buf->rlength);
-                    send_md = buf->put_md;
-                }
-            }
-        } else {
-            if (buf->get_md->options) {
-                if (!!(buf->get_md->options & PTL_IOVEC)) {
-                    ptl_info("IO vec get transfer %i \n", (int)buf->rlength);
-                    send_md = buf->get_md;
-                }
-            }
-        }
+    return n;
+}
 
+/**
+ * @brief Copy the wire image of a message.
+ *
+ * @param[in] buf the buf to send
+ * @param[out] dst at least UDP_HDR_MAX bytes
+ * @param[in] flags UDP_HDR_* flags to set
+ *
+ * @return the length of the image
+ */
+static unsigned int udp_wire_copy(buf_t *buf, unsigned char *dst, int flags)
+{
+    struct udp_hdr hdr;
+    struct iovec iov[3];
+    unsigned int len = 0;
+    int i, n;
+
+    n = udp_wire_iov(buf, &hdr, iov, flags);
+    for (i = 0; i < n; i++) {
+        memcpy(dst + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
     }
-    //the buf has data and is not a small message or an ack
-    //TODO: Adjust this to the actual data size available in the buf_t immediate data
-    if (buf->rlength > sizeof(buf_t)) {
-        //this means that we have a message that is too large for an immediate send
-        //we must send it as a iovec upto the maximum UDP message size (64KB)
 
-        ptl_info("starting large message send \n");
-        if (send_md == NULL) {
-            ptl_info("data ptr`: %p length: %i \n",
-                     buf->transfer.udp.my_iovec.iov_base,
-                     (int)buf->transfer.udp.my_iovec.iov_len);
-            buf->transfer.udp.is_iovec = 0;
-        } else {
-            if (buf->transfer.udp.is_iovec == 1) {
-                ptl_info
-                    ("Flagged IO vec, data prt: %p data: %llu number of vecs: %i \n",
-                     buf->transfer.udp.data,
-                     *(long long unsigned int *)buf->transfer.udp.data,
-                     (int)buf->transfer.udp.num_iovecs);
-            } else if (!!(send_md->options & PTL_IOVEC)) {
-                ptl_info("IO vec, data prt: %p number of vecs: %i \n",
-                         buf->transfer.udp.iovecs,
-                         (int)buf->transfer.udp.num_iovecs);
-                //Now we just copy the iovecs into a sinlge buffer for sending as one large message
-                int i;
-                int cur_pntr = 0;
-                for (i = 0; i < buf->transfer.udp.num_iovecs; i++) {
-                    memcpy(buf->transfer.udp.my_iovec.iov_base + cur_pntr,
-                           buf->transfer.udp.iovecs[i].iov_base,
-                           buf->transfer.udp.iovecs[i].iov_len);
-                    cur_pntr += buf->transfer.udp.iovecs[i].iov_len;
-                }
-                buf->transfer.udp.is_iovec = 0;
-            } else {
-                buf->transfer.udp.is_iovec = 0;
-            }
-        }
+    return len;
+}
 
-        int segments = 0;
-        struct msghdr buf_msg_hdr;
-        int bytes_remain;
-        int cur_ptr;
-        struct sockaddr_in msg_dest;
-        int current_iovec = 0;
-        msg_dest = *dest;
-        req_hdr_t *hdr = (req_hdr_t *) buf->internal_data;
+/**
+ * @brief Length of a wire image before its data, from its header.
+ *
+ * @param[in] hdr the UDP header
+ *
+ * @return the length, or 0 if the header is invalid
+ */
+unsigned int udp_wire_len(const struct udp_hdr *hdr)
+{
+    unsigned int length = le32_to_cpu(hdr->length);
 
-        segments = (buf->rlength / (MAX_UDP_MSG_SIZE - sizeof(buf_t))) + 1;
+    if (length > BUF_DATA_SIZE)
+        return 0;
 
-        hdr->fragment_seq = 0;
+    return sizeof(*hdr) + length +
+        ((hdr->flags & UDP_HDR_CONN) ? sizeof(struct udp_conn_msg) : 0);
+}
 
-        int iovec_elements;
+/**
+ * @brief Build a received buf from the wire image of a message.
+ *
+ * @param[in] wire the image
+ * @param[in] len the number of bytes available in it
+ *
+ * @return a new buf, or NULL if the image is invalid
+ */
+buf_t *udp_wire_to_buf(const unsigned char *wire, unsigned int len)
+{
+    const struct udp_hdr *hdr = (const struct udp_hdr *)wire;
+    unsigned int wire_len;
+    buf_t *buf;
 
-        if (buf->transfer.udp.is_iovec == 0) {
-            iovec_elements = 2;
-            buf->transfer.udp.num_iovecs = iovec_elements;
-            buf->transfer.udp.is_iovec = 0;
-        } else {
-            iovec_elements = buf->transfer.udp.num_iovecs;
-            if (iovec_elements == buf->rlength) {
-                iovec_elements = 2;
-                buf->transfer.udp.num_iovecs = 2;
-                buf->transfer.udp.is_iovec = 0;
-            } else {
-                iovec_elements = buf->transfer.udp.num_iovecs++;
-            }
-            current_iovec = 0;
+    if (len < sizeof(*hdr))
+        return NULL;
 
-        }
-        //for a non-iovec based send
-        //we only have two iovec elements, the buf_t and the data
-        //for an io-vec based send we have 1 + the number of
-        //elements in the sending io-vec
-        struct iovec iov[iovec_elements + 1];
+    wire_len = udp_wire_len(hdr);
+    if (!wire_len || wire_len > len)
+        return NULL;
 
-        ptl_info("# of segments: %i \n", segments);
-        assert(segments > 0);
+    buf = calloc(1, UDP_BUF_SIZE);
+    if (!buf)
+        return NULL;
 
-        buf->udp.src_addr = target;
-        ptl_info("set buf target to: %s:%d \n", inet_ntoa(target.sin_addr),
-                 ntohs(target.sin_port));
+    /* One reference is dropped by the receive state machine, the
+     * other is the progress thread's, which frees the buf. */
+    ref_set(&buf->obj.obj_ref, 2);
 
+    buf->type = hdr->type;
+    buf->length = le32_to_cpu(hdr->length);
+    buf->rlength = le64_to_cpu(hdr->rlength);
+    buf->transfer.udp.seq_num = le32_to_cpu(hdr->seq_num);
 
-        iov[0].iov_base = buf;
-        iov[0].iov_len = sizeof(buf_t);
+    if (hdr->flags & UDP_HDR_CONN)
+        memcpy(&buf->transfer.udp.conn_msg, hdr + 1,
+               sizeof(buf->transfer.udp.conn_msg));
 
-        if (buf->transfer.udp.is_iovec == 0) {
-            buf->transfer.udp.is_iovec = 0;
-            iov[1].iov_base = (void *)buf->transfer.udp.my_iovec.iov_base;
-            ptl_info("sending iov: %p \n",
-                     buf->transfer.udp.my_iovec.iov_base);
-            if (buf->rlength > MAX_UDP_MSG_SIZE - sizeof(buf_t)) {
-                iov[1].iov_len = MAX_UDP_MSG_SIZE - sizeof(buf_t);
-                bytes_remain =
-                    buf->rlength - (MAX_UDP_MSG_SIZE - sizeof(buf_t));
-                cur_ptr = (MAX_UDP_MSG_SIZE - sizeof(buf_t));
-            } else {
-                iov[1].iov_len = buf->rlength;
-                bytes_remain = 0;
-            }
-            //this is always equal to 2 for non-iovec sends
-            current_iovec = iovec_elements;
-        } else {
-            int i = 1;
-            bytes_remain = buf->rlength;
-            int current_size = 0;
+    memcpy(buf->internal_data, udp_wire_msg(hdr), buf->length);
 
-            int total_size = 0;
-            for (i = 0; i < buf->transfer.udp.num_iovecs; i++) {
-                total_size += buf->transfer.udp.iovecs[i].iov_len;
-            }
+    buf->data = buf->internal_data;
+    buf->transfer.udp.data = buf->internal_data;
+    buf->transfer.udp.my_iovec.iov_base = buf->internal_data;
+    buf->transfer.udp.my_iovec.iov_len = buf->length;
 
-            bytes_remain = total_size;
-            ptl_info("total size of iovec is: %i \n", total_size);
-            i = 1;
-
-            if (total_size < (MAX_UDP_MSG_SIZE - sizeof(buf_t))) {
-                //just send all of the iovecs in the message data iovec
-                for (i = 1; i <= iovec_elements; i++) {
-                    iov[i].iov_base =
-                        buf->transfer.udp.iovecs[i - 1].iov_base;
-                    iov[i].iov_len = buf->transfer.udp.iovecs[i - 1].iov_len;
-                    current_iovec++;
-                }
-                current_iovec++;
-            } else {
-                while (bytes_remain && current_iovec <= iovec_elements) {
-
-                    if ((current_size +
-                         buf->transfer.udp.iovecs[current_iovec].iov_len) <
-                        (MAX_UDP_MSG_SIZE - sizeof(buf_t))) {
-                        iov[i].iov_base =
-                            buf->transfer.udp.iovecs[current_iovec].iov_base;
-                        ptl_info
-                            ("native IOvec send, sending iovec #%i of %i \n",
-                             current_iovec + 1,
-                             (int)buf->transfer.udp.num_iovecs);
-                        iov[i].iov_len =
-                            buf->transfer.udp.iovecs[current_iovec].iov_len;
-                        bytes_remain = bytes_remain - iov[i].iov_len;
-                        current_size = current_size + iov[i].iov_len;
-                        current_iovec++;
-                        i++;
-                    } else {
-                        //if there's any space left, send part of the next iovec.
-                        if (current_size < (MAX_UDP_MSG_SIZE - sizeof(buf_t))) {
-                            int space_left =
-                                (MAX_UDP_MSG_SIZE - sizeof(buf_t)) -
-                                current_size;
-                            iov[i].iov_base =
-                                buf->transfer.udp.
-                                iovecs[current_iovec].iov_base;
-                            iov[i].iov_len = space_left;
-                            current_size += iov[i].iov_len;
-                            buf->transfer.udp.
-                                iovecs[current_iovec].iov_base += space_left;
-                            buf->transfer.udp.iovecs[current_iovec].iov_len -=
-                                space_left;
-                            i++;
-                        }
-                        ptl_info
-                            ("current message data payload full, send additional segments \n");
-                        //send iovec datagram and then loop back to prepare another
-                        buf_msg_hdr.msg_name = (void *)dest;
-                        buf_msg_hdr.msg_namelen = sizeof(*dest);
-                        buf_msg_hdr.msg_iov = (struct iovec *)&iov;
-                        buf_msg_hdr.msg_iovlen = i;
-                        buf->transfer.udp.msg_num_iovecs = i;
-                        ptl_info
-                            ("message header iov num set to %i , size: %i, length: %i\n",
-                             (int)buf_msg_hdr.msg_iovlen, (int)buf->rlength,
-                             (int)current_size);
-                        buf_msg_hdr.msg_flags = 0;
-
-                        ptl_info("sending large message to: %s:%i \n",
-                                 inet_ntoa(((struct sockaddr_in *)
-                                            buf_msg_hdr.msg_name)->sin_addr),
-                                 ntohs(((struct sockaddr_in *)
-                                        buf_msg_hdr.msg_name)->sin_port));
-
-                        buf_msg_hdr.msg_control = NULL;
-                        buf_msg_hdr.msg_controllen = 0;
-                        ptl_info("send IOvec, segment #%i of #%i \n",
-                                 hdr->fragment_seq + 1, segments);
-                        err =
-                            ptl_sendmsg(ni->iface->udp.connect_s,
-                                        (void *)&buf_msg_hdr, 0, ni);
-                        hdr->fragment_seq++;
-                        current_size = 0;
-                        i = 1;
-                    }
+    return buf;
+}
 
-                }
-                //current_iovec is used in the next section as the length of the to be sent message, so set it to i.
-                bytes_remain = 0;
-                current_iovec = i;
+/*
+ * Small messages to the same destination are packed in one
+ * datagram. Each record is the wire image of a message, padded to 8
+ * bytes, with UDP_HDR_PACKED set, which tells the receiver to read
+ * the whole datagram.
+ */
+struct udp_pack {
+    struct list_head list;
+    struct sockaddr_in dest;
+    uint8_t stripe;             /* of all the records */
+    unsigned int length;        /* bytes used in data */
+    unsigned int count;         /* number of records */
+    unsigned int seen;          /* count at the last progress pass */
+    uint64_t first;             /* time the first record was added, in ns */
+    unsigned char data[];
+};
 
-            }
-        }
+static inline unsigned int udp_record_len(unsigned int length)
+{
+    return (sizeof(struct udp_hdr) + length + 7) & ~7;
+}
 
+static uint64_t udp_pack_now(void)
+{
+    struct timespec ts;
 
-        ptl_info("iov lengths: %u %u \n", (int)iov[0].iov_len,
-                 (int)iov[1].iov_len);
-
-        buf_msg_hdr.msg_name = (void *)dest;
-        buf_msg_hdr.msg_namelen = sizeof(*dest);
-        buf_msg_hdr.msg_iov = (struct iovec *)&iov;
-        buf_msg_hdr.msg_iovlen = current_iovec;
-        buf->transfer.udp.msg_num_iovecs = current_iovec;
-        ptl_info("message header iov num set to %i \n",
-                 (int)buf_msg_hdr.msg_iovlen);
-        buf_msg_hdr.msg_flags = 0;
-
-        ptl_info("sending large message to: %s:%i \n",
-                 inet_ntoa(((struct sockaddr_in *)buf_msg_hdr.
-                            msg_name)->sin_addr),
-                 ntohs(((struct sockaddr_in *)buf_msg_hdr.
-                        msg_name)->sin_port));
-
-        buf_msg_hdr.msg_control = NULL;
-        buf_msg_hdr.msg_controllen = 0;
-
-        ptl_info("is message iovec? %i \n", buf->transfer.udp.is_iovec);
-        ptl_info("sending UDP message of size: %i, maximum: %i \n",
-                 (int)(buf_msg_hdr.msg_iov[0].iov_len +
-                       buf_msg_hdr.msg_iov[1].iov_len),
-                 (int)MAX_UDP_MSG_SIZE);
-        ptl_info("send segment #%i of #%i \n", hdr->fragment_seq + 1,
-                 segments);
-        err =
-            ptl_sendmsg(ni->iface->udp.connect_s, (void *)&buf_msg_hdr, 0,
-                        ni);
-        if (err == -1) {
-            ptl_error
-                ("error while sending multi segment message: %s\n remaining data: %i \n",
-                 strerror(errno), bytes_remain);
-        }
-        //this continues sending other datagrams for the non-iovec case
-        while (bytes_remain) {
-
-            hdr->fragment_seq++;
-            //keep sending multiple UDP segments until all the data is sent
-            if (bytes_remain >= (MAX_UDP_MSG_SIZE - sizeof(buf_t))) {
-                //more UDP segments to this message will follow
-                cur_ptr = MAX_UDP_MSG_SIZE - sizeof(buf_t);
-                bytes_remain -= (MAX_UDP_MSG_SIZE - sizeof(buf_t));
-            } else {
-                //last UDP segment in sequence
-                cur_ptr = bytes_remain;
-                bytes_remain -= bytes_remain;
-            }
-            iov[1].iov_base += cur_ptr;
-            iov[1].iov_len = cur_ptr;
-            buf_msg_hdr.msg_iov = (struct iovec *)&iov;
-            ptl_info("send segment #%i of #%i \n", hdr->fragment_seq + 1,
-                     segments);
-#ifdef __APPLE__
-            //We can overrun the send buffer without a wait here
-            //due to Mac's having very small network buffers
-            usleep(50);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Whether a message may wait in a pack.
+ *
+ * Acks and requests carrying their data inline qualify.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf to send
+ *
+ * @return 1 if the message can be packed, 0 otherwise
+ */
+static int udp_can_pack(ni_t *ni, buf_t *buf)
+{
+    struct hdr_common *hdr = (struct hdr_common *)buf->internal_data;
+
+    if (!ni->udp.pack.delay || buf->type != BUF_UDP_RECEIVE ||
+        buf->data != buf->internal_data || buf->length > BUF_DATA_SIZE)
+        return 0;
+
+    switch (hdr->operation) {
+        case OP_ACK:
+        case OP_CT_ACK:
+        case OP_OC_ACK:
+        case OP_NO_ACK:
+            return 1;
+        default:
+            return buf->rlength <= get_param(PTL_MAX_INLINE_DATA);
+    }
+}
+
+/**
+ * @brief Send datagrams, in order.
+ *
+ * With io_uring, they are all submitted at once.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf they come from, NULL for a pack
+ * @param[in] msgs the datagrams
+ * @param[in] n the number of datagrams
+ * @param[in] zc whether io_uring may send them without a copy
+ *
+ * @return the number of datagrams sent; if less than n, errno is set
+ */
+static int udp_sendmsgs(ni_t *ni, buf_t *buf, struct msghdr *msgs, int n,
+                        int zc)
+{
+    int s = ni->iface->udp.connect_s;
+    int i;
+
+#if WITH_UDP_URING
+    if (ni->iface->udp.uring[0])
+        return uring_sendmsgs(ni->iface->udp.uring[0], msgs, n, zc);
 #endif
-            err =
-                ptl_sendmsg(ni->iface->udp.connect_s, (void *)&buf_msg_hdr, 0,
-                            ni);
-            if (err == -1) {
-                ptl_error
-                    ("error while sending multi segment message: %s\n remaining data: %i \n",
-                     strerror(errno), bytes_remain);
-            }
-        }
 
+    for (i = 0; i < n; i++) {
+        /* Packs are outside of the RUDP sequence. */
+        ssize_t ret = buf ? ptl_sendmsg(s, &msgs[i], 0, buf, ni) :
+            sendmsg(s, &msgs[i], 0);
 
-    } else if (buf->rlength <= sizeof(buf_t)) { // for immediate data, just send the actual buffer
-        err =
-            ptl_sendto(ni->iface->udp.connect_s, buf, sizeof(*buf), 0,
-                       (struct sockaddr *)dest, sizeof(*dest), ni);
+        if (ret == -1)
+            break;
     }
 
-    if (err == -1) {
+    return i;
+}
+
+/* Send a pack and put it back on the free list. Called with the
+ * pack lock held. The progress thread is stopped with
+ * pthread_cancel(), so it must not be cancelled in sendmsg while it
+ * holds the lock. */
+static void udp_pack_flush_locked(ni_t *ni, struct udp_pack *pack)
+{
+    struct iovec iov = {
+        .iov_base = pack->data,
+        .iov_len = pack->length,
+    };
+    struct msghdr msg = {
+        .msg_name = &pack->dest,
+        .msg_namelen = sizeof(pack->dest),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+    int cancel_state;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+
+    if (udp_sendmsgs(ni, NULL, &msg, 1, 0) != 1) {
         WARN();
-        ptl_error("error sending to: %s:%d \n", inet_ntoa(dest->sin_addr),
-                  ntohs(dest->sin_port));
-        ptl_error("error sending buffer to socket: %i %s \n",
-                  ni->iface->udp.connect_s, strerror(errno));
-        abort();
-        return;
+        ptl_error("error sending %u packed messages to %s:%d: %s\n",
+                  pack->count, inet_ntoa(pack->dest.sin_addr),
+                  ntohs(pack->dest.sin_port), strerror(errno));
     }
-    ptl_info
-        ("UDP send completed successfully to: %s:%d from: %d size:%lu %i %i\n",
-         inet_ntoa(target.sin_addr), ntohs(target.sin_port),
-         ntohs(ni->iface->udp.sin.sin_port), sizeof(*buf), (int)buf->rlength,
-         err);
 
+    pthread_setcancelstate(cancel_state, NULL);
+
+    STATS_ADD(ni, udp_packed_msgs, pack->count);
+    STATS_INC(ni, udp_packed_dgrams);
+
+    pack->length = 0;
+    pack->count = 0;
+    list_del(&pack->list);
+    list_add(&pack->list, &ni->udp.pack.free);
+}
+
+static inline int udp_same_dest(const struct sockaddr_in *a,
+                                const struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr &&
+        a->sin_port == b->sin_port;
 }
 
 /**
- * @brief receive a buf using a UDP socket.
+ * @brief Add a message to the pack of its destination.
  *
- * @param[in] ni the network interface.
+ * The pack is sent once it is full. Otherwise it waits for
+ * udp_pack_progress() or for a message that can't be packed.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf to send
+ * @param[in] dest the destination
+ *
+ * @return 1 if the message was packed, 0 if it must be sent alone
  */
-buf_t *udp_receive(ni_t *ni)
+static int udp_pack_add(ni_t *ni, buf_t *buf, const struct sockaddr_in *dest)
 {
+    unsigned int len = udp_record_len(buf->length);
+    uint8_t stripe = udp_stripe(buf);
+    struct udp_pack *pack = NULL;
+    struct list_head *l;
 
-    int err;
-    struct sockaddr_in temp_sin;
-    socklen_t lensin = sizeof(temp_sin);
+    if (len > ni->udp.pack.max)
+        return 0;
 
-    buf_t *thebuf = (buf_t *)calloc(1, sizeof(buf_t));
+    PTL_FASTLOCK_LOCK(&ni->udp.pack.lock);
 
-    if (atomic_read(&ni->udp.self_recv) >= 1) {
-        ptl_info("got a message from self %p \n", ni->udp.self_recv_addr);
-        free(thebuf);
-        thebuf = (buf_t *)ni->udp.self_recv_addr;
-        return thebuf;
-    }
+    list_for_each(l, &ni->udp.pack.busy) {
+        struct udp_pack *p = list_entry(l, struct udp_pack, list);
 
+        if (udp_same_dest(&p->dest, dest) && p->stripe == stripe) {
+            pack = p;
+            break;
+        }
+    }
 
-    int flags;
-    flags = MSG_PEEK;
-    //REG: we need to perform a quick message peek here to determine if it is a short or long message
-    // this can be tweaked performance wise to only peek on the beginning of the buf for the length
-    // this peak is also used to determine if it is a multi-segment message
-    err =
-        ptl_recvfrom(ni->iface->udp.connect_s, thebuf, sizeof(*thebuf), flags,
-                     (struct sockaddr *)&temp_sin, &lensin, ni);
+    if (pack && pack->length + len > ni->udp.pack.max) {
+        udp_pack_flush_locked(ni, pack);
+        pack = NULL;
+    }
 
-    if (err == -1) {
-        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-            // OK, nothing ready to fetch
-            free(thebuf);
-            return NULL;
+    if (!pack) {
+        if (!list_empty(&ni->udp.pack.free)) {
+            pack = list_first_entry(&ni->udp.pack.free, struct udp_pack,
+                                    list);
+            list_del(&pack->list);
         } else {
-            // Error, recvfrom returned unexpected error
-            free(thebuf);
-            WARN();
-            ptl_warn("error when peeking at message: %s \n", strerror(errno));
-            return NULL;
+            pack = malloc(sizeof(*pack) + ni->udp.pack.max);
+            if (!pack) {
+                PTL_FASTLOCK_UNLOCK(&ni->udp.pack.lock);
+                return 0;
+            }
+            pack->length = 0;
+            pack->count = 0;
         }
+
+        pack->dest = *dest;
+        pack->stripe = stripe;
+        pack->first = udp_pack_now();
+        pack->seen = 0;
+        list_add_tail(&pack->list, &ni->udp.pack.busy);
     }
 
-    req_hdr_t *hdr;
+    udp_wire_copy(buf, pack->data + pack->length, UDP_HDR_PACKED);
 
-    //first check to see if this is meant for this ni
-    if (thebuf->internal_data != NULL) {
-        hdr = (req_hdr_t *) thebuf->internal_data;
-    } else {
-        hdr = (req_hdr_t *) & thebuf->data;
-    }
+    pack->length += len;
+    pack->count++;
 
-    ptl_info("QQQQQQQQQQQQQQ: ni_type of incoming message: %x and ni_type of %x\n",hdr->h1.ni_type,ni->ni_type);
+    /* Don't wait if not even an empty message would fit. */
+    if (pack->length + sizeof(struct udp_hdr) > ni->udp.pack.max)
+        udp_pack_flush_locked(ni, pack);
 
-    if (((hdr->h1.physical == 0) && (!!(ni->options & PTL_NI_PHYSICAL))) ||
-        ((hdr->h1.physical == 1) && (!!(ni->options & PTL_NI_LOGICAL))) ||
-        (hdr->h1.ni_type != ni->ni_type)) {
-            //this datagram is not meant for us
-            ptl_info("packet not meant for this NI, dropping \n");
-            free(thebuf);
-            //this time interval is just to back off, it is completely arbitrary
-            //although 20us is a reasonable approximation of the time to 
-            //fetch a recv through the kernel UDP networking stack
-            usleep(20);
-            return NULL;
-        
-    }
-    //we are going to be handling multiple messages, implemented through a recvmsg call
-    if (thebuf->rlength > sizeof(buf_t)) {
-        ptl_info("peek indicates large message of size: %i\n",
-                 (int)thebuf->rlength);
+    PTL_FASTLOCK_UNLOCK(&ni->udp.pack.lock);
 
-        //first I/O vector will be the traditional portals buf
-        //second will be the data for the buf, so we need to set the data pointer appropriately once
-        //the data has arrived
-        struct msghdr buf_msg_hdr;
-        char *buf_data;
-        int buf_data_len;
-        struct iovec iov[thebuf->transfer.udp.num_iovecs + 1];
-
-        //this is the size of the largest UDP message that can be sent
-        //without fragmenting into multiple datagrams
-        int MAX_UDP_MSG_SIZE;
-        uint32_t max_len_size;
-        max_len_size = sizeof(int);
-        int current_message_size;
-
-        getsockopt(ni->iface->udp.connect_s, SOL_SOCKET, SO_RCVBUF,
-                   (int *)&MAX_UDP_MSG_SIZE, &max_len_size);
-        //65507 is the max IPv4 UDP message size (65536 - 8 byte UDP header - 20 byte IP header)
-        if (MAX_UDP_MSG_SIZE > 65507)
-            MAX_UDP_MSG_SIZE = 65507;
-        buf_data = calloc(1, (size_t) MAX_UDP_MSG_SIZE);
-
-        iov[0].iov_base = thebuf;
-        iov[0].iov_len = sizeof(buf_t);
-        iov[1].iov_base = buf_data;
-        //just combine all data into one big iov
-        iov[1].iov_len = thebuf->rlength;
+    return 1;
+}
 
-        buf_msg_hdr.msg_name = &temp_sin;
-        buf_msg_hdr.msg_namelen = sizeof(temp_sin);
-        buf_msg_hdr.msg_iov = (struct iovec *)&iov;
+/**
+ * @brief Send the pack of a destination, or all of them.
+ *
+ * @param[in] ni the network interface
+ * @param[in] dest the destination, or NULL for all
+ */
+static void udp_pack_flush(ni_t *ni, const struct sockaddr_in *dest)
+{
+    struct list_head *l, *t;
 
-        //we only ever have two iovecs, the header and the data
-        buf_msg_hdr.msg_iovlen = 2;
+    if (list_empty(&ni->udp.pack.busy))
+        return;
 
-        err = recvmsg(ni->iface->udp.connect_s, &buf_msg_hdr, 0);
-        if (err == -1) {
-            free(thebuf);
-            free(buf_data);
-            WARN();
-            ptl_warn("error receiving main buffer from socket: %d %s\n",
-                     ni->iface->udp.connect_s, strerror(errno));
-            abort();
-            return NULL;
+    PTL_FASTLOCK_LOCK(&ni->udp.pack.lock);
 
-        }
+    list_for_each_safe(l, t, &ni->udp.pack.busy) {
+        struct udp_pack *pack = list_entry(l, struct udp_pack, list);
 
-        current_message_size = err - sizeof(buf_t);
-        ptl_info("received message of size: %i %i %i\n", err,
-                 (int)iov[0].iov_len, (int)iov[1].iov_len);
-
-        //process received IO vectors
-        thebuf = (buf_t *)buf_msg_hdr.msg_iov[0].iov_base;
-        thebuf->transfer.udp.num_iovecs = buf_msg_hdr.msg_iovlen;
-
-        struct md *recv_md = NULL;
-
-        //check if this is an iovec
-        //if it is, copy all of the iovecs over
-        if (thebuf->transfer.udp.num_iovecs > 2) {
-            int cur_iov_copy_loc = 0;
-            int i;
-            for (i = 1; i < thebuf->transfer.udp.num_iovecs; i++) { //msg_num_iovecs
-                ptl_info("copy iovec #%i of %i\n", i,
-                         (int)thebuf->transfer.udp.num_iovecs);
-                memcpy((buf_data + cur_iov_copy_loc),
-                       buf_msg_hdr.msg_iov[i].iov_base,
-                       buf_msg_hdr.msg_iov[i].iov_len);
-                cur_iov_copy_loc =
-                    cur_iov_copy_loc + buf_msg_hdr.msg_iov[i].iov_len;
-            }
-            thebuf->transfer.udp.my_iovec.iov_base = buf_data;
-            thebuf->transfer.udp.my_iovec.iov_len = thebuf->rlength;
+        if (!dest || udp_same_dest(&pack->dest, dest))
+            udp_pack_flush_locked(ni, pack);
+    }
+
+    PTL_FASTLOCK_UNLOCK(&ni->udp.pack.lock);
+}
+
+/**
+ * @brief Send the packs that waited long enough.
+ *
+ * Called by the progress thread after each poll of the socket. A
+ * pack is sent once it is older than the coalescing delay, or when
+ * the progress thread is idle and no message was added to it since
+ * the previous pass, i.e. the application stopped sending.
+ *
+ * @param[in] ni the network interface
+ * @param[in] idle set if nothing was received
+ */
+void udp_pack_progress(ni_t *ni, int idle)
+{
+    struct list_head *l, *t;
+    uint64_t now;
+
+    if (list_empty(&ni->udp.pack.busy))
+        return;
+
+    now = udp_pack_now();
+
+    PTL_FASTLOCK_LOCK(&ni->udp.pack.lock);
+
+    list_for_each_safe(l, t, &ni->udp.pack.busy) {
+        struct udp_pack *pack = list_entry(l, struct udp_pack, list);
+
+        if ((idle && pack->count == pack->seen) ||
+            now - pack->first >= ni->udp.pack.delay)
+            udp_pack_flush_locked(ni, pack);
+        else
+            pack->seen = pack->count;
+    }
+
+    PTL_FASTLOCK_UNLOCK(&ni->udp.pack.lock);
+}
+
+/**
+ * @brief Enable the UDP segmentation and receive offloads.
+ *
+ * With UDP_SEGMENT, the fragments of a large message are sent as
+ * MTU sized datagrams, up to UDP_GSO_SEGS of them per call. With
+ * UDP_GRO, the kernel may return several datagrams of a flow in one
+ * read, which udp_receive() then splits.
+ *
+ * @param[in] iface the interface, once its socket is bound
+ */
+void udp_offload_init(iface_t *iface)
+{
+    iface->udp.gso_size = 0;
+    iface->udp.gro = 0;
+
+#if UDP_OFFLOAD && !WITH_RUDP
+    int mtu = iface->udp.mtu;
+    int on = 1;
+
+    if (!get_param(PTL_UDP_OFFLOAD))
+        return;
+
+    /* Not worth it unless several datagrams fit in a send. */
+    if (mtu <= 28 || 2 * (mtu - 28) > UDP_MAX_PAYLOAD)
+        return;
+
+    iface->udp.gso_size = mtu - 28;
+
+    /* A train goes to the socket picked for its first datagram,
+     * which would defeat striping. */
+    if (iface->udp.num_s > 1)
+        return;
+
+    if (setsockopt(iface->udp.connect_s, SOL_UDP, UDP_GRO, &on,
+                   sizeof(on)) == -1) {
+        ptl_info("UDP_GRO not supported: %s\n", strerror(errno));
+        return;
+    }
+
+    iface->udp.gro = 1;
+#endif
+}
+
+/**
+ * @brief Drive the interface sockets through io_uring, if possible.
+ *
+ * Called after udp_offload_init(), since receiving GRO trains needs
+ * room for their segment size.
+ *
+ * @param[in] iface the interface, once its sockets are bound
+ */
+void udp_uring_init(iface_t *iface)
+{
+#if WITH_UDP_URING
+    int i;
+
+    for (i = 0; i < UDP_SOCKS_MAX; i++)
+        iface->udp.uring[i] = NULL;
+    iface->udp.zc = 0;
+
+    if (!get_param(PTL_UDP_URING))
+        return;
+
+    for (i = 0; i < iface->udp.num_s; i++) {
+        iface->udp.uring[i] = uring_init(iface->udp.s[i], iface->udp.gro);
+        if (!iface->udp.uring[i]) {
+            /* All or none. */
+            udp_uring_fini(iface);
+            return;
+        }
+    }
+
+    iface->udp.zc = get_param(PTL_UDP_URING_ZC);
+#endif
+}
+
+/**
+ * @brief Release the io_uring of the interface sockets.
+ *
+ * @param[in] iface the interface
+ */
+void udp_uring_fini(iface_t *iface)
+{
+#if WITH_UDP_URING
+    int i;
+
+    for (i = 0; i < UDP_SOCKS_MAX; i++) {
+        if (iface->udp.uring[i]) {
+            uring_fini(iface->udp.uring[i]);
+            iface->udp.uring[i] = NULL;
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Initialize message packing on an NI.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return status
+ */
+int udp_pack_init(ni_t *ni)
+{
+    int mtu = ni->iface->udp.mtu;
+    int i;
+
+    PTL_FASTLOCK_INIT(&ni->udp.pack.lock);
+    INIT_LIST_HEAD(&ni->udp.pack.busy);
+    INIT_LIST_HEAD(&ni->udp.pack.free);
+
+    /* Stay within the MTU so that a pack is never fragmented by IP. */
+    if (mtu > 28 && mtu - 28 < UDP_MAX_PAYLOAD)
+        ni->udp.pack.max = mtu - 28;
+    else
+        ni->udp.pack.max = UDP_MAX_PAYLOAD;
+
+#if WITH_RUDP
+    /* The reliability layer tracks each message. */
+    ni->udp.pack.delay = 0;
+#else
+    ni->udp.pack.delay = get_param(PTL_UDP_COALESCE_DELAY) * 1000ULL;
+#endif
+
+    /* One receive queue per socket of the interface. */
+    ni->udp.num_rxq = 0;
+    ni->udp.rxq = calloc(ni->iface->udp.num_s, sizeof(*ni->udp.rxq));
+    if (!ni->udp.rxq) {
+        WARN();
+        return PTL_NO_SPACE;
+    }
+
+    for (i = 0; i < ni->iface->udp.num_s; i++) {
+        struct udp_rxq *rxq = &ni->udp.rxq[i];
+
+        rxq->ni = ni;
+        rxq->index = i;
+        rxq->wait = NULL;
+        rxq->has_thread = 0;
+
+        rxq->unpack.length = 0;
+        rxq->unpack.offset = 0;
+        rxq->unpack.data = malloc(UDP_MAX_PAYLOAD);
+        if (!rxq->unpack.data) {
+            WARN();
+            return PTL_NO_SPACE;
+        }
+
+        /* Grown to the size of the trains received. */
+        rxq->gro.data = NULL;
+        rxq->gro.size = 0;
+        rxq->gro.train = NULL;
+        rxq->gro.length = 0;
+        rxq->gro.offset = 0;
+#if WITH_UDP_URING
+        rxq->gro.bid = -1;
+#endif
+
+        ni->udp.num_rxq++;
+    }
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Send the pending packs and release the packing resources.
+ *
+ * @param[in] ni the network interface
+ */
+void udp_pack_fini(ni_t *ni)
+{
+    struct list_head *l, *t;
+    int i;
+
+    if (!ni->udp.rxq)
+        return;
+
+    udp_pack_flush(ni, NULL);
+
+    list_for_each_safe(l, t, &ni->udp.pack.free) {
+        list_del(l);
+        free(list_entry(l, struct udp_pack, list));
+    }
+
+    for (i = 0; i < ni->udp.num_rxq; i++) {
+        struct udp_rxq *rxq = &ni->udp.rxq[i];
+
+        free(rxq->unpack.data);
+        rxq->unpack.data = NULL;
+
+        free(rxq->gro.data);
+        rxq->gro.data = NULL;
+
+#if WITH_UDP_URING
+        /* The ring may outlive this NI. */
+        if (rxq->gro.bid != -1) {
+            uring_recv_release(ni->iface->udp.uring[i], rxq->gro.bid);
+            rxq->gro.bid = -1;
+        }
+#endif
+    }
+    free(ni->udp.rxq);
+    ni->udp.rxq = NULL;
+    ni->udp.num_rxq = 0;
+
+    PTL_FASTLOCK_DESTROY(&ni->udp.pack.lock);
+}
+
+/**
+ * @brief Extract the next message of the last packed datagram.
+ *
+ * @param[in] ni the network interface
+ * @param[in] rxq the receive queue
+ * @param[out] src the sender of the datagram
+ *
+ * @return a new buf, or NULL if there is no message left
+ */
+static buf_t *udp_unpack(ni_t *ni, struct udp_rxq *rxq,
+                         struct sockaddr_in *src)
+{
+    unsigned int left = rxq->unpack.length - rxq->unpack.offset;
+    unsigned char *rec = rxq->unpack.data + rxq->unpack.offset;
+    unsigned int len;
+    buf_t *buf;
+
+    if (left < sizeof(struct udp_hdr))
+        goto done;
+
+    buf = udp_wire_to_buf(rec, left);
+    if (!buf) {
+        WARN();
+        ptl_warn("dropping malformed packed datagram from %s:%d\n",
+                 inet_ntoa(rxq->unpack.src.sin_addr),
+                 ntohs(rxq->unpack.src.sin_port));
+        goto done;
+    }
+
+    len = udp_record_len(buf->length);
+    rxq->unpack.offset += len < left ? len : left;
+
+    *src = rxq->unpack.src;
+
+    STATS_INC(ni, udp_unpacked_msgs);
+
+    return buf;
+
+  done:
+    rxq->unpack.length = 0;
+    rxq->unpack.offset = 0;
+    return NULL;
+}
+
+/**
+ * @brief Start a cursor over the data of a large message.
+ *
+ * @param[in] buf the buf
+ * @param[out] g the cursor
+ */
+void udp_gather_init(buf_t *buf, struct udp_gather *g)
+{
+    struct md *send_md = NULL;
+
+    if ((buf->put_md != NULL) || buf->get_md != NULL) {
+        if (buf->put_md != NULL) {
+            if (buf->put_md->options) {
+                if (!!(buf->put_md->options & PTL_IOVEC)) {
+                    ptl_warn("IO vec put transfer %i \n", (int)buf->rlength);
+                    send_md = buf->put_md;
+                }
+            }
+        } else {
+            if (buf->get_md->options) {
+                if (!!(buf->get_md->options & PTL_IOVEC)) {
+                    ptl_info("IO vec get transfer %i \n", (int)buf->rlength);
+                    send_md = buf->get_md;
+                }
+            }
+        }
+
+    }
+
+    if (buf->transfer.udp.is_iovec || send_md != NULL) {
+        ptl_info("IO vec, number of vecs: %i offset: %i \n",
+                 (int)buf->transfer.udp.num_iovecs,
+                 (int)buf->transfer.udp.offset);
+        g->iov = buf->transfer.udp.iovecs;
+        g->iov_offsets = buf->transfer.udp.iov_offsets;
+        g->mr_list = buf->transfer.udp.mr_list;
+        g->num_iov = buf->transfer.udp.num_iovecs;
+    } else {
+        ptl_info("data ptr`: %p length: %i \n",
+                 buf->transfer.udp.my_iovec.iov_base,
+                 (int)buf->transfer.udp.my_iovec.iov_len);
+        g->iov = &buf->transfer.udp.my_iovec;
+        g->iov_offsets = NULL;
+        g->mr_list = NULL;
+        g->num_iov = 1;
+    }
+    g->offset = buf->transfer.udp.offset;
+    g->index = iov_seek(g->iov, g->iov_offsets, g->num_iov, &g->offset);
+}
+
+/**
+ * @brief Describe the next fragment of a large message.
+ *
+ * The fragment is shorter than requested when max_iov entries are
+ * not enough, or when the data ends.
+ *
+ * @param[in,out] g the cursor, advanced past the fragment
+ * @param[out] iov the pieces of the fragment
+ * @param[in] max_iov the number of entries in iov
+ * @param[in,out] length the requested, then actual, fragment length
+ *
+ * @return the number of iovec entries used
+ */
+int udp_gather_frag(struct udp_gather *g, struct iovec *iov,
+                    int max_iov, ptl_size_t *length)
+{
+    ptl_size_t left = *length;
+    int n = 0;
+
+    while (left && n < max_iov && g->index < g->num_iov) {
+        ptl_iovec_t *src = &g->iov[g->index];
+        ptl_size_t bytes = src->iov_len - g->offset;
+
+        if (bytes > left)
+            bytes = left;
+
+        if (bytes) {
+            iov[n].iov_base = g->mr_list ?
+                addr_to_ppe(src->iov_base + g->offset,
+                            g->mr_list[g->index]) :
+                src->iov_base + g->offset;
+            iov[n].iov_len = bytes;
+            n++;
+        }
+
+        g->offset += bytes;
+        left -= bytes;
+
+        if (g->offset == src->iov_len) {
+            g->index++;
+            g->offset = 0;
+        }
+    }
+
+    *length -= left;
+
+    return n;
+}
+
+/* Move a cursor to some bytes past its start. */
+static void udp_gather_seek(struct udp_gather *g,
+                            const struct udp_gather *start,
+                            ptl_size_t length)
+{
+    ptl_size_t offset = start->offset + length;
+
+    *g = *start;
+    g->index += iov_seek(g->iov + start->index,
+                         g->iov_offsets ? g->iov_offsets + start->index :
+                         NULL, g->num_iov - start->index, &offset);
+    g->offset = offset;
+}
+
+/* Most sendmsg() calls queued at once, with io_uring. */
+#if WITH_UDP_URING
+#define UDP_SEND_BATCH URING_SEND_MAX
+#else
+#define UDP_SEND_BATCH 1
+#endif
+
+/**
+ * @brief Send the fragments of a large message.
+ *
+ * Each fragment is a datagram holding the headers of the message and
+ * a piece of its data. When the interface has UDP_SEGMENT, up to
+ * UDP_GSO_SEGS fragments of its MTU are handed to the kernel in one
+ * message, otherwise each fragment is as large as a datagram can be.
+ * With io_uring, up to UDP_SEND_BATCH messages are submitted at once.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf
+ * @param[in] dest the destination
+ * @param[in,out] g the cursor over the data
+ * @param[in] wire the headers
+ * @param[in] wire_len the length of the headers
+ * @param[in] max_size the largest datagram without UDP_SEGMENT
+ *
+ * @return 0, or -1 with errno set
+ */
+static int udp_send_frags(ni_t *ni, buf_t *buf, struct sockaddr_in *dest,
+                          struct udp_gather *g, unsigned char *wire,
+                          unsigned int wire_len, unsigned int max_size)
+{
+    iface_t *iface = ni->iface;
+    const struct udp_gather start = *g;
+    unsigned int seg_size = max_size;
+    int max_segs = 1;
+    int max_msgs = 1;
+    int zc = 0;
+    unsigned char *hdrs = NULL;
+    /* Keeps every copy of the headers aligned for struct udp_hdr. */
+    const unsigned int hdr_stride = (wire_len + 7) & ~7;
+    ptl_size_t offset = 0;
+    unsigned int frag_seq = 0;
+    const uint8_t pair = ((struct udp_hdr *)wire)->stripe;
+    struct msghdr msgs[UDP_SEND_BATCH];
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } ctrl[UDP_SEND_BATCH];
+    /* Where each message starts, to resend from there. */
+    ptl_size_t msg_offset[UDP_SEND_BATCH];
+    unsigned int msg_seq[UDP_SEND_BATCH];
+    int n_iov;
+    int err = 0;
+
+#if WITH_UDP_URING
+    if (iface->udp.uring[0]) {
+        max_msgs = UDP_SEND_BATCH;
+        zc = iface->udp.zc;
+    }
+#endif
+
+#if UDP_OFFLOAD
+    /* Only worth it if the data is most of each datagram. */
+    if (iface->udp.gso_size > 2 * wire_len) {
+        seg_size = iface->udp.gso_size;
+        max_segs = UDP_MAX_PAYLOAD / seg_size;
+        if (max_segs > UDP_GSO_SEGS)
+            max_segs = UDP_GSO_SEGS;
+    }
+#endif
+
+    /* Each datagram in flight needs its own copy of the headers. */
+    if (max_msgs * max_segs > 1) {
+        hdrs = malloc(max_msgs * max_segs * hdr_stride);
+        if (!hdrs) {
+            seg_size = max_size;
+            max_segs = 1;
+            max_msgs = 1;
+        }
+    }
+
+    /* A datagram has its headers, then at most all the pieces. */
+    n_iov = max_msgs * max_segs * (1 + g->num_iov);
+    if (n_iov > IOV_MAX)
+        n_iov = IOV_MAX;
+
+    struct iovec iov[n_iov];
+
+    ptl_info("# of segments: %i \n",
+             (int)((buf->rlength + seg_size - wire_len - 1) /
+                   (seg_size - wire_len)));
+
+    while (offset < buf->rlength) {
+        ptl_size_t total = 0;
+        int nmsg = 0;
+        int nhdr = 0;
+        int n = 0;
+        int sent;
+
+        do {
+            struct msghdr *msg = &msgs[nmsg];
+            ptl_size_t batch = 0;
+            int nseg = 0;
+            int first = n;
+            /* Spread the fragments over the receive sockets. */
+            uint8_t stripe = pair + 1 + frag_seq;
+
+            msg_offset[nmsg] = offset + total;
+            msg_seq[nmsg] = frag_seq;
+
+            /* Every datagram of a message but the last is seg_size
+             * long. */
+            do {
+                struct udp_hdr *hdr = (struct udp_hdr *)
+                    (hdrs ? hdrs + nhdr++ * hdr_stride : wire);
+                ptl_size_t want = buf->rlength - offset - total - batch;
+                ptl_size_t len;
+
+                if (want > seg_size - wire_len)
+                    want = seg_size - wire_len;
+
+                if (hdrs)
+                    memcpy(hdr, wire, wire_len);
+                hdr->frag_seq = cpu_to_le16(frag_seq + nseg);
+                hdr->frag_offset = cpu_to_le32(offset + total + batch);
+                hdr->stripe = stripe;
+
+                iov[n].iov_base = hdr;
+                iov[n].iov_len = wire_len;
+                n++;
+
+                len = want;
+                n += udp_gather_frag(g, &iov[n], n_iov - n, &len);
+                if (!len) {
+                    WARN();
+                    ptl_error("large message data ends %lu bytes early\n",
+                              (unsigned long)(buf->rlength - offset -
+                                              total - batch));
+                    errno = EINVAL;
+                    err = -1;
+                    goto done;
+                }
+
+                batch += len;
+                nseg++;
+
+                if (len < want)
+                    break;
+            } while (nseg < max_segs &&
+                     offset + total + batch < buf->rlength &&
+                     n + 2 <= n_iov);
+
+            /* The last fragment delivers the message, so it goes
+             * through the socket of the pair to keep it ordered. All
+             * the datagrams of a UDP_SEGMENT send go to the socket
+             * picked for the first one. */
+            if (offset + total + batch >= buf->rlength) {
+                int i;
+
+                if (!hdrs)
+                    ((struct udp_hdr *)wire)->stripe = pair;
+                else
+                    for (i = nhdr - nseg; i < nhdr; i++)
+                        ((struct udp_hdr *)(hdrs + i * hdr_stride))->stripe =
+                            pair;
+            }
+
+            memset(msg, 0, sizeof(*msg));
+            msg->msg_name = (void *)dest;
+            msg->msg_namelen = sizeof(*dest);
+            msg->msg_iov = &iov[first];
+            msg->msg_iovlen = n - first;
+
+#if UDP_OFFLOAD
+            if (nseg > 1) {
+                struct cmsghdr *cm;
+
+                msg->msg_control = ctrl[nmsg].buf;
+                msg->msg_controllen = sizeof(ctrl[nmsg].buf);
+                cm = CMSG_FIRSTHDR(msg);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                *(uint16_t *)CMSG_DATA(cm) = seg_size;
+            }
+#endif
+
+            ptl_info("send segments #%i to #%i at offset %lu length %lu\n",
+                     frag_seq + 1, frag_seq + nseg,
+                     (unsigned long)(offset + total), (unsigned long)batch);
+
+            total += batch;
+            frag_seq += nseg;
+            nmsg++;
+        } while (nmsg < max_msgs && offset + total < buf->rlength &&
+                 n + 2 <= n_iov);
+
+#ifdef __APPLE__
+        //We can overrun the send buffer without a wait here
+        //due to Mac's having very small network buffers
+        if (offset)
+            usleep(50);
+#endif
+        sent = udp_sendmsgs(ni, buf, msgs, nmsg, zc);
+        if (sent < nmsg) {
+            /* EMSGSIZE: the datagram, or train, spans more pages
+             * than a zero copy send can pin, which is the case for
+             * the large datagrams sent without offload or over
+             * the loopback. */
+            if (zc && (errno == EINVAL || errno == EOPNOTSUPP ||
+                       errno == EMSGSIZE)) {
+                ptl_warn("SENDMSG_ZC failed: %s, disabling it\n",
+                         strerror(errno));
+#if WITH_UDP_URING
+                iface->udp.zc = 0;
+#endif
+                zc = 0;
+            } else if (msgs[sent].msg_controllen &&
+                       (errno == EIO || errno == EINVAL ||
+                        errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+                /* The route can't segment, e.g. no checksum
+                 * offload. Resend as plain datagrams. */
+                ptl_warn("UDP_SEGMENT failed: %s, disabling it\n",
+                         strerror(errno));
+                iface->udp.gso_size = 0;
+                seg_size = max_size;
+                max_segs = 1;
+            } else {
+                ptl_error
+                    ("error while sending multi segment message: %s\n remaining data: %lu \n",
+                     strerror(errno),
+                     (unsigned long)(buf->rlength - msg_offset[sent]));
+                err = -1;
+                goto done;
+            }
+
+            /* Start again from the first message not sent. */
+            offset = msg_offset[sent];
+            frag_seq = msg_seq[sent];
+            udp_gather_seek(g, &start, offset);
+            continue;
+        }
+
+        offset += total;
+    }
+
+  done:
+    free(hdrs);
+
+    return err;
+}
+
+/**
+ * @brief send a buf to a pid using UDP socket.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf
+ * @param[in] dest the destination socket info
+ */
+void udp_send(ni_t *ni, buf_t *buf, struct sockaddr_in *dest)
+{
+    int err;
+
+    const struct sockaddr_in target = *dest;
+
+    int MAX_UDP_MSG_SIZE = 1488;
+    uint32_t max_len_size;
+    max_len_size = sizeof(int);
+    getsockopt(ni->iface->udp.connect_s, SOL_SOCKET, SO_SNDBUF,
+               (int *)&MAX_UDP_MSG_SIZE, &max_len_size);
+    //65507 is the max IPv4 UDP message size (65536 - 8 byte UDP header - 20 byte IP header)
+    //Send buffers can sometimes exceed this size, so we need to cap the max packet size
+    if (MAX_UDP_MSG_SIZE > 65507)
+        MAX_UDP_MSG_SIZE = 65507;
+
+    ptl_info("max udp message size is: %i \n", MAX_UDP_MSG_SIZE);
+
+    //check for send to self, use local memory for transfer
+    if (((dest->sin_port == ni->id.phys.pid) &&
+         (dest->sin_addr.s_addr == nid_to_addr(ni->id.phys.nid)))) {
+        ptl_info("sending to self! \n");
+        if (buf->rlength <= UDP_BUF_SIZE) {
+            if (buf->transfer.udp.conn_msg.msg_type !=
+                le16_to_cpu(UDP_CONN_MSG_REP)) {
+                //the only multiple outstanding self sends that are valid are
+                //connection request replies and ACKS, otherwise, wait until the previous
+                //send has been received and processed
+                ack_hdr_t *hdr = (ack_hdr_t *) buf->data;
+                if (!
+                    (hdr->h1.operation == OP_ACK ||
+                     hdr->h1.operation == OP_CT_ACK ||
+                     hdr->h1.operation == OP_OC_ACK)) {
+                    while (atomic_read(&ni->udp.self_recv) > 0) {
+                        ptl_info("queuing for self send \n");
+                        sleep(1);
+                    }
+                }
+            }
+            buf->udp.src_addr = *dest;
+            ni->udp.self_recv_addr = buf;
+            ni->udp.self_recv_len = UDP_BUF_SIZE;
+            ptl_info("self ref addr is: %p \n", ni->udp.self_recv_addr);
+            atomic_inc(&ni->udp.self_recv);
+            return;
         } else {
-            //if not, copy just the data in the 2 element iovec
-            ptl_info("not an iovec \n");
-            memcpy(buf_data, buf_msg_hdr.msg_iov[1].iov_base,
-                   (size_t) buf_msg_hdr.msg_iovlen);
-            buf_data_len = buf_msg_hdr.msg_iovlen;
-            thebuf->transfer.udp.my_iovec.iov_base =
-                buf_msg_hdr.msg_iov[1].iov_base;
-            thebuf->transfer.udp.my_iovec.iov_len =
-                buf_msg_hdr.msg_iov[1].iov_len;
+            ptl_warn("large message self sends not yet supported \n");
+            abort();
+        }
+
+    }
+
+    if (udp_can_pack(ni, buf) && udp_pack_add(ni, buf, dest))
+        return;
+
+    /* Don't overtake the messages already packed for dest. */
+    udp_pack_flush(ni, dest);
+
+    //the buf has data and is not a small message or an ack
+    //TODO: Adjust this to the actual data size available in the buf_t immediate data
+    if (buf->rlength > UDP_BUF_SIZE) {
+        //this means that we have a message that is too large for an immediate send
+        //we must send it in fragments upto the maximum UDP message size (64KB),
+        //each one gathered directly from the MD or ME
+        unsigned char wire[UDP_HDR_MAX] __attribute__ ((aligned(8)));
+        unsigned int wire_len;
+        struct udp_gather g;
+
+        ptl_info("starting large message send \n");
+
+        udp_gather_init(buf, &g);
+
+        buf->udp.src_addr = target;
+        ptl_info("set buf target to: %s:%d \n", inet_ntoa(target.sin_addr),
+                 ntohs(target.sin_port));
+
+        //the headers are repeated in each fragment
+        wire_len = udp_wire_copy(buf, wire, UDP_HDR_FRAG);
+
+        /* Fragments give their offset in 32 bits. */
+        if (buf->rlength > UINT32_MAX) {
+            ptl_error("message of %lu bytes is too large for UDP\n",
+                      (unsigned long)buf->rlength);
+            err = -1;
+        } else {
+            err = udp_send_frags(ni, buf, dest, &g, wire, wire_len,
+                                 MAX_UDP_MSG_SIZE);
+        }
+
+    } else { // for immediate data, just send the message
+        struct udp_hdr hdr;
+        struct iovec iov[3];
+        struct msghdr msg_hdr = {
+            .msg_name = (void *)dest,
+            .msg_namelen = sizeof(*dest),
+            .msg_iov = iov,
+            .msg_iovlen = udp_wire_iov(buf, &hdr, iov, 0),
+        };
+
+        err = (udp_sendmsgs(ni, buf, &msg_hdr, 1, 0) == 1) ? 0 : -1;
+    }
+
+    if (err == -1) {
+        WARN();
+        ptl_error("error sending to: %s:%d \n", inet_ntoa(dest->sin_addr),
+                  ntohs(dest->sin_port));
+        ptl_error("error sending buffer to socket: %i %s \n",
+                  ni->iface->udp.connect_s, strerror(errno));
+        abort();
+        return;
+    }
+    ptl_info
+        ("UDP send completed successfully to: %s:%d from: %d size:%lu %i %i\n",
+         inet_ntoa(target.sin_addr), ntohs(target.sin_port),
+         ntohs(ni->iface->udp.sin.sin_port), UDP_BUF_SIZE, (int)buf->rlength,
+         err);
+
+}
+
+/**
+ * @brief Find the buf of the large message a fragment belongs to.
+ *
+ * The first fragment received of a message allocates it, along with
+ * a buffer for its data, and puts it on the outstanding transfers
+ * list. With several sockets, the fragments of the next message of a
+ * sender may come before the last ones of the previous message, so a
+ * message is known by its sender and the handle in its header.
+ *
+ * @param[in] ni the network interface
+ * @param[in] wire the headers of the fragment
+ * @param[in] wire_len their length
+ * @param[in] src the sender
+ *
+ * @return the buf, or NULL if out of memory or the message is larger
+ * than the NI allows
+ */
+static buf_t *udp_frag_buf(ni_t *ni, const unsigned char *wire,
+                           unsigned int wire_len,
+                           const struct sockaddr_in *src)
+{
+    const struct hdr_common *hdr =
+        udp_wire_msg((const struct udp_hdr *)wire);
+    buf_t *big_buf;
+    struct list_head *l;
+
+    //fetch the large message buffer from the outstanding transfers list
+    //THIS ASSUMES UDP IS RELIABLE, which it is not unless a reliability layer is present.
+    PTL_FASTLOCK_LOCK(&ni->udp_lock);
+
+    list_for_each(l, &ni->udp_list) {
+        big_buf = list_entry(l, buf_t, list);
+
+        if (big_buf->udp.src_addr.sin_port == src->sin_port &&
+            big_buf->udp.src_addr.sin_addr.s_addr == src->sin_addr.s_addr &&
+            ((struct hdr_common *)big_buf->internal_data)->handle ==
+            hdr->handle &&
+            ((struct hdr_common *)big_buf->internal_data)->operation ==
+            hdr->operation) {
+            PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
+            ptl_info("found a matching in-progress transfer \n");
+            return big_buf;
+        }
+    }
+
+    //this is a new incoming large message, so allocate one
+    big_buf = udp_wire_to_buf(wire, wire_len);
+    if (!big_buf) {
+        PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
+        WARN();
+        return NULL;
+    }
+
+    /* The data is allocated at once, and its length comes from the
+     * wire. */
+    if (big_buf->rlength > ni->limits.max_msg_size) {
+        PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
+        ptl_warn("dropping a message of %lu bytes from %s:%d\n",
+                 (unsigned long)big_buf->rlength, inet_ntoa(src->sin_addr),
+                 ntohs(src->sin_port));
+        free(big_buf);
+        return NULL;
+    }
+
+    big_buf->transfer.udp.data = malloc(big_buf->rlength);
+    if (!big_buf->transfer.udp.data) {
+        PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
+        WARN();
+        free(big_buf);
+        return NULL;
+    }
+
+    ptl_info
+        ("memory region starting at %p allocated for transfer reception \n",
+         big_buf->transfer.udp.data);
+
+    big_buf->udp.src_addr = *src;
+    big_buf->transfer.udp.my_iovec.iov_len = 0;
+    big_buf->transfer.udp.fragment_count = 0;
+
+    //add the buffer to the udp outstanding transfer list
+    INIT_LIST_HEAD(&big_buf->list);
+    list_add_tail(&big_buf->list, &ni->udp_list);
+
+    PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
+
+    return big_buf;
+}
+
+/* A large message with all its data. */
+buf_t *udp_frag_complete(buf_t *big_buf)
+{
+    ptl_info
+        ("transfer complete in %i segments, removing buffer from active transfers list \n",
+         (int)big_buf->transfer.udp.fragment_count);
+
+    big_buf->transfer.udp.my_iovec.iov_base = big_buf->transfer.udp.data;
+    big_buf->transfer.udp.my_iovec.iov_len = big_buf->rlength;
+    big_buf->recv_buf = big_buf;
+
+    return big_buf;
+}
+
+/**
+ * @brief Account for the data of a fragment.
+ *
+ * With a single socket, the message is complete with its last
+ * fragment received. With several, the last fragment sent goes
+ * through the socket of the message's stripe, and the message is
+ * only returned there, once the fragments striped to the other
+ * sockets are in too. Until then that queue waits for them.
+ *
+ * @param[in] ni the network interface
+ * @param[in] rxq the receive queue of the fragment
+ * @param[in] big_buf the buf of the message
+ * @param[in] whdr the header of the fragment
+ * @param[in] len the length of its data
+ *
+ * @return the buf once the message is complete, NULL before
+ */
+static buf_t *udp_frag_done(ni_t *ni, struct udp_rxq *rxq, buf_t *big_buf,
+                            const struct udp_hdr *whdr, unsigned int len)
+{
+    int last = le32_to_cpu(whdr->frag_offset) + len >= big_buf->rlength;
+    int complete;
+
+    ptl_info("received segment #%i at offset %lu, size: %i\n",
+             le16_to_cpu(whdr->frag_seq) + 1,
+             (unsigned long)le32_to_cpu(whdr->frag_offset), len);
+
+    PTL_FASTLOCK_LOCK(&ni->udp_lock);
+
+    big_buf->transfer.udp.my_iovec.iov_len += len;
+    big_buf->transfer.udp.fragment_count++;
+
+    complete = big_buf->transfer.udp.my_iovec.iov_len >= big_buf->rlength;
+    if (complete)
+        list_del(&big_buf->list);
+
+    PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
+
+    if (ni->iface->udp.num_s > 1) {
+        if (!last)
+            return NULL;
+
+        if (!complete) {
+            ptl_info("last segment received, waiting for the others\n");
+            rxq->wait = big_buf;
+            return NULL;
+        }
+    } else if (!complete) {
+        //check to see if the transfer is complete
+        //if it is not, return nothing as we are still in progress
+        ptl_info("transfer not complete, wait for more incoming datagrams \n");
+        return NULL;
+    }
+
+    return udp_frag_complete(big_buf);
+}
+
+/**
+ * @brief Check on the message a receive queue waits for.
+ *
+ * @param[in] ni the network interface
+ * @param[in] rxq the receive queue
+ *
+ * @return the message once complete, NULL before
+ */
+static buf_t *udp_frag_wait(ni_t *ni, struct udp_rxq *rxq)
+{
+    buf_t *big_buf = rxq->wait;
+    int complete;
+
+    PTL_FASTLOCK_LOCK(&ni->udp_lock);
+    complete = big_buf->transfer.udp.my_iovec.iov_len >= big_buf->rlength;
+    PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
+
+    if (!complete)
+        return NULL;
+
+    rxq->wait = NULL;
+
+    return udp_frag_complete(big_buf);
+}
+
+/**
+ * @brief Whether a queue waiting for striped fragments may take a
+ * datagram.
+ *
+ * Only fragments that don't end their message can be taken before
+ * the message waited for.
+ *
+ * @param[in] whdr the header of the datagram
+ * @param[in] wire_len the length of its headers
+ * @param[in] len its length
+ *
+ * @return non zero if it can
+ */
+static int udp_frag_can_wait(const struct udp_hdr *whdr,
+                             unsigned int wire_len, unsigned int len)
+{
+    return (whdr->flags & UDP_HDR_FRAG) &&
+        le32_to_cpu(whdr->frag_offset) + len - wire_len <
+        le64_to_cpu(whdr->rlength);
+}
+
+/**
+ * @brief Check whether a received message is meant for an NI.
+ *
+ * NIs of the same interface share its socket.
+ *
+ * @param[in] ni the network interface
+ * @param[in] hdr the header of the message
+ *
+ * @return non zero if it is
+ */
+int udp_for_ni(ni_t *ni, const req_hdr_t *hdr)
+{
+    return !(((hdr->h1.physical == 0) && (!!(ni->options & PTL_NI_PHYSICAL))) ||
+             ((hdr->h1.physical == 1) && (!!(ni->options & PTL_NI_LOGICAL))) ||
+             (hdr->h1.ni_type != ni->ni_type));
+}
+
+#if UDP_OFFLOAD || WITH_UDP_URING
+/**
+ * @brief Get the message in a datagram of the last GRO train.
+ *
+ * @param[in] ni the network interface
+ * @param[in] rxq the receive queue
+ * @param[in] dgram the datagram
+ * @param[in] len its length
+ * @param[in] src the sender
+ *
+ * @return a buf, or NULL if there is none yet
+ */
+static buf_t *udp_gro_dgram(ni_t *ni, struct udp_rxq *rxq,
+                            const unsigned char *dgram, unsigned int len,
+                            struct sockaddr_in *src)
+{
+    const struct udp_hdr *whdr = (const struct udp_hdr *)dgram;
+    unsigned int wire_len;
+    buf_t *big_buf;
+
+    wire_len = (len >= sizeof(*whdr)) ? udp_wire_len(whdr) : 0;
+    if (!wire_len || wire_len > len) {
+        WARN();
+        ptl_warn("dropping malformed datagram from %s:%d\n",
+                 inet_ntoa(src->sin_addr), ntohs(src->sin_port));
+        return NULL;
+    }
+
+    if (whdr->flags & UDP_HDR_PACKED) {
+        memcpy(rxq->unpack.data, dgram, len);
+        rxq->unpack.length = len;
+        rxq->unpack.offset = 0;
+        rxq->unpack.src = *src;
+        STATS_INC(ni, udp_unpacked_dgrams);
+
+        return udp_unpack(ni, rxq, src);
+    }
+
+    if (!(whdr->flags & UDP_HDR_FRAG))
+        return udp_wire_to_buf(dgram, len);
+
+    big_buf = udp_frag_buf(ni, dgram, wire_len, src);
+    if (!big_buf)
+        return NULL;
+
+    if (le32_to_cpu(whdr->frag_offset) + len - wire_len > big_buf->rlength) {
+        WARN();
+        ptl_warn("dropping fragment past the end of a message from %s:%d\n",
+                 inet_ntoa(src->sin_addr), ntohs(src->sin_port));
+        return NULL;
+    }
+
+    memcpy(big_buf->transfer.udp.data + le32_to_cpu(whdr->frag_offset),
+           dgram + wire_len, len - wire_len);
+
+    return udp_frag_done(ni, rxq, big_buf, whdr, len - wire_len);
+}
+
+/**
+ * @brief Get the message in the next datagram of the last GRO train.
+ *
+ * Each datagram is processed as if it had been received alone.
+ *
+ * @param[in] ni the network interface
+ * @param[in] rxq the receive queue
+ * @param[out] src the sender
+ *
+ * @return a buf, or NULL if there is none yet
+ */
+static buf_t *udp_gro_next(ni_t *ni, struct udp_rxq *rxq,
+                            struct sockaddr_in *src)
+{
+    const unsigned char *dgram = rxq->gro.train + rxq->gro.offset;
+    unsigned int len = rxq->gro.length - rxq->gro.offset;
+    buf_t *buf;
+
+    if (len > rxq->gro.seg)
+        len = rxq->gro.seg;
+    rxq->gro.offset += len;
+
+    *src = rxq->gro.src;
+
+    buf = udp_gro_dgram(ni, rxq, dgram, len, src);
+
+#if WITH_UDP_URING
+    /* Everything was copied out of the ring buffer. */
+    if (rxq->gro.bid != -1 && rxq->gro.offset >= rxq->gro.length) {
+        uring_recv_release(ni->iface->udp.uring[rxq->index], rxq->gro.bid);
+        rxq->gro.bid = -1;
+    }
+#endif
+
+    return buf;
+}
+#endif
+
+#if UDP_OFFLOAD
+/**
+ * @brief Read a train of datagrams coalesced by UDP_GRO.
+ *
+ * @param[in] ni the network interface
+ * @param[in] rxq the receive queue
+ * @param[in] len the length of the train
+ * @param[in] seg the length of its datagrams, but the last
+ * @param[out] src the sender
+ *
+ * @return the message in the first datagram, or NULL
+ */
+static buf_t *udp_gro_recv(ni_t *ni, struct udp_rxq *rxq, unsigned int len,
+                           unsigned int seg, struct sockaddr_in *src)
+{
+    int s = ni->iface->udp.s[rxq->index];
+    socklen_t lensin = sizeof(*src);
+    int err;
+
+    if (len > rxq->gro.size) {
+        unsigned char *data = realloc(rxq->gro.data, len);
+
+        if (!data) {
+            /* Drop it. */
+            recv(s, NULL, 0, 0);
+            WARN();
+            return NULL;
         }
 
-        thebuf->transfer.udp.data = (unsigned char *)buf_data;
-
-        temp_sin = *(struct sockaddr_in *)buf_msg_hdr.msg_name;
-        lensin = buf_msg_hdr.msg_namelen;
-
-        int MAX_UDP_RECV_SIZE = 1488;
-        uint32_t max_recv_size;
-        max_recv_size = sizeof(int);
-        getsockopt(ni->iface->udp.connect_s, SOL_SOCKET, SO_SNDBUF,
-                   (int *)&MAX_UDP_RECV_SIZE, &max_recv_size);
-        if (MAX_UDP_RECV_SIZE > 65507)
-            MAX_UDP_RECV_SIZE = 65507;
-
-        if ((thebuf->rlength + sizeof(buf_t)) > MAX_UDP_RECV_SIZE) {
-            //this message is large enough to span multiple UDP messages, so we need to fetch them all
-            //first message will be the portals buf, and data upto 64K
-            //subsequent messages need to be added to the received data buffer as extra data
-            //there is no finalization footer etc.
-            //THIS ASSUMES UDP IS RELIABLE AND IN-ORDER, which it is not unless a reliability layer is present.
-            //this also assumes that there is not data incoming from multiple sources on this socket/port           
-            ptl_warn
-                ("Message size exceeds that of a single datagram, this operational mode is not recommended \n");
-
-            ptl_info("ni->iface is %p \n", ni->iface);
-
-            buf_t *big_buf;
-
-            //create or fetch a large message buffer from a linked list
-            int found_one = 0;
-            struct list_head *l, *t;
-
-            list_for_each_safe(l, t, &ni->udp_list) {
-                big_buf = list_entry(l, buf_t, list);
-                ptl_info("list buf @%p \n", big_buf);
-                ptl_info
-                    ("compare in progress list item to present transfer %p %i %s:%i\n",
-                     ni->iface, ni->iface->id.phys.pid,
-                     inet_ntoa(big_buf->udp.src_addr.sin_addr),
-                     ntohs(big_buf->udp.src_addr.sin_port));
-                //We only need to check the pid
-                if (ntohs(thebuf->udp.src_addr.sin_port) ==
-                    ntohs(big_buf->udp.src_addr.sin_port)) {
-                    //ptl_info("found match for system, checking logical NI \n");
-                    //found a matching buf, check to see if addressing mode is correct
-                    if ((((!!(ni->options & PTL_NI_LOGICAL)) &&
-                         (hdr->h1.physical == 0)) ||
-                        ((!!(ni->options & PTL_NI_PHYSICAL)) &&
-                         (hdr->h1.physical == 1))) &&
-                        (hdr->h1.ni_type == ni->ni_type)) {
-                            //this is an exact match
-                            found_one = 1;
-                            ptl_info("found a matching in-progress transfer \n");
-                            break;
-                            
-                    }
-                }
+        rxq->gro.data = data;
+        rxq->gro.size = len;
+    }
 
-            }
-            //if a buffer didn't already exist, this is a new incoming
-            //large message, so allocate one
-            if (found_one != 1) {
-                //size is 16MB because we have 8 bits available for number of 64K packets
-                //this is completely arbitrary, and could be adjusted up or down
-                ptl_info
-                    ("not an oustanding transfer, allocate a new buffer \n");
-                //copy the buf over to the first iovec
-                big_buf = calloc(1, sizeof(buf_t));
-                memcpy(big_buf, buf_msg_hdr.msg_iov[0].iov_base,
-                       sizeof(buf_t));
-                //set the 16MB buffer
-                big_buf->transfer.udp.data = calloc(1, 65536 << 8);
-                ptl_info
-                    ("memory region starting at %p allocated for transfer reception \n",
-                     big_buf->transfer.udp.data);
-                ptl_info("destination pid is: %s:%d \n",
-                         inet_ntoa(big_buf->udp.src_addr.sin_addr),
-                         ntohs(big_buf->udp.src_addr.sin_port));
-                big_buf->transfer.udp.my_iovec.iov_len = 0;
-                ptl_info("adding buffer @%p to the list \n", big_buf);
-                //add the buffer to the udp outstanding transfer list
-                INIT_LIST_HEAD(&big_buf->list);
-                list_add_tail(&big_buf->list, &ni->udp_list);
-                big_buf->transfer.udp.fragment_count = 0;
-                big_buf->transfer.udp.cur_iov_copy_loc = 0;
-            }
+    err = recvfrom(s, rxq->gro.data, len, 0,
+                   (struct sockaddr *)src, &lensin);
+    if (err == -1) {
+        if (errno != EAGAIN) {
+            WARN();
+            ptl_warn("error receiving datagram train: %s\n", strerror(errno));
+        }
+        return NULL;
+    }
 
-            ptl_info("copy data to big receive buffer for segment #%i\n",
-                     hdr->fragment_seq);
-            //Copy the incoming data to the big buffer's data region
-            //In the correct section for its sequence number
-            //so we don't have to worry about out of order segments, this is handled here
-            ptl_info("copying to location: %p \n",
-                     big_buf->transfer.udp.data +
-                     ((MAX_UDP_RECV_SIZE -
-                       sizeof(buf_t)) * hdr->fragment_seq));
-
-            if (big_buf->transfer.udp.is_iovec) {
-                if ((big_buf->put_md != NULL) || big_buf->get_md != NULL) {
-                    if (big_buf->put_md != NULL) {
-                        if (big_buf->put_md->options) {
-                            if (big_buf->put_md->options & PTL_IOVEC) {
-                                ptl_warn("IO vec put transfer %i \n",
-                                         (int)big_buf->rlength);
-                                recv_md = big_buf->put_md;
-                            }
-                        }
-                    }
-                } else {
-                    if (big_buf->get_md->options) {
-                        if (big_buf->get_md->options & PTL_IOVEC) {
-                            ptl_info("IO vec get transfer %i \n",
-                                     (int)big_buf->rlength);
-                            recv_md = big_buf->get_md;
-                        }
-                    }
-                }
-            } else {
-                ptl_info("Not a iovec recv \n");
-                recv_md = NULL;
-            }
+    ptl_info("received a train of %u datagrams of %u bytes\n",
+             (err + seg - 1) / seg, seg);
 
-            memcpy((big_buf->transfer.udp.data +
-                    (((MAX_UDP_RECV_SIZE -
-                       sizeof(buf_t)) * hdr->fragment_seq))),
-                   buf_msg_hdr.msg_iov[1].iov_base, current_message_size);
-
-            ptl_info("segment size was data:%i max data size:%lu \n",
-                     current_message_size, MAX_UDP_RECV_SIZE - sizeof(buf_t));
-            big_buf->transfer.udp.my_iovec.iov_len += current_message_size;
-
-            //increment the fragment counter and check to see if it equals the total
-            big_buf->transfer.udp.fragment_count++;
-            ptl_info("have #%i segments of #%i size: %i\n",
-                     (int)big_buf->transfer.udp.fragment_count,
-                     (int)((thebuf->rlength /
-                            (MAX_UDP_RECV_SIZE - sizeof(buf_t))) + 1),
-                     (int)thebuf->rlength);
-            //check to see if the transfer is complete
-            if (big_buf->transfer.udp.fragment_count ==
-                ((thebuf->rlength / (MAX_UDP_RECV_SIZE - sizeof(buf_t))) +
-                 1)) {
-                //we're done the transfer
-                ptl_info
-                    ("transfer complete length: %i, removing buffer from active transfers list \n",
-                     (int)big_buf->transfer.udp.my_iovec.iov_len);
-
-                ptl_info("data at end (%p) is: %llu \n",
-                         (big_buf->transfer.udp.data + big_buf->rlength),
-                         *(long long unsigned int *)(big_buf->transfer.
-                                                     udp.data +
-                                                     (current_message_size)));
-
-                if (!(list_empty(&ni->udp_list))) {
-                    list_del(l);
-                }
-                big_buf->transfer.udp.my_iovec.iov_base =
-                    big_buf->transfer.udp.data;
-                big_buf->transfer.udp.my_iovec.iov_len = thebuf->rlength;
-                thebuf = big_buf;
-                thebuf->recv_buf = big_buf;
+    rxq->gro.train = rxq->gro.data;
+    rxq->gro.length = err;
+    rxq->gro.offset = 0;
+    rxq->gro.seg = seg;
+    rxq->gro.src = *src;
+
+    return udp_gro_next(ni, rxq, src);
+}
+#endif
+
+/**
+ * @brief Count a datagram that the kernel steered through another
+ * socket than its stripe picks, see udp_steer_init().
+ *
+ * @param[in] ni the network interface
+ * @param[in] rxq the receive queue it came through
+ * @param[in] whdr its UDP header
+ */
+static inline void udp_check_steer(ni_t *ni, struct udp_rxq *rxq,
+                                   const struct udp_hdr *whdr)
+{
+    int num_s = ni->iface->udp.num_s;
+
+    if (num_s > 1 && whdr->stripe % num_s != rxq->index)
+        __sync_fetch_and_add(&udp_missteered, 1);
+}
+
+/**
+ * @brief receive a buf using a UDP socket.
+ *
+ * @param[in] ni the network interface.
+ * @param[in] rxq the receive queue of the socket.
+ */
+buf_t *udp_receive(ni_t *ni, struct udp_rxq *rxq)
+{
+
+    int s = ni->iface->udp.s[rxq->index];
+    int err;
+    struct sockaddr_in temp_sin;
+    socklen_t lensin = sizeof(temp_sin);
+    buf_t *thebuf;
+    req_hdr_t *hdr;
+    unsigned char wire[UDP_HDR_MAX] __attribute__ ((aligned(8)));
+    struct udp_hdr *whdr = (struct udp_hdr *)wire;
+    unsigned int wire_len;
+    unsigned int train_len = 0;
+    int seg = 0;
+
+    /* Finish the last packed datagram first. */
+    if (rxq->unpack.offset < rxq->unpack.length) {
+        thebuf = udp_unpack(ni, rxq, &temp_sin);
+        if (!thebuf)
+            return NULL;
+        hdr = (req_hdr_t *)thebuf->internal_data;
+        goto received;
+    }
+
+#if UDP_OFFLOAD || WITH_UDP_URING
+    /* Then the rest of the last GRO train. */
+    if (rxq->gro.offset < rxq->gro.length) {
+        thebuf = udp_gro_next(ni, rxq, &temp_sin);
+        if (!thebuf)
+            return NULL;
+        hdr = (req_hdr_t *)thebuf->internal_data;
+        goto received;
+    }
+#endif
+
+    /* Then the large message waiting for its striped fragments. */
+    if (rxq->wait) {
+        thebuf = udp_frag_wait(ni, rxq);
+        if (thebuf) {
+            hdr = (req_hdr_t *)thebuf->internal_data;
+            goto received;
+        }
+    }
+
+    if (rxq->index == 0 && atomic_read(&ni->udp.self_recv) >= 1) {
+        ptl_info("got a message from self %p \n", ni->udp.self_recv_addr);
+        thebuf = (buf_t *)ni->udp.self_recv_addr;
+        return thebuf;
+    }
+
+#if WITH_UDP_URING
+    if (ni->iface->udp.uring[rxq->index]) {
+        /* Received by the kernel in a ring buffer, which is read in
+         * place as a train of datagrams. */
+        struct uring *u = ni->iface->udp.uring[rxq->index];
+        const unsigned char *dgram;
+        unsigned int len, dgram_seg;
+
+        dgram = uring_recv_peek(u, &len, &dgram_seg, &temp_sin);
+        if (!dgram)
+            return NULL;
+
+        /* Leave another NI's datagram, as the peek below does.
+         * Malformed ones are dropped by udp_gro_next(). */
+        whdr = (struct udp_hdr *)dgram;
+        wire_len = (len >= sizeof(*whdr)) ? udp_wire_len(whdr) : 0;
+        if (wire_len && wire_len <= len &&
+            !udp_for_ni(ni, udp_wire_msg(whdr))) {
+            uring_recv_leave(u);
+            usleep(20);
+            return NULL;
+        }
+
+        if (rxq->wait && !(wire_len && wire_len <= len &&
+                           udp_frag_can_wait(whdr, wire_len, len))) {
+            uring_recv_leave(u);
+            return NULL;
+        }
+
+        if (wire_len && wire_len <= len)
+            udp_check_steer(ni, rxq, whdr);
+
+        rxq->gro.bid = uring_recv_take(u);
+        rxq->gro.train = dgram;
+        rxq->gro.length = len;
+        rxq->gro.offset = 0;
+        rxq->gro.seg = dgram_seg;
+        rxq->gro.src = temp_sin;
+
+        thebuf = udp_gro_next(ni, rxq, &temp_sin);
+        if (!thebuf)
+            return NULL;
+        hdr = (req_hdr_t *)thebuf->internal_data;
+        goto received;
+    }
+#endif
+
+    //REG: we need to perform a quick message peek here to determine if it is a short or long message
+    // only the headers are peeked at, the data of a large message stays in the socket
+    // this peak is also used to determine if it is a multi-segment message
+#if UDP_OFFLOAD
+    if (ni->iface->udp.gro) {
+        /* Also learn whether the kernel coalesced a train of
+         * datagrams, and its whole length. */
+        union {
+            char buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } ctrl;
+        struct iovec iov = { wire, sizeof(wire) };
+        struct msghdr msg;
+        struct cmsghdr *cmsg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &temp_sin;
+        msg.msg_namelen = sizeof(temp_sin);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+
+        err = recvmsg(s, &msg, MSG_PEEK | MSG_TRUNC);
+        if (err != -1) {
+            for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+                 cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP &&
+                    cmsg->cmsg_type == UDP_GRO)
+                    memcpy(&seg, CMSG_DATA(cmsg), sizeof(seg));
             }
-            //if it does not, return nothing as we are still in progress
-            else {
-                ptl_info
-                    ("transfer not complete, wait for more incoming datagrams \n");
-                return NULL;
+            train_len = err;
+            if (err > sizeof(wire))
+                err = sizeof(wire);
+        }
+    } else
+#endif
+    {
+        err = recvfrom(s, wire, sizeof(wire), MSG_PEEK | MSG_TRUNC,
+                       (struct sockaddr *)&temp_sin, &lensin);
+        if (err != -1) {
+            train_len = err;
+            if (err > sizeof(wire))
+                err = sizeof(wire);
+        }
+    }
+
+    if (err == -1) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            // OK, nothing ready to fetch
+            return NULL;
+        } else {
+            // Error, recvfrom returned unexpected error
+            WARN();
+            ptl_warn("error when peeking at message: %s \n", strerror(errno));
+            return NULL;
+        }
+    }
+
+    wire_len = (err >= sizeof(*whdr)) ? udp_wire_len(whdr) : 0;
+    if (!wire_len || wire_len > err) {
+        /* Consume it. */
+        recv(s, wire, 0, 0);
+        WARN();
+        ptl_warn("dropping malformed datagram from %s:%d\n",
+                 inet_ntoa(temp_sin.sin_addr), ntohs(temp_sin.sin_port));
+        return NULL;
+    }
+
+    //first check to see if this is meant for this ni
+    hdr = (req_hdr_t *)udp_wire_msg(whdr);
+
+    ptl_info("QQQQQQQQQQQQQQ: ni_type of incoming message: %x and ni_type of %x\n",hdr->h1.ni_type,ni->ni_type);
+
+    if (!udp_for_ni(ni, hdr)) {
+            //this datagram is not meant for us
+            ptl_info("packet not meant for this NI, dropping \n");
+            //this time interval is just to back off, it is completely arbitrary
+            //although 20us is a reasonable approximation of the time to 
+            //fetch a recv through the kernel UDP networking stack
+            usleep(20);
+            return NULL;
+        
+    }
+
+    if (rxq->wait && !udp_frag_can_wait(whdr, wire_len, train_len)) {
+        /* Leave it until the message waited for is complete. */
+        return NULL;
+    }
+
+    udp_check_steer(ni, rxq, whdr);
+#if UDP_OFFLOAD
+    if (seg > 0 && train_len > (unsigned int)seg) {
+        /* Several datagrams coalesced by the kernel. */
+        thebuf = udp_gro_recv(ni, rxq, train_len, seg, &temp_sin);
+        if (!thebuf)
+            return NULL;
+        hdr = (req_hdr_t *)thebuf->internal_data;
+    } else
+#endif
+    if (whdr->flags & UDP_HDR_PACKED) {
+        /* Several small messages, read the whole datagram. */
+        err = recvfrom(s, rxq->unpack.data,
+                       UDP_MAX_PAYLOAD, 0, (struct sockaddr *)&temp_sin,
+                       &lensin);
+        if (err == -1) {
+            if (errno != EAGAIN) {
+                WARN();
+                ptl_warn("error receiving packed datagram: %s\n",
+                         strerror(errno));
             }
+            return NULL;
+        }
+
+        rxq->unpack.length = err;
+        rxq->unpack.offset = 0;
+        rxq->unpack.src = temp_sin;
+        STATS_INC(ni, udp_unpacked_dgrams);
+
+        thebuf = udp_unpack(ni, rxq, &temp_sin);
+        if (!thebuf)
+            return NULL;
+        hdr = (req_hdr_t *)thebuf->internal_data;
+    }
+    //we are going to be handling multiple messages, implemented through a recvmsg call
+    else if (whdr->flags & UDP_HDR_FRAG) {
+        //a fragment of a large message. After the headers, of the length seen
+        //by the peek, its data is received directly at its place in the message
+        ptl_size_t frag_offset = le32_to_cpu(whdr->frag_offset);
+        struct msghdr buf_msg_hdr;
+        struct iovec iov[2];
+        buf_t *big_buf;
+
+        ptl_info("peek indicates large message of size: %i\n",
+                 (int)le64_to_cpu(whdr->rlength));
+
+        big_buf = udp_frag_buf(ni, wire, wire_len, &temp_sin);
+        if (!big_buf) {
+            recv(s, wire, 0, 0);
+            return NULL;
+        }
+
+        if (frag_offset >= big_buf->rlength) {
+            recv(s, wire, 0, 0);
+            WARN();
+            ptl_warn("dropping fragment past the end of a message from %s:%d\n",
+                     inet_ntoa(temp_sin.sin_addr), ntohs(temp_sin.sin_port));
+            return NULL;
+        }
+
+        iov[0].iov_base = wire;
+        iov[0].iov_len = wire_len;
+        iov[1].iov_base = big_buf->transfer.udp.data + frag_offset;
+        iov[1].iov_len = big_buf->rlength - frag_offset;
+
+        memset(&buf_msg_hdr, 0, sizeof(buf_msg_hdr));
+        buf_msg_hdr.msg_name = &temp_sin;
+        buf_msg_hdr.msg_namelen = sizeof(temp_sin);
+        buf_msg_hdr.msg_iov = iov;
+        buf_msg_hdr.msg_iovlen = 2;
+
+        err = recvmsg(s, &buf_msg_hdr, 0);
+        if (err == -1) {
+            WARN();
+            ptl_warn("error receiving main buffer from socket: %d %s\n",
+                     s, strerror(errno));
+            abort();
+            return NULL;
+
         }
+
+        thebuf = udp_frag_done(ni, rxq, big_buf, whdr, err - wire_len);
+        if (!thebuf)
+            return NULL;
+        hdr = (req_hdr_t *)thebuf->internal_data;
     } else {
         //this is a small transfer with immediate data, fetch it.
         err =
-            ptl_recvfrom(ni->iface->udp.connect_s, thebuf, sizeof(*thebuf), 0,
-                         (struct sockaddr *)&temp_sin, &lensin, ni);
+            recvfrom(s, wire, sizeof(wire), 0,
+                     (struct sockaddr *)&temp_sin, &lensin);
         if (err == -1) {
             if (errno != EAGAIN) {
-                free(thebuf);
                 WARN();
                 ptl_warn("error receiving main buffer from socket: %d %s\n",
-                         ni->iface->udp.connect_s, strerror(errno));
+                         s, strerror(errno));
                 return NULL;
 
             } else {
                 //Nothing to fetch
-                free(thebuf);
                 return NULL;
             }
         }
-        thebuf->transfer.udp.data = (unsigned char*)&thebuf->internal_data;
-        thebuf->transfer.udp.my_iovec.iov_len = thebuf->length;
+
+        thebuf = udp_wire_to_buf(wire, err);
+        if (!thebuf) {
+            WARN();
+            return NULL;
+        }
+        hdr = (req_hdr_t *)thebuf->internal_data;
     }
 
+#if WITH_RUDP
+    process_rudp_recv_hdr(thebuf, thebuf->length, ni);
+#endif
+
+  received:
+    return udp_received(ni, thebuf, &temp_sin);
+}
+
+/**
+ * @brief Finish a received buf, once its message and data are in.
+ *
+ * @param[in] ni the network interface
+ * @param[in] thebuf the buf
+ * @param[in] src the UDP address of the sender
+ *
+ * @return the buf
+ */
+buf_t *udp_received(ni_t *ni, buf_t *thebuf, const struct sockaddr_in *src)
+{
+    req_hdr_t *hdr = (req_hdr_t *)thebuf->internal_data;
+
     if (&thebuf->transfer.udp.conn_msg != NULL) {
         ptl_info("process received message type \n");
         struct udp_conn_msg *msg = &thebuf->transfer.udp.conn_msg;
@@ -1070,6 +2252,8 @@ buf_t *udp_receive(ni_t *ni)
         } else if (msg->msg_type == le16_to_cpu(UDP_CONN_MSG_REP)) {
             ptl_info("recieved a UDP connection reply \n");
             thebuf->type = BUF_UDP_CONN_REP;
+            /* The requester gave its connection in the request. */
+            thebuf->conn = (conn_t *)(uintptr_t)msg->req_cookie;
         } else {
             ptl_info("received a UDP data packet \n");
             thebuf->type = BUF_UDP_RECEIVE;
@@ -1085,58 +2269,14 @@ buf_t *udp_receive(ni_t *ni)
     }
 
     ptl_info
-        ("received data from %s:%i type:%i data size: %lu message size:%u %i \n",
-         inet_ntoa(temp_sin.sin_addr), ntohs(temp_sin.sin_port), thebuf->type,
-         sizeof(*(thebuf->data)), (int)thebuf->rlength, err);
+        ("received data from %s:%i type:%i data size: %lu message size:%u\n",
+         inet_ntoa(src->sin_addr), ntohs(src->sin_port), thebuf->type,
+         sizeof(*(thebuf->data)), (int)thebuf->rlength);
 
-    thebuf->udp.src_addr = temp_sin;
+    thebuf->udp.src_addr = *src;
     return (buf_t *)thebuf;
 }
 
-/* change the state of conn; we are now connected (UO & REB) */
-void PtlSetMap_udp(ni_t *ni, ptl_size_t map_size,
-                   const ptl_process_t *mapping)
-{
-    int i;
-
-    ptl_info("Creating a connection for PTlSetMapn");
-    for (i = 0; i < map_size; i++) {
-#if WITH_TRANSPORT_SHMEM
-        if (mapping[i].phys.nid != ni->iface->id.phys.nid) {
-#endif
-            conn_t *conn;
-
-            ptl_process_t id;
-            id.rank = i;
-
-            conn = get_conn(ni, id);
-            if (!conn) {
-                /* It's hard to recover from here. */
-                WARN();
-                abort();
-                return;
-            };
-
-            if (conn->transport.type == CONN_TYPE_UDP)
-                conn->transport = transport_udp;
-
-            conn->udp.dest_addr.sin_addr.s_addr =
-                nid_to_addr(mapping[i].phys.nid);
-            conn->udp.dest_addr.sin_port = pid_to_port(mapping[i].phys.pid);
-            ptl_info("setmap connection: %s:%i rank: %i\n",
-                     inet_ntoa(conn->udp.dest_addr.sin_addr),
-                     htons(conn->udp.dest_addr.sin_port), id.rank);
-
-            //We are not connected until we've exchanged messages
-            conn_put(conn);            /* from get_conn */
-
-        }
-        ptl_info("Done creating connection for PtlSetMap\n");
-#if WITH_TRANSPORT_SHMEM
-    }                                  //end the check for offnode connections
-#endif
-}
-
 /**
  * @param[in] ni
  * @param[in] conn
@@ -1150,7 +2290,7 @@ static int init_connect_udp(ni_t *ni, conn_t *conn)
     int ret;
 
     /* Create a buffer for sending the connection request message */
-    buf_t *conn_buf = (buf_t *)calloc(1, sizeof(buf_t));
+    buf_t *conn_buf = (buf_t *)calloc(1, UDP_BUF_SIZE);
     conn_buf->type = BUF_UDP_CONN_REQ;
 
     /* Send the connect request. */
@@ -1166,7 +2306,7 @@ static int init_connect_udp(ni_t *ni, conn_t *conn)
     hdr = (struct req_hdr *)&conn_buf->internal_data;
     conn_buf->data = (void *)&conn_buf->internal_data;
 
-    ((struct hdr_common *)hdr)->version = PTL_HDR_VER_1;
+    ((struct hdr_common *)hdr)->version = PTL_HDR_VER_2;
 
     hdr->h1.src_nid = cpu_to_le32(ni->id.phys.nid);
     hdr->h1.src_pid = cpu_to_le32(ni->id.phys.pid);
@@ -1176,7 +2316,7 @@ static int init_connect_udp(ni_t *ni, conn_t *conn)
     hdr->h1.ni_type = ni->ni_type;
 
     conn_buf->transfer.udp.conn_msg = msg;
-    conn_buf->length = (sizeof(buf_t));
+    conn_buf->length = sizeof(struct req_hdr);
     conn_buf->conn = conn;
     conn_buf->udp.dest_addr = &conn->sin;
 
@@ -1207,13 +2347,20 @@ static int init_connect_udp(ni_t *ni, conn_t *conn)
     }
 
     ptl_info("to send msg size: %lu in UDP message size: %lu\n", sizeof(msg),
-             sizeof(buf_t));
+             sizeof(struct udp_hdr) + sizeof(msg) + conn_buf->length);
 
     /* Send the request to the listening socket on the remote node. */
-    /* This does not send just the msg, but a buf to maintain compatibility with the progression thread */
-    ret =
-        ptl_sendto(ni->iface->udp.connect_s, conn_buf, conn_buf->length, 0,
-                   (struct sockaddr *)&conn->sin, sizeof(conn->sin), ni);
+    /* The header is sent with the msg, for the receiver to check the NI */
+    struct udp_hdr udp_hdr;
+    struct iovec iov[3];
+    struct msghdr msg_hdr = {
+        .msg_name = &conn->sin,
+        .msg_namelen = sizeof(conn->sin),
+        .msg_iov = iov,
+        .msg_iovlen = udp_wire_iov(conn_buf, &udp_hdr, iov, 0),
+    };
+
+    ret = ptl_sendmsg(ni->iface->udp.connect_s, &msg_hdr, 0, conn_buf, ni);
     if (ret == -1) {
         WARN();
         return PTL_FAIL;
@@ -1240,6 +2387,19 @@ struct transport transport_udp = {
     .tgt_data_out = udp_tgt_data_out,
 };
 
+/* The same, with a TCP stream to each peer in place of datagrams.
+ * See ptl_tcp.c. */
+struct transport transport_tcp = {
+    .type = CONN_TYPE_UDP,
+    .buf_alloc = buf_alloc,
+    .init_connect = init_connect_tcp,
+    .send_message = send_message_tcp,
+    .set_send_flags = udp_set_send_flags,
+    .init_prepare_transfer = init_prepare_transfer_udp,
+    .post_tgt_dma = do_udp_transfer,
+    .tgt_data_out = udp_tgt_data_out,
+};
+
 struct transport_ops transport_remote_udp = {
     .init_iface = init_iface_udp,
     .NIInit = PtlNIInit_UDP,
@@ -0,0 +1,59 @@
+/**
+ * @file ptl_udp_steer.c
+ *
+ * @brief Steering of UDP datagrams to the receive sockets of an
+ * interface.
+ *
+ * Kept apart from ptl_loc.h: <linux/filter.h> pulls <linux/types.h>,
+ * which conflicts with ptl_byteorder.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include "ptl_log.h"
+
+/**
+ * @brief Have the kernel pick the receive socket of a datagram
+ * from its stripe.
+ *
+ * The sockets of a SO_REUSEPORT group are numbered in the order
+ * they were bound. A classic BPF program loads the stripe byte of
+ * the udp_hdr starting the datagram and returns it modulo the
+ * number of sockets.
+ *
+ * @param[in] s the first socket of the group
+ * @param[in] num_s the number of sockets in the group
+ * @param[in] stripe_offset the offset of the stripe in a udp_hdr,
+ * which can't be seen from here
+ *
+ * @return 0 on success, -1 on error
+ */
+int udp_steer_init(int s, int num_s, unsigned int stripe_offset)
+{
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_B | BPF_ABS, 0, 0, stripe_offset},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, num_s},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    struct sock_fprog prog = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code,
+    };
+
+    if (setsockopt(s, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                   sizeof(prog)) == -1) {
+        ptl_warn("SO_ATTACH_REUSEPORT_CBPF failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
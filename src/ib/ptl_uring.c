@@ -0,0 +1,721 @@
+/**
+ * @file ptl_uring.c
+ *
+ * @brief io_uring engine of the UDP transport.
+ *
+ * There is one ring per interface socket. A multishot recvmsg stays
+ * armed on the socket, and the kernel writes each datagram, or GRO
+ * train, into a buffer it takes from a registered buffer ring, so
+ * receiving costs no system call while traffic flows. Sends are
+ * queued as linked SENDMSG entries and submitted together with a
+ * single io_uring_enter(), or none at all when a kernel thread polls
+ * the submission queue (PTL_UDP_URING_SQPOLL).
+ *
+ * The NIs of an interface share its socket, hence its ring, which is
+ * protected by a lock. As with MSG_PEEK on the socket, udp_receive()
+ * looks at the oldest datagram received and leaves it in place if it
+ * belongs to another NI.
+ *
+ * Only the kernel interface is used, there is no dependency on
+ * liburing.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "ptl_log.h"
+#include "ptl_locks.h"
+#include "ptl_param.h"
+#include "ptl_uring.h"
+
+/* Entries in the submission queue; the completion queue has 4 times
+ * as many. */
+#define URING_ENTRIES 256
+
+/* Receive buffers, a power of 2. */
+#define URING_BUFS 64
+
+#define URING_BGID 0
+
+/* A receive buffer holds the recvmsg header, the source address, a
+ * UDP_GRO control message and the largest datagram or GRO train. */
+#define URING_BUF_SIZE \
+    ((sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + \
+      CMSG_SPACE(sizeof(int)) + 65535 + 63) & ~63UL)
+
+/* user_data of the receive entry. A send carries the id of its
+ * struct uring_send times URING_SEND_MAX, plus its index in it. */
+#define URING_RECV_TAG 1
+
+struct uring {
+    PTL_FASTLOCK_TYPE lock;
+    int fd;
+    int s;                      /* the socket */
+    int sqpoll;
+
+    /* Submission queue. */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_flags;
+    unsigned int *sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail; /* entries queued, maybe not published */
+    unsigned int sq_submitted;  /* entries taken by the kernel */
+    struct io_uring_sqe *sqes;
+
+    /* Completion queue. */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    /* Receive buffers. */
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    unsigned short br_tail;
+    unsigned char *bufs;
+
+    /* Template of the multishot recvmsg. */
+    struct msghdr recv_msg;
+    int armed;
+
+    /* Buffers of the datagrams received, oldest first. */
+    unsigned short recv[URING_BUFS];
+    unsigned int recv_head;
+    unsigned int recv_tail;
+
+    /* Sends waiting for their completions. */
+    struct uring_send *sends;
+    uint64_t send_id;           /* of the next one */
+};
+
+/* A batch of sends, waiting for its completions. */
+struct uring_send {
+    unsigned int results;       /* entries yet to complete */
+    unsigned int more;          /* entries that will notify */
+    unsigned int notified;      /* entries that notified */
+    int done;                   /* messages sent before the first error */
+    int err;                    /* first error, as an errno */
+    uint64_t id;
+    struct uring_send *next;
+};
+
+static int sys_io_uring_setup(unsigned int entries,
+                              struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+                                 unsigned int nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Get a free submission entry. Called with the lock held. */
+static struct io_uring_sqe *uring_get_sqe(struct uring *u)
+{
+    unsigned int head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    unsigned int index;
+    struct io_uring_sqe *sqe;
+
+    if (u->sq_local_tail - head >= u->sq_entries)
+        return NULL;
+
+    index = u->sq_local_tail & u->sq_mask;
+    sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[index] = index;
+    u->sq_local_tail++;
+
+    return sqe;
+}
+
+/* Give a receive buffer back to the kernel. */
+static void uring_buf_add(struct uring *u, unsigned short bid)
+{
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail & (URING_BUFS - 1)];
+
+    b->addr = (uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE);
+    b->len = URING_BUF_SIZE;
+    b->bid = bid;
+
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+/* Queue the multishot receive. Called with the lock held. */
+static void uring_arm(struct uring *u)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+    if (!sqe)
+        return;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = u->s;
+    sqe->addr = (uintptr_t)&u->recv_msg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = URING_RECV_TAG;
+
+    u->armed = 1;
+}
+
+static void uring_recv_cqe(struct uring *u, const struct io_uring_cqe *cqe)
+{
+    /* Without F_MORE, the receive is no longer armed, for instance
+     * because it ran out of buffers. */
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        u->armed = 0;
+
+    if (cqe->res < 0) {
+        if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+            ptl_warn("io_uring receive failed: %s\n", strerror(-cqe->res));
+        return;
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_BUFFER))
+        return;
+
+    u->recv[u->recv_tail % URING_BUFS] =
+        cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    u->recv_tail++;
+}
+
+static void uring_send_cqe(struct uring_send *send,
+                           const struct io_uring_cqe *cqe)
+{
+    unsigned int bit = 1U << (cqe->user_data % URING_SEND_MAX);
+
+    /* The kernel is done with the data of a zero copy send. Those
+     * cancelled by a failure in their chain may notify too, though
+     * they didn't say so, and need not be waited for. */
+    if (cqe->flags & IORING_CQE_F_NOTIF) {
+        send->notified |= bit;
+        return;
+    }
+
+    /* A zero copy send will also notify. */
+    if (cqe->flags & IORING_CQE_F_MORE)
+        send->more |= bit;
+
+    send->results &= ~bit;
+
+    /* Linked entries complete in order, and the ones after a failure
+     * are cancelled. */
+    if (cqe->res < 0) {
+        if (!send->err)
+            send->err = -cqe->res;
+    } else if (!send->err) {
+        send->done++;
+    }
+}
+
+/* Find the send a completion is for. A zero copy send cancelled by
+ * a failure in its chain may still notify once the call that queued
+ * it has returned, so there can be none. */
+static struct uring_send *uring_send_find(struct uring *u, uint64_t id)
+{
+    struct uring_send *send;
+
+    for (send = u->sends; send; send = send->next)
+        if (send->id == id)
+            return send;
+
+    return NULL;
+}
+
+/* Process the completions. Called with the lock held. */
+static void uring_reap(struct uring *u)
+{
+    unsigned int head = *u->cq_head;
+    unsigned int tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    /* Completions that didn't fit are flushed by entering. */
+    if (__atomic_load_n(u->sq_flags, __ATOMIC_RELAXED) &
+        IORING_SQ_CQ_OVERFLOW)
+        sys_io_uring_enter(u->fd, 0, 0, IORING_ENTER_GETEVENTS);
+
+    while (head != tail) {
+        const struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+
+        if (cqe->user_data == URING_RECV_TAG) {
+            uring_recv_cqe(u, cqe);
+        } else {
+            struct uring_send *send =
+                uring_send_find(u, cqe->user_data / URING_SEND_MAX);
+
+            if (send)
+                uring_send_cqe(send, cqe);
+        }
+
+        head++;
+        if (head == tail)
+            tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Hand the queued entries to the kernel. Called with the lock
+ * held. On failure, the entries not taken are dropped, and errno
+ * is set. */
+static int uring_submit(struct uring *u)
+{
+    unsigned int n;
+    int ret;
+
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+
+    if (u->sqpoll) {
+        u->sq_submitted = u->sq_local_tail;
+
+        /* Only wake up the polling thread if it went to sleep. */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(u->sq_flags, __ATOMIC_RELAXED) &
+            IORING_SQ_NEED_WAKEUP)
+            sys_io_uring_enter(u->fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+        return 0;
+    }
+
+    n = u->sq_local_tail - u->sq_submitted;
+    while (n) {
+        ret = sys_io_uring_enter(u->fd, n, 0, 0);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+
+            /* The completion queue is full. */
+            if (errno == EAGAIN || errno == EBUSY) {
+                uring_reap(u);
+                continue;
+            }
+
+            ret = errno;
+            WARN();
+            ptl_warn("io_uring submission failed: %s\n", strerror(ret));
+
+            /* Take back the entries the kernel didn't take, so
+             * that the next caller doesn't submit them. */
+            u->sq_local_tail = u->sq_submitted;
+            __atomic_store_n(u->sq_tail, u->sq_local_tail,
+                             __ATOMIC_RELEASE);
+
+            errno = ret;
+            return -1;
+        }
+
+        u->sq_submitted += ret;
+        n -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Release a ring.
+ *
+ * @param[in] u the ring
+ */
+void uring_fini(struct uring *u)
+{
+    if (!u)
+        return;
+
+    /* Closing the ring cancels the receive. */
+    if (u->fd != -1)
+        close(u->fd);
+
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring)
+        munmap(u->sq_ring, u->sq_ring_size);
+    if (u->br)
+        munmap(u->br, u->br_size);
+    if (u->bufs)
+        munmap(u->bufs, (size_t)URING_BUFS * URING_BUF_SIZE);
+
+    PTL_FASTLOCK_DESTROY(&u->lock);
+
+    free(u);
+}
+
+/**
+ * @brief Set up a ring for a bound UDP socket and arm its receive.
+ *
+ * @param[in] s the socket
+ * @param[in] gro whether UDP_GRO is enabled on the socket
+ *
+ * @return the ring, or NULL if io_uring can't be used
+ */
+struct uring *uring_init(int s, int gro)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    struct uring *u;
+    unsigned char *cq;
+    int i;
+
+    u = calloc(1, sizeof(*u));
+    if (!u)
+        return NULL;
+
+    u->fd = -1;
+    u->s = s;
+    u->send_id = 1;
+    PTL_FASTLOCK_INIT(&u->lock);
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = 4 * URING_ENTRIES;
+    if (get_param(PTL_UDP_URING_SQPOLL)) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = 1000;        /* ms */
+        u->sqpoll = 1;
+    }
+
+    u->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (u->fd == -1) {
+        ptl_info("io_uring not available: %s\n", strerror(errno));
+        goto error;
+    }
+
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_ring_size =
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_size > u->sq_ring_size)
+            u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = u->sq_ring_size;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        u->sq_ring = NULL;
+        goto error;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->fd,
+                          IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            u->cq_ring = NULL;
+            goto error;
+        }
+    }
+
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        goto error;
+    }
+
+    u->sq_head = u->sq_ring + p.sq_off.head;
+    u->sq_tail = u->sq_ring + p.sq_off.tail;
+    u->sq_flags = u->sq_ring + p.sq_off.flags;
+    u->sq_array = u->sq_ring + p.sq_off.array;
+    u->sq_mask = *(unsigned int *)(u->sq_ring + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sq_local_tail = *u->sq_tail;
+    u->sq_submitted = u->sq_local_tail;
+
+    cq = u->cq_ring;
+    u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* The receive buffers, and the ring through which the kernel
+     * takes them. */
+    u->bufs = mmap(NULL, (size_t)URING_BUFS * URING_BUF_SIZE,
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->bufs == MAP_FAILED) {
+        u->bufs = NULL;
+        goto error;
+    }
+
+    u->br_size = URING_BUFS * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->br == MAP_FAILED) {
+        u->br = NULL;
+        goto error;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)u->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BGID;
+    if (sys_io_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        ptl_info("io_uring buffer rings not available: %s\n",
+                 strerror(errno));
+        goto error;
+    }
+
+    for (i = 0; i < URING_BUFS; i++)
+        uring_buf_add(u, i);
+
+    /* Room for the source address, and the segment size of a GRO
+     * train, in front of each datagram. */
+    u->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    u->recv_msg.msg_controllen = gro ? CMSG_SPACE(sizeof(int)) : 0;
+
+    uring_arm(u);
+    if (uring_submit(u))
+        goto error;
+
+    ptl_info("io_uring engine ready on socket %d%s\n", s,
+             u->sqpoll ? ", with a polling thread" : "");
+
+    return u;
+
+  error:
+    uring_fini(u);
+    return NULL;
+}
+
+/**
+ * @brief Look at the oldest datagram received.
+ *
+ * On success, the ring stays locked until the datagram is left with
+ * uring_recv_leave() or taken with uring_recv_take().
+ *
+ * @param[in] u the ring
+ * @param[out] len the length of the datagram, or GRO train
+ * @param[out] seg the length of the datagrams of a train, but the
+ * last, or len
+ * @param[out] src the sender
+ *
+ * @return the datagram, or NULL if there is none
+ */
+const unsigned char *uring_recv_peek(struct uring *u, unsigned int *len,
+                                     unsigned int *seg,
+                                     struct sockaddr_in *src)
+{
+    PTL_FASTLOCK_LOCK(&u->lock);
+
+    uring_reap(u);
+
+    /* Re-arm once the buffers are back. */
+    if (!u->armed && u->recv_head == u->recv_tail) {
+        uring_arm(u);
+        if (uring_submit(u))
+            u->armed = 0;
+    }
+
+    while (u->recv_head != u->recv_tail) {
+        unsigned short bid = u->recv[u->recv_head % URING_BUFS];
+        struct io_uring_recvmsg_out *out =
+            (struct io_uring_recvmsg_out *)(u->bufs +
+                                            (size_t)bid * URING_BUF_SIZE);
+        unsigned char *name = (unsigned char *)(out + 1);
+        unsigned char *control = name + u->recv_msg.msg_namelen;
+        unsigned char *payload = control + u->recv_msg.msg_controllen;
+        struct msghdr msg;
+        struct cmsghdr *cmsg;
+
+        if ((out->flags & MSG_TRUNC) ||
+            out->namelen < sizeof(struct sockaddr_in)) {
+            WARN();
+            ptl_warn("dropping truncated datagram of %u bytes\n",
+                     out->payloadlen);
+            uring_buf_add(u, bid);
+            u->recv_head++;
+            continue;
+        }
+
+        memcpy(src, name, sizeof(*src));
+        *len = out->payloadlen;
+        *seg = out->payloadlen;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = out->controllen;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int gso_size;
+
+                memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                if (gso_size > 0 && gso_size < *len)
+                    *seg = gso_size;
+            }
+        }
+
+        return payload;
+    }
+
+    PTL_FASTLOCK_UNLOCK(&u->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Leave the datagram returned by uring_recv_peek() for the
+ * next caller.
+ *
+ * @param[in] u the ring
+ */
+void uring_recv_leave(struct uring *u)
+{
+    PTL_FASTLOCK_UNLOCK(&u->lock);
+}
+
+/**
+ * @brief Take the datagram returned by uring_recv_peek().
+ *
+ * It stays valid until its buffer is released.
+ *
+ * @param[in] u the ring
+ *
+ * @return the buffer holding it, for uring_recv_release()
+ */
+int uring_recv_take(struct uring *u)
+{
+    int bid = u->recv[u->recv_head % URING_BUFS];
+
+    u->recv_head++;
+
+    PTL_FASTLOCK_UNLOCK(&u->lock);
+
+    return bid;
+}
+
+/**
+ * @brief Give the buffer of a datagram back to the kernel.
+ *
+ * @param[in] u the ring
+ * @param[in] bid the buffer, from uring_recv_take()
+ */
+void uring_recv_release(struct uring *u, int bid)
+{
+    PTL_FASTLOCK_LOCK(&u->lock);
+    uring_buf_add(u, bid);
+    PTL_FASTLOCK_UNLOCK(&u->lock);
+}
+
+/**
+ * @brief Send datagrams, in order.
+ *
+ * The messages are submitted together, linked so that a failure
+ * cancels the ones after it, and the call returns once the kernel
+ * is done with them.
+ *
+ * @param[in] u the ring
+ * @param[in] msgs the messages
+ * @param[in] n the number of messages, at most URING_SEND_MAX
+ * @param[in] zc whether to send without copying the data
+ *
+ * @return the number of messages sent; if less than n, errno is set
+ * by the first one that failed
+ */
+int uring_sendmsgs(struct uring *u, struct msghdr *msgs, int n, int zc)
+{
+    struct uring_send send = {
+        .results = (1U << n) - 1,
+    };
+    struct uring_send **prev;
+    unsigned int first;
+    int submit_err = 0;
+    int i;
+
+    assert(n <= URING_SEND_MAX);
+
+    PTL_FASTLOCK_LOCK(&u->lock);
+
+    /* Wait for room for all the messages before queueing any, so
+     * that the entries of another thread can't get into the chain. */
+    while (u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) +
+           n > u->sq_entries) {
+        /* Only with a polling thread that is behind. */
+        PTL_FASTLOCK_UNLOCK(&u->lock);
+        sys_io_uring_enter(u->fd, 0, 0, IORING_ENTER_SQ_WAIT);
+        PTL_FASTLOCK_LOCK(&u->lock);
+    }
+
+    first = u->sq_local_tail;
+    send.id = u->send_id++;
+    send.next = u->sends;
+    u->sends = &send;
+
+    for (i = 0; i < n; i++) {
+        struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+        sqe->opcode = zc ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+        sqe->fd = u->s;
+        sqe->addr = (uintptr_t)&msgs[i];
+        sqe->user_data = send.id * URING_SEND_MAX + i;
+        if (i < n - 1)
+            sqe->flags = IOSQE_IO_LINK;
+    }
+
+    /* The entries the kernel didn't take are gone, but the others
+     * point to send and msgs, so their completions must still be
+     * waited for. */
+    if (uring_submit(u)) {
+        submit_err = errno;
+        send.results &= (1U << (u->sq_local_tail - first)) - 1;
+    }
+
+    /* The socket is non blocking, so the sends are usually complete
+     * by now. */
+    for (;;) {
+        uring_reap(u);
+        if (!send.results && !(send.more & ~send.notified))
+            break;
+
+        PTL_FASTLOCK_UNLOCK(&u->lock);
+        sched_yield();
+        PTL_FASTLOCK_LOCK(&u->lock);
+    }
+
+    prev = &u->sends;
+    while (*prev != &send)
+        prev = &(*prev)->next;
+    *prev = send.next;
+
+    PTL_FASTLOCK_UNLOCK(&u->lock);
+
+    if (send.done < n)
+        errno = send.err ? send.err : submit_err;
+
+    return send.done;
+}
@@ -0,0 +1,35 @@
+/**
+ * @file ptl_uring.h
+ *
+ * @brief io_uring engine of the UDP transport.
+ *
+ * Kept apart from ptl_loc.h: ptl_uring.c needs <linux/io_uring.h>,
+ * whose <linux/types.h> conflicts with ptl_byteorder.h.
+ */
+
+#ifndef PTL_URING_H
+#define PTL_URING_H
+
+#if WITH_UDP_URING
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* Most messages in one uring_sendmsgs() call. */
+#define URING_SEND_MAX 16
+
+struct uring;
+
+struct uring *uring_init(int s, int gro);
+void uring_fini(struct uring *u);
+const unsigned char *uring_recv_peek(struct uring *u, unsigned int *len,
+                                     unsigned int *seg,
+                                     struct sockaddr_in *src);
+void uring_recv_leave(struct uring *u);
+int uring_recv_take(struct uring *u);
+void uring_recv_release(struct uring *u, int bid);
+int uring_sendmsgs(struct uring *u, struct msghdr *msgs, int n, int zc);
+
+#endif
+
+#endif /* PTL_URING_H */
@@ -0,0 +1,157 @@
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+/*
+ * Check that a physical NI stops sending over shared memory to a
+ * local peer once it left the node directory. Rank 1 closes its NI
+ * and opens another one, which takes the same slot. A put from rank
+ * 0 to the NI that is gone must fail, and must not reach the new one.
+ */
+
+static void append_le(ptl_handle_ni_t ni_h, uint64_t *value,
+                      ptl_handle_le_t *le_h, ptl_handle_ct_t *ct_h)
+{
+    ptl_pt_index_t pt_index;
+    ptl_le_t       le;
+
+    CHECK_RETURNVAL(PtlPTAlloc(ni_h, 0, PTL_EQ_NONE, 0, &pt_index));
+    assert(pt_index == 0);
+
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, ct_h));
+
+    memset(&le, 0, sizeof(le));
+    le.start     = value;
+    le.length    = sizeof(*value);
+    le.uid       = PTL_UID_ANY;
+    le.options   = PTL_LE_OP_PUT | PTL_LE_EVENT_CT_COMM;
+    le.ct_handle = *ct_h;
+    CHECK_RETURNVAL(PtlLEAppend(ni_h, 0, &le, PTL_PRIORITY_LIST, NULL,
+                                le_h));
+}
+
+static void release_le(ptl_handle_ni_t ni_h, ptl_handle_le_t le_h,
+                       ptl_handle_ct_t ct_h)
+{
+    CHECK_RETURNVAL(PtlLEUnlink(le_h));
+    CHECK_RETURNVAL(PtlCTFree(ct_h));
+    CHECK_RETURNVAL(PtlPTFree(ni_h, 0));
+}
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_h;
+    ptl_handle_le_t le_h;
+    ptl_handle_ct_t le_ct;
+    ptl_handle_md_t md_h;
+    ptl_md_t        md;
+    ptl_ct_event_t  ctc;
+    ptl_process_t  *procs;
+    uint64_t        value = 0;
+    int             rank;
+    int             num_procs;
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(libtest_init());
+
+    rank = libtest_get_rank();
+    num_procs = libtest_get_size();
+
+    /* This test only succeeds if we have more than one rank */
+    if (num_procs < 2)
+        return 77;
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_PHYSICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    procs = libtest_get_mapping(ni_h);
+
+    /* The peers must share the node. */
+    if (procs[0].phys.nid != procs[1].phys.nid)
+        return 77;
+
+    if (rank == 1) {
+        append_le(ni_h, &value, &le_h, &le_ct);
+    } else if (rank == 0) {
+        value = 0xdeadbeef;
+
+        md.start     = &value;
+        md.length    = sizeof(value);
+        md.options   = PTL_MD_EVENT_CT_SEND | PTL_MD_EVENT_CT_ACK;
+        md.eq_handle = PTL_EQ_NONE;
+        CHECK_RETURNVAL(PtlCTAlloc(ni_h, &md.ct_handle));
+        CHECK_RETURNVAL(PtlMDBind(ni_h, &md, &md_h));
+    }
+
+    libtest_barrier();
+
+    /* Connect. */
+    if (rank == 1) {
+        CHECK_RETURNVAL(PtlCTWait(le_ct, 1, &ctc));
+        assert(ctc.failure == 0);
+    } else if (rank == 0) {
+        CHECK_RETURNVAL(PtlPut(md_h, 0, sizeof(value), PTL_CT_ACK_REQ,
+                               procs[1], 0, 0, 0, NULL, 0));
+        CHECK_RETURNVAL(PtlCTWait(md.ct_handle, 2, &ctc));
+        assert(ctc.failure == 0);
+    }
+
+    libtest_barrier();
+
+    /* Rank 1 leaves, and comes back in the same slot. */
+    if (rank == 1) {
+        release_le(ni_h, le_h, le_ct);
+        CHECK_RETURNVAL(PtlNIFini(ni_h));
+
+        CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                                  PTL_NI_NO_MATCHING | PTL_NI_PHYSICAL,
+                                  PTL_PID_ANY, NULL, NULL, &ni_h));
+        value = 0;
+        append_le(ni_h, &value, &le_h, &le_ct);
+    }
+
+    libtest_barrier();
+
+    if (rank == 0) {
+        CHECK_RETURNVAL(PtlPut(md_h, 0, sizeof(value), PTL_CT_ACK_REQ,
+                               procs[1], 0, 0, 0, NULL, 0));
+        CHECK_RETURNVAL(PtlCTWait(md.ct_handle, 4, &ctc));
+        if (ctc.failure == 0) {
+            fprintf(stderr, "put to a process that left succeeded\n");
+            return 1;
+        }
+    }
+
+    libtest_barrier();
+
+    if (rank == 1) {
+        CHECK_RETURNVAL(PtlCTGet(le_ct, &ctc));
+        if (ctc.success != 0 || value != 0) {
+            fprintf(stderr, "the new NI got a put for the old one\n");
+            return 1;
+        }
+
+        release_le(ni_h, le_h, le_ct);
+    } else if (rank == 0) {
+        CHECK_RETURNVAL(PtlMDRelease(md_h));
+        CHECK_RETURNVAL(PtlCTFree(md.ct_handle));
+    }
+
+    /* cleanup */
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    CHECK_RETURNVAL(libtest_fini());
+    PtlFini();
+
+    return 0;
+}
+
+/* vim:set expandtab: */
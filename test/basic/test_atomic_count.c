@@ -0,0 +1,146 @@
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "testing.h"
+
+/*
+ * Count the atomic read-modify-writes done by the calling thread in
+ * PtlPut, PtlGet and PtlAtomic, and check that they stay within a
+ * budget. The library only counts them when configured with
+ * --enable-atomic-count; otherwise the test is skipped.
+ */
+
+#define NUM_OPS    100
+
+/* Budget of atomic operations per call, with the shared memory
+ * transport: the MD and conn references, the buf allocation (pool
+ * count, free list, NI reference), the send and the release of the
+ * MD, conn and buf once the message is out. A get has nothing to
+ * release until the reply comes back. */
+#define MAX_PUT    10
+#define MAX_GET    7
+#define MAX_ATOMIC 10
+
+unsigned long PtlInternalAtomicCount(void) __attribute__ ((weak));
+
+enum { OP_PUT, OP_GET, OP_ATOMIC };
+
+static const char *op_name[] = { "PtlPut", "PtlGet", "PtlAtomic" };
+
+static double count_op(int op, ptl_handle_md_t md_h, ptl_handle_ct_t ct_h,
+                       ptl_process_t myself, ptl_pt_index_t pt_index)
+{
+    unsigned long total = 0;
+    ptl_ct_event_t ctc;
+    int i;
+
+    for (i = 0; i < NUM_OPS; i++) {
+        unsigned long start = PtlInternalAtomicCount();
+
+        switch (op) {
+            case OP_PUT:
+                CHECK_RETURNVAL(PtlPut(md_h, 0, sizeof(uint64_t),
+                                       PTL_NO_ACK_REQ, myself, pt_index, 0,
+                                       0, NULL, 0));
+                break;
+            case OP_GET:
+                CHECK_RETURNVAL(PtlGet(md_h, 0, sizeof(uint64_t), myself,
+                                       pt_index, 0, 0, NULL));
+                break;
+            case OP_ATOMIC:
+                CHECK_RETURNVAL(PtlAtomic(md_h, 0, sizeof(uint64_t),
+                                          PTL_NO_ACK_REQ, myself, pt_index,
+                                          0, 0, NULL, 0, PTL_SUM,
+                                          PTL_UINT64_T));
+                break;
+        }
+
+        total += PtlInternalAtomicCount() - start;
+
+        /* Let the operation complete, out of the count. */
+        CHECK_RETURNVAL(PtlCTWait(ct_h, i + 1, &ctc));
+        assert(ctc.failure == 0);
+    }
+
+    return (double)total / NUM_OPS;
+}
+
+int main(int   argc,
+         char *argv[])
+{
+    static const int max[] = { MAX_PUT, MAX_GET, MAX_ATOMIC };
+    ptl_handle_ni_t ni_h;
+    ptl_process_t   myself;
+    ptl_pt_index_t  pt_index;
+    uint64_t        value, local;
+    ptl_le_t        le;
+    ptl_handle_le_t le_h;
+    ptl_md_t        md;
+    ptl_handle_md_t md_h;
+    int             failed = 0;
+    int             op;
+
+    if (!PtlInternalAtomicCount || PtlInternalAtomicCount() == ULONG_MAX) {
+        fprintf(stderr, "atomic operations are not counted\n");
+        return 77;
+    }
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_PHYSICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    CHECK_RETURNVAL(PtlGetId(ni_h, &myself));
+
+    CHECK_RETURNVAL(PtlPTAlloc(ni_h, 0, PTL_EQ_NONE, PTL_PT_ANY,
+                               &pt_index));
+
+    value = 0;
+    le.start   = &value;
+    le.length  = sizeof(uint64_t);
+    le.uid     = PTL_UID_ANY;
+    le.options = PTL_LE_OP_PUT | PTL_LE_OP_GET | PTL_LE_ACK_DISABLE |
+                 PTL_LE_EVENT_COMM_DISABLE | PTL_LE_EVENT_LINK_DISABLE;
+    le.ct_handle = PTL_CT_NONE;
+    CHECK_RETURNVAL(PtlLEAppend(ni_h, pt_index, &le, PTL_PRIORITY_LIST,
+                                NULL, &le_h));
+
+    for (op = OP_PUT; op <= OP_ATOMIC; op++) {
+        double count;
+
+        local = 1;
+        md.start     = &local;
+        md.length    = sizeof(uint64_t);
+        md.options   = op == OP_GET ? PTL_MD_EVENT_CT_REPLY :
+                                      PTL_MD_EVENT_CT_SEND;
+        md.eq_handle = PTL_EQ_NONE;
+        CHECK_RETURNVAL(PtlCTAlloc(ni_h, &md.ct_handle));
+        CHECK_RETURNVAL(PtlMDBind(ni_h, &md, &md_h));
+
+        count = count_op(op, md_h, md.ct_handle, myself, pt_index);
+
+        printf("%-10s %5.1f atomic operations per call (budget %d)\n",
+               op_name[op], count, max[op]);
+        if (count > max[op])
+            failed = 1;
+
+        CHECK_RETURNVAL(PtlMDRelease(md_h));
+        CHECK_RETURNVAL(PtlCTFree(md.ct_handle));
+    }
+
+    CHECK_RETURNVAL(PtlLEUnlink(le_h));
+    CHECK_RETURNVAL(PtlPTFree(ni_h, pt_index));
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    PtlFini();
+
+    return failed;
+}
+
+/* vim:set expandtab: */
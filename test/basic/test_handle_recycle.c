@@ -0,0 +1,67 @@
+#include <portals4.h>
+
+#include <stdio.h>                     /* for fprintf() */
+#include <stdlib.h>                    /* for abort() */
+#include <assert.h>
+
+#include "testing.h"
+
+#define NUM_NI_LOOPS 64
+#define NUM_MD_LOOPS 1000
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_h;
+    ptl_md_t        md;
+    ptl_handle_md_t md_h, old_md_h;
+    ptl_handle_ct_t ct_h, old_ct_h;
+    int             i;
+
+    CHECK_RETURNVAL(PtlInit());
+
+    /* Each NI brings its own object pools. Their handle indexes must
+     * be given back when the NI goes away. */
+    for (i = 0; i < NUM_NI_LOOPS; i++) {
+        CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                                  PTL_NI_NO_MATCHING | PTL_NI_PHYSICAL,
+                                  PTL_PID_ANY, NULL, NULL, &ni_h));
+        CHECK_RETURNVAL(PtlNIFini(ni_h));
+    }
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_PHYSICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    md.start = NULL;
+    md.length = 0;
+    md.options = 0;
+    md.eq_handle = PTL_EQ_NONE;
+    md.ct_handle = PTL_CT_NONE;
+
+    /* A freed object is handed out again by its pool. The handle of
+     * the previous user must not reach the new one. */
+    CHECK_RETURNVAL(PtlMDBind(ni_h, &md, &old_md_h));
+    CHECK_RETURNVAL(PtlMDRelease(old_md_h));
+
+    for (i = 0; i < NUM_MD_LOOPS; i++) {
+        CHECK_RETURNVAL(PtlMDBind(ni_h, &md, &md_h));
+        assert(md_h != old_md_h);
+        assert(PtlMDRelease(old_md_h) == PTL_ARG_INVALID);
+        CHECK_RETURNVAL(PtlMDRelease(md_h));
+        old_md_h = md_h;
+    }
+
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, &old_ct_h));
+    CHECK_RETURNVAL(PtlCTFree(old_ct_h));
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, &ct_h));
+    assert(PtlCTFree(old_ct_h) == PTL_ARG_INVALID);
+    CHECK_RETURNVAL(PtlCTFree(ct_h));
+
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    PtlFini();
+
+    return 0;
+}
+
+/* vim:set expandtab: */
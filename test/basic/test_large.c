@@ -0,0 +1,137 @@
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+#if INTERFACE == 1
+# define ENTRY_T  ptl_me_t
+# define HANDLE_T ptl_handle_me_t
+# define NI_TYPE  PTL_NI_MATCHING
+# define OPTIONS  (PTL_ME_OP_PUT | PTL_ME_OP_GET | PTL_ME_EVENT_CT_COMM)
+# define APPEND   PtlMEAppend
+# define UNLINK   PtlMEUnlink
+#else
+# define ENTRY_T  ptl_le_t
+# define HANDLE_T ptl_handle_le_t
+# define NI_TYPE  PTL_NI_NO_MATCHING
+# define OPTIONS  (PTL_LE_OP_PUT | PTL_LE_OP_GET | PTL_LE_EVENT_CT_COMM)
+# define APPEND   PtlLEAppend
+# define UNLINK   PtlLEUnlink
+#endif /* if INTERFACE == 1 */
+
+/* Large enough not to be inlined by any transport, and twice the
+ * default shmem bounce buffer (PTL_BOUNCE_BUF_SIZE) so that the copy
+ * without knem takes several rounds. */
+#define BUFSIZE (64 * 1024)
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_logical;
+    ptl_process_t   myself, peer;
+    ptl_pt_index_t  logical_pt_index;
+    unsigned char  *value, *buf;
+    ENTRY_T         value_e;
+    HANDLE_T        value_e_handle;
+    ptl_md_t        md;
+    ptl_handle_md_t md_handle;
+    ptl_ct_event_t  ctc;
+    int             num_procs;
+    size_t          i;
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(libtest_init());
+
+    num_procs = libtest_get_size();
+
+    value = malloc(BUFSIZE);
+    assert(value);
+    buf = malloc(BUFSIZE);
+    assert(buf);
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT, NI_TYPE | PTL_NI_LOGICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_logical));
+
+    CHECK_RETURNVAL(PtlSetMap(ni_logical, num_procs,
+                              libtest_get_mapping(ni_logical)));
+
+    CHECK_RETURNVAL(PtlGetId(ni_logical, &myself));
+    CHECK_RETURNVAL(PtlPTAlloc(ni_logical, 0, PTL_EQ_NONE, PTL_PT_ANY,
+                               &logical_pt_index));
+    assert(logical_pt_index == 0);
+
+    memset(value, 0, BUFSIZE);
+    value_e.start  = value;
+    value_e.length = BUFSIZE;
+    value_e.uid    = PTL_UID_ANY;
+#if INTERFACE == 1
+    value_e.match_id.rank = PTL_RANK_ANY;
+    value_e.match_bits    = 1;
+    value_e.ignore_bits   = 0;
+#endif
+    value_e.options = OPTIONS;
+    CHECK_RETURNVAL(PtlCTAlloc(ni_logical, &value_e.ct_handle));
+    CHECK_RETURNVAL(APPEND(ni_logical, 0, &value_e, PTL_PRIORITY_LIST, NULL,
+                           &value_e_handle));
+
+    md.start     = buf;
+    md.length    = BUFSIZE;
+    md.options   = PTL_MD_EVENT_CT_ACK | PTL_MD_EVENT_CT_REPLY;
+    md.eq_handle = PTL_EQ_NONE;
+    CHECK_RETURNVAL(PtlCTAlloc(ni_logical, &md.ct_handle));
+    CHECK_RETURNVAL(PtlMDBind(ni_logical, &md, &md_handle));
+
+    libtest_barrier();
+
+    /* write a pattern into the next rank's buffer */
+    peer.rank = (myself.rank + 1) % num_procs;
+    for (i = 0; i < BUFSIZE; i++)
+        buf[i] = (unsigned char)(i * 7 + myself.rank);
+    CHECK_RETURNVAL(PtlPut(md_handle, 0, BUFSIZE, PTL_CT_ACK_REQ, peer,
+                           logical_pt_index, 1, 0, NULL, 0));
+    CHECK_RETURNVAL(PtlCTWait(md.ct_handle, 1, &ctc));
+    assert(ctc.failure == 0);
+
+    /* wait until the previous rank wrote into mine */
+    CHECK_RETURNVAL(PtlCTWait(value_e.ct_handle, 1, &ctc));
+    assert(ctc.failure == 0);
+
+    libtest_barrier();
+
+    /* read it back from the next rank */
+    memset(buf, 0, BUFSIZE);
+    CHECK_RETURNVAL(PtlGet(md_handle, 0, BUFSIZE, peer, logical_pt_index, 1,
+                           0, NULL));
+    CHECK_RETURNVAL(PtlCTWait(md.ct_handle, 2, &ctc));
+    assert(ctc.failure == 0);
+
+    for (i = 0; i < BUFSIZE; i++)
+        assert(buf[i] == (unsigned char)(i * 7 + myself.rank));
+
+    libtest_barrier();
+
+    CHECK_RETURNVAL(PtlMDRelease(md_handle));
+    CHECK_RETURNVAL(PtlCTFree(md.ct_handle));
+    CHECK_RETURNVAL(UNLINK(value_e_handle));
+    CHECK_RETURNVAL(PtlCTFree(value_e.ct_handle));
+
+    /* cleanup */
+    CHECK_RETURNVAL(PtlPTFree(ni_logical, logical_pt_index));
+    CHECK_RETURNVAL(PtlNIFini(ni_logical));
+    CHECK_RETURNVAL(libtest_fini());
+    PtlFini();
+
+    free(buf);
+    free(value);
+
+    return 0;
+}
+
+/* vim:set expandtab: */
@@ -0,0 +1,156 @@
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+/* Check that the header fields of a put reach the target, whatever
+ * width they are sent on by a compact header (see ptl_hdr.h). */
+
+#define MATCH_BITS	0xa5a5a5a55a5a5a5aULL
+
+struct put {
+    ptl_size_t     local_offset;
+    ptl_size_t     length;
+    ptl_size_t     remote_offset;
+    ptl_hdr_data_t hdr_data;
+};
+
+static const struct put put_tests[] = {
+    { 0, 8, 24, 0x0123456789abcdefULL },   /* 64 bits hdr_data */
+    { 8, 16, 40, 0x1234 },                  /* 32 bits hdr_data */
+    { 0, 8, 0x10000, 0xffffffff00000000ULL },
+};
+
+#define NUM_PUTS	(sizeof(put_tests) / sizeof(put_tests[0]))
+#define BUFSIZE		(0x10000 + 64)
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_h;
+    ptl_pt_index_t  pt_index;
+    unsigned char  *value;
+    unsigned char   src[64];
+    ptl_me_t        value_e;
+    ptl_handle_me_t value_e_handle;
+    ptl_md_t        write_md;
+    ptl_handle_md_t write_md_handle;
+    ptl_handle_eq_t eq_h;
+    ptl_event_t     ev;
+    int             num_procs;
+    int             rank;
+    unsigned int    i;
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(libtest_init());
+
+    rank = libtest_get_rank();
+    num_procs = libtest_get_size();
+
+    /* This test only succeeds if we have more than one rank */
+    if (num_procs < 2) return 77;
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_MATCHING | PTL_NI_LOGICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    CHECK_RETURNVAL(PtlSetMap(ni_h, num_procs, libtest_get_mapping(ni_h)));
+
+    CHECK_RETURNVAL(PtlEQAlloc(ni_h, 64, &eq_h));
+    CHECK_RETURNVAL(PtlPTAlloc(ni_h, 0, eq_h, PTL_PT_ANY, &pt_index));
+    assert(pt_index == 0);
+
+    value = calloc(1, BUFSIZE);
+    assert(value);
+
+    for (i = 0; i < sizeof(src); i++)
+        src[i] = i + 1;
+
+    if (1 == rank) {
+        value_e.start          = value;
+        value_e.length         = BUFSIZE;
+        value_e.uid            = PTL_UID_ANY;
+        value_e.match_id.rank  = PTL_RANK_ANY;
+        value_e.match_bits     = MATCH_BITS;
+        value_e.ignore_bits    = 0;
+        value_e.options        = PTL_ME_OP_PUT |
+                                 PTL_ME_EVENT_LINK_DISABLE |
+                                 PTL_ME_EVENT_UNLINK_DISABLE;
+        value_e.ct_handle      = PTL_CT_NONE;
+
+        CHECK_RETURNVAL(PtlMEAppend(ni_h, 0, &value_e, PTL_PRIORITY_LIST,
+                                    NULL, &value_e_handle));
+    } else if (0 == rank) {
+        write_md.start     = src;
+        write_md.length    = sizeof(src);
+        write_md.options   = PTL_MD_EVENT_SEND_DISABLE;
+        write_md.eq_handle = eq_h;
+        write_md.ct_handle = PTL_CT_NONE;
+        CHECK_RETURNVAL(PtlMDBind(ni_h, &write_md, &write_md_handle));
+    }
+
+    libtest_barrier();
+
+    if (1 == rank) {
+        for (i = 0; i < NUM_PUTS; i++) {
+            const struct put *p = &put_tests[i];
+
+            CHECK_RETURNVAL(PtlEQWait(eq_h, &ev));
+            assert(ev.type == PTL_EVENT_PUT);
+            assert(ev.ni_fail_type == PTL_NI_OK);
+            assert(ev.match_bits == MATCH_BITS);
+            assert(ev.hdr_data == p->hdr_data);
+            assert(ev.remote_offset == p->remote_offset);
+            assert(ev.rlength == p->length);
+            assert(ev.mlength == p->length);
+            assert(ev.start == value + p->remote_offset);
+            assert(memcmp(value + p->remote_offset, src + p->local_offset,
+                          p->length) == 0);
+        }
+    } else if (0 == rank) {
+        ptl_process_t peer = { .rank = 1 };
+
+        /* One at a time, so that the events come in order. */
+        for (i = 0; i < NUM_PUTS; i++) {
+            const struct put *p = &put_tests[i];
+
+            CHECK_RETURNVAL(PtlPut(write_md_handle, p->local_offset,
+                                   p->length, PTL_ACK_REQ, peer, pt_index,
+                                   MATCH_BITS, p->remote_offset, NULL,
+                                   p->hdr_data));
+            CHECK_RETURNVAL(PtlEQWait(eq_h, &ev));
+            assert(ev.type == PTL_EVENT_ACK);
+            assert(ev.ni_fail_type == PTL_NI_OK);
+            assert(ev.mlength == p->length);
+            assert(ev.remote_offset == p->remote_offset);
+        }
+    }
+
+    libtest_barrier();
+
+    /* cleanup */
+    if (1 == rank) {
+        CHECK_RETURNVAL(PtlMEUnlink(value_e_handle));
+    } else if (0 == rank) {
+        CHECK_RETURNVAL(PtlMDRelease(write_md_handle));
+    }
+
+    free(value);
+
+    CHECK_RETURNVAL(PtlEQFree(eq_h));
+    CHECK_RETURNVAL(PtlPTFree(ni_h, pt_index));
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    CHECK_RETURNVAL(libtest_fini());
+    PtlFini();
+
+    return 0;
+}
+
+/* vim:set expandtab: */
@@ -0,0 +1,140 @@
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testing.h"
+
+/*
+ * Check that the UDP transport steers every datagram to the receive
+ * socket its stripe picks, with 4 sockets per interface
+ * (PTL_UDP_SOCKETS). Small puts to several portal tables give
+ * different stripes, and a large put sends fragments. The library
+ * counts the datagrams that came through another socket. The test
+ * is skipped without the UDP transport or without steering.
+ */
+
+#define NUM_PTS   8
+#define NUM_PUTS  16
+#define LARGE     (16 * 1024)
+
+unsigned long PtlInternalUDPMissteered(void) __attribute__ ((weak));
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_h;
+    ptl_process_t   myself, peer;
+    ptl_pt_index_t  pt_index[NUM_PTS];
+    unsigned char  *value, *buf;
+    ptl_le_t        le;
+    ptl_handle_le_t le_h[NUM_PTS];
+    ptl_handle_ct_t le_ct;
+    ptl_md_t        md;
+    ptl_handle_md_t md_h;
+    ptl_ct_event_t  ctc;
+    unsigned long   missteered;
+    int             num_procs;
+    int             i, j;
+
+    /* Unless the test is run with another setting. */
+    setenv("PTL_UDP_SOCKETS", "4", 0);
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(libtest_init());
+
+    num_procs = libtest_get_size();
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_LOGICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    if (!PtlInternalUDPMissteered || PtlInternalUDPMissteered() == ULONG_MAX) {
+        fprintf(stderr, "UDP datagrams are not steered\n");
+        return 77;
+    }
+
+    CHECK_RETURNVAL(PtlSetMap(ni_h, num_procs, libtest_get_mapping(ni_h)));
+    CHECK_RETURNVAL(PtlGetId(ni_h, &myself));
+
+    value = calloc(1, LARGE);
+    assert(value);
+    buf = malloc(LARGE);
+    assert(buf);
+    memset(buf, 0x5a, LARGE);
+
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, &le_ct));
+
+    for (i = 0; i < NUM_PTS; i++) {
+        CHECK_RETURNVAL(PtlPTAlloc(ni_h, 0, PTL_EQ_NONE, i, &pt_index[i]));
+
+        le.start     = value;
+        le.length    = LARGE;
+        le.uid       = PTL_UID_ANY;
+        le.options   = PTL_LE_OP_PUT | PTL_LE_EVENT_CT_COMM;
+        le.ct_handle = le_ct;
+        CHECK_RETURNVAL(PtlLEAppend(ni_h, pt_index[i], &le,
+                                    PTL_PRIORITY_LIST, NULL, &le_h[i]));
+    }
+
+    md.start     = buf;
+    md.length    = LARGE;
+    md.options   = PTL_MD_EVENT_CT_ACK;
+    md.eq_handle = PTL_EQ_NONE;
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, &md.ct_handle));
+    CHECK_RETURNVAL(PtlMDBind(ni_h, &md, &md_h));
+
+    libtest_barrier();
+
+    peer.rank = (myself.rank + 1) % num_procs;
+
+    for (j = 0; j < NUM_PUTS; j++)
+        for (i = 0; i < NUM_PTS; i++)
+            CHECK_RETURNVAL(PtlPut(md_h, 0, sizeof(uint64_t),
+                                   PTL_CT_ACK_REQ, peer, pt_index[i], 0, 0,
+                                   NULL, 0));
+
+    CHECK_RETURNVAL(PtlPut(md_h, 0, LARGE, PTL_CT_ACK_REQ, peer,
+                           pt_index[0], 0, 0, NULL, 0));
+
+    CHECK_RETURNVAL(PtlCTWait(md.ct_handle, NUM_PUTS * NUM_PTS + 1, &ctc));
+    assert(ctc.failure == 0);
+
+    CHECK_RETURNVAL(PtlCTWait(le_ct, NUM_PUTS * NUM_PTS + 1, &ctc));
+    assert(ctc.failure == 0);
+
+    libtest_barrier();
+
+    missteered = PtlInternalUDPMissteered();
+    if (missteered) {
+        fprintf(stderr, "%lu datagrams came through the wrong socket\n",
+                missteered);
+        return 1;
+    }
+
+    CHECK_RETURNVAL(PtlMDRelease(md_h));
+    CHECK_RETURNVAL(PtlCTFree(md.ct_handle));
+    for (i = 0; i < NUM_PTS; i++) {
+        CHECK_RETURNVAL(PtlLEUnlink(le_h[i]));
+        CHECK_RETURNVAL(PtlPTFree(ni_h, pt_index[i]));
+    }
+    CHECK_RETURNVAL(PtlCTFree(le_ct));
+
+    /* cleanup */
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    CHECK_RETURNVAL(libtest_fini());
+    PtlFini();
+
+    free(buf);
+    free(value);
+
+    return 0;
+}
+
+/* vim:set expandtab: */
@@ -0,0 +1,225 @@
+/*
+ * Put message rate with iovec MDs and LEs.
+ *
+ * Every rank streams windows of small puts to the next rank (or to
+ * itself when running alone). Both the MD and the LE are iovec
+ * arrays of many small elements, and the puts are spread over the
+ * whole arrays, so that each message has to find its starting
+ * element on both sides. Compare the rate for different numbers of
+ * elements to see how the cost of a message grows with it.
+ */
+
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define CHECK_RETURNVAL(x) do { int ret;                                                                                                                              \
+                                switch (ret = x) {                                                                                                                    \
+                                    case PTL_IGNORED: case PTL_OK: break;                                                                                             \
+                                    case PTL_FAIL: fprintf(stderr, "=> %s returned PTL_FAIL (line %u)\n", # x, (unsigned int)__LINE__); abort(); break;               \
+                                    case PTL_NO_SPACE: fprintf(stderr, "=> %s returned PTL_NO_SPACE (line %u)\n", # x, (unsigned int)__LINE__); abort(); break;       \
+                                    case PTL_ARG_INVALID: fprintf(stderr, "=> %s returned PTL_ARG_INVALID (line %u)\n", # x, (unsigned int)__LINE__); abort(); break; \
+                                    case PTL_NO_INIT: fprintf(stderr, "=> %s returned PTL_NO_INIT (line %u)\n", # x, (unsigned int)__LINE__); abort(); break;         \
+                                    default: fprintf(stderr, "=> %s returned failcode %i (line %u)\n", # x, ret, (unsigned int)__LINE__); abort(); break;             \
+                                } } while (0)
+
+static double timer(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: P4iovecrate [OPTION]...\n\n");
+    fprintf(stderr, "  -h           Display this help message and exit\n");
+    fprintf(stderr, "  -i <num>     Number of iterations\n");
+    fprintf(stderr, "  -m <num>     Number of puts per iteration\n");
+    fprintf(stderr, "  -n <num>     Number of iovec elements in the MD and LE\n");
+    fprintf(stderr, "  -e <size>    Number of bytes per iovec element\n");
+    fprintf(stderr, "  -s <size>    Number of bytes per put\n");
+}
+
+/* Cut buf in num elements of size bytes. */
+static ptl_iovec_t *make_iovec(char *buf, int num, int size)
+{
+    ptl_iovec_t *iov = malloc(num * sizeof(*iov));
+    int i;
+
+    assert(iov);
+
+    for (i = 0; i < num; i++) {
+        iov[i].iov_base = buf + i * size;
+        iov[i].iov_len = size;
+    }
+
+    return iov;
+}
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_h;
+    ptl_pt_index_t  pt_index;
+    ptl_process_t   myself;
+    ptl_process_t   peer;
+    ptl_le_t        le;
+    ptl_handle_le_t le_h;
+    ptl_md_t        md;
+    ptl_handle_md_t md_h;
+    ptl_ct_event_t  ctc;
+    ptl_iovec_t    *send_iov;
+    ptl_iovec_t    *recv_iov;
+    char           *send_buf;
+    char           *recv_buf;
+    double          start, elapsed;
+    ptl_size_t      total;
+    ptl_size_t      stride;
+    int             num_procs;
+    int             niters = 100;
+    int             nmsgs = 64;
+    int             niov = 4096;
+    int             elem_size = 64;
+    int             nbytes = 8;
+    char            lim[32];
+    int             ch;
+    int             i, k;
+
+    while ((ch = getopt(argc, argv, "hi:m:n:e:s:")) != -1) {
+        switch (ch) {
+            case 'i':
+                niters = strtol(optarg, NULL, 0);
+                break;
+            case 'm':
+                nmsgs = strtol(optarg, NULL, 0);
+                break;
+            case 'n':
+                niov = strtol(optarg, NULL, 0);
+                break;
+            case 'e':
+                elem_size = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                nbytes = strtol(optarg, NULL, 0);
+                break;
+            case 'h':
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    total = (ptl_size_t)niov * elem_size;
+    if (nbytes > total) {
+        usage();
+        return 1;
+    }
+
+    /* Spread the puts over the whole iovec, up to its end. */
+    stride = nmsgs > 1 ? (total - nbytes) / (nmsgs - 1) : 0;
+
+    /* The default limit on iovec elements is lower than what is
+     * measured here, raise it unless the user set it. */
+    snprintf(lim, sizeof(lim), "%d", niov);
+    setenv("PTL_LIM_MAX_IOVECS", lim, 0);
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(libtest_init());
+
+    num_procs = libtest_get_size();
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_LOGICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    CHECK_RETURNVAL(PtlSetMap(ni_h, num_procs, libtest_get_mapping(ni_h)));
+
+    CHECK_RETURNVAL(PtlGetId(ni_h, &myself));
+
+    CHECK_RETURNVAL(PtlPTAlloc(ni_h, 0, PTL_EQ_NONE, PTL_PT_ANY,
+                               &pt_index));
+
+    send_buf = calloc(niov, elem_size);
+    recv_buf = calloc(niov, elem_size);
+    assert(send_buf && recv_buf);
+
+    send_iov = make_iovec(send_buf, niov, elem_size);
+    recv_iov = make_iovec(recv_buf, niov, elem_size);
+
+    le.start   = recv_iov;
+    le.length  = niov;
+    le.uid     = PTL_UID_ANY;
+    le.options = PTL_IOVEC | PTL_LE_OP_PUT | PTL_LE_ACK_DISABLE |
+                 PTL_LE_EVENT_CT_COMM | PTL_LE_EVENT_COMM_DISABLE |
+                 PTL_LE_EVENT_LINK_DISABLE;
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, &le.ct_handle));
+    CHECK_RETURNVAL(PtlLEAppend(ni_h, pt_index, &le, PTL_PRIORITY_LIST,
+                                NULL, &le_h));
+
+    md.start     = send_iov;
+    md.length    = niov;
+    md.options   = PTL_IOVEC | PTL_MD_EVENT_CT_SEND;
+    md.eq_handle = PTL_EQ_NONE;
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, &md.ct_handle));
+    CHECK_RETURNVAL(PtlMDBind(ni_h, &md, &md_h));
+
+    peer.rank = (myself.rank + 1) % num_procs;
+
+    libtest_barrier();
+
+    start = timer();
+
+    for (i = 0; i < niters; i++) {
+        for (k = 0; k < nmsgs; k++) {
+            CHECK_RETURNVAL(PtlPut(md_h, k * stride, nbytes, PTL_NO_ACK_REQ,
+                                   peer, pt_index, 0, k * stride, NULL, 0));
+        }
+
+        CHECK_RETURNVAL(PtlCTWait(md.ct_handle, (i + 1) * nmsgs, &ctc));
+        assert(ctc.failure == 0);
+    }
+
+    /* Every rank receives as many puts as it sends. */
+    CHECK_RETURNVAL(PtlCTWait(le.ct_handle, niters * nmsgs, &ctc));
+    assert(ctc.failure == 0);
+
+    elapsed = timer() - start;
+
+    libtest_barrier();
+
+    if (myself.rank == 0) {
+        printf("procs=%d iovecs=%d element=%d size=%d msgs=%d\n", num_procs,
+               niov, elem_size, nbytes, niters * nmsgs);
+        printf("Message rate: %.0f msgs/s per rank\n",
+               (niters * nmsgs) / elapsed);
+    }
+
+    /* cleanup */
+    CHECK_RETURNVAL(PtlMDRelease(md_h));
+    CHECK_RETURNVAL(PtlCTFree(md.ct_handle));
+    CHECK_RETURNVAL(PtlLEUnlink(le_h));
+    CHECK_RETURNVAL(PtlCTFree(le.ct_handle));
+    CHECK_RETURNVAL(PtlPTFree(ni_h, pt_index));
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    CHECK_RETURNVAL(libtest_fini());
+    PtlFini();
+
+    free(send_iov);
+    free(recv_iov);
+    free(send_buf);
+    free(recv_buf);
+
+    return 0;
+}
+
+/* vim:set expandtab: */
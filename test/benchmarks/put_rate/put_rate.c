@@ -0,0 +1,177 @@
+/*
+ * Streaming put message rate.
+ *
+ * Every rank streams windows of small puts to the next rank (or to
+ * itself when running alone) and reports the aggregate message
+ * rate. The benchmark stresses the library's per message path: buf
+ * allocation, header build, send and target processing. Run it with
+ * different library tunables (for instance PTL_HUGEPAGES=0/1/2) to
+ * compare their effect.
+ */
+
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define CHECK_RETURNVAL(x) do { int ret;                                                                                                                              \
+                                switch (ret = x) {                                                                                                                    \
+                                    case PTL_IGNORED: case PTL_OK: break;                                                                                             \
+                                    case PTL_FAIL: fprintf(stderr, "=> %s returned PTL_FAIL (line %u)\n", # x, (unsigned int)__LINE__); abort(); break;               \
+                                    case PTL_NO_SPACE: fprintf(stderr, "=> %s returned PTL_NO_SPACE (line %u)\n", # x, (unsigned int)__LINE__); abort(); break;       \
+                                    case PTL_ARG_INVALID: fprintf(stderr, "=> %s returned PTL_ARG_INVALID (line %u)\n", # x, (unsigned int)__LINE__); abort(); break; \
+                                    case PTL_NO_INIT: fprintf(stderr, "=> %s returned PTL_NO_INIT (line %u)\n", # x, (unsigned int)__LINE__); abort(); break;         \
+                                    default: fprintf(stderr, "=> %s returned failcode %i (line %u)\n", # x, ret, (unsigned int)__LINE__); abort(); break;             \
+                                } } while (0)
+
+static double timer(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: P4putrate [OPTION]...\n\n");
+    fprintf(stderr, "  -h           Display this help message and exit\n");
+    fprintf(stderr, "  -i <num>     Number of iterations\n");
+    fprintf(stderr, "  -m <num>     Number of puts per iteration\n");
+    fprintf(stderr, "  -s <size>    Number of bytes per put\n");
+}
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_h;
+    ptl_pt_index_t  pt_index;
+    ptl_process_t   myself;
+    ptl_process_t   peer;
+    ptl_le_t        le;
+    ptl_handle_le_t le_h;
+    ptl_md_t        md;
+    ptl_handle_md_t md_h;
+    ptl_ct_event_t  ctc;
+    char           *send_buf;
+    char           *recv_buf;
+    double          start, elapsed;
+    int             num_procs;
+    int             niters = 1000;
+    int             nmsgs = 64;
+    int             nbytes = 8;
+    int             ch;
+    int             i, k;
+
+    while ((ch = getopt(argc, argv, "hi:m:s:")) != -1) {
+        switch (ch) {
+            case 'i':
+                niters = strtol(optarg, NULL, 0);
+                break;
+            case 'm':
+                nmsgs = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                nbytes = strtol(optarg, NULL, 0);
+                break;
+            case 'h':
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(libtest_init());
+
+    num_procs = libtest_get_size();
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_LOGICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    CHECK_RETURNVAL(PtlSetMap(ni_h, num_procs, libtest_get_mapping(ni_h)));
+
+    CHECK_RETURNVAL(PtlGetId(ni_h, &myself));
+
+    CHECK_RETURNVAL(PtlPTAlloc(ni_h, 0, PTL_EQ_NONE, PTL_PT_ANY,
+                               &pt_index));
+
+    send_buf = calloc(nmsgs, nbytes);
+    recv_buf = calloc(nmsgs, nbytes);
+    assert(send_buf && recv_buf);
+
+    le.start   = recv_buf;
+    le.length  = nmsgs * nbytes;
+    le.uid     = PTL_UID_ANY;
+    le.options = PTL_LE_OP_PUT | PTL_LE_ACK_DISABLE |
+                 PTL_LE_EVENT_CT_COMM | PTL_LE_EVENT_COMM_DISABLE |
+                 PTL_LE_EVENT_LINK_DISABLE;
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, &le.ct_handle));
+    CHECK_RETURNVAL(PtlLEAppend(ni_h, pt_index, &le, PTL_PRIORITY_LIST,
+                                NULL, &le_h));
+
+    md.start     = send_buf;
+    md.length    = nmsgs * nbytes;
+    md.options   = PTL_MD_EVENT_CT_SEND;
+    md.eq_handle = PTL_EQ_NONE;
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, &md.ct_handle));
+    CHECK_RETURNVAL(PtlMDBind(ni_h, &md, &md_h));
+
+    peer.rank = (myself.rank + 1) % num_procs;
+
+    libtest_barrier();
+
+    start = timer();
+
+    for (i = 0; i < niters; i++) {
+        for (k = 0; k < nmsgs; k++) {
+            CHECK_RETURNVAL(PtlPut(md_h, k * nbytes, nbytes, PTL_NO_ACK_REQ,
+                                   peer, pt_index, 0, k * nbytes, NULL, 0));
+        }
+
+        CHECK_RETURNVAL(PtlCTWait(md.ct_handle, (i + 1) * nmsgs, &ctc));
+        assert(ctc.failure == 0);
+    }
+
+    /* Every rank receives as many puts as it sends. */
+    CHECK_RETURNVAL(PtlCTWait(le.ct_handle, niters * nmsgs, &ctc));
+    assert(ctc.failure == 0);
+
+    elapsed = timer() - start;
+
+    libtest_barrier();
+
+    if (myself.rank == 0) {
+        const char *huge = getenv("PTL_HUGEPAGES");
+
+        printf("procs=%d size=%d msgs=%d PTL_HUGEPAGES=%s\n", num_procs,
+               nbytes, niters * nmsgs, huge ? huge : "0");
+        printf("Message rate: %.0f msgs/s per rank\n",
+               (niters * nmsgs) / elapsed);
+    }
+
+    /* cleanup */
+    CHECK_RETURNVAL(PtlMDRelease(md_h));
+    CHECK_RETURNVAL(PtlCTFree(md.ct_handle));
+    CHECK_RETURNVAL(PtlLEUnlink(le_h));
+    CHECK_RETURNVAL(PtlCTFree(le.ct_handle));
+    CHECK_RETURNVAL(PtlPTFree(ni_h, pt_index));
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    CHECK_RETURNVAL(libtest_fini());
+    PtlFini();
+
+    free(send_buf);
+    free(recv_buf);
+
+    return 0;
+}
+
+/* vim:set expandtab: */
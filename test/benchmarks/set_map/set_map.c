@@ -0,0 +1,156 @@
+/*
+ * PtlSetMap cost for large synthetic jobs.
+ *
+ * A single process loads a logical NI with a mapping of the requested
+ * number of ranks, where rank 0 is itself and the other ranks are
+ * made up nodes of ppn processes each. It reports how long PtlSetMap
+ * took and how much the resident size of the process grew. With -r
+ * the made up ranks are shuffled, which defeats any compact encoding
+ * of regular layouts.
+ */
+
+#include <portals4.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define CHECK_RETURNVAL(x) do { int ret;                                                                                                                              \
+                                switch (ret = x) {                                                                                                                    \
+                                    case PTL_IGNORED: case PTL_OK: break;                                                                                             \
+                                    case PTL_FAIL: fprintf(stderr, "=> %s returned PTL_FAIL (line %u)\n", # x, (unsigned int)__LINE__); abort(); break;               \
+                                    case PTL_NO_SPACE: fprintf(stderr, "=> %s returned PTL_NO_SPACE (line %u)\n", # x, (unsigned int)__LINE__); abort(); break;       \
+                                    case PTL_ARG_INVALID: fprintf(stderr, "=> %s returned PTL_ARG_INVALID (line %u)\n", # x, (unsigned int)__LINE__); abort(); break; \
+                                    case PTL_NO_INIT: fprintf(stderr, "=> %s returned PTL_NO_INIT (line %u)\n", # x, (unsigned int)__LINE__); abort(); break;         \
+                                    default: fprintf(stderr, "=> %s returned failcode %i (line %u)\n", # x, ret, (unsigned int)__LINE__); abort(); break;             \
+                                } } while (0)
+
+static double timer(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* resident size of the process in bytes */
+static long resident(void)
+{
+    FILE *f;
+    long size, rss = 0;
+
+    f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &size, &rss) != 2)
+            rss = 0;
+        fclose(f);
+    }
+
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: P4setmap [OPTION]...\n\n");
+    fprintf(stderr, "  -h           Display this help message and exit\n");
+    fprintf(stderr, "  -n <num>     Number of ranks in the map\n");
+    fprintf(stderr, "  -p <num>     Number of processes per node\n");
+    fprintf(stderr, "  -r           Shuffle the ranks\n");
+}
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_phys, ni_logical;
+    ptl_process_t   myself;
+    ptl_process_t  *mapping;
+    double          start, elapsed;
+    long            rss;
+    int             nranks = 65536;
+    int             ppn = 16;
+    int             shuffle = 0;
+    int             ch;
+    int             i;
+
+    while ((ch = getopt(argc, argv, "hn:p:r")) != -1) {
+        switch (ch) {
+            case 'n':
+                nranks = strtol(optarg, NULL, 0);
+                break;
+            case 'p':
+                ppn = strtol(optarg, NULL, 0);
+                break;
+            case 'r':
+                shuffle = 1;
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (nranks < 1 || ppn < 1) {
+        usage();
+        return 1;
+    }
+
+    CHECK_RETURNVAL(PtlInit());
+
+    /* the physical NI establishes our PID */
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_PHYSICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_phys));
+    CHECK_RETURNVAL(PtlGetPhysId(ni_phys, &myself));
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_LOGICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_logical));
+
+    mapping = malloc(nranks * sizeof(ptl_process_t));
+    if (!mapping) {
+        fprintf(stderr, "can't allocate a map of %d ranks\n", nranks);
+        return 1;
+    }
+
+    mapping[0] = myself;
+    for (i = 1; i < nranks; i++) {
+        mapping[i].phys.nid = myself.phys.nid + 1 + (i - 1) / ppn;
+        mapping[i].phys.pid = myself.phys.pid + (i - 1) % ppn;
+    }
+
+    if (shuffle) {
+        srand(1);
+        for (i = nranks - 1; i > 1; i--) {
+            int j = 1 + rand() % i;
+            ptl_process_t tmp = mapping[i];
+
+            mapping[i] = mapping[j];
+            mapping[j] = tmp;
+        }
+    }
+
+    rss = resident();
+    start = timer();
+    CHECK_RETURNVAL(PtlSetMap(ni_logical, nranks, mapping));
+    elapsed = timer() - start;
+    rss = resident() - rss;
+
+    printf("ranks: %d ppn: %d%s\n", nranks, ppn, shuffle ? " shuffled" : "");
+    printf("PtlSetMap time: %.3f ms\n", elapsed * 1e3);
+    printf("Resident growth: %ld KiB\n", rss / 1024);
+
+    free(mapping);
+
+    CHECK_RETURNVAL(PtlNIFini(ni_logical));
+    CHECK_RETURNVAL(PtlNIFini(ni_phys));
+    PtlFini();
+
+    return 0;
+}
+
+/* vim:set expandtab: */